@@ -54,10 +54,10 @@ static void* fuzz_resolve_import(void* arg, const char* module, const char* name
 int LLVMFuzzerInitialize(int* argc, char*** argv) {
     (void)argc; (void)argv;
 
-    // Mirror the host's machine setup: large-abs extern / small-pic internal
-    // code models, with popcnt gated on the running CPU.
+    // Mirror the host's machine setup: small-pic code models for both extern
+    // and internal calls, with popcnt gated on the running CPU.
     spidir_x64_machine_config_t machine_config = {
-        .extern_code_model = SPIDIR_X64_CM_LARGE_ABS,
+        .extern_code_model = SPIDIR_X64_CM_SMALL_PIC,
         .internal_code_model = SPIDIR_X64_CM_SMALL_PIC,
     };
     unsigned int eax, ebx, ecx, edx;
@@ -117,12 +117,12 @@ int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
 // state, which this lean fuzz binary deliberately doesn't link. Stubs satisfy
 // the reference; they can never actually be called here.
 
-int32_t wasm_host_memory_size(void* memory_base, void* state_base) {
-    (void)memory_base; (void)state_base;
+int64_t wasm_host_memory_size(void* memory_base, void* state_base, uint32_t memidx) {
+    (void)memory_base; (void)state_base; (void)memidx;
     return 0;
 }
 
-int32_t wasm_host_memory_grow(void* memory_base, void* state_base, int32_t new_page_count) {
-    (void)memory_base; (void)state_base; (void)new_page_count;
+int64_t wasm_host_memory_grow(void* memory_base, void* state_base, uint32_t memidx, int64_t new_page_count) {
+    (void)memory_base; (void)state_base; (void)memidx; (void)new_page_count;
     return -1;
 }
@@ -1,9 +1,16 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <wasm/wasm.h>
 #include <wasm/jit.h>
@@ -42,6 +49,13 @@ static spidir_dump_status_t spidir_dump_callback(const char* data, size_t size,
     return SPIDIR_DUMP_CONTINUE;
 }
 
+// --- Unwind info ---------------------------------------------------------
+
+// Provided by the unwinder (libgcc or libunwind), both accept the whole
+// .eh_frame rather than a single FDE.
+extern void __register_frame(void* begin);
+extern void __deregister_frame(void* begin);
+
 // --- Command-line options ------------------------------------------------
 
 typedef enum option_type {
@@ -58,6 +72,15 @@ typedef enum option_type {
     OPTION_EMIT_DEBUG_ELF,
     OPTION_GDB_JIT,
     OPTION_JIT_ONLY,
+    OPTION_TIME,
+    OPTION_REPEAT,
+    OPTION_STREAM,
+    OPTION_ARENA,
+    OPTION_COMPILE_TIMEOUT,
+    OPTION_ASYNC,
+    OPTION_WARMUP,
+    OPTION_LIMIT,
+    OPTION_EXPECT_ERROR,
 } option_type_t;
 
 static struct option long_options[] = {
@@ -67,11 +90,23 @@ static struct option long_options[] = {
     { "log-level", required_argument, 0, OPTION_LOG_LEVEL },
     { "spidir-dump", optional_argument, 0, OPTION_SPIDIR_DUMP },
     { "jit-only", no_argument, 0, OPTION_JIT_ONLY },
+    { "time", no_argument, 0, OPTION_TIME },
+    { "repeat", required_argument, 0, OPTION_REPEAT },
+    { "stream", optional_argument, 0, OPTION_STREAM },
+    { "arena", no_argument, 0, OPTION_ARENA },
+    { "compile-timeout", required_argument, 0, OPTION_COMPILE_TIMEOUT },
+    { "async", no_argument, 0, OPTION_ASYNC },
+    { "warmup", required_argument, 0, OPTION_WARMUP },
+    { "limit", required_argument, 0, OPTION_LIMIT },
+    { "expect-error", required_argument, 0, OPTION_EXPECT_ERROR },
     { "emit-debug-elf", required_argument, 0, OPTION_EMIT_DEBUG_ELF },
     { "gdb-jit", no_argument, 0, OPTION_GDB_JIT },
     { 0, 0, 0, 0 },
 };
 
+// the default chunk size of --stream, about what a socket read gives us
+#define STREAM_CHUNK_SIZE   (64 * 1024)
+
 /**
  * Parsed command-line options. The owned pointers (module_path, debug_elf_path)
  * and the dump_file handle are released by main during cleanup.
@@ -80,6 +115,14 @@ typedef struct options {
     char* module_path;       // -m: module to compile (owned)
     bool optimize;           // cleared by -d
     bool jit_only;           // --jit-only: compile but don't run
+    bool time;               // --time: report how long loading, jitting and running took
+    unsigned long repeat;    // --repeat: how many times to jit the module (at least once)
+    size_t stream_chunk;     // --stream: load the module in chunks of this size, 0 to load it whole
+    bool arena;              // --arena: allocate the module from an arena
+    bool async;              // --async: jit on a background thread and wait for it
+    char* warmup_path;       // --warmup: module to jit through the same session first (owned)
+    wasm_jit_limits_t limits;       // --limit, --compile-timeout: the limits of the jit
+    wasm_err_t expect_error;        // --expect-error: the error loading or jitting must fail with
     char* debug_elf_path;    // --emit-debug-elf: where to write the debug ELF (owned)
     bool gdb_jit;            // --gdb-jit: publish the debug ELF to GDB
     spidir_dump_callback_t dump_callback;   // --spidir-dump sink, or NULL
@@ -93,12 +136,56 @@ static void print_usage(void) {
     TRACE(" -m | --module <file>          the wasm module file to compile");
     TRACE(" -d | --debug                  don't perform jit optimizations");
     TRACE("      --jit-only               compile the module but don't run it");
+    TRACE("      --time                   print how long loading, jitting and running the module took, and the code size");
+    TRACE("      --repeat <count>         jit the module count times back to back, keeping the last one");
+    TRACE("      --stream[=<size>]        load the module through the streaming loader, in chunks of size bytes");
+    TRACE("      --arena                  allocate the loaded module from a few large blocks");
+    TRACE("      --compile-timeout <ms>   fail the jit when it takes longer than this");
+    TRACE("      --async                  jit the module on a background thread and wait for it");
+    TRACE("      --warmup <file>          jit another module through the same session first");
+    TRACE("      --limit <name>=<value>   set one of the jit limits, the names are the fields of");
+    TRACE("                               wasm_jit_limits_t without the max_ prefix");
+    TRACE("      --expect-error <code>    succeed only when loading or jitting fails with this error");
     TRACE("      --log-level <level>      set the spidir log level (0=none .. 5=trace)");
     TRACE("      --spidir-dump[=<file>]   dump the spidir output (omit the file for stdout)");
     TRACE("      --emit-debug-elf <file>  write a debug ELF reflecting the JIT'd binary");
     TRACE("      --gdb-jit                register the debug ELF with GDB via the JIT interface");
 }
 
+/**
+ * Parse a --limit, the name is the field of wasm_jit_limits_t without the max_
+ */
+static wasm_err_t parse_limit(const char* arg, wasm_jit_limits_t* limits) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    const char* equals = strchr(arg, '=');
+    CHECK(equals != nullptr, "invalid --limit: %s", arg);
+    size_t name_len = equals - arg;
+
+    errno = 0;
+    unsigned long long value = strtoull(equals + 1, nullptr, 0);
+    CHECK(errno == 0, "invalid --limit: %s", arg);
+
+    #define LIMIT(name) \
+        if (name_len == sizeof(#name) - 1 && memcmp(arg, #name, name_len) == 0) { \
+            limits->max_##name = value; \
+            CHECK(limits->max_##name == value, "invalid --limit: %s", arg); \
+            goto cleanup; \
+        }
+    LIMIT(function_size)
+    LIMIT(locals)
+    LIMIT(labels)
+    LIMIT(br_table_size)
+    LIMIT(instructions)
+    LIMIT(compile_time_ns)
+    #undef LIMIT
+
+    CHECK_FAIL("unknown --limit: %s", arg);
+
+cleanup:
+    return err;
+}
+
 /**
  * Parse argv into `opts`. `opts` must already hold the defaults (notably
  * optimize = true). On a usage request opts->help is set and parsing stops.
@@ -123,6 +210,56 @@ static wasm_err_t parse_args(int argc, char** argv, options_t* opts) {
                 opts->jit_only = true;
             } break;
 
+            case OPTION_TIME: {
+                opts->time = true;
+            } break;
+
+            case OPTION_REPEAT: {
+                errno = 0;
+                opts->repeat = strtoul(optarg, nullptr, 0);
+                CHECK(errno == 0 && opts->repeat != 0, "invalid --repeat: %s", optarg);
+            } break;
+
+            case OPTION_STREAM: {
+                opts->stream_chunk = STREAM_CHUNK_SIZE;
+                if (optarg != nullptr) {
+                    errno = 0;
+                    opts->stream_chunk = strtoul(optarg, nullptr, 0);
+                    CHECK(errno == 0 && opts->stream_chunk != 0, "invalid --stream: %s", optarg);
+                }
+            } break;
+
+            case OPTION_ARENA: {
+                opts->arena = true;
+            } break;
+
+            case OPTION_COMPILE_TIMEOUT: {
+                errno = 0;
+                unsigned long timeout = strtoul(optarg, nullptr, 0);
+                CHECK(errno == 0, "invalid --compile-timeout: %s", optarg);
+                opts->limits.max_compile_time_ns = timeout * 1000000ull;
+            } break;
+
+            case OPTION_LIMIT: {
+                RETHROW(parse_limit(optarg, &opts->limits));
+            } break;
+
+            case OPTION_EXPECT_ERROR: {
+                errno = 0;
+                opts->expect_error = strtoul(optarg, nullptr, 0);
+                CHECK(errno == 0 && opts->expect_error != WASM_NO_ERROR, "invalid --expect-error: %s", optarg);
+            } break;
+
+            case OPTION_ASYNC: {
+                opts->async = true;
+            } break;
+
+            case OPTION_WARMUP: {
+                CHECK(opts->warmup_path == nullptr, "Warmup module already specified");
+                opts->warmup_path = strdup(optarg);
+                CHECK(opts->warmup_path != nullptr);
+            } break;
+
             case OPTION_SPIDIR_DUMP: {
                 opts->dump_callback = spidir_dump_callback;
                 if (optarg == nullptr) {
@@ -170,33 +307,32 @@ cleanup:
 // --- File I/O ------------------------------------------------------------
 
 /**
- * Read an entire file into a freshly allocated buffer. On success ownership of
- * *out_data transfers to the caller (free with wasm_host_free).
+ * Map an entire file read-only. On success the caller owns the mapping
+ * (release with munmap).
  */
-static wasm_err_t read_file(const char* path, void** out_data, size_t* out_size) {
+static wasm_err_t map_file(const char* path, void** out_data, size_t* out_size) {
     wasm_err_t err = WASM_NO_ERROR;
-    FILE* file = nullptr;
-    void* data = nullptr;
+    int fd = -1;
 
-    file = fopen(path, "rb");
-    CHECK(file != nullptr, "%s: %s", strerror(errno), path);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    CHECK(fd >= 0, "%s: %s", strerror(errno), path);
 
-    CHECK(fseek(file, 0, SEEK_END) == 0, "%s", strerror(errno));
-    long size = ftell(file);
-    CHECK(size > 0, "%s", strerror(errno));
-    CHECK(fseek(file, 0, SEEK_SET) == 0, "%s", strerror(errno));
+    struct stat st;
+    CHECK(fstat(fd, &st) == 0, "%s", strerror(errno));
+    CHECK(st.st_size > 0, "%s: empty file", path);
 
-    data = wasm_host_calloc(1, (size_t)size);
-    CHECK(data != nullptr);
-    CHECK(fread(data, (size_t)size, 1, file) == 1, "%s", strerror(errno));
+    // The loader reads the whole file front to back right away, so fault it
+    // all in up front and let the kernel read ahead aggressively. The pages
+    // are backed by the page cache, so nothing is zeroed or copied.
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    CHECK(data != MAP_FAILED, "%s", strerror(errno));
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
 
     *out_data = data;
-    *out_size = (size_t)size;
-    data = nullptr;  // ownership transferred to the caller
+    *out_size = (size_t)st.st_size;
 
 cleanup:
-    if (file != nullptr) fclose(file);
-    wasm_host_free(data);  // frees only on the error path (NULL on success)
+    if (fd >= 0) close(fd);
     return err;
 }
 
@@ -215,6 +351,211 @@ cleanup:
     return err;
 }
 
+typedef struct stream_validate {
+    wasm_jit_session_t* session;
+    const wasm_jit_config_t* config;
+    wasm_err_t err;
+} stream_validate_t;
+
+/**
+ * Validate every function body as soon as it arrives, the first error is kept
+ * until the feed that caused it returns
+ */
+static void stream_on_function(void* arg, wasm_module_t* module, uint32_t funcidx) {
+    stream_validate_t* validate = arg;
+    if (!IS_ERROR(validate->err)) {
+        validate->err = wasm_jit_session_validate_function(validate->session, module, validate->config, funcidx);
+    }
+}
+
+/**
+ * Load the module through the streaming loader, feeding it the way it would
+ * arrive from the network. Unlike the borrowed load the module owns its memory.
+ * The function bodies are validated by the jit session while the rest of the
+ * module is still coming in, so the jit only has to compile them.
+ */
+static wasm_err_t load_module_streaming(wasm_module_t* module, const uint8_t* data, size_t size, size_t chunk, bool arena,
+                                        wasm_jit_session_t* session, const wasm_jit_config_t* jit_config) {
+    wasm_err_t err = WASM_NO_ERROR;
+    wasm_stream_t* stream = nullptr;
+
+    stream_validate_t validate = { .session = session, .config = jit_config };
+    wasm_stream_config_t config = {
+        .on_function = stream_on_function,
+        .on_function_arg = &validate,
+        .use_arena = arena,
+    };
+    RETHROW(wasm_stream_create(&stream, &config));
+    for (size_t offset = 0; offset < size; offset += chunk) {
+        size_t len = size - offset < chunk ? size - offset : chunk;
+        RETHROW(wasm_stream_feed(stream, data + offset, len));
+        RETHROW(validate.err);
+    }
+    RETHROW(wasm_stream_finish(stream, module));
+
+cleanup:
+    wasm_stream_destroy(stream);
+    return err;
+}
+
+// --- Timing --------------------------------------------------------------
+
+/**
+ * Monotonic timestamp in nanoseconds, for --time.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * The clock of the jit config, for --compile-timeout.
+ */
+static uint64_t jit_now_ns(void* arg) {
+    (void)arg;
+    return now_ns();
+}
+
+// --- Parallel work -------------------------------------------------------
+
+// the most threads a parallel_for will use, the calling thread included
+#define PARALLEL_FOR_MAX_THREADS 64
+
+typedef struct parallel_for_ctx {
+    void (*task)(void* task_arg, uint32_t index);
+    void* task_arg;
+    uint32_t count;
+    atomic_uint next;
+} parallel_for_ctx_t;
+
+static void* parallel_for_worker(void* arg) {
+    parallel_for_ctx_t* ctx = arg;
+    for (;;) {
+        uint32_t index = atomic_fetch_add(&ctx->next, 1);
+        if (index >= ctx->count) {
+            break;
+        }
+        ctx->task(ctx->task_arg, index);
+    }
+    return nullptr;
+}
+
+/**
+ * The parallel_for of the jit config. Every thread, the calling one included,
+ * takes the next index until none are left. A thread that fails to start just
+ * leaves its share to the others.
+ */
+static void host_parallel_for(void* arg, uint32_t count, void (*task)(void* task_arg, uint32_t index), void* task_arg) {
+    (void)arg;
+
+    parallel_for_ctx_t ctx = { .task = task, .task_arg = task_arg, .count = count };
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > PARALLEL_FOR_MAX_THREADS) cpus = PARALLEL_FOR_MAX_THREADS;
+    if (cpus > count) cpus = count;
+
+    pthread_t threads[PARALLEL_FOR_MAX_THREADS];
+    int threads_count = 0;
+    for (long i = 1; i < cpus; i++) {
+        if (pthread_create(&threads[threads_count], nullptr, parallel_for_worker, &ctx) == 0) {
+            threads_count++;
+        }
+    }
+
+    parallel_for_worker(&ctx);
+
+    for (int i = 0; i < threads_count; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+}
+
+// --- Background jit ----------------------------------------------------
+
+typedef struct async_task {
+    void (*task)(void* task_arg);
+    void* task_arg;
+} async_task_t;
+
+static void* async_task_worker(void* arg) {
+    async_task_t task = *(async_task_t*)arg;
+    free(arg);
+    task.task(task.task_arg);
+    return nullptr;
+}
+
+/**
+ * The run_async of the jit config, every task gets a detached thread of its
+ * own. When the thread can't be started the task just runs right here.
+ */
+static void host_run_async(void* arg, void (*task)(void* task_arg), void* task_arg) {
+    (void)arg;
+
+    async_task_t* async_task = malloc(sizeof(*async_task));
+    if (async_task != nullptr) {
+        *async_task = (async_task_t){ .task = task, .task_arg = task_arg };
+
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, async_task_worker, async_task) == 0) {
+            pthread_detach(thread);
+            return;
+        }
+        free(async_task);
+    }
+
+    task(task_arg);
+}
+
+/**
+ * Jit the module, for --async through a background compilation that is waited
+ * on right away. The handle is destroyed as soon as the result is taken, which
+ * is when the thread of the compilation may still be finishing up.
+ */
+static wasm_err_t jit_module(wasm_jit_session_t* session, wasm_module_t* module, wasm_module_jit_t* jit,
+                             wasm_jit_config_t* config, bool async) {
+    wasm_err_t err = WASM_NO_ERROR;
+    wasm_jit_async_t* handle = nullptr;
+
+    if (!async) {
+        RETHROW(wasm_module_jit_with_session(session, module, jit, config));
+        goto cleanup;
+    }
+
+    RETHROW(wasm_module_jit_async(session, module, config, &handle));
+    RETHROW(wasm_jit_async_wait(handle, jit));
+
+cleanup:
+    wasm_jit_async_destroy(handle);
+    return err;
+}
+
+/**
+ * Load and jit another module through the session and throw the result away,
+ * so the module that runs gets a session that was already used by a different
+ * module, with bookkeeping sized for that one
+ */
+static wasm_err_t warmup_session(wasm_jit_session_t* session, const char* path, const wasm_jit_config_t* config) {
+    wasm_err_t err = WASM_NO_ERROR;
+    void* binary = nullptr;
+    size_t size = 0;
+    wasm_module_t module = {};
+    wasm_module_jit_t jit = {};
+
+    // the limits are for the module that runs
+    wasm_jit_config_t warmup_config = *config;
+    warmup_config.limits = (wasm_jit_limits_t){};
+
+    RETHROW(map_file(path, &binary, &size));
+    RETHROW(wasm_load_module_borrowed(&module, binary, size));
+    RETHROW(wasm_module_jit_with_session(session, &module, &jit, &warmup_config));
+
+cleanup:
+    wasm_module_jit_free(&jit);
+    wasm_module_free(&module);
+    if (binary != nullptr) munmap(binary, size);
+    return err;
+}
+
 // --- Execution -----------------------------------------------------------
 
 /**
@@ -229,7 +570,7 @@ static int run_module(wasm_module_t* module, wasm_module_jit_t* jit, void* state
         jit->start_func(memory, state);
     }
 
-    int64_t index = wasm_find_export(module, "_start");
+    int64_t index = wasm_find_export_of_kind(module, "_start", WASM_EXPORT_FUNC);
     if (index < 0) {
         ERROR("module has no _start export");
         return EXIT_FAILURE;
@@ -243,15 +584,17 @@ int main(int argc, char** argv) {
     wasm_err_t err = WASM_NO_ERROR;
     int status = EXIT_SUCCESS;
 
-    options_t opts = { .optimize = true };
+    options_t opts = { .optimize = true, .repeat = 1 };
     wasm_module_t module = {};
     wasm_module_jit_t jit = {};
+    wasm_jit_session_t* session = nullptr;
     void* module_binary = nullptr;
     size_t module_size = 0;
     void* state = nullptr;
     void* debug_elf_data = nullptr;
     size_t debug_elf_size = 0;
     gdb_jit_entry_t* gdb_entry = nullptr;
+    bool eh_frame_registered = false;
 
     // Enable spidir logging at warn level by default.
     spidir_log_init(stdout_log_callback);
@@ -271,14 +614,72 @@ int main(int argc, char** argv) {
         // The debug ELF / GDB JIT paths need per-function layout and resolved
         // relocations recorded during the JIT; a normal run pays nothing.
         .emit_debug_info = opts.debug_elf_path != nullptr || opts.gdb_jit,
+        // Always cheap enough to keep, it lets backtraces, profilers and the
+        // crash handler walk through the jitted frames.
+        .emit_unwind_info = true,
+        // Validating the function bodies is independent per function, so it
+        // is spread over all the cores.
+        .parallel_for = host_parallel_for,
+        .limits = opts.limits,
+        .now_ns = jit_now_ns,
+        .run_async = host_run_async,
     };
 
-    // Load and compile the module.
-    RETHROW(read_file(opts.module_path, &module_binary, &module_size));
-    RETHROW(wasm_load_module(&module, module_binary, module_size));
-    wasm_host_free(module_binary);
-    module_binary = nullptr;
-    RETHROW(wasm_module_jit(&module, &jit, &config));
+    // all the compilations share a single session, so only the first one
+    // has to allocate the jit's bookkeeping
+    RETHROW(wasm_jit_session_create(&session));
+    if (opts.warmup_path != nullptr) {
+        RETHROW(warmup_session(session, opts.warmup_path, &config));
+    }
+
+    // Load and compile the module. Mapping the file is kept out of the timings
+    // so --time only measures our own work. The module borrows the bodies and
+    // data segments straight from the mapping, which stays until the module is
+    // freed: the active segments are copied into memory by runtime_init and
+    // the state points right at the passive ones for memory.init. --stream
+    // loads an owning copy instead, like a module arriving over the network,
+    // so the file is unmapped as soon as it was fed to the loader.
+    RETHROW(map_file(opts.module_path, &module_binary, &module_size));
+    uint64_t load_start = now_ns();
+    if (opts.stream_chunk != 0) {
+        err = load_module_streaming(&module, module_binary, module_size, opts.stream_chunk, opts.arena, session, &config);
+        munmap(module_binary, module_size);
+        module_binary = nullptr;
+        RETHROW(err);
+    } else {
+        wasm_load_config_t load_config = { .borrow = true, .use_arena = opts.arena };
+        RETHROW(wasm_load_module_with_config(&module, module_binary, module_size, &load_config));
+    }
+    uint64_t load_end = now_ns();
+
+    uint64_t jit_start = now_ns();
+    RETHROW(jit_module(session, &module, &jit, &config, opts.async));
+    uint64_t jit_end = now_ns();
+
+    // --repeat: jit the module again, each time replacing the previous result
+    for (unsigned long i = 1; i < opts.repeat; i++) {
+        wasm_module_jit_free(&jit);
+        jit = (wasm_module_jit_t){};
+        RETHROW(jit_module(session, &module, &jit, &config, opts.async));
+    }
+    uint64_t repeat_end = now_ns();
+
+    if (opts.expect_error != WASM_NO_ERROR) {
+        ERROR("expected error %d, but the module was jitted", opts.expect_error);
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+
+    if (opts.time) {
+        TRACE("load: %.3f ms", (double)(load_end - load_start) / 1e6);
+        TRACE("jit: %.3f ms", (double)(jit_end - jit_start) / 1e6);
+        if (opts.repeat > 1) {
+            TRACE("jit (warm): %.3f ms", (double)(repeat_end - jit_end) / 1e6 / (double)(opts.repeat - 1));
+        }
+
+        // so the effect of codegen changes on the code size can be compared
+        TRACE("jit code: %zu bytes, rodata: %zu bytes", jit.debug.code_size, jit.debug.rodata_size);
+    }
 
     // Emit the debug ELF up front so it reflects the live JIT image (the bytes
     // don't change after this point). One buffer feeds both the file dump and
@@ -294,25 +695,52 @@ int main(int argc, char** argv) {
         }
     }
 
+    // Only the last jit is kept, so it is the only one that gets registered.
+    if (jit.eh_frame != nullptr) {
+        __register_frame(jit.eh_frame);
+        eh_frame_registered = true;
+    }
+
+    // Nothing jits the module again, so it can let go of the bytecode. This
+    // comes before instantiating on purpose, every test run then checks that
+    // nothing past the jit uses what was trimmed.
+    wasm_module_trim(&module);
+
     // Set up the linear memory and the main instance's state buffer, then run.
     RETHROW(runtime_init(&module, &jit));
     CHECK(runtime_alloc_state(&state));
 
     if (!opts.jit_only) {
+        uint64_t run_start = now_ns();
         status = run_module(&module, &jit, state);
+        uint64_t run_end = now_ns();
+
+        if (opts.time) {
+            TRACE("run: %.3f ms", (double)(run_end - run_start) / 1e6);
+        }
     }
 
 cleanup:
     gdb_jit_unregister(gdb_entry);
     wasm_host_free(debug_elf_data);
+    runtime_free_state(state);
     runtime_destroy();
+    if (eh_frame_registered) {
+        __deregister_frame(jit.eh_frame);
+    }
     wasm_module_jit_free(&jit);
+    wasm_jit_session_destroy(session);
     wasm_module_free(&module);
-    wasm_host_free(module_binary);
-    free(state);
+    if (module_binary != nullptr) munmap(module_binary, module_size);
     free(opts.module_path);
     free(opts.debug_elf_path);
+    free(opts.warmup_path);
     if (opts.dump_file != nullptr) fclose(opts.dump_file);
 
+    // --expect-error turns the error it names into the success
+    if (opts.expect_error != WASM_NO_ERROR) {
+        return err == opts.expect_error ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     return IS_ERROR(err) ? EXIT_FAILURE : status;
 }
@@ -13,7 +13,8 @@
 
 // 8 GiB of address space, reserved up front as required by the JIT's linear
 // memory model: the base never moves, and memory.grow only commits more of this
-// already-reserved range.
+// already-reserved range. A 64-bit memory is bounds checked against its max
+// instead, so it reserves the max plus the same 8 GiB as a guard for the offset.
 #define MEMORY_RESERVE_SIZE (8ull * 1024ull * 1024ull * 1024ull)
 
 // --- Live instance state -------------------------------------------------
@@ -21,13 +22,21 @@
 // for why this is a process-wide singleton rather than a passed-in context.
 static wasm_module_t* m_module = nullptr;
 static wasm_module_jit_t* m_jit = nullptr;
-static void* m_memory_base = nullptr;
 
-// Current committed size of the linear memory, in bytes. memory.size reads this
-// lock-free while a concurrent memory.grow may be publishing a new value, so
-// it's atomic: the grow mutex only serializes growers against each other, not
-// against readers.
-static _Atomic size_t m_memory_size = 0;
+// One per memory the module declares, in memidx order.
+typedef struct runtime_memory {
+    void* base;
+    size_t reserve;
+
+    // Current committed size of the memory, in bytes. memory.size reads this
+    // lock-free while a concurrent memory.grow may be publishing a new value, so
+    // it's atomic: the grow mutex only serializes growers against each other,
+    // not against readers.
+    _Atomic size_t size;
+} runtime_memory_t;
+
+static runtime_memory_t* m_memories = nullptr;
+static uint32_t m_memories_count = 0;
 
 bool runtime_alloc_state(void** out) {
     if (m_jit->state_size == 0) {
@@ -39,10 +48,32 @@ bool runtime_alloc_state(void** out) {
         return false;
     }
     memcpy(state, m_jit->state_init, m_jit->state_size);
+
+    // Memory 0 is passed to the code directly, the bases of the rest are read
+    // from the state.
+    void** bases = (void**)((char*)state + m_jit->memories_offset);
+    for (uint32_t i = 1; i < m_memories_count; i++) {
+        bases[i - 1] = m_memories[i].base;
+    }
+
+    // The tables are writable, every instance gets its own copy of them.
+    if (IS_ERROR(wasm_module_jit_init_tables(m_jit, state))) {
+        free(state);
+        return false;
+    }
+
     *out = state;
     return true;
 }
 
+void runtime_free_state(void* state) {
+    if (state == nullptr) {
+        return;
+    }
+    wasm_module_jit_free_tables(m_jit, state);
+    free(state);
+}
+
 // --- wasi-threads thread-spawn -------------------------------------------
 // ABI: `thread-spawn(start_arg: i32) -> i32` asks the host to start a thread
 // that re-enters the module through the exported
@@ -50,8 +81,8 @@ bool runtime_alloc_state(void** out) {
 // success, or a negative value on failure.
 //
 // Threading model: every thread shares the single linear memory (it's declared
-// `shared`, and m_memory_base is a process-global mapping whose base never
-// moves). But each thread is its own instance as far as *globals* go: the
+// `shared`, and m_memories holds process-global mappings whose bases never
+// move). But each thread is its own instance as far as *globals* go: the
 // mutable globals __stack_pointer and __tls_base must be private per thread or
 // the threads would stomp each other's stacks. In this JIT the globals live in
 // the `state` buffer, so each thread gets a fresh copy seeded from state_init;
@@ -76,9 +107,9 @@ static void* thread_trampoline(void* arg) {
 
     // Run the wasm-side thread entry on the shared memory with this thread's own
     // globals. Returns when the thread's start routine does.
-    m_wasi_thread_start(m_memory_base, args.state, args.thread_id, args.start_arg);
+    m_wasi_thread_start(runtime_memory_base(), args.state, args.thread_id, args.start_arg);
 
-    free(args.state);
+    runtime_free_state(args.state);
     return nullptr;
 }
 
@@ -94,7 +125,7 @@ static int32_t wasi_spawn_thread(void* memory, void* state, int32_t start_arg) {
 
     thread_spawn_args_t* args = malloc(sizeof(*args));
     if (args == nullptr) {
-        free(thread_state);
+        runtime_free_state(thread_state);
         return -1;
     }
     int32_t thread_id = atomic_fetch_add_explicit(&m_next_thread_id, 1, memory_order_relaxed);
@@ -108,7 +139,7 @@ static int32_t wasi_spawn_thread(void* memory, void* state, int32_t start_arg) {
     pthread_attr_t attr;
     if (pthread_attr_init(&attr) != 0) {
         free(args);
-        free(thread_state);
+        runtime_free_state(thread_state);
         return -1;
     }
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
@@ -121,7 +152,7 @@ static int32_t wasi_spawn_thread(void* memory, void* state, int32_t start_arg) {
     pthread_attr_destroy(&attr);
     if (rc != 0) {
         free(args);
-        free(thread_state);
+        runtime_free_state(thread_state);
         return -1;
     }
 
@@ -180,40 +211,55 @@ wasm_err_t runtime_init(wasm_module_t* module, wasm_module_jit_t* jit) {
     m_module = module;
     m_jit = jit;
 
-    // Reserve the full address range up front (PROT_NONE: no pages committed).
-    m_memory_base = mmap(
-        nullptr,
-        MEMORY_RESERVE_SIZE,
-        PROT_NONE,
-        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
-        -1,
-        0
-    );
-    CHECK(m_memory_base != MAP_FAILED);
-
-    // Commit the initial pages. Skipped when the module declares no memory —
-    // such modules never touch this region.
-    if (module->memory.min != 0) {
-        void* mapped = mmap(
-            m_memory_base,
-            module->memory.min,
-            PROT_READ | PROT_WRITE,
-            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+    m_memories_count = module->memories_count;
+    if (m_memories_count != 0) {
+        m_memories = calloc(m_memories_count, sizeof(*m_memories));
+        CHECK(m_memories != nullptr);
+    }
+
+    for (uint32_t i = 0; i < m_memories_count; i++) {
+        wasm_memory_t* memory = &module->memories[i];
+        runtime_memory_t* instance = &m_memories[i];
+
+        // Reserve the full address range up front (PROT_NONE: no pages committed).
+        instance->reserve = MEMORY_RESERVE_SIZE;
+        if (memory->is64) {
+            instance->reserve += memory->max;
+        }
+        void* base = mmap(
+            nullptr,
+            instance->reserve,
+            PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
             -1,
             0
         );
-        CHECK(mapped != MAP_FAILED);
-        CHECK(mapped == m_memory_base);
-        m_memory_size = module->memory.min;
-    }
+        CHECK(base != MAP_FAILED);
+        instance->base = base;
+
+        // Commit the initial pages. Skipped when the memory starts out empty.
+        if (memory->min != 0) {
+            void* mapped = mmap(
+                base,
+                memory->min,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                -1,
+                0
+            );
+            CHECK(mapped != MAP_FAILED);
+            CHECK(mapped == base);
+            instance->size = memory->min;
+        }
 
-    // Install the active data segments / table initializers.
-    wasm_module_init_memory(module, m_memory_base);
+        // Install the active data segments of this memory.
+        wasm_module_init_memory(module, i, base);
+    }
 
     // Resolve the wasm-side thread entry up front so thread-spawn (first reached
     // from _start onwards) doesn't race to look it up. Absent for non-threaded
     // modules, which simply never call thread-spawn.
-    int64_t thread_start_index = wasm_find_export(module, "wasi_thread_start");
+    int64_t thread_start_index = wasm_find_export_of_kind(module, "wasi_thread_start", WASM_EXPORT_FUNC);
     if (thread_start_index >= 0) {
         m_wasi_thread_start = jit->exports[thread_start_index].func.address;
     }
@@ -223,14 +269,18 @@ cleanup:
 }
 
 void runtime_destroy(void) {
-    if (m_memory_base != nullptr && m_memory_base != MAP_FAILED) {
-        munmap(m_memory_base, MEMORY_RESERVE_SIZE);
+    for (uint32_t i = 0; i < m_memories_count; i++) {
+        if (m_memories[i].base != nullptr) {
+            munmap(m_memories[i].base, m_memories[i].reserve);
+        }
     }
-    m_memory_base = nullptr;
+    free(m_memories);
+    m_memories = nullptr;
+    m_memories_count = 0;
 }
 
 void* runtime_memory_base(void) {
-    return m_memory_base;
+    return m_memories_count != 0 ? m_memories[0].base : nullptr;
 }
 
 // --- Stateful host callbacks (declared in wasm/host.h) -------------------
@@ -238,7 +288,7 @@ void* runtime_memory_base(void) {
 // instance state above. The remaining wasm_host_* callbacks are stateless and
 // live in host_platform.c.
 
-int32_t wasm_host_memory_size(void* memory_base, void* state_base) {
+int64_t wasm_host_memory_size(void* memory_base, void* state_base, uint32_t memidx) {
     (void)memory_base; (void)state_base;
     // Lock-free, race-free read. memory.size only has to observe a valid size,
     // not block: the value grows monotonically and grow publishes it with a
@@ -246,29 +296,31 @@ int32_t wasm_host_memory_size(void* memory_base, void* state_base) {
     // bound (a legal observation), never a torn or over-reported one. The
     // acquire pairs with that release so a caller that reads the size and then
     // touches the new pages sees them mapped.
-    return atomic_load_explicit(&m_memory_size, memory_order_acquire) / WASM_PAGE_SIZE;
+    return atomic_load_explicit(&m_memories[memidx].size, memory_order_acquire) / WASM_PAGE_SIZE;
 }
 
 // Serializes concurrent memory.grow on a shared memory. A grow is a
-// read-modify-write of m_memory_size plus the mmap that commits the new pages,
+// read-modify-write of the memory size plus the mmap that commits the new pages,
 // so two threads growing at once would race on both. Private memories are only
 // ever touched by their single thread, so the lock is taken only when shared.
 static pthread_mutex_t m_memory_grow_lock = PTHREAD_MUTEX_INITIALIZER;
 
-int32_t wasm_host_memory_grow(void* memory_base, void* state_base, int32_t new_page_count) {
+int64_t wasm_host_memory_grow(void* memory_base, void* state_base, uint32_t memidx, int64_t new_page_count) {
     (void)state_base;
-    if (new_page_count < 0) return -1;
+    wasm_memory_t* memory = &m_module->memories[memidx];
+    runtime_memory_t* instance = &m_memories[memidx];
+    if (new_page_count < 0 || (uint64_t)new_page_count > memory->max / WASM_PAGE_SIZE) return -1;
 
-    bool shared = m_module->memory.shared;
+    bool shared = memory->shared;
     if (shared) pthread_mutex_lock(&m_memory_grow_lock);
 
     // Spec: refuse if growth would exceed the declared max. The size increase
     // happens only along the way to a successful mmap, so the -1 return path
-    // leaves m_memory_size untouched. Relaxed is enough here: the mutex already
+    // leaves the size untouched. Relaxed is enough here: the mutex already
     // orders this against other growers, and readers don't depend on this load.
-    size_t old_count = atomic_load_explicit(&m_memory_size, memory_order_relaxed) / WASM_PAGE_SIZE;
+    size_t old_count = atomic_load_explicit(&instance->size, memory_order_relaxed) / WASM_PAGE_SIZE;
     size_t new_count = old_count + (size_t)new_page_count;
-    if (new_count * WASM_PAGE_SIZE > m_module->memory.max) {
+    if (new_count * WASM_PAGE_SIZE > memory->max) {
         if (shared) pthread_mutex_unlock(&m_memory_grow_lock);
         return -1;
     }
@@ -293,12 +345,12 @@ int32_t wasm_host_memory_grow(void* memory_base, void* state_base, int32_t new_p
 
     // Release store so a lock-free memory.size reader that observes the new size
     // also sees the mmap that backs it.
-    atomic_store_explicit(&m_memory_size, new_count * WASM_PAGE_SIZE, memory_order_release);
+    atomic_store_explicit(&instance->size, new_count * WASM_PAGE_SIZE, memory_order_release);
 
     if (shared) {
         atomic_thread_fence(memory_order_seq_cst);
         pthread_mutex_unlock(&m_memory_grow_lock);
     }
 
-    return (int32_t)old_count;
+    return (int64_t)old_count;
 }
@@ -4,7 +4,7 @@
 #include "wasm/jit.h"
 
 // The host-side runtime backing a single JIT'd module instance. It owns the
-// linear memory mapping and holds the live module/jit handles that the stateful
+// linear memory mappings and holds the live module/jit handles that the stateful
 // wasm_host_* callbacks (memory.size / memory.grow) and wasi-threads read.
 //
 // A process runs exactly one module, so this state is a singleton rather than an
@@ -15,29 +15,37 @@
 
 /**
  * Bind the runtime to a freshly loaded and JIT'd module: reserve and commit the
- * linear memory, install its initial contents, and resolve the wasi-threads
+ * linear memories, install their initial contents, and resolve the wasi-threads
  * entry point if the module exports one. Call once before running.
  */
 wasm_err_t runtime_init(wasm_module_t* module, wasm_module_jit_t* jit);
 
 /**
- * Release the linear memory mapping. Safe even if runtime_init failed partway.
+ * Release the linear memory mappings. Safe even if runtime_init failed partway.
  */
 void runtime_destroy(void);
 
 /**
- * Base of the linear memory, passed to every generated function as `memory`.
+ * Base of memory 0, passed to every generated function as `memory`. NULL when
+ * the module declares no memory.
  */
 void* runtime_memory_base(void);
 
 /**
  * Allocate and seed a per-instance state buffer (globals + tables) from the JIT
- * initializer. On success writes the buffer to *out (NULL when the module
- * declares no state) and returns true; returns false only on allocation
- * failure. The caller frees the buffer with free().
+ * initializer, fill in the bases of the memories past the first, and give it its
+ * own copy of the tables. On success writes the buffer to *out (NULL when the
+ * module declares no state) and returns true; returns false only on allocation
+ * failure. The caller frees the buffer with runtime_free_state().
  */
 bool runtime_alloc_state(void** out);
 
+/**
+ * Free a state buffer from runtime_alloc_state along with its tables. Safe to
+ * call with NULL.
+ */
+void runtime_free_state(void* state);
+
 /**
  * Resolve an import to the host function backing it, linking the guest against
  * the host's import surface: a handful of test functions under "env",
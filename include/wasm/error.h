@@ -3,4 +3,18 @@
 typedef enum wasm_err {
     WASM_NO_ERROR = 0,
     WASM_ERROR_CHECK_FAILED = 1,
+
+    // the module went over one of the limits of wasm_jit_limits_t
+    WASM_ERROR_FUNCTION_TOO_LARGE = 2,
+    WASM_ERROR_TOO_MANY_LOCALS = 3,
+    WASM_ERROR_TOO_MANY_LABELS = 4,
+    WASM_ERROR_BR_TABLE_TOO_LARGE = 5,
+    WASM_ERROR_TOO_MANY_INSTRUCTIONS = 6,
+    WASM_ERROR_COMPILE_TIMEOUT = 7,
+
+    // the async compilation was cancelled
+    WASM_ERROR_CANCELLED = 8,
+
+    // the module is valid, but uses something the jit can't compile
+    WASM_ERROR_UNSUPPORTED = 9,
 } wasm_err_t;
@@ -27,27 +27,32 @@ void* wasm_host_realloc(void* ptr, size_t new_size);
 void wasm_host_free(void* ptr);
 
 /**
- * The amount size of the current memory instance. In page count
+ * The amount size of the current memory instance. In page count, the jit
+ * truncates it for a 32bit memory
  *
- * @param memory_base       [IN] the base of memory
+ * @param memory_base       [IN] the base of the memory
  * @param state_base        [IN] the base of per-thread state
+ * @param memidx            [IN] the index of the memory
  */
-int32_t wasm_host_memory_size(void* memory_base, void* state_base);
+int64_t wasm_host_memory_size(void* memory_base, void* state_base, uint32_t memidx);
 
 /**
  * Grow the memory instance as given into a wasm function, directly called by memory.grow.
  *
  * Returns the old page count. Or -1 if the operation failed.
  *
- * NOTE: the memory base must stay the same
+ * NOTE: the memory base must stay the same, anything up to the max of the memory
+ *       must be reserved up front, for a 64bit memory with an additional 8GB
+ *       guard region after it
  *
  * TODO: support for returning a different memory base
  *
- * @param memory_base       [IN] The base of memory
+ * @param memory_base       [IN] The base of the memory
  * @param state_base        [IN] the base of per-thread state
- * @param new_page_count    [IN] The new page count
+ * @param memidx            [IN] the index of the memory
+ * @param new_page_count    [IN] The amount of pages to add, unsigned for a 32bit memory
  */
-int32_t wasm_host_memory_grow(void* memory_base, void* state_base, int32_t new_page_count);
+int64_t wasm_host_memory_grow(void* memory_base, void* state_base, uint32_t memidx, int64_t new_page_count);
 
 /**
  * Allocate a contig region of memory, initially mapped as rw. After the
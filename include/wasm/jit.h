@@ -6,6 +6,33 @@
 
 #include "error.h"
 
+/**
+ * Limits on what a single module can make the jit do, for compiling modules
+ * that are not trusted. Going over one fails the compilation with the error
+ * code of the limit. A limit of zero is no limit.
+ */
+typedef struct wasm_jit_limits {
+    // the size in bytes of a single function body
+    uint32_t max_function_size;
+
+    // the locals of a single function, params included
+    uint32_t max_locals;
+
+    // how deep blocks can nest, the body of the function included
+    uint32_t max_labels;
+
+    // the targets of a single br_table, the default one included
+    uint32_t max_br_table_size;
+
+    // the instructions of all the function bodies of the module together,
+    // which is what the size of the spidir IR follows
+    uint64_t max_instructions;
+
+    // the wall-clock time the whole compilation can take, only enforced
+    // when the config has a now_ns
+    uint64_t max_compile_time_ns;
+} wasm_jit_limits_t;
+
 typedef struct wasm_jit_config {
     /**
      * The codegen machine handle for the target arch
@@ -37,6 +64,54 @@ typedef struct wasm_jit_config {
      * allocation that the runtime doesn't read.
      */
     bool emit_debug_info;
+
+    /**
+     * Build an .eh_frame for the jitted code into wasm_module_jit_t::eh_frame,
+     * so unwinders, profilers and crash reporters can walk the stack through
+     * wasm frames once the host registers it with __register_frame.
+     */
+    bool emit_unwind_info;
+
+    /**
+     * Optional call counts of the functions from a previous run, indexed by
+     * funcidx (imports included). They weight the call graph the code layout
+     * is built from, and functions that were never called are moved to the
+     * end of the code along with the thunks. Can be left as null, in which
+     * case every call site counts the same.
+     */
+    const uint64_t* profile_counts;
+    size_t profile_counts_count;
+
+    /**
+     * Optional way to run work on multiple threads, the library has no threads
+     * of its own. Must call task(task_arg, i) for every i below count, in any
+     * order and on any thread, and return once all of them are done. Can be
+     * left as null, in which case the work runs on the calling thread.
+     */
+    void (*parallel_for)(void* arg, uint32_t count, void (*task)(void* task_arg, uint32_t index), void* task_arg);
+    void* parallel_for_arg;
+
+    /**
+     * The limits on the module, all zero means no limits
+     */
+    wasm_jit_limits_t limits;
+
+    /**
+     * A monotonic clock in nanoseconds for the compile time limit, it is
+     * called from the threads of parallel_for as well. Can be left as null
+     * when there is no time limit.
+     */
+    uint64_t (*now_ns)(void* arg);
+    void* now_ns_arg;
+
+    /**
+     * Run task(task_arg) in the background, for wasm_module_jit_async. It
+     * must not wait for the task to finish. Can be left as null, in which
+     * case wasm_module_jit_async compiles on the calling thread and returns
+     * once it is done.
+     */
+    void (*run_async)(void* arg, void (*task)(void* task_arg), void* task_arg);
+    void* run_async_arg;
 } wasm_jit_config_t;
 
 typedef union wasm_jit_export {
@@ -126,11 +201,22 @@ typedef struct wasm_jit_reloc {
     // keep this so the ELF emitter can attach the reloc to the right symbol /
     // section without a second pass to figure out the containing function.
     // When the reloc lives inside a CFI thunk this is the wrapped function's
-    // funcidx with owner_cfi set.
+    // funcidx with owner_cfi set, and inside an invoke thunk (which has no
+    // wasm-level identity) it is UINT32_MAX.
     uint32_t owner_funcidx;
     bool owner_cfi;
 } wasm_jit_reloc_t;
 
+typedef struct wasm_jit_table {
+    // the offset of the table in the state buffer
+    size_t offset;
+
+    // the elements the table starts with, function references are the
+    // addresses of their cfi thunks
+    void** elements;
+    uint32_t length;
+} wasm_jit_table_t;
+
 typedef struct wasm_jit_debug_info {
     wasm_jit_func_layout_t* funcs;
     size_t funcs_count;
@@ -152,7 +238,10 @@ typedef struct wasm_module_jit {
     size_t rx_page_count;
     size_t ro_page_count;
 
-    // the addresses of exported functions
+    // the addresses of exported functions, they take the memory base and the
+    // state base before their args. A function with multiple results returns
+    // the first one and takes a pointer to 8 byte slots for the rest as its
+    // last param, a v128 takes two of them
     wasm_jit_export_t* exports;
 
     // the size in bytes needed for the runtime state buffer. The host 
@@ -164,15 +253,121 @@ typedef struct wasm_module_jit {
     // allocated state before calling into the code
     void* state_init;
 
+    // the offset in the state buffer of the bases of the memories past the
+    // first, the base of memory i is in the 8 byte slot at
+    // memories_offset + (i - 1) * 8. The host must fill them in after
+    // copying the initializer, memory 0 is passed as the memory_base param
+    size_t memories_offset;
+
+    // the tables of the module, they are writable so every instance has
+    // its own copy, see wasm_module_jit_init_tables
+    wasm_jit_table_t* tables;
+    size_t tables_count;
+
+    // the offsets in the state buffer of the mutable exnref globals, the
+    // exceptions they still hold are released by wasm_module_jit_free_tables
+    size_t* exnref_globals;
+    size_t exnref_globals_count;
+
+    // the functions of the passive elem segments one after the other, as the
+    // addresses of their cfi thunks, the state points into it for table.init
+    void** elems;
+    size_t elems_count;
+
     // Optional debug info for the JIT'd binary, captured during codegen.
     // Always present after a successful jit (even if there are no functions —
     // the bounds are still meaningful).
     wasm_jit_debug_info_t debug;
 
+    // The .eh_frame of the jitted code when emit_unwind_info is set, an FDE for
+    // every function (and one for the veneers) followed by the zero terminator,
+    // with absolute pointers. The host passes it to __register_frame as is and
+    // must __deregister_frame it before freeing the jit.
+    void* eh_frame;
+    size_t eh_frame_size;
+
     // the jitted start function
     void (*start_func)(void* memory_base, void* state_base);
 } wasm_module_jit_t;
 
+/**
+ * A jit session holds the bookkeeping the jit needs while compiling a module,
+ * and keeps its memory around between compilations so compiling many modules
+ * one after the other doesn't need to allocate it from scratch every time.
+ *
+ * A session can only be used by a single compilation at a time.
+ */
+typedef struct wasm_jit_session wasm_jit_session_t;
+
+wasm_err_t wasm_jit_session_create(wasm_jit_session_t** out_session);
+
+void wasm_jit_session_destroy(wasm_jit_session_t* session);
+
+/**
+ * Jit the module using a temporary session
+ */
 wasm_err_t wasm_module_jit(wasm_module_t* module, wasm_module_jit_t* jitted_module, wasm_jit_config_t* config);
 
+/**
+ * Jit the module reusing the memory of the given session
+ */
+wasm_err_t wasm_module_jit_with_session(wasm_jit_session_t* session, wasm_module_t* module, wasm_module_jit_t* jitted_module, wasm_jit_config_t* config);
+
+/**
+ * Validate a function of a module that is still being streamed in, meant to be
+ * called from wasm_stream_config_t::on_function with the funcidx it gets. What
+ * the validation finds is kept in the session, so the next jit with the session
+ * doesn't validate the function again, that jit must be of the module the stream
+ * produces and with the same config, which can be null for the default one.
+ */
+wasm_err_t wasm_jit_session_validate_function(wasm_jit_session_t* session, wasm_module_t* module, const wasm_jit_config_t* config, uint32_t funcidx);
+
 void wasm_module_jit_free(wasm_module_jit_t* jit);
+
+/**
+ * A compilation running in the background, see wasm_module_jit_async
+ */
+typedef struct wasm_jit_async wasm_jit_async_t;
+
+/**
+ * Start jitting the module through the run_async of the config, the session can
+ * be null to use a temporary one. The config is copied, but the module and the
+ * session must stay around until the handle is destroyed.
+ */
+wasm_err_t wasm_module_jit_async(wasm_jit_session_t* session, wasm_module_t* module, wasm_jit_config_t* config, wasm_jit_async_t** out_async);
+
+/**
+ * Check whether the compilation is done, without blocking
+ */
+bool wasm_jit_async_poll(wasm_jit_async_t* async);
+
+/**
+ * Ask the compilation to stop, it fails with WASM_ERROR_CANCELLED at the next
+ * function it gets to. Does nothing when it is already done
+ */
+void wasm_jit_async_cancel(wasm_jit_async_t* async);
+
+/**
+ * Wait for the compilation to finish and return its result, on success the
+ * jitted module is moved to out_jit and must be freed by the caller. Whatever
+ * a failed compilation allocated is already freed
+ */
+wasm_err_t wasm_jit_async_wait(wasm_jit_async_t* async, wasm_module_jit_t* out_jit);
+
+/**
+ * Cancel the compilation if it is still running, wait for it, and free the
+ * handle along with the result if it was never taken
+ */
+void wasm_jit_async_destroy(wasm_jit_async_t* async);
+
+/**
+ * Give a state buffer that was just copied from the initializer its own copy of
+ * the tables, must be called before calling into the code with it
+ */
+wasm_err_t wasm_module_jit_init_tables(wasm_module_jit_t* jit, void* state);
+
+/**
+ * Free the tables of a state buffer, including anything table.grow allocated,
+ * along with the exceptions that the exnref globals still hold
+ */
+void wasm_module_jit_free_tables(wasm_module_jit_t* jit, void* state);
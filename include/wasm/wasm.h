@@ -7,6 +7,10 @@
 
 #define WASM_PAGE_SIZE (65536)
 
+// The largest 64bit memory we support, the whole max of a 64bit memory
+// is reserved up front so it must fit in the host address space
+#define WASM_MEMORY64_MAX_SIZE (1ull << 40)
+
 typedef enum wasm_value_type {
     WASM_VALUE_TYPE_INVALID,
 
@@ -15,8 +19,19 @@ typedef enum wasm_value_type {
     WASM_VALUE_TYPE_F32,
     WASM_VALUE_TYPE_I64,
     WASM_VALUE_TYPE_I32,
+
+    // Vector Types
+    WASM_VALUE_TYPE_V128,
+
+    // Reference Types
+    WASM_VALUE_TYPE_FUNCREF,
+    WASM_VALUE_TYPE_EXTERNREF,
+    WASM_VALUE_TYPE_EXNREF,
 } wasm_value_type_t;
 
+// the funcidx of a null reference in a constant expression
+#define WASM_REF_NULL UINT32_MAX
+
 typedef struct wasm_value {
     wasm_value_type_t kind;
     union {
@@ -24,6 +39,9 @@ typedef struct wasm_value {
         int64_t i64;
         float f32;
         double f64;
+
+        // the funcidx of a reference, or WASM_REF_NULL
+        uint32_t ref;
     } value;
 } wasm_value_t;
 
@@ -40,6 +58,7 @@ typedef struct wasm_global {
 } wasm_global_t;
 
 typedef struct wasm_table {
+    wasm_value_type_t type;
     uint32_t min;
     uint32_t max;
 } wasm_table_t;
@@ -49,10 +68,19 @@ typedef struct wasm_elem_segment {
     uint32_t offset;
     uint32_t funcs_count;
     uint32_t* funcs;
+
+    // passive and declarative segments are not placed in a table, they
+    // only declare the functions that can be referenced by ref.func
+    bool active;
+
+    // declarative segments can't be used by table.init either, they
+    // are dropped as soon as the module is instantiated
+    bool declarative;
 } wasm_elem_segment_t;
 
 typedef struct wasm_data {
-    uint32_t offset;
+    uint32_t memidx;
+    uint64_t offset;
     uint32_t len;
     void* data;
     bool active;
@@ -98,6 +126,9 @@ typedef struct wasm_memory {
     uint64_t min;
     uint64_t max;
     bool shared;
+
+    // the memory is indexed with i64 addresses
+    bool is64;
 } wasm_memory_t;
 
 typedef struct wasm_module {
@@ -109,13 +140,14 @@ typedef struct wasm_module {
     wasm_table_t* tables;
     wasm_elem_segment_t* elems;
     wasm_data_t* data;
+    wasm_memory_t* memories;
+
+    // the type of the exception of every tag, tags only have params
+    typeidx_t* tags;
 
     // same amount as functions count
     wasm_code_t* code;
 
-    // right now only one memory is supported
-    wasm_memory_t memory;
-
     uint32_t types_count;
     uint32_t functions_count;
     uint32_t globals_count;
@@ -124,6 +156,12 @@ typedef struct wasm_module {
     uint32_t tables_count;
     uint32_t elems_count;
     uint32_t data_count;
+    uint32_t memories_count;
+    uint32_t tags_count;
+
+    // the module has a data count section, data_count is then known before
+    // the data section arrives and the data section must match it
+    bool has_data_count;
 
     // the starting function, 
     // -1 if no such function
@@ -136,21 +174,110 @@ typedef struct wasm_module {
     // string owned by the module, or NULL.
     char* module_name;
     char** function_names;
+
+    // The function bodies and data segments point into the buffer the module
+    // was loaded from instead of owning a copy, see wasm_load_module_borrowed
+    bool borrowed;
+
+    // Open addressed hash index over the export names, built by the loader.
+    // Every slot is an index into exports plus one, or zero when empty, and
+    // the slot count is export_slots_mask + 1 (a power of two)
+    uint32_t* export_slots;
+    uint32_t export_slots_mask;
+
+    // When set everything the module owns is allocated from this arena
+    // instead of one by one, see wasm_load_config_t::use_arena
+    struct arena* arena;
 } wasm_module_t;
 
+typedef struct wasm_load_config {
+    // borrow the function bodies and the data segments from the
+    // buffer, see wasm_load_module_borrowed
+    bool borrow;
+
+    // allocate everything the module owns from a few large blocks instead of
+    // one allocation per item, wasm_module_free then only frees the blocks.
+    // Worth it when modules are loaded and freed all the time, but nothing of
+    // the module can be freed on its own before that.
+    bool use_arena;
+} wasm_load_config_t;
+
+/**
+ * Load a module, everything the module keeps is copied out of the given buffer,
+ * so the buffer is only read during the call and can be freed once it returns
+ */
 wasm_err_t wasm_load_module(wasm_module_t* module, void* data, size_t size);
 
 /**
- * Initialize the module's linear memory based on the module requirements, assumed
- * to be zero-initialized already
+ * Load a module with the given options, the other loaders are shorthands for it.
+ * The buffer has the lifetime of wasm_load_module, or of wasm_load_module_borrowed
+ * when config->borrow is set.
  */
-void wasm_module_init_memory(wasm_module_t* module, void* memory);
+wasm_err_t wasm_load_module_with_config(wasm_module_t* module, void* data, size_t size, const wasm_load_config_t* config);
 
 /**
- * Find an export in the module, returns null if not found
+ * Load a module without copying the function bodies and the data segments out
+ * of the given buffer, wasm_code_t::code and wasm_data_t::data point right into
+ * it. The buffer is owned by the caller and must stay alive and unchanged until
+ * wasm_module_free, which leaves it alone. A module jitted from it doesn't need
+ * the buffer anymore, only wasm_module_init_memory does.
+ */
+wasm_err_t wasm_load_module_borrowed(wasm_module_t* module, void* data, size_t size);
+
+typedef struct wasm_stream wasm_stream_t;
+
+typedef struct wasm_stream_config {
+    /**
+     * Called with every function body as soon as all of it arrived, the funcidx
+     * includes the imports. Every section before the code section is already
+     * parsed when it is called, the data section is not. Can be null.
+     */
+    void (*on_function)(void* arg, wasm_module_t* module, uint32_t funcidx);
+    void* on_function_arg;
+
+    // same as wasm_load_config_t::use_arena
+    bool use_arena;
+} wasm_stream_config_t;
+
+/**
+ * Start loading a module that arrives in chunks, the config is optional
+ */
+wasm_err_t wasm_stream_create(wasm_stream_t** out_stream, const wasm_stream_config_t* config);
+
+/**
+ * Feed the next chunk of the module, the chunk can be of any size and is not
+ * needed after this returns. After an error the stream can only be destroyed.
+ */
+wasm_err_t wasm_stream_feed(wasm_stream_t* stream, const void* chunk, size_t size);
+
+/**
+ * Finish loading after the whole module was fed, fails if it was truncated.
+ * The module owns all of its memory and is freed with wasm_module_free.
+ */
+wasm_err_t wasm_stream_finish(wasm_stream_t* stream, wasm_module_t* module);
+
+void wasm_stream_destroy(wasm_stream_t* stream);
+
+/**
+ * Initialize one of the module's linear memories based on the module requirements,
+ * assumed to be zero-initialized already
+ */
+void wasm_module_init_memory(wasm_module_t* module, uint32_t memidx, void* memory);
+
+/**
+ * Find an export in the module, returns -1 if not found. The index is stable
+ * for the lifetime of the module and is the same in wasm_module_t::exports and
+ * wasm_module_jit_t::exports, so callers that look up the same name over and
+ * over can resolve it once and keep the index.
  */
 int64_t wasm_find_export(wasm_module_t* module, const char* name);
 
+/**
+ * Same as wasm_find_export, but also returns -1 when the export is not of the
+ * given kind, so the index can be used as that kind without checking
+ */
+int64_t wasm_find_export_of_kind(wasm_module_t* module, const char* name, wasm_export_type_t kind);
+
 /**
  * Get the type of a function from a funcidx
  */
@@ -160,3 +287,13 @@ wasm_type_t* wasm_get_func(wasm_module_t* module, int64_t index);
  * Free the contents of the given module
  */
 void wasm_module_free(wasm_module_t* module);
+
+/**
+ * Drop what only the jit needs from a module that was already jitted, the function
+ * bodies, the elem segments and the debug names, leaving what instantiating and
+ * running the jitted module needs: the types, imports, exports, memories, data
+ * segments and so on. The module can't be jitted again afterwards, and the debug
+ * ELF must be emitted before. The memory of a module loaded into an arena is only
+ * released by wasm_module_free.
+ */
+void wasm_module_trim(wasm_module_t* module);
@@ -44,18 +44,82 @@ cleanup:
     return err;
 }
 
-wasm_err_t buffer_pull_u32(buffer_t* buffer, uint32_t* value) {
+//
+// The values that don't fit in two bytes (addresses, large constants, section
+// sizes) are decoded a word at a time when the buffer has 8 bytes left: the
+// first byte without the continuation bit marks the end of the encoding, and
+// its 7 bit groups are squeezed together with a few shifts instead of a loop.
+// Whatever the word doesn't cover, and the end of the buffer, goes through the
+// byte at a time loop which also takes care of the malformed encodings.
+//
+
+#define LEB128_CONTINUATION_BITS    0x8080808080808080ull
+
+/**
+ * Decode the first 8 bytes of a LEB128, returns the length of the encoding or
+ * 8 if it doesn't end in them, the value is of the bytes decoded either way
+ */
+static inline size_t buffer_decode_leb128_word(const uint8_t* data, uint64_t* value) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+
+    size_t len = sizeof(word);
+    uint64_t ends = ~word & LEB128_CONTINUATION_BITS;
+    if (ends != 0) {
+        len = (__builtin_ctzll(ends) + 1) / 8;
+    }
+
+    // drop whatever comes after the encoding and the continuation bits
+    if (len < sizeof(word)) {
+        word &= (1ull << (len * 8)) - 1;
+    }
+    word &= ~LEB128_CONTINUATION_BITS;
+
+    // 7 bit groups -> 14 bit groups -> 28 bit groups -> 56 bits
+    word = (word & 0x007F007F007F007Full) | ((word & 0x7F007F007F007F00ull) >> 1);
+    word = (word & 0x00003FFF00003FFFull) | ((word & 0x3FFF00003FFF0000ull) >> 2);
+    word = (word & 0x000000000FFFFFFFull) | ((word & 0x0FFFFFFF00000000ull) >> 4);
+
+    *value = word;
+    return len;
+}
+
+/**
+ * Start decoding a LEB128 of at most max_len bytes with a single word, leaves the
+ * last byte it decoded in byte so the caller can continue from it if needed
+ */
+static inline void buffer_pull_leb128_word(buffer_t* buffer, size_t max_len, uint64_t* result, uint32_t* shift, uint8_t* byte) {
+    if (buffer->len < sizeof(uint64_t)) {
+        return;
+    }
+
+    // an encoding that is too long is left for the byte loop to reject
+    size_t len = buffer_decode_leb128_word(buffer->data, result);
+    if (len > max_len) {
+        len = max_len;
+        *result &= (1ull << (len * 7)) - 1;
+    }
+
+    const uint8_t* data = buffer_pull(buffer, len);
+    *byte = data[len - 1];
+    *shift = len * 7;
+}
+
+wasm_err_t buffer_pull_u32_slow(buffer_t* buffer, uint32_t* value) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    uint32_t result = 0;
+    uint64_t word = 0;
     uint32_t shift = 0;
-    uint8_t byte = 0;
-    do {
+    uint8_t byte = 0x80;
+    buffer_pull_leb128_word(buffer, 5, &word, &shift, &byte);
+
+    uint32_t result = word;
+    while ((byte & 0x80) != 0) {
         CHECK(shift <= 28);
         byte = BUFFER_PULL(uint8_t, buffer);
         result |= (uint32_t)(byte & 0x7f) << shift;
         shift += 7;
-    } while ((byte & 0x80) != 0);
+    }
 
     *value = result;
 
@@ -63,18 +127,20 @@ cleanup:
     return err;
 }
 
-wasm_err_t buffer_pull_u64(buffer_t* buffer, uint64_t* value) {
+wasm_err_t buffer_pull_u64_slow(buffer_t* buffer, uint64_t* value) {
     wasm_err_t err = WASM_NO_ERROR;
 
     uint64_t result = 0;
     uint32_t shift = 0;
-    uint8_t byte = 0;
-    do {
+    uint8_t byte = 0x80;
+    buffer_pull_leb128_word(buffer, 10, &result, &shift, &byte);
+
+    while ((byte & 0x80) != 0) {
         CHECK(shift <= 63);
         byte = BUFFER_PULL(uint8_t, buffer);
         result |= (uint64_t)(byte & 0x7f) << shift;
         shift += 7;
-    } while ((byte & 0x80) != 0);
+    }
 
     *value = result;
 
@@ -82,18 +148,21 @@ cleanup:
     return err;
 }
 
-wasm_err_t buffer_pull_i32(buffer_t* buffer, int32_t* out) {
+wasm_err_t buffer_pull_i32_slow(buffer_t* buffer, int32_t* out) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    uint32_t result = 0;
+    uint64_t word = 0;
     uint32_t shift = 0;
-    uint8_t byte = 0;
-    do {
+    uint8_t byte = 0x80;
+    buffer_pull_leb128_word(buffer, 5, &word, &shift, &byte);
+
+    uint32_t result = word;
+    while ((byte & 0x80) != 0) {
         CHECK(shift <= 28);
         byte = BUFFER_PULL(uint8_t, buffer);
         result |= (uint32_t)(byte & 0x7F) << shift;
         shift += 7;
-    } while ((byte & 0x80) != 0);
+    }
 
     // sign-extend if the encoding's sign bit (0x40 of the final byte) is set
     // and we haven't already filled the full 32 bits
@@ -107,18 +176,20 @@ cleanup:
     return err;
 }
 
-wasm_err_t buffer_pull_i64(buffer_t* buffer, int64_t* out) {
+wasm_err_t buffer_pull_i64_slow(buffer_t* buffer, int64_t* out) {
     wasm_err_t err = WASM_NO_ERROR;
 
     uint64_t result = 0;
     uint32_t shift = 0;
-    uint8_t byte = 0;
-    do {
+    uint8_t byte = 0x80;
+    buffer_pull_leb128_word(buffer, 10, &result, &shift, &byte);
+
+    while ((byte & 0x80) != 0) {
         CHECK(shift <= 63);
         byte = BUFFER_PULL(uint8_t, buffer);
         result |= (uint64_t)(byte & 0x7F) << shift;
         shift += 7;
-    } while ((byte & 0x80) != 0);
+    }
 
     if ((shift < 64) && (byte & 0x40)) {
         result |= ~(uint64_t)0 << shift;
@@ -187,6 +258,10 @@ wasm_err_t buffer_pull_val_type(buffer_t* buffer, wasm_value_type_t* valtype) {
         case 0x7D: *valtype = WASM_VALUE_TYPE_F32; break;
         case 0x7E: *valtype = WASM_VALUE_TYPE_I64; break;
         case 0x7F: *valtype = WASM_VALUE_TYPE_I32; break;
+        case 0x7B: *valtype = WASM_VALUE_TYPE_V128; break;
+        case 0x70: *valtype = WASM_VALUE_TYPE_FUNCREF; break;
+        case 0x6F: *valtype = WASM_VALUE_TYPE_EXTERNREF; break;
+        case 0x69: *valtype = WASM_VALUE_TYPE_EXNREF; break;
         default: CHECK_FAIL("%x", byte);
     }
 
@@ -23,10 +23,83 @@ wasm_err_t buffer_push(buffer_t* buffer, const void* data, size_t len);
 wasm_err_t buffer_fill(buffer_t* buffer, uint8_t value, size_t len);
 wasm_err_t buffer_align(buffer_t* buffer, uint8_t value, size_t alignment);
 
-wasm_err_t buffer_pull_u32(buffer_t* buffer, uint32_t* value);
-wasm_err_t buffer_pull_u64(buffer_t* buffer, uint64_t* value);
-wasm_err_t buffer_pull_i32(buffer_t* buffer, int32_t* value);
-wasm_err_t buffer_pull_i64(buffer_t* buffer, int64_t* value);
+// The out of line LEB128 decoders, the buffer_pull_* wrappers below only
+// call them for values that don't fit in the first two bytes
+wasm_err_t buffer_pull_u32_slow(buffer_t* buffer, uint32_t* value);
+wasm_err_t buffer_pull_u64_slow(buffer_t* buffer, uint64_t* value);
+wasm_err_t buffer_pull_i32_slow(buffer_t* buffer, int32_t* value);
+wasm_err_t buffer_pull_i64_slow(buffer_t* buffer, int64_t* value);
+
+/**
+ * Decode a one or two byte LEB128 from the start of the buffer, which is what
+ * nearly every index, alignment and small constant is encoded as. Returns the
+ * length of the encoding, or zero if it is longer (or the buffer is too short)
+ */
+static inline size_t buffer_peek_leb128_short(buffer_t* buffer, uint32_t* value) {
+    const uint8_t* data = buffer->data;
+    if (buffer->len >= 1 && data[0] < 0x80) {
+        *value = data[0];
+        return 1;
+    }
+    if (buffer->len >= 2 && data[1] < 0x80) {
+        *value = (data[0] & 0x7F) | ((uint32_t)data[1] << 7);
+        return 2;
+    }
+    return 0;
+}
+
+static inline wasm_err_t buffer_pull_u32(buffer_t* buffer, uint32_t* value) {
+    uint32_t result;
+    size_t len = buffer_peek_leb128_short(buffer, &result);
+    if (len == 0) {
+        return buffer_pull_u32_slow(buffer, value);
+    }
+    buffer->data += len;
+    buffer->len -= len;
+    *value = result;
+    return WASM_NO_ERROR;
+}
+
+static inline wasm_err_t buffer_pull_u64(buffer_t* buffer, uint64_t* value) {
+    uint32_t result;
+    size_t len = buffer_peek_leb128_short(buffer, &result);
+    if (len == 0) {
+        return buffer_pull_u64_slow(buffer, value);
+    }
+    buffer->data += len;
+    buffer->len -= len;
+    *value = result;
+    return WASM_NO_ERROR;
+}
+
+static inline wasm_err_t buffer_pull_i32(buffer_t* buffer, int32_t* value) {
+    uint32_t result;
+    size_t len = buffer_peek_leb128_short(buffer, &result);
+    if (len == 0) {
+        return buffer_pull_i32_slow(buffer, value);
+    }
+    buffer->data += len;
+    buffer->len -= len;
+
+    // sign extend from the 7 or 14 bits we got
+    uint32_t shift = 32 - 7 * len;
+    *value = (int32_t)(result << shift) >> shift;
+    return WASM_NO_ERROR;
+}
+
+static inline wasm_err_t buffer_pull_i64(buffer_t* buffer, int64_t* value) {
+    uint32_t result;
+    size_t len = buffer_peek_leb128_short(buffer, &result);
+    if (len == 0) {
+        return buffer_pull_i64_slow(buffer, value);
+    }
+    buffer->data += len;
+    buffer->len -= len;
+
+    uint32_t shift = 64 - 7 * len;
+    *value = (int64_t)((uint64_t)result << shift) >> shift;
+    return WASM_NO_ERROR;
+}
 
 wasm_err_t buffer_pull_name(buffer_t* buffer, buffer_t* name);
 
@@ -55,8 +55,12 @@ static void jit_build_cfi_thunk(spidir_builder_handle_t builder, void* _ctx) {
     // the success path, call the real function directly
     spidir_builder_set_block(builder, cfi_success);
 
-    // setup the args, we passthrough most of it
-    size_t arg_count = type->arg_types_count + 2;
+    // setup the args, we passthrough most of it, including the
+    // pointer to the area of the extra results
+    size_t arg_count = jit_count_spidir_values(type->arg_types, type->arg_types_count) + 2;
+    if (jit_count_extra_results(type) != 0) {
+        arg_count++;
+    }
     params = CALLOC(spidir_value_t, arg_count);
     CHECK(params != nullptr);
 
@@ -65,8 +69,8 @@ static void jit_build_cfi_thunk(spidir_builder_handle_t builder, void* _ctx) {
     params[1] = spidir_builder_build_param_ref(builder, 1);
 
     // the rest come after the type id
-    for (int i = 0; i < type->arg_types_count; i++) {
-        params[2 + i] = spidir_builder_build_param_ref(builder, 3 + i);
+    for (int i = 2; i < arg_count; i++) {
+        params[i] = spidir_builder_build_param_ref(builder, i + 1);
     }
 
     // and now call it and return it
@@ -83,28 +87,50 @@ wasm_err_t jit_create_cfi_thunk(jit_context_t* ctx, uint32_t funcidx) {
     wasm_err_t err = WASM_NO_ERROR;
     spidir_value_type_t* args = nullptr;
 
+    jit_function_t* func = &ctx->functions[funcidx];
+    if (func->has_cfi) {
+        goto cleanup;
+    }
+
+    // a folded function has the same typeidx as the one it is folded
+    // into, so it can share the thunk, which is built with that function
+    if (func->folded) {
+        RETHROW(jit_create_cfi_thunk(ctx, func->folded_into));
+        func->has_cfi = true;
+        func->cfi_thunk = ctx->functions[func->folded_into].cfi_thunk;
+        func->cfi_built = true;
+        goto cleanup;
+    }
+
     wasm_type_t* type = wasm_get_func(ctx->module, funcidx);
     CHECK(type != nullptr);
     
-    // the ret type
+    // the ret type, the rest of the results are left in the area
+    // the caller passes by the real function
     spidir_value_type_t ret_type = SPIDIR_TYPE_NONE;
-    if (type->result_types_count == 1) {
+    if (type->result_types_count != 0) {
         ret_type = jit_get_spidir_value_type(type->result_types[0]);
-    } else {
-        CHECK(type->result_types_count == 0);
     }
 
     // the args
-    size_t args_count = type->arg_types_count + 3;
+    size_t wasm_args_count = jit_count_spidir_values(type->arg_types, type->arg_types_count);
+    size_t args_count = wasm_args_count + 3;
+    if (jit_count_extra_results(type) != 0) {
+        args_count++;
+    }
     args = CALLOC(spidir_value_type_t, args_count);
-    int ai = 0;
+    CHECK(args != nullptr);
     
-    args[ai++] = SPIDIR_TYPE_PTR; // the memory base
-    args[ai++] = SPIDIR_TYPE_PTR; // the state base
-    args[ai++] = SPIDIR_TYPE_I64; // the type id
+    args[0] = SPIDIR_TYPE_PTR; // the memory base
+    args[1] = SPIDIR_TYPE_PTR; // the state base
+    args[2] = SPIDIR_TYPE_I64; // the type id
 
-    for (int64_t i = 0; i < type->arg_types_count; i++) {
-        args[ai++] = jit_get_spidir_value_type(type->arg_types[i]);
+    jit_fill_spidir_value_types(type->arg_types, type->arg_types_count, &args[3]);
+    for (int64_t i = 3; i < wasm_args_count + 3; i++) {
+        args[i] = jit_lower_value_type(args[i]);
+    }
+    if (args_count != wasm_args_count + 3) {
+        args[args_count - 1] = SPIDIR_TYPE_PTR; // the extra results
     }
 
     // TODO: generate a nice debug name
@@ -117,7 +143,6 @@ wasm_err_t jit_create_cfi_thunk(jit_context_t* ctx, uint32_t funcidx) {
     name[4 + digits] = '\0';
 
     // create the spidir function for it
-    jit_function_t* func = &ctx->functions[funcidx];
     func->has_cfi = true;
     func->cfi_thunk = spidir_module_create_function(
         ctx->spidir,
@@ -126,27 +151,43 @@ wasm_err_t jit_create_cfi_thunk(jit_context_t* ctx, uint32_t funcidx) {
         args_count, args
     );
 
-    // and build it right away because we can
-    jit_cfi_ctx_t cfi_ctx = {
-        .ref = func->spidir,
-        .type = type,
-        .ctx = ctx,
-        .err = WASM_NO_ERROR,
-    };
-    spidir_module_build_function(
-        ctx->spidir,
-        ctx->functions[funcidx].cfi_thunk,
-        jit_build_cfi_thunk,
-        &cfi_ctx
-    );
-    RETHROW(cfi_ctx.err);
-
 cleanup:
     wasm_host_free(args);
 
     return err;
 }
 
+wasm_err_t jit_build_cfi_thunks(jit_context_t* ctx) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    size_t functions_count = ctx->module->imports_count + ctx->module->functions_count;
+    for (size_t funcidx = 0; funcidx < functions_count; funcidx++) {
+        jit_function_t* func = &ctx->functions[funcidx];
+        if (!func->has_cfi || func->cfi_built) {
+            continue;
+        }
+
+        jit_cfi_ctx_t cfi_ctx = {
+            .ref = func->spidir,
+            .type = wasm_get_func(ctx->module, funcidx),
+            .ctx = ctx,
+            .err = WASM_NO_ERROR,
+        };
+        spidir_module_build_function(
+            ctx->spidir,
+            func->cfi_thunk,
+            jit_build_cfi_thunk,
+            &cfi_ctx
+        );
+        RETHROW(cfi_ctx.err);
+
+        func->cfi_built = true;
+    }
+
+cleanup:
+    return err;
+}
+
 uint64_t jit_cfi_get_type_id(jit_context_t* ctx, wasm_type_t* type) {
     // NOTE: we assume the type is part of the types array and is of the current module
     //       so we can derive the type id back really easily
@@ -4,6 +4,16 @@
 #include "wasm/error.h"
 #include "wasm/wasm.h"
 
+/**
+ * Create the cfi thunk of a function if it doesn't have one yet, the function
+ * must already be prepared. This can be called while building another function,
+ * so the thunk itself is only built by jit_build_cfi_thunks
+ */
 wasm_err_t jit_create_cfi_thunk(jit_context_t* ctx, uint32_t funcidx);
 
+/**
+ * Build all the thunks that were created since the last call
+ */
+wasm_err_t jit_build_cfi_thunks(jit_context_t* ctx);
+
 uint64_t jit_cfi_get_type_id(jit_context_t* ctx, wasm_type_t* type);
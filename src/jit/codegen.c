@@ -2,6 +2,7 @@
 
 #include "jit/helpers.h"
 #include "jit/libcall.h"
+#include "jit/unwind.h"
 #include "spidir/codegen.h"
 #include "spidir/module.h"
 #include "spidir/x64.h"
@@ -42,9 +43,63 @@ typedef struct function_codegen {
      * The constpool offset for this function
      */
     uint32_t constpool_offset;
+
+    /**
+     * The size of the code and constpool of the function, these
+     * outlive the blob for the layout of folded functions
+     */
+    uint32_t code_size;
+    uint32_t constpool_size;
+
+    /**
+     * This is a cfi thunk, which is only ever called indirectly, so
+     * any reference to it must include the endbr64
+     */
+    bool indirect;
+
+    /**
+     * Placed with the cold code at the end, it was never called in the profile
+     */
+    bool cold;
+
+    /**
+     * The wasm funcidx of this function, UINT32_MAX for the cfi and
+     * invoke thunks, which are not wasm functions
+     */
+    uint32_t funcidx;
+
+    /**
+     * The layout chain this function was merged into (a union-find parent),
+     * and the function that comes right after it in the chain. The chain's
+     * representative also knows the first and last function of the chain,
+     * how many functions and bytes of code the chain takes.
+     */
+    uint32_t chain;
+    uint32_t chain_next;
+    uint32_t chain_head;
+    uint32_t chain_tail;
+    uint32_t chain_count;
+    uint64_t chain_size;
+
+    /**
+     * Where the function starts in its chain, relative to the base of the
+     * chain's representative, so a chain can be moved behind another one
+     * without touching the offsets of its functions
+     */
+    int64_t chain_offset;
+    int64_t chain_base;
 } function_codegen_t;
 
-typedef struct codegen_ctx {
+/**
+ * The direct calls between two functions, in either direction
+ */
+typedef struct jit_call_edge {
+    uint32_t caller;
+    uint32_t callee;
+    uint64_t weight;
+} jit_call_edge_t;
+
+struct codegen_ctx {
     /**
      * The queue of functions to jit, the index is into 
      * the functions array making it easier to deal with
@@ -61,6 +116,13 @@ typedef struct codegen_ctx {
      */
     hmap_t func_to_idx;
 
+    /**
+     * The call graph the layout is built from, and the index of every
+     * pair of functions in it
+     */
+    vec(jit_call_edge_t) call_edges;
+    hmap_t call_edge_map;
+
     /** 
      * Maps a spidir global into an offset
      */
@@ -71,6 +133,19 @@ typedef struct codegen_ctx {
      */
     hmap_t imports;
 
+    /**
+     * External call targets (helpers, imports and libcalls) that are called
+     * with a PC32 relocation, mapped to their slot in the veneer island. Each
+     * target gets a single veneer no matter how many call sites it has.
+     */
+    hmap_t veneers;
+
+    /**
+     * The code offset of the veneer island, placed right after the last
+     * function so every call site can reach it with a rel32
+     */
+    size_t veneers_offset;
+
     /**
      * The total size of the code that we need for this
      */
@@ -110,14 +185,23 @@ typedef struct codegen_ctx {
      * jit->debug at the end of codegen.
      */
     vec(wasm_jit_reloc_t) debug_relocs;
-} codegen_ctx_t;
+
+    /**
+     * Whether we're building the .eh_frame of the jitted code, and the
+     * .eh_frame itself, copied into jit->eh_frame at the end of codegen
+     */
+    bool emit_unwind;
+    jit_eh_frame_t eh_frame;
+};
 
 static spidir_codegen_machine_handle_t m_spidir_machine = nullptr;
 
 static void wasm_jit_init(wasm_jit_config_t* config) {
     if (config->machine_handle == nullptr) {
         spidir_x64_machine_config_t machine_config = {
-            .extern_code_model = SPIDIR_X64_CM_LARGE_ABS,
+            // externs are called directly and linked through the
+            // veneer island when they are out of rel32 range
+            .extern_code_model = SPIDIR_X64_CM_SMALL_PIC,
             .internal_code_model = SPIDIR_X64_CM_SMALL_PIC,
         };
 
@@ -215,6 +299,12 @@ static wasm_err_t jit_codegen_prepare_debug_maps(jit_context_t* ctx, codegen_ctx
             continue;
         }
 
+        // a folded function shares the spidir function (and thunk) of the
+        // one it is folded into, which is the one the code is named after
+        if (func->folded) {
+            continue;
+        }
+
         if (spidir_funcref_is_internal(func->spidir)) {
             RETHROW(hmap_insert(
                 &codegen->dbg_func_to_funcidx,
@@ -242,6 +332,147 @@ cleanup:
     return err;
 }
 
+static void jit_codegen_alias_layout(
+    wasm_module_jit_t* jit,
+    codegen_ctx_t* codegen,
+    spidir_function_t function,
+    uint32_t funcidx,
+    bool cfi_thunk
+) {
+    uint64_t index;
+    if (!hmap_lookup(&codegen->func_to_idx, function.id, &index)) {
+        return;
+    }
+    function_codegen_t* func = &codegen->functions.elements[index];
+
+    void* jit_code = jit->binary;
+    void* jit_rodata = jit->binary + codegen->code_size;
+
+    wasm_jit_func_layout_t* layout = &jit->debug.funcs[jit->debug.funcs_count++];
+    layout->funcidx = funcidx;
+    layout->cfi_thunk = cfi_thunk;
+    layout->address = jit_code + func->code_offset;
+    layout->code_size = func->code_size;
+    layout->const_address = func->constpool_size != 0 ? jit_rodata + func->constpool_offset : nullptr;
+    layout->const_size = func->constpool_size;
+}
+
+/**
+ * The folded functions have no code of their own, record them at the
+ * address of the function they were folded into, and the same for
+ * their cfi thunk
+ */
+static void jit_codegen_folded_layouts(wasm_module_jit_t* jit, jit_context_t* ctx, codegen_ctx_t* codegen) {
+    size_t total_funcs = ctx->module->imports_count + ctx->module->functions_count;
+    for (size_t i = 0; i < total_funcs; i++) {
+        jit_function_t* func = &ctx->functions[i];
+        if (!func->inited || !func->folded) {
+            continue;
+        }
+
+        jit_codegen_alias_layout(jit, codegen, spidir_funcref_get_internal(func->spidir), i, false);
+        if (func->has_cfi) {
+            jit_codegen_alias_layout(jit, codegen, func->cfi_thunk, i, true);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Veneers for external calls
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Every veneer is a `jmp [rip+0]` followed by the absolute target address,
+ * padded to 16 bytes
+ */
+#define JIT_VENEER_SIZE 16
+
+/**
+ * Get the key of the veneer used by the given relocation, returns false if the
+ * relocation does not go through a veneer. Helpers and imports share the spidir
+ * extern id space, libcalls are placed above it.
+ */
+static bool jit_get_veneer_key(const spidir_codegen_reloc_t* reloc, uint64_t* key) {
+    if (reloc->kind != SPIDIR_RELOC_X64_PC32) {
+        return false;
+    }
+
+    switch (reloc->target_kind) {
+        case SPIDIR_RELOC_TARGET_EXTERNAL_FUNCTION: *key = reloc->target.external.id; return true;
+        case SPIDIR_RELOC_TARGET_LIBCALL: *key = (1ull << 32) | reloc->target.libcall; return true;
+        default: return false;
+    }
+}
+
+static wasm_err_t jit_reserve_veneer(codegen_ctx_t* codegen, const spidir_codegen_reloc_t* reloc) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint64_t key;
+    if (!jit_get_veneer_key(reloc, &key)) {
+        goto cleanup;
+    }
+
+    uint64_t index;
+    if (!hmap_lookup(&codegen->veneers, key, &index)) {
+        RETHROW(hmap_insert(&codegen->veneers, key, codegen->veneers.size));
+    }
+
+cleanup:
+    return err;
+}
+
+static void jit_codegen_veneers(codegen_ctx_t* codegen) {
+    // the island goes right after the functions, so it is always
+    // in range of every call site that needs it
+    codegen->code_size = ALIGN_UP(codegen->code_size, 16);
+    codegen->veneers_offset = codegen->code_size;
+    codegen->code_size += codegen->veneers.size * JIT_VENEER_SIZE;
+}
+
+/**
+ * Resolve the address a PC32 external call should be linked against, this is the
+ * target itself when it is in rel32 range, otherwise it is the target's veneer,
+ * which is written the first time it is used
+ */
+static wasm_err_t jit_get_veneer(
+    codegen_ctx_t* codegen,
+    void* jit_code,
+    void* site,
+    const spidir_codegen_reloc_t* reloc,
+    void** target
+) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint64_t key;
+    if (!jit_get_veneer_key(reloc, &key)) {
+        goto cleanup;
+    }
+
+    // if we can reach it directly there is no need for the veneer
+    ptrdiff_t value = (uint64_t)*target + reloc->addend - (uint64_t)site;
+    if (INT32_MIN <= value && value <= INT32_MAX) {
+        goto cleanup;
+    }
+
+    uint64_t index;
+    CHECK(hmap_lookup(&codegen->veneers, key, &index));
+    uint8_t* veneer = jit_code + codegen->veneers_offset + index * JIT_VENEER_SIZE;
+
+    // the island is filled with int3, so an unwritten veneer is easy to spot
+    if (veneer[0] == 0xCC) {
+        // jmp [rip+0]
+        veneer[0] = 0xFF;
+        veneer[1] = 0x25;
+        POKE(uint32_t, veneer + 2) = 0;
+        POKE(uint64_t, veneer + 6) = (uint64_t)*target;
+    }
+
+    *target = veneer;
+
+cleanup:
+    return err;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // Final linking in memory
 //----------------------------------------------------------------------------------------------------------------------
@@ -313,17 +544,19 @@ static wasm_err_t jit_codegen_link(wasm_module_jit_t* jit, jit_context_t* ctx, c
         }
 
         // Record the layout for the debug ELF. Every emitted function is
-        // either a wasm function or a CFI thunk, so resolving the owner
-        // through the two maps must succeed; skip the whole dance when
-        // nobody asked for debug info.
+        // either a wasm function, a CFI thunk or an invoke thunk, the last
+        // of which has no funcidx to be recorded under so it only gets its
+        // relocations captured; skip the whole dance when nobody asked for
+        // debug info.
         uint64_t owner_funcidx = UINT64_MAX;
         bool owner_cfi = false;
         if (codegen->capture_debug) {
             if (!hmap_lookup(&codegen->dbg_func_to_funcidx, func->function.id, &owner_funcidx)) {
-                CHECK(hmap_lookup(&codegen->dbg_cfi_to_funcidx, func->function.id, &owner_funcidx));
-                owner_cfi = true;
+                owner_cfi = hmap_lookup(&codegen->dbg_cfi_to_funcidx, func->function.id, &owner_funcidx);
             }
+        }
 
+        if (owner_funcidx != UINT64_MAX) {
             wasm_jit_func_layout_t* layout = &jit->debug.funcs[jit->debug.funcs_count++];
             layout->funcidx = (uint32_t)owner_funcidx;
             layout->cfi_thunk = owner_cfi;
@@ -333,6 +566,12 @@ static wasm_err_t jit_codegen_link(wasm_module_jit_t* jit, jit_context_t* ctx, c
             layout->const_size = blob_const_size;
         }
 
+        // the FDE of the function, the endbr64 slot in front of it is covered
+        // as well since an indirect call lands there
+        if (codegen->emit_unwind && blob_code_size != 0) {
+            RETHROW(jit_unwind_add_code(&codegen->eh_frame, jit_code + func->code_offset - 4, blob_code_size + 4, 4));
+        }
+
         // go over the relocations of the function
         size_t relocs_count = spidir_codegen_blob_get_reloc_count(blob);
         const spidir_codegen_reloc_t* relocs = spidir_codegen_blob_get_relocs(blob);
@@ -366,20 +605,20 @@ static wasm_err_t jit_codegen_link(wasm_module_jit_t* jit, jit_context_t* ctx, c
                     CHECK(hmap_lookup(&codegen->func_to_idx, reloc->target.internal.id, &index));
                     target = jit_code + codegen->functions.elements[index].code_offset;
 
-                    // we assume that the ABS64 will
-                    // have an indirect access
-                    if (reloc->kind == SPIDIR_RELOC_X64_ABS64) {
+                    // we assume that the ABS64 will have an indirect
+                    // access, and a thunk is only ever called indirectly
+                    if (reloc->kind == SPIDIR_RELOC_X64_ABS64 || codegen->functions.elements[index].indirect) {
                         target = jit_get_indirect(target);
                     }
 
                     if (codegen->capture_debug) {
-                        // The callee is either a wasm function or a CFI
-                        // thunk; a thunk is recorded under the funcidx it
-                        // wraps with target_cfi set.
+                        // The callee is either a wasm function, a CFI thunk
+                        // or an invoke thunk; a CFI thunk is recorded under
+                        // the funcidx it wraps with target_cfi set, and an
+                        // invoke thunk has no funcidx at all.
                         uint64_t callee_funcidx = UINT64_MAX;
                         if (!hmap_lookup(&codegen->dbg_func_to_funcidx, reloc->target.internal.id, &callee_funcidx)) {
-                            CHECK(hmap_lookup(&codegen->dbg_cfi_to_funcidx, reloc->target.internal.id, &callee_funcidx));
-                            dbg_target_cfi = true;
+                            dbg_target_cfi = hmap_lookup(&codegen->dbg_cfi_to_funcidx, reloc->target.internal.id, &callee_funcidx);
                         }
                         dbg_target_funcidx = (uint32_t)callee_funcidx;
                     }
@@ -419,12 +658,20 @@ static wasm_err_t jit_codegen_link(wasm_module_jit_t* jit, jit_context_t* ctx, c
                     CHECK_FAIL();
             }
 
+            // external calls that can't reach their target go through its veneer
+            void* link_target = target;
+            RETHROW(jit_get_veneer(
+                codegen, jit_code,
+                jit_code + func->code_offset + reloc->offset,
+                reloc, &link_target
+            ));
+
             // actually apply the reloc
             RETHROW(jit_apply_reloc(
                 jit_code + func->code_offset,
                 blob_code_size,
                 reloc,
-                target
+                link_target
             ));
 
             // Record the reloc for the debug ELF. Kind and target_kind are
@@ -432,7 +679,9 @@ static wasm_err_t jit_codegen_link(wasm_module_jit_t* jit, jit_context_t* ctx, c
             // relocations for ABS64, but PC32 entries help label call sites if
             // we ever surface them). target_address is the value the bytes
             // were actually linked against — for an ABS64 to an internal
-            // function that is the endbr64 slot, not the function entry.
+            // function that is the endbr64 slot, not the function entry. For
+            // a call going through a veneer it is the final target and not
+            // the veneer itself.
             if (codegen->capture_debug) {
                 wasm_jit_reloc_t entry = {
                     .address = jit_code + func->code_offset + reloc->offset,
@@ -463,50 +712,33 @@ cleanup:
 // Codegen for tables
 //----------------------------------------------------------------------------------------------------------------------
 
-static wasm_err_t jit_codegen_tables(jit_context_t* ctx, codegen_ctx_t* codegen) {
+static wasm_err_t jit_codegen_fill_tables(wasm_module_jit_t* jit, jit_context_t* ctx, codegen_ctx_t* codegen) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // lay out the tables in memory, tables are read-only right now and 
-    // only contain functions, so we can just add them to the rodata
-    for (int i = 0; i < ctx->module->tables_count; i++) {
-        jit_table_t* table = &ctx->tables[i];
-        if (!table->used) {
-            continue;
+    // the initial elements of the tables, every instance gets a copy of them
+    for (int64_t i = 0; i < jit->tables_count; i++) {
+        wasm_jit_table_t* table = &jit->tables[i];
+        if (table->length != 0) {
+            table->elements = CALLOC(void*, table->length);
+            CHECK(table->elements != nullptr);
         }
-
-        codegen->rodata_size = ALIGN_UP(codegen->rodata_size, _Alignof(void*));
-        size_t offset = codegen->rodata_size;
-        codegen->rodata_size += sizeof(void*) * table->length;
-
-        RETHROW(hmap_insert(&codegen->global_offsets, table->global.id, offset));
     }
 
-cleanup:
-    return err;
-}
-
-static wasm_err_t jit_codegen_fill_tables(wasm_module_jit_t* jit, jit_context_t* ctx, codegen_ctx_t* codegen) {
-    wasm_err_t err = WASM_NO_ERROR;
-
     for (int64_t i = 0; i < ctx->module->elems_count; i++) {
         wasm_elem_segment_t* elem = &ctx->module->elems[i];
-        CHECK(elem->tableidx < ctx->module->tables_count);
-        jit_table_t* table = &ctx->tables[elem->tableidx];
-        if (!table->used) {
+        if (!elem->active) {
             continue;
         }
-        
-        // get the rodata offset from the global
-        uint64_t rodata_offset = -1;
-        CHECK(hmap_lookup(&codegen->global_offsets, table->global.id, &rodata_offset));
 
-        // segment must fit within the table's reserved range
+        CHECK(elem->tableidx < jit->tables_count);
+        wasm_jit_table_t* table = &jit->tables[elem->tableidx];
+
+        // segment must fit within the table's initial length
         size_t end_slot;
         CHECK(!__builtin_add_overflow((size_t)elem->offset, (size_t)elem->funcs_count, &end_slot));
         CHECK(end_slot <= table->length);
 
         // lay out all of the functions in the elements
-        void** slots = jit->binary + codegen->code_size + rodata_offset;
         for (int64_t j = 0; j < elem->funcs_count; j++) {
             jit_function_t* function = &ctx->functions[elem->funcs[j]];
 
@@ -519,10 +751,47 @@ static wasm_err_t jit_codegen_fill_tables(wasm_module_jit_t* jit, jit_context_t*
                 function->cfi_thunk,
                 &address
             ));
-            slots[elem->offset + j] = address;
+            table->elements[elem->offset + j] = address;
+        }
+    }
+
+    // the functions of the passive segments, which table.init copies from
+    size_t elems_count = 0;
+    for (int64_t i = 0; i < ctx->module->elems_count; i++) {
+        wasm_elem_segment_t* elem = &ctx->module->elems[i];
+        if (!elem->active && !elem->declarative) {
+            elems_count += elem->funcs_count;
         }
     }
 
+    if (elems_count != 0) {
+        jit->elems = CALLOC(void*, elems_count);
+        CHECK(jit->elems != nullptr);
+        jit->elems_count = elems_count;
+    }
+
+    size_t elem_start = 0;
+    for (int64_t i = 0; i < ctx->module->elems_count; i++) {
+        wasm_elem_segment_t* elem = &ctx->module->elems[i];
+        if (elem->active || elem->declarative) {
+            continue;
+        }
+
+        for (int64_t j = 0; j < elem->funcs_count; j++) {
+            jit_function_t* function = &ctx->functions[elem->funcs[j]];
+
+            void* address;
+            CHECK(function->has_cfi);
+            RETHROW(jit_get_internal_function_addr(
+                jit, ctx, codegen,
+                function->cfi_thunk,
+                &address
+            ));
+            jit->elems[elem_start + j] = address;
+        }
+        elem_start += elem->funcs_count;
+    }
+
 cleanup:
     return err;
 }
@@ -547,7 +816,9 @@ static wasm_err_t jit_codegen_function(jit_context_t* ctx, codegen_ctx_t* codege
     // add the function into the list
     function_codegen_t* func = vec_add(&codegen->functions, 1);
     CHECK(func != NULL);
+    memset(func, 0, sizeof(*func));
     func->function = function;
+    func->funcidx = UINT32_MAX;
     RETHROW(hmap_insert(&codegen->func_to_idx, function.id, codegen->functions.length - 1));
 
     // actually emit the function
@@ -562,22 +833,8 @@ static wasm_err_t jit_codegen_function(jit_context_t* ctx, codegen_ctx_t* codege
     );
     CHECK(status == SPIDIR_CODEGEN_OK, "Spidir codegen failed with error %d", status);
 
-    // Allocate code space, align the code to 16 bytes, which are used for both 
-    // padding and for adding the ENDBR when needed
-    codegen->code_size = ALIGN_UP(codegen->code_size, 16);
-    codegen->code_size += 16;
-    func->code_offset = codegen->code_size;
-    codegen->code_size += spidir_codegen_blob_get_code_size(func->blob);
-
-    // Allocate constpool space
-    size_t constpool_size = spidir_codegen_blob_get_constpool_size(func->blob);
-    if (constpool_size != 0) {
-        codegen->rodata_size += ALIGN_UP(codegen->rodata_size, spidir_codegen_blob_get_constpool_align(func->blob));
-        func->constpool_offset = codegen->rodata_size;
-        codegen->rodata_size += constpool_size;
-    } else {
-        func->constpool_offset = -1;
-    }
+    // the space for the code is only allocated once everything is
+    // emitted, see jit_codegen_layout
 
     // now go over the relocations and queue any functions that also need codegen
     size_t reloc_count = spidir_codegen_blob_get_reloc_count(func->blob);
@@ -591,6 +848,9 @@ static wasm_err_t jit_codegen_function(jit_context_t* ctx, codegen_ctx_t* codege
                 vec_push(&codegen->queue, reloc->target.internal);
             }
 
+        } else {
+            // external calls might need a veneer
+            RETHROW(jit_reserve_veneer(codegen, reloc));
         }
     }
 
@@ -663,14 +923,32 @@ static wasm_err_t jit_codegen_functions(jit_context_t* ctx, codegen_ctx_t* codeg
     // and now codegen until we are done
     while (codegen->queue.length != 0) {
         spidir_function_t func = vec_pop(&codegen->queue);
+        RETHROW(jit_check_interrupt(ctx));
         RETHROW(jit_codegen_function(ctx, codegen, func));
     }
 
+    // a thunk can also be reached through a ref.func, which takes its
+    // address like a direct call would, mark them so they are linked
+    // against the endbr64. Also remember which of the functions are the
+    // wasm functions themselves for the layout.
+    size_t functions_count = ctx->module->imports_count + ctx->module->functions_count;
+    for (size_t i = 0; i < functions_count; i++) {
+        uint64_t index;
+        if (ctx->functions[i].has_cfi && hmap_lookup(&codegen->func_to_idx, ctx->functions[i].cfi_thunk.id, &index)) {
+            codegen->functions.elements[index].indirect = true;
+        }
 
-cleanup:
-    // free the queue eagerly
-    vec_free(&codegen->queue);
+        if (
+            ctx->functions[i].inited &&
+            !ctx->functions[i].folded &&
+            spidir_funcref_is_internal(ctx->functions[i].spidir) &&
+            hmap_lookup(&codegen->func_to_idx, spidir_funcref_get_internal(ctx->functions[i].spidir).id, &index)
+        ) {
+            codegen->functions.elements[index].funcidx = i;
+        }
+    }
 
+cleanup:
     return err;
 }
 
@@ -692,7 +970,7 @@ static wasm_err_t jit_codegen_fill_functions(wasm_module_jit_t* jit, jit_context
             // get the global's offset
             jit->exports[i].global.offset = ctx->globals[index].offset;
 
-        } else if (kind == WASM_EXPORT_MEMORY) {
+        } else if (kind == WASM_EXPORT_MEMORY || kind == WASM_EXPORT_TABLE) {
             // nothing to do...
 
         } else {
@@ -711,16 +989,400 @@ cleanup:
     return err;
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// Code layout
+//----------------------------------------------------------------------------------------------------------------------
+
+//
+// The functions are laid out by call graph affinity, so a caller and its
+// callees share pages and cache lines instead of being wherever the codegen
+// queue happened to pop them. This is the greedy chain merging of Pettis and
+// Hansen: every function starts as a chain of its own, and going from the
+// heaviest call edge down the chains of the two ends are concatenated, in the
+// order that puts the two functions closest to each other. Either chain may be
+// reversed for that, so a function in the middle of a chain can still end up
+// right next to the other end of the edge.
+//
+// The weight of an edge is the number of direct call sites between the two
+// functions, scaled by the profile counts when the host gave us any. The cfi
+// and invoke thunks are only reached through tables and the exception path,
+// so they are kept out of the graph and placed at the end together with the
+// functions the profile says are cold.
+//
+
+/**
+ * The weight of a function, its call count when we have a profile for it
+ */
+static uint64_t jit_layout_function_weight(wasm_jit_config_t* config, function_codegen_t* func) {
+    if (config->profile_counts == nullptr || func->funcidx >= config->profile_counts_count) {
+        return 1;
+    }
+    return config->profile_counts[func->funcidx];
+}
+
+static bool jit_layout_is_hot(function_codegen_t* func) {
+    return func->funcidx != UINT32_MAX && !func->cold;
+}
+
+/**
+ * The bytes the function takes once it is placed, with the padding before it
+ */
+static uint64_t jit_layout_function_size(function_codegen_t* func) {
+    return ALIGN_UP(spidir_codegen_blob_get_code_size(func->blob), 16) + 16;
+}
+
+static uint32_t jit_layout_find_chain(function_codegen_t* functions, uint32_t index) {
+    while (functions[index].chain != index) {
+        functions[index].chain = functions[functions[index].chain].chain;
+        index = functions[index].chain;
+    }
+    return index;
+}
+
+/**
+ * The offset of a function from the start of its chain
+ */
+static uint64_t jit_layout_chain_offset(function_codegen_t* functions, uint32_t chain, uint32_t index) {
+    return functions[chain].chain_base + functions[index].chain_offset;
+}
+
+static void jit_layout_reverse_chain(function_codegen_t* functions, uint32_t chain) {
+    uint32_t prev = UINT32_MAX;
+    uint32_t i = functions[chain].chain_head;
+    while (i != UINT32_MAX) {
+        uint32_t next = functions[i].chain_next;
+        functions[i].chain_next = prev;
+        functions[i].chain_offset = functions[chain].chain_size - jit_layout_chain_offset(functions, chain, i)
+                                  - jit_layout_function_size(&functions[i]);
+        prev = i;
+        i = next;
+    }
+
+    functions[chain].chain_base = 0;
+    functions[chain].chain_tail = functions[chain].chain_head;
+    functions[chain].chain_head = prev;
+}
+
+/**
+ * Put the chain `second` right after the chain `first`. Only the functions of
+ * the shorter chain are walked, the longer one keeps its offsets and at most
+ * has its base moved, so every function is walked a logarithmic amount of times
+ */
+static void jit_layout_concat_chains(function_codegen_t* functions, uint32_t first, uint32_t second) {
+    bool first_is_short = functions[first].chain_count < functions[second].chain_count;
+    uint32_t short_chain = first_is_short ? first : second;
+    uint32_t long_chain = first_is_short ? second : first;
+
+    // the second chain moves by the size of the first
+    int64_t shift = first_is_short ? 0 : functions[first].chain_size;
+    if (first_is_short) {
+        functions[long_chain].chain_base += functions[first].chain_size;
+    }
+    for (uint32_t i = functions[short_chain].chain_head; i != UINT32_MAX; i = functions[i].chain_next) {
+        functions[i].chain_offset = jit_layout_chain_offset(functions, short_chain, i) + shift
+                                  - functions[long_chain].chain_base;
+    }
+
+    functions[functions[first].chain_tail].chain_next = functions[second].chain_head;
+    functions[long_chain].chain_head = functions[first].chain_head;
+    functions[long_chain].chain_tail = functions[second].chain_tail;
+    functions[long_chain].chain_count = functions[first].chain_count + functions[second].chain_count;
+    functions[long_chain].chain_size = functions[first].chain_size + functions[second].chain_size;
+    functions[short_chain].chain = long_chain;
+}
+
+/**
+ * Heavier edges first, the indices break ties so the layout is deterministic
+ */
+static bool jit_call_edge_before(const jit_call_edge_t* a, const jit_call_edge_t* b) {
+    if (a->weight != b->weight) {
+        return a->weight > b->weight;
+    }
+    if (a->caller != b->caller) {
+        return a->caller < b->caller;
+    }
+    return a->callee < b->callee;
+}
+
+static void jit_call_edges_sift(jit_call_edge_t* edges, size_t root, size_t count) {
+    for (;;) {
+        size_t child = root * 2 + 1;
+        if (child >= count) {
+            break;
+        }
+
+        if (child + 1 < count && jit_call_edge_before(&edges[child], &edges[child + 1])) {
+            child++;
+        }
+
+        if (!jit_call_edge_before(&edges[root], &edges[child])) {
+            break;
+        }
+
+        jit_call_edge_t tmp = edges[root];
+        edges[root] = edges[child];
+        edges[child] = tmp;
+        root = child;
+    }
+}
+
+/**
+ * Heapsort the edges, there is no qsort to lean on in here
+ */
+static void jit_call_edges_sort(jit_call_edge_t* edges, size_t count) {
+    for (size_t i = count / 2; i-- > 0;) {
+        jit_call_edges_sift(edges, i, count);
+    }
+
+    for (size_t end = count; end-- > 1;) {
+        jit_call_edge_t tmp = edges[0];
+        edges[0] = edges[end];
+        edges[end] = tmp;
+        jit_call_edges_sift(edges, 0, end);
+    }
+}
+
+static wasm_err_t jit_layout_add_calls(codegen_ctx_t* codegen, wasm_jit_config_t* config, uint32_t caller) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    function_codegen_t* functions = codegen->functions.elements;
+    uint64_t caller_weight = jit_layout_function_weight(config, &functions[caller]);
+
+    size_t reloc_count = spidir_codegen_blob_get_reloc_count(functions[caller].blob);
+    const spidir_codegen_reloc_t* relocs = spidir_codegen_blob_get_relocs(functions[caller].blob);
+    for (size_t i = 0; i < reloc_count; i++) {
+        const spidir_codegen_reloc_t* reloc = &relocs[i];
+
+        // only direct calls, an ABS64 is a function address being taken
+        if (reloc->target_kind != SPIDIR_RELOC_TARGET_INTERNAL_FUNCTION || reloc->kind != SPIDIR_RELOC_X64_PC32) {
+            continue;
+        }
+
+        uint64_t callee;
+        CHECK(hmap_lookup(&codegen->func_to_idx, reloc->target.internal.id, &callee));
+        if (callee == caller || !jit_layout_is_hot(&functions[callee])) {
+            continue;
+        }
+
+        // a call can't be taken more often than the less called of the two
+        uint64_t weight = MIN(caller_weight, jit_layout_function_weight(config, &functions[callee]));
+        uint64_t key = ((uint64_t)MIN(caller, (uint32_t)callee) << 32) | MAX(caller, (uint32_t)callee);
+
+        uint64_t index;
+        if (hmap_lookup(&codegen->call_edge_map, key, &index)) {
+            codegen->call_edges.elements[index].weight += weight;
+        } else {
+            RETHROW(hmap_insert(&codegen->call_edge_map, key, codegen->call_edges.length));
+            vec_push(&codegen->call_edges, (jit_call_edge_t){
+                .caller = caller,
+                .callee = callee,
+                .weight = weight,
+            });
+        }
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * Allocate the code and constpool space of the function, the code is aligned
+ * to 16 bytes, which are used for both padding and for adding the ENDBR when
+ * needed
+ */
+static void jit_layout_place(codegen_ctx_t* codegen, function_codegen_t* func) {
+    codegen->code_size = ALIGN_UP(codegen->code_size, 16);
+    codegen->code_size += 16;
+    func->code_offset = codegen->code_size;
+    func->code_size = spidir_codegen_blob_get_code_size(func->blob);
+    codegen->code_size += func->code_size;
+
+    func->constpool_size = spidir_codegen_blob_get_constpool_size(func->blob);
+    if (func->constpool_size != 0) {
+        codegen->rodata_size = ALIGN_UP(codegen->rodata_size, spidir_codegen_blob_get_constpool_align(func->blob));
+        func->constpool_offset = codegen->rodata_size;
+        codegen->rodata_size += func->constpool_size;
+    } else {
+        func->constpool_offset = -1;
+    }
+}
+
+static wasm_err_t jit_codegen_layout(codegen_ctx_t* codegen, wasm_jit_config_t* config) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    function_codegen_t* functions = codegen->functions.elements;
+    uint32_t functions_count = codegen->functions.length;
+
+    // every function starts as a chain of its own
+    for (uint32_t i = 0; i < functions_count; i++) {
+        function_codegen_t* func = &functions[i];
+        func->chain = i;
+        func->chain_next = UINT32_MAX;
+        func->chain_head = i;
+        func->chain_tail = i;
+        func->chain_count = 1;
+        func->chain_size = jit_layout_function_size(func);
+        func->chain_offset = 0;
+        func->chain_base = 0;
+        func->cold = func->funcidx != UINT32_MAX && jit_layout_function_weight(config, func) == 0;
+    }
+
+    // build the call graph of the hot functions
+    for (uint32_t i = 0; i < functions_count; i++) {
+        if (jit_layout_is_hot(&functions[i])) {
+            RETHROW(jit_layout_add_calls(codegen, config, i));
+        }
+    }
+    jit_call_edges_sort(codegen->call_edges.elements, codegen->call_edges.length);
+
+    // and merge the chains, heaviest edge first
+    for (uint32_t i = 0; i < codegen->call_edges.length; i++) {
+        jit_call_edge_t* edge = &codegen->call_edges.elements[i];
+        uint32_t first = jit_layout_find_chain(functions, edge->caller);
+        uint32_t second = jit_layout_find_chain(functions, edge->callee);
+        if (first == second) {
+            continue;
+        }
+
+        // the bytes between the end of the caller and the end of its chain
+        // on either side, and the same for the callee
+        uint64_t caller_before = jit_layout_chain_offset(functions, first, edge->caller);
+        uint64_t caller_after = functions[first].chain_size - caller_before - jit_layout_function_size(&functions[edge->caller]);
+        uint64_t callee_before = jit_layout_chain_offset(functions, second, edge->callee);
+        uint64_t callee_after = functions[second].chain_size - callee_before - jit_layout_function_size(&functions[edge->callee]);
+
+        // pick the concatenation with the least code between the two, reversing
+        // both chains is the same as not reversing either, so there are four,
+        // on a tie the caller goes first and nothing is reversed
+        uint64_t distances[] = {
+            caller_after + callee_before,   // first, second
+            callee_after + caller_before,   // second, first
+            caller_before + callee_before,  // reversed first, second
+            caller_after + callee_after,    // first, reversed second
+        };
+        uint32_t best = 0;
+        for (uint32_t j = 1; j < ARRAY_LENGTH(distances); j++) {
+            if (distances[j] < distances[best]) {
+                best = j;
+            }
+        }
+
+        // reversing one chain is the same as reversing the other one and
+        // swapping them, so only the shorter chain is ever reversed
+        bool first_is_short = functions[first].chain_count < functions[second].chain_count;
+        if (best == 2 || best == 3) {
+            jit_layout_reverse_chain(functions, first_is_short ? first : second);
+        }
+        if (best == 1 || (best == 2 && !first_is_short) || (best == 3 && first_is_short)) {
+            uint32_t tmp = first;
+            first = second;
+            second = tmp;
+        }
+
+        jit_layout_concat_chains(functions, first, second);
+    }
+
+    // The hot chains come first, in the order their heads were emitted,
+    // which keeps the exports and the start function up front
+    for (uint32_t i = 0; i < functions_count; i++) {
+        if (!jit_layout_is_hot(&functions[i])) {
+            continue;
+        }
+
+        uint32_t chain = jit_layout_find_chain(functions, i);
+        if (functions[chain].chain_head != i) {
+            continue;
+        }
+
+        for (uint32_t j = i; j != UINT32_MAX; j = functions[j].chain_next) {
+            jit_layout_place(codegen, &functions[j]);
+        }
+    }
+
+    // then the cold functions and the thunks
+    for (uint32_t i = 0; i < functions_count; i++) {
+        if (functions[i].cold) {
+            jit_layout_place(codegen, &functions[i]);
+        }
+    }
+
+    for (uint32_t i = 0; i < functions_count; i++) {
+        if (functions[i].funcidx == UINT32_MAX) {
+            jit_layout_place(codegen, &functions[i]);
+        }
+    }
+
+cleanup:
+    return err;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // Top level codegen function
 //----------------------------------------------------------------------------------------------------------------------
 
+wasm_err_t jit_codegen_ctx_create(codegen_ctx_t** out_codegen) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    codegen_ctx_t* codegen = CALLOC(codegen_ctx_t, 1);
+    CHECK(codegen != nullptr);
+    *out_codegen = codegen;
+
+cleanup:
+    return err;
+}
+
+void jit_codegen_ctx_destroy(codegen_ctx_t* codegen) {
+    if (codegen == nullptr) {
+        return;
+    }
+
+    // the blobs are already destroyed at the end of every codegen
+    hmap_free(&codegen->global_offsets);
+    hmap_free(&codegen->imports);
+    hmap_free(&codegen->veneers);
+    hmap_free(&codegen->func_to_idx);
+    hmap_free(&codegen->call_edge_map);
+    hmap_free(&codegen->dbg_func_to_funcidx);
+    hmap_free(&codegen->dbg_cfi_to_funcidx);
+    hmap_free(&codegen->dbg_extern_to_funcidx);
+    vec_free(&codegen->debug_relocs);
+    vec_free(&codegen->eh_frame);
+    vec_free(&codegen->queue);
+    vec_free(&codegen->functions);
+    vec_free(&codegen->call_edges);
+    wasm_host_free(codegen);
+}
+
+/**
+ * Clear everything from the previous codegen, keeping the memory of the
+ * maps and vectors around
+ */
+static void jit_codegen_ctx_reset(codegen_ctx_t* codegen, bool capture_debug, bool emit_unwind) {
+    hmap_clear(&codegen->global_offsets);
+    hmap_clear(&codegen->imports);
+    hmap_clear(&codegen->veneers);
+    hmap_clear(&codegen->func_to_idx);
+    hmap_clear(&codegen->call_edge_map);
+    hmap_clear(&codegen->dbg_func_to_funcidx);
+    hmap_clear(&codegen->dbg_cfi_to_funcidx);
+    hmap_clear(&codegen->dbg_extern_to_funcidx);
+    codegen->debug_relocs.length = 0;
+    codegen->queue.length = 0;
+    codegen->functions.length = 0;
+    codegen->call_edges.length = 0;
+    codegen->veneers_offset = 0;
+    codegen->code_size = 0;
+    codegen->rodata_size = 0;
+    codegen->capture_debug = capture_debug;
+    codegen->eh_frame.length = 0;
+    codegen->emit_unwind = emit_unwind;
+}
+
 wasm_err_t jit_codegen(wasm_module_jit_t* jit, jit_context_t* ctx, wasm_jit_config_t* config) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    codegen_ctx_t codegen = {
-        .capture_debug = config->emit_debug_info,
-    };
+    codegen_ctx_t* codegen = ctx->session->codegen;
+    jit_codegen_ctx_reset(codegen, config->emit_debug_info, config->emit_unwind_info);
 
     if (m_spidir_machine == nullptr) {
         wasm_jit_init(config);
@@ -728,15 +1390,16 @@ wasm_err_t jit_codegen(wasm_module_jit_t* jit, jit_context_t* ctx, wasm_jit_conf
 
     // build the spidir -> wasm reverse maps so the linking step can label
     // the captured layout / relocations at the wasm level
-    if (codegen.capture_debug) {
-        RETHROW(jit_codegen_prepare_debug_maps(ctx, &codegen));
+    if (codegen->capture_debug) {
+        RETHROW(jit_codegen_prepare_debug_maps(ctx, codegen));
     }
 
     //
     // jit everything
     //
-    RETHROW(jit_codegen_functions(ctx, &codegen));
-    RETHROW(jit_codegen_tables(ctx, &codegen));
+    RETHROW(jit_codegen_functions(ctx, codegen));
+    RETHROW(jit_codegen_layout(codegen, config));
+    jit_codegen_veneers(codegen);
 
     //
     // now we can allocate the entire space for the code
@@ -744,37 +1407,47 @@ wasm_err_t jit_codegen(wasm_module_jit_t* jit, jit_context_t* ctx, wasm_jit_conf
 
     // remember the exact sizes before the page alignment, the debug ELF
     // wants the real extents rather than the padded ones
-    size_t code_size_orig = codegen.code_size;
-    size_t rodata_size_orig = codegen.rodata_size;
+    size_t code_size_orig = codegen->code_size;
+    size_t rodata_size_orig = codegen->rodata_size;
 
     // align everything to page size
     size_t page_size = wasm_host_page_size();
-    codegen.code_size = ALIGN_UP(codegen.code_size, page_size);
-    codegen.rodata_size = ALIGN_UP(codegen.rodata_size, page_size);
+    codegen->code_size = ALIGN_UP(codegen->code_size, page_size);
+    codegen->rodata_size = ALIGN_UP(codegen->rodata_size, page_size);
 
     // now that we know the sizes allocate the full range
-    jit->rx_page_count = codegen.code_size / page_size;
-    jit->ro_page_count = codegen.rodata_size / page_size;
+    jit->rx_page_count = codegen->code_size / page_size;
+    jit->ro_page_count = codegen->rodata_size / page_size;
     jit->binary = wasm_host_jit_alloc(jit->rx_page_count, jit->ro_page_count);
     CHECK(jit->binary != nullptr);
 
     void* jit_code = jit->binary;
-    void* jit_rodata = jit->binary + codegen.code_size;
+    void* jit_rodata = jit->binary + codegen->code_size;
 
     // initialize the jit as required
-    if (codegen.code_size != 0) memset(jit_code, 0xCC, codegen.code_size);
-    if (codegen.rodata_size != 0) memset(jit_rodata, 0x00, codegen.rodata_size);
+    if (codegen->code_size != 0) memset(jit_code, 0xCC, codegen->code_size);
+    if (codegen->rodata_size != 0) memset(jit_rodata, 0x00, codegen->rodata_size);
 
     // Record the segment bounds and reserve the per-function layout array
     // up front so the linking step can fill it without reallocations. Both
     // are skipped entirely when debug capture is off.
-    if (codegen.capture_debug) {
+    if (codegen->capture_debug) {
         jit->debug.code_base = jit_code;
         jit->debug.code_size = code_size_orig;
         jit->debug.rodata_base = jit_rodata;
         jit->debug.rodata_size = rodata_size_orig;
-        if (codegen.functions.length != 0) {
-            jit->debug.funcs = CALLOC(wasm_jit_func_layout_t, codegen.functions.length);
+
+        // a folded function takes an entry for itself and one for its thunk
+        size_t layouts_count = codegen->functions.length;
+        size_t total_funcs = ctx->module->imports_count + ctx->module->functions_count;
+        for (size_t i = 0; i < total_funcs; i++) {
+            if (ctx->functions[i].folded) {
+                layouts_count += 2;
+            }
+        }
+
+        if (layouts_count != 0) {
+            jit->debug.funcs = CALLOC(wasm_jit_func_layout_t, layouts_count);
             CHECK(jit->debug.funcs != nullptr);
         }
     }
@@ -782,25 +1455,48 @@ wasm_err_t jit_codegen(wasm_module_jit_t* jit, jit_context_t* ctx, wasm_jit_conf
     //
     // finally we can link it
     //
-    RETHROW(jit_codegen_link(jit, ctx, &codegen));
+    if (codegen->emit_unwind) {
+        RETHROW(jit_unwind_begin(&codegen->eh_frame));
+    }
+    RETHROW(jit_codegen_link(jit, ctx, codegen));
+    if (codegen->capture_debug) {
+        jit_codegen_folded_layouts(jit, ctx, codegen);
+    }
+
+    // The veneers are only written while linking, so their FDE comes last.
+    // The .eh_frame is copied out rather than moved so the session keeps
+    // its buffer for the next module.
+    if (codegen->emit_unwind) {
+        if (codegen->veneers.size != 0) {
+            RETHROW(jit_unwind_add_code(&codegen->eh_frame,
+                jit_code + codegen->veneers_offset,
+                codegen->veneers.size * JIT_VENEER_SIZE, 0));
+        }
+        RETHROW(jit_unwind_end(&codegen->eh_frame));
+
+        jit->eh_frame = CALLOC(uint8_t, codegen->eh_frame.length);
+        CHECK(jit->eh_frame != nullptr);
+        memcpy(jit->eh_frame, codegen->eh_frame.elements, codegen->eh_frame.length);
+        jit->eh_frame_size = codegen->eh_frame.length;
+    }
 
     // Hand the captured reloc list off to the JIT result. We move the buffer
     // rather than copy it to keep this hot path allocation-light. When debug
     // capture is off, debug_relocs is empty and this is just a couple of
     // null assignments.
-    if (codegen.capture_debug) {
-        jit->debug.relocs = codegen.debug_relocs.elements;
-        jit->debug.relocs_count = codegen.debug_relocs.length;
-        codegen.debug_relocs.elements = nullptr;
-        codegen.debug_relocs.length = 0;
-        codegen.debug_relocs.capacity = 0;
+    if (codegen->capture_debug) {
+        jit->debug.relocs = codegen->debug_relocs.elements;
+        jit->debug.relocs_count = codegen->debug_relocs.length;
+        codegen->debug_relocs.elements = nullptr;
+        codegen->debug_relocs.length = 0;
+        codegen->debug_relocs.capacity = 0;
     }
 
     //
     // and now fill in all the visible functions with their pointers
     //
-    RETHROW(jit_codegen_fill_functions(jit, ctx, &codegen));
-    RETHROW(jit_codegen_fill_tables(jit, ctx, &codegen));
+    RETHROW(jit_codegen_fill_functions(jit, ctx, codegen));
+    RETHROW(jit_codegen_fill_tables(jit, ctx, codegen));
 
     //
     // and now we can finally lock the entire thing
@@ -808,21 +1504,14 @@ wasm_err_t jit_codegen(wasm_module_jit_t* jit, jit_context_t* ctx, wasm_jit_conf
     CHECK(wasm_host_jit_lock(jit->binary, jit->rx_page_count, jit->ro_page_count));
     
 cleanup:
-    hmap_free(&codegen.global_offsets);
-    hmap_free(&codegen.imports);
-    hmap_free(&codegen.func_to_idx);
-    hmap_free(&codegen.dbg_func_to_funcidx);
-    hmap_free(&codegen.dbg_cfi_to_funcidx);
-    hmap_free(&codegen.dbg_extern_to_funcidx);
-    vec_free(&codegen.debug_relocs);
-    vec_free(&codegen.queue);
-    for (size_t i = 0; i < codegen.functions.length; i++) {
-        spidir_codegen_blob_handle_t blob = codegen.functions.elements[i].blob;
+    // the blobs are only needed until we are linked
+    for (size_t i = 0; i < codegen->functions.length; i++) {
+        spidir_codegen_blob_handle_t blob = codegen->functions.elements[i].blob;
         if (blob != nullptr) {
             spidir_codegen_blob_destroy(blob);
         }
     }
-    vec_free(&codegen.functions);
+    codegen->functions.length = 0;
 
     return err;
 }
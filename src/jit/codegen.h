@@ -1,8 +1,16 @@
 #pragma once
 
 #include "jit/helpers.h"
+#include "jit/jit_internal.h"
 #include "util/vec.h"
 #include "wasm/error.h"
 #include "wasm/jit.h"
 
+wasm_err_t jit_codegen_ctx_create(codegen_ctx_t** out_codegen);
+
+void jit_codegen_ctx_destroy(codegen_ctx_t* codegen);
+
+/**
+ * Codegen and link the module, using the codegen state of the session
+ */
 wasm_err_t jit_codegen(wasm_module_jit_t* jit, jit_context_t* ctx, wasm_jit_config_t* config);
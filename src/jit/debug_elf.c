@@ -502,8 +502,8 @@ wasm_err_t wasm_jit_emit_debug_elf(
 
                 case SPIDIR_RELOC_TARGET_CONSTPOOL:
                 case SPIDIR_RELOC_TARGET_GLOBAL:
-                    // Both live in .rodata (globals are only used for the
-                    // tables right now, which are laid out in rodata).
+                    // Both live in .rodata (the jit doesn't emit any globals
+                    // right now, the tables live in the instance state).
                     if (have_rodata) {
                         sym_index = sym_rodata_section;
                         // The addend should bring the section symbol up to the
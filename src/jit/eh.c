@@ -0,0 +1,156 @@
+#include "eh.h"
+
+#include "jit/cfi.h"
+#include "jit_internal.h"
+#include "spidir/module.h"
+#include "util/defs.h"
+#include "util/except.h"
+#include "util/string.h"
+#include "wasm/error.h"
+#include "wasm/host.h"
+#include "wasm/wasm.h"
+
+//
+// A call that is inside of a try_table goes through the invoke helper, which
+// is the only place that sets up a frame for a throw to jump back into. The
+// helper can't know the signature of the target, so the args are passed through
+// the state and the invoke thunk of the type unpacks them and calls the cfi
+// thunk of the target, storing the first result back in the args area. The
+// pointer to the area of the extra results is passed after the args.
+//
+
+typedef struct jit_invoke_ctx {
+    jit_context_t* ctx;
+    wasm_type_t* type;
+    wasm_err_t err;
+} jit_invoke_ctx_t;
+
+static void jit_build_invoke_thunk(spidir_builder_handle_t builder, void* _ctx) {
+    wasm_err_t err = WASM_NO_ERROR;
+    jit_invoke_ctx_t* build = _ctx;
+    spidir_value_t* params = nullptr;
+    spidir_value_type_t* arg_types = nullptr;
+    jit_context_t* ctx = build->ctx;
+    wasm_type_t* type = build->type;
+
+    spidir_block_t entry = spidir_builder_create_block(builder);
+    spidir_builder_set_entry_block(builder, entry);
+    spidir_builder_set_block(builder, entry);
+
+    // the args area right after the eh state
+    spidir_value_t args_area = spidir_builder_build_ptroff(builder,
+        spidir_builder_build_param_ref(builder, 1),
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, ctx->eh_offset + offsetof(jit_eh_state_t, args)));
+
+    // the target is a cfi thunk, so it takes the type id as well
+    size_t args_count = jit_count_spidir_values(type->arg_types, type->arg_types_count);
+    if (jit_count_extra_results(type) != 0) {
+        args_count++;
+    }
+    params = CALLOC(spidir_value_t, args_count + 3);
+    CHECK(params != nullptr);
+    arg_types = CALLOC(spidir_value_type_t, args_count + 3);
+    CHECK(arg_types != nullptr);
+
+    arg_types[0] = SPIDIR_TYPE_PTR;
+    arg_types[1] = SPIDIR_TYPE_PTR;
+    arg_types[2] = SPIDIR_TYPE_I64;
+    params[0] = spidir_builder_build_param_ref(builder, 0);
+    params[1] = spidir_builder_build_param_ref(builder, 1);
+    params[2] = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, jit_cfi_get_type_id(ctx, type));
+
+    jit_fill_spidir_value_types(type->arg_types, type->arg_types_count, &arg_types[3]);
+    if (jit_count_extra_results(type) != 0) {
+        arg_types[args_count + 2] = SPIDIR_TYPE_PTR;
+    }
+    for (size_t i = 0; i < args_count; i++) {
+        spidir_value_type_t arg_type = jit_lower_value_type(arg_types[i + 3]);
+        arg_types[i + 3] = arg_type;
+        params[i + 3] = spidir_builder_build_load(builder,
+            jit_get_spidir_mem_size(arg_type), arg_type,
+            spidir_builder_build_ptroff(builder, args_area,
+                spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, i * sizeof(uint64_t))));
+    }
+
+    // only the first result is returned directly, the rest are
+    // already in the area of the caller
+    spidir_value_type_t ret_type = SPIDIR_TYPE_NONE;
+    if (type->result_types_count != 0) {
+        ret_type = jit_get_spidir_value_type(type->result_types[0]);
+    }
+
+    spidir_value_t res = spidir_builder_build_callind(builder,
+        ret_type, args_count + 3, arg_types,
+        spidir_builder_build_param_ref(builder, 2), params);
+
+    if (ret_type != SPIDIR_TYPE_NONE) {
+        spidir_builder_build_store(builder, jit_get_spidir_mem_size(ret_type), res, args_area);
+    }
+
+    spidir_builder_build_return(builder, SPIDIR_VALUE_INVALID);
+
+cleanup:
+    wasm_host_free(arg_types);
+    wasm_host_free(params);
+
+    build->err = err;
+}
+
+wasm_err_t jit_create_invoke_thunk(jit_context_t* ctx, uint32_t typeidx) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(typeidx < ctx->module->types_count);
+    CHECK(ctx->eh_offset != -1);
+
+    jit_invoke_t* invoke = &ctx->invokes[typeidx];
+    if (invoke->created) {
+        goto cleanup;
+    }
+
+    char name[64];
+    memcpy(name, "invoke.", 7);
+    int digits = u64toa(typeidx, &name[7]);
+    name[7 + digits] = '\0';
+
+    // (memory base, state base, target)
+    static const spidir_value_type_t args[] = { SPIDIR_TYPE_PTR, SPIDIR_TYPE_PTR, SPIDIR_TYPE_PTR };
+    invoke->created = true;
+    invoke->thunk = spidir_module_create_function(
+        ctx->spidir,
+        name,
+        SPIDIR_TYPE_NONE,
+        ARRAY_LENGTH(args), args
+    );
+
+cleanup:
+    return err;
+}
+
+wasm_err_t jit_build_invoke_thunks(jit_context_t* ctx) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    for (uint32_t typeidx = 0; typeidx < ctx->module->types_count; typeidx++) {
+        jit_invoke_t* invoke = &ctx->invokes[typeidx];
+        if (!invoke->created || invoke->built) {
+            continue;
+        }
+
+        jit_invoke_ctx_t invoke_ctx = {
+            .ctx = ctx,
+            .type = &ctx->module->types[typeidx],
+            .err = WASM_NO_ERROR,
+        };
+        spidir_module_build_function(
+            ctx->spidir,
+            invoke->thunk,
+            jit_build_invoke_thunk,
+            &invoke_ctx
+        );
+        RETHROW(invoke_ctx.err);
+
+        invoke->built = true;
+    }
+
+cleanup:
+    return err;
+}
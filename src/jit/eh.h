@@ -0,0 +1,17 @@
+#pragma once
+
+#include "jit/helpers.h"
+#include "wasm/error.h"
+#include "wasm/wasm.h"
+
+/**
+ * Create the invoke thunk of a function type if it doesn't have one yet, this
+ * can be called while building another function, so the thunk itself is only
+ * built by jit_build_invoke_thunks
+ */
+wasm_err_t jit_create_invoke_thunk(jit_context_t* ctx, uint32_t typeidx);
+
+/**
+ * Build all the invoke thunks that were created since the last call
+ */
+wasm_err_t jit_build_invoke_thunks(jit_context_t* ctx);
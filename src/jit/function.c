@@ -5,6 +5,7 @@
 #include "spidir/module.h"
 #include "util/defs.h"
 #include "util/except.h"
+#include "util/string.h"
 #include "wasm/host.h"
 #include "wasm/wasm.h"
 #include <stdint.h>
@@ -15,6 +16,69 @@ typedef struct jit_build_ctx {
     uint32_t funcidx;
 } jit_build_ctx_t;
 
+/**
+ * FNV-1a over the type and the body of the function, the body includes the
+ * declaration of the locals
+ */
+static uint64_t jit_hash_function_body(typeidx_t typeidx, wasm_code_t* code) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (int i = 0; i < sizeof(typeidx); i++) {
+        hash ^= (typeidx >> (i * 8)) & 0xFF;
+        hash *= 0x100000001b3ull;
+    }
+
+    const uint8_t* data = code->code;
+    for (uint32_t i = 0; i < code->length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+/**
+ * Find a function that was already prepared with the exact same type and body,
+ * compilers emit many of those (template instantiations, trivial accessors) and
+ * there is no need to build and emit each of them. Returns false if there is
+ * none, in which case this function becomes the one the others fold into.
+ *
+ * The type must be the same typeidx and not just the same signature, since the
+ * typeidx is what the cfi thunk checks against, which lets them share it.
+ */
+static wasm_err_t jit_find_identical_function(jit_context_t* ctx, uint32_t funcidx, bool* out_found, uint32_t* out_funcidx) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    size_t imports_count = ctx->module->imports_count;
+    typeidx_t typeidx = ctx->module->functions[funcidx - imports_count];
+    wasm_code_t* code = &ctx->module->code[funcidx - imports_count];
+    uint64_t hash = jit_hash_function_body(typeidx, code);
+
+    *out_found = false;
+
+    uint64_t other;
+    if (!hmap_lookup(&ctx->session->bodies, hash, &other)) {
+        RETHROW(hmap_insert(&ctx->session->bodies, hash, funcidx));
+        goto cleanup;
+    }
+
+    // on a hash collision just compile it on its own
+    wasm_code_t* other_code = &ctx->module->code[other - imports_count];
+    if (
+        ctx->module->functions[other - imports_count] != typeidx ||
+        other_code->length != code->length ||
+        memcmp(other_code->code, code->code, code->length) != 0
+    ) {
+        goto cleanup;
+    }
+
+    *out_found = true;
+    *out_funcidx = other;
+
+cleanup:
+    return err;
+}
+
 wasm_err_t jit_prepare_function(jit_context_t* ctx, uint32_t funcidx) {
     wasm_err_t err = WASM_NO_ERROR;
     spidir_value_type_t* args = nullptr;
@@ -26,28 +90,52 @@ wasm_err_t jit_prepare_function(jit_context_t* ctx, uint32_t funcidx) {
         goto cleanup;
     }
 
+    // share the code of an identical function if there is one, it is already
+    // prepared since it was put in the map when it was prepared
+    if (funcidx >= imports_count) {
+        bool found;
+        uint32_t other;
+        RETHROW(jit_find_identical_function(ctx, funcidx, &found, &other));
+        if (found) {
+            CHECK(ctx->functions[other].inited);
+            ctx->functions[funcidx].spidir = ctx->functions[other].spidir;
+            ctx->functions[funcidx].folded = true;
+            ctx->functions[funcidx].folded_into = other;
+            ctx->functions[funcidx].inited = true;
+            goto cleanup;
+        }
+    }
+
     wasm_type_t* type = wasm_get_func(ctx->module, funcidx);
     CHECK(type != nullptr);
 
-    // the ret type
+    // the ret type, only the first result is returned directly, the
+    // rest are passed through an area on the stack of the caller
     spidir_value_type_t ret_type = SPIDIR_TYPE_NONE;
-    if (type->result_types_count == 1) {
+    if (type->result_types_count != 0) {
         ret_type = jit_get_spidir_value_type(type->result_types[0]);
-    } else {
-        CHECK(type->result_types_count == 0);
     }
 
     // the args, note that we add two hidden parameters which are the
-    // memory base and a combined state base.
-    size_t args_count = type->arg_types_count + 2;
+    // memory base and a combined state base, a v128 is passed as two halves,
+    // and the pointer to the area of the extra results goes after them
+    size_t wasm_args_count = jit_count_spidir_values(type->arg_types, type->arg_types_count);
+    size_t args_count = wasm_args_count + 2;
+    if (jit_count_extra_results(type) != 0) {
+        args_count++;
+    }
     args = CALLOC(spidir_value_type_t, args_count);
-    int ai = 0;
+    CHECK(args != nullptr);
 
-    args[ai++] = SPIDIR_TYPE_PTR; // the memory base
-    args[ai++] = SPIDIR_TYPE_PTR; // the state base (globals + tables)
+    args[0] = SPIDIR_TYPE_PTR; // the memory base
+    args[1] = SPIDIR_TYPE_PTR; // the state base (globals + tables)
 
-    for (int64_t i = 0; i < type->arg_types_count; i++) {
-        args[ai++] = jit_get_spidir_value_type(type->arg_types[i]);
+    jit_fill_spidir_value_types(type->arg_types, type->arg_types_count, &args[2]);
+    for (int64_t i = 2; i < wasm_args_count + 2; i++) {
+        args[i] = jit_lower_value_type(args[i]);
+    }
+    if (args_count != wasm_args_count + 2) {
+        args[args_count - 1] = SPIDIR_TYPE_PTR; // the extra results
     }
 
     // get the debug name if available
@@ -73,6 +161,14 @@ wasm_err_t jit_prepare_function(jit_context_t* ctx, uint32_t funcidx) {
         wasm_import_t* import = &ctx->module->imports[funcidx];
         CHECK(import->kind == WASM_EXTERN_FUNC);
 
+        // the host has no way to fill the area of the extra results
+        CHECK(type->result_types_count <= 1, "Multi-value import `%s.%s` is not supported", import->module_name, import->item_name);
+
+        // and no way to know how we split a v128
+        CHECK(jit_count_spidir_values(type->arg_types, type->arg_types_count) == type->arg_types_count &&
+              jit_count_spidir_values(type->result_types, type->result_types_count) == type->result_types_count,
+              "v128 in import `%s.%s` is not supported", import->module_name, import->item_name);
+
         void* addr = nullptr;
         if (ctx->config->resolve_import != nullptr) {
             addr = ctx->config->resolve_import(
@@ -103,7 +199,7 @@ wasm_err_t jit_prepare_function(jit_context_t* ctx, uint32_t funcidx) {
         ctx->functions[funcidx].spidir = spidir_funcref_make_internal(func);
 
         // only queue internal functions for jitting
-        vec_push(&ctx->queue, funcidx);
+        vec_push(&ctx->session->queue, funcidx);
     }
 
     ctx->functions[funcidx].inited = true;
@@ -121,7 +217,10 @@ static void jit_build_function(spidir_builder_handle_t builder, void* _ctx) {
     jit_build_ctx_t* build = _ctx;
     uint32_t funcidx = build->funcidx;
     jit_context_t* ctx = build->ctx;
-    jit_function_ctx_t func = {};
+    jit_function_ctx_t func = { .funcidx = funcidx, .arena = &ctx->session->arena };
+
+    // nothing from the previous function is still in use
+    arena_reset(func.arena);
 
     // this must be an internal function, verify as such
     uint32_t imports_count = ctx->module->imports_count;
@@ -137,26 +236,45 @@ static void jit_build_function(spidir_builder_handle_t builder, void* _ctx) {
     };
 
     // the main block
-    jit_label_t label = { .result_type = SPIDIR_TYPE_NONE };
-
-    // setup params
-    wasm_value_type_t* arg_types = type->arg_types;
-
-    size_t args_count = type->arg_types_count;
+    jit_label_t label = {};
+
+    // the validation already knows how big everything gets
+    jit_function_info_t* info = &ctx->infos[funcidx];
+    vec_set_cap(&func.labels, info->max_label_depth);
+    vec_set_cap(&func.locals, info->local_slots_count);
+    vec_set_cap(&func.local_slots, info->locals_count);
+    vec_set_cap(&label.stack, info->max_stack_depth);
+
+    // setup params, every wasm local takes a slot in the locals
+    // and a v128 takes another one for its high half
+    size_t args_count = jit_count_spidir_values(type->arg_types, type->arg_types_count);
     jit_value_t* args = vec_add(&func.locals, args_count);
+    for (int i = 0, slot = 0; i < type->arg_types_count; i++) {
+        vec_push(&func.local_slots, slot);
+        slot += jit_count_spidir_values(&type->arg_types[i], 1);
+    }
+
+    spidir_value_type_t* arg_types = ARENA_CALLOC(func.arena, spidir_value_type_t, args_count);
+    CHECK(arg_types != nullptr);
+    jit_fill_spidir_value_types(type->arg_types, type->arg_types_count, arg_types);
     for (int i = 0; i < args_count; i++) {
-        args[i].type = jit_get_spidir_value_type(arg_types[i]);
+        args[i].type = arg_types[i];
         // hidden params 0..1 are mem/state; wasm args follow
         args[i].value = spidir_builder_build_param_ref(builder, i + 2);
     }
+    func.arg_types = arg_types;
+    func.arg_count = args_count;
 
-    // setup ret type
-    CHECK(type->result_types_count <= 1);
-    if (type->result_types_count == 1) {
-        func.ret_type = jit_get_spidir_value_type(type->result_types[0]);
-    } else {
-        func.ret_type = SPIDIR_TYPE_NONE;
-    }
+    // the caller passes the refs of the exnrefs over to us
+    jit_mark_owned(ctx, args, type->arg_types, type->arg_types_count);
+
+    // setup the results, a branch to the main block is a return
+    // so it carries the results as well
+    RETHROW(jit_get_spidir_value_types(&func, type->result_types, type->result_types_count, &func.result_types, &func.result_count));
+    label.result_types = func.result_types;
+    label.result_count = func.result_count;
+    label.branch_types = func.result_types;
+    label.branch_count = func.result_count;
 
     // setup locals
     uint32_t locals_count = BUFFER_PULL_U32(&code);
@@ -166,21 +284,56 @@ static void jit_build_function(spidir_builder_handle_t builder, void* _ctx) {
         wasm_value_type_t type = 0;
         RETHROW(buffer_pull_val_type(&code, &type));
 
-        jit_value_t* locals = vec_add(&func.locals, count);
+        size_t slots = jit_count_spidir_values(&type, 1);
         for (int j = 0; j < count; j++) {
+            vec_push(&func.local_slots, func.locals.length + j * slots);
+        }
+
+        jit_value_t* locals = vec_add(&func.locals, count * slots);
+        for (int j = 0; j < count * slots; j++) {
             locals[j].type = jit_get_spidir_value_type(type);
+            if (slots == 2 && j % 2 == 1) {
+                locals[j].type = JIT_TYPE_V128_HI;
+            }
             switch (locals[j].type) {
                 case SPIDIR_TYPE_F32: locals[j].value = spidir_builder_build_fconst32(builder, 0); break;
                 case SPIDIR_TYPE_F64: locals[j].value = spidir_builder_build_fconst64(builder, 0); break;
-                default:              locals[j].value = spidir_builder_build_iconst(builder, locals[j].type, 0); break;
+                default:              locals[j].value = spidir_builder_build_iconst(builder, jit_lower_value_type(locals[j].type), 0); break;
             }
+
+            // an exnref local holds a ref to its value, which starts as null
+            locals[j].owned = jit_is_owned_type(ctx, type);
         }
     }
 
+    // find the locals that are written in each of the scopes, the
+    // code is passed by value so we still start from the first opcode
+    RETHROW(jit_scan_locals(code, &func));
+
     // setup the entry block
     spidir_block_t block = spidir_builder_create_block(builder);
     spidir_builder_set_entry_block(builder, block);
     spidir_builder_set_block(builder, block);
+
+    // with a tail call to ourselves the body becomes a loop, so the
+    // params are moved into phis at the start of a block of their own
+    if (func.tail_call_self) {
+        func.tail_block = spidir_builder_create_block(builder);
+        spidir_builder_build_branch(builder, func.tail_block);
+        spidir_builder_set_block(builder, func.tail_block);
+
+        func.tail_phis = ARENA_CALLOC(func.arena, spidir_phi_t, args_count);
+        CHECK(func.tail_phis != nullptr);
+        for (int i = 0; i < args_count; i++) {
+            jit_value_t* arg = &func.locals.elements[i];
+            arg->value = spidir_builder_build_phi(builder,
+                jit_lower_value_type(arg->type),
+                1, &arg->value,
+                &func.tail_phis[i]
+            );
+        }
+    }
+
     vec_push(&func.labels, label);
 
     // jit everything
@@ -203,6 +356,9 @@ cleanup:
     }
     vec_free(&func.labels);
     vec_free(&func.locals);
+    vec_free(&func.local_slots);
+    vec_free(&func.scopes);
+    vec_free(&func.scope_locals);
 
     build->err = err;
 }
@@ -7,13 +7,13 @@
 #include <stdatomic.h>
 #include <stdint.h>
 
-static void jit_helper_memory_copy(void* d, const void* s, uint32_t n) {
+static void jit_helper_memory_copy(void* d, const void* s, uint64_t n) {
     if (n != 0) {
         memmove(d, s, n);
     }
 }
 
-static void jit_helper_memory_fill(void* d, uint32_t val, uint32_t n) {
+static void jit_helper_memory_fill(void* d, uint32_t val, uint64_t n) {
     if (n != 0) {
         memset(d, (uint8_t)val, n);
     }
@@ -35,6 +35,93 @@ static void jit_helper_memory_init(void* dst, void* data, uint32_t data_len, uin
     }
 }
 
+static uint32_t jit_helper_table_grow(jit_table_state_t* table, void* init, uint32_t delta, uint32_t max) {
+    // refuse to grow past the max of the table, the check is done
+    // in 64bit so the new length can't wrap around
+    uint32_t old_length = table->length;
+    uint64_t new_length = (uint64_t)old_length + delta;
+    if (new_length > max) {
+        return -1;
+    }
+
+    if (delta != 0) {
+        void** elements = wasm_host_realloc(table->elements, new_length * sizeof(void*));
+        if (elements == nullptr) {
+            return -1;
+        }
+
+        for (uint64_t i = old_length; i < new_length; i++) {
+            elements[i] = init;
+        }
+
+        table->elements = elements;
+        table->length = new_length;
+    }
+
+    return old_length;
+}
+
+static void jit_helper_table_fill(void** slots, void* value, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        slots[i] = value;
+    }
+}
+
+static jit_exception_t* jit_helper_exception_new(uint32_t tag, uint32_t values_count) {
+    jit_exception_t* exception = wasm_host_calloc(1, sizeof(jit_exception_t) + values_count * sizeof(uint64_t));
+    if (exception == nullptr) {
+        __builtin_trap();
+    }
+    exception->tag = tag;
+
+    // the ref of the throw itself
+    exception->refs = 1;
+    return exception;
+}
+
+static void jit_helper_exception_retain(jit_exception_t* exception) {
+    if (exception != nullptr) {
+        exception->refs++;
+    }
+}
+
+static void jit_helper_exception_release(jit_exception_t* exception) {
+    if (exception != nullptr && --exception->refs == 0) {
+        wasm_host_free(exception);
+    }
+}
+
+static void jit_helper_throw(jit_eh_state_t* eh, jit_exception_t* exception) {
+    // nothing is going to catch it, same as a trap
+    if (eh->handler == nullptr) {
+        __builtin_trap();
+    }
+
+    eh->exception = exception;
+    __builtin_longjmp(eh->handler, 1);
+}
+
+typedef void (*jit_invoke_thunk_t)(void* memory, void* state, void* target);
+
+static int32_t jit_helper_invoke(jit_invoke_thunk_t thunk, void* memory, void* state, jit_eh_state_t* eh, void* target) {
+    // the frame the thrower jumps back into, only the calls that are inside of
+    // a try_table go through here so the rest of the calls don't pay for it
+    void* frame[5];
+    jit_eh_state_t* volatile saved_eh = eh;
+    void* volatile saved_handler = eh->handler;
+    eh->handler = frame;
+
+    if (__builtin_setjmp(frame) != 0) {
+        saved_eh->handler = saved_handler;
+        return 1;
+    }
+
+    thunk(memory, state, target);
+
+    saved_eh->handler = saved_handler;
+    return 0;
+}
+
 static float f32_abs(float value) { return __builtin_fabsf(value); }
 static float f32_neg(float value) { return -value; }
 static float f32_ceil(float value) { return __builtin_ceilf(value); }
@@ -141,6 +228,76 @@ static void jit_helper_trap(void) {
     __builtin_trap();
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// SIMD
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef union v128 {
+    uint64_t u64[2];
+    int64_t i64[2];
+    uint32_t u32[4];
+    int32_t i32[4];
+    uint16_t u16[8];
+    int16_t i16[8];
+    uint8_t u8[16];
+    int8_t i8[16];
+    float f32[4];
+    double f64[2];
+} v128_t;
+
+// go over all the lanes of a shape, these are kept as plain loops over
+// the union so the compiler can turn them into vector instructions
+#define LANES(_count) for (int i = 0; i < (_count); i++)
+
+/**
+ * Define the helper of a single simd op, it takes its operands as i64 halves
+ * and writes the vector result to area[0..1]. The unary ops ignore b
+ */
+#define SIMD_HELPER(_name, ...) \
+    static void jit_simd_##_name(uint64_t* area, uint64_t a_lo, uint64_t a_hi, uint64_t b_lo, uint64_t b_hi) { \
+        v128_t a = { .u64 = { a_lo, a_hi } }; \
+        [[maybe_unused]] v128_t b = { .u64 = { b_lo, b_hi } }; \
+        v128_t r = {}; \
+        __VA_ARGS__ \
+        area[0] = r.u64[0]; \
+        area[1] = r.u64[1]; \
+    }
+
+SIMD_HELPER(i8x16_swizzle, LANES(16) { r.u8[i] = b.u8[i] < 16 ? a.u8[b.u8[i]] : 0; })
+
+//
+// f32x4 and f64x2 rounding
+//
+SIMD_HELPER(f32x4_ceil, LANES(4) { r.f32[i] = f32_ceil(a.f32[i]); })
+SIMD_HELPER(f32x4_floor, LANES(4) { r.f32[i] = f32_floor(a.f32[i]); })
+SIMD_HELPER(f32x4_trunc, LANES(4) { r.f32[i] = f32_trunc(a.f32[i]); })
+SIMD_HELPER(f32x4_nearest, LANES(4) { r.f32[i] = f32_nearest(a.f32[i]); })
+SIMD_HELPER(f64x2_ceil, LANES(2) { r.f64[i] = f64_ceil(a.f64[i]); })
+SIMD_HELPER(f64x2_floor, LANES(2) { r.f64[i] = f64_floor(a.f64[i]); })
+SIMD_HELPER(f64x2_trunc, LANES(2) { r.f64[i] = f64_trunc(a.f64[i]); })
+SIMD_HELPER(f64x2_nearest, LANES(2) { r.f64[i] = f64_nearest(a.f64[i]); })
+
+//
+// f32x4 and f64x2, the rest of the arithmetic is done inline
+//
+SIMD_HELPER(f32x4_sqrt, LANES(4) { r.f32[i] = f32_sqrt(a.f32[i]); })
+SIMD_HELPER(f32x4_min, LANES(4) { r.f32[i] = f32_min(a.f32[i], b.f32[i]); })
+SIMD_HELPER(f32x4_max, LANES(4) { r.f32[i] = f32_max(a.f32[i], b.f32[i]); })
+SIMD_HELPER(f64x2_sqrt, LANES(2) { r.f64[i] = f64_sqrt(a.f64[i]); })
+SIMD_HELPER(f64x2_min, LANES(2) { r.f64[i] = f64_min(a.f64[i], b.f64[i]); })
+SIMD_HELPER(f64x2_max, LANES(2) { r.f64[i] = f64_max(a.f64[i], b.f64[i]); })
+
+//
+// Conversions
+//
+SIMD_HELPER(i32x4_trunc_sat_f32x4_s, LANES(4) { r.i32[i] = i32_trunc_sat_f32_s(a.f32[i]); })
+SIMD_HELPER(i32x4_trunc_sat_f32x4_u, LANES(4) { r.u32[i] = i32_trunc_sat_f32_u(a.f32[i]); })
+SIMD_HELPER(i32x4_trunc_sat_f64x2_s_zero, LANES(2) { r.i32[i] = i32_trunc_sat_f64_s(a.f64[i]); })
+SIMD_HELPER(i32x4_trunc_sat_f64x2_u_zero, LANES(2) { r.u32[i] = i32_trunc_sat_f64_u(a.f64[i]); })
+
+#undef SIMD_HELPER
+#undef LANES
+
 //----------------------------------------------------------------------------------------------------------------------
 // The actual helper definitions
 //----------------------------------------------------------------------------------------------------------------------
@@ -163,14 +320,26 @@ typedef struct helper_def {
         .arg_types = HELPER_FUNC_SIG(__VA_ARGS__) \
     }
 
+// every simd helper has the same signature, see SIMD_HELPER
+#define SIMD_HELPER_FUNC(_name) HELPER_FUNC(jit_simd_##_name, NONE, PTR, I64, I64, I64, I64)
+
 static const helper_def_t m_helper_defs[JIT_HELPER_COUNT] = {
-    [JIT_HELPER_MEMORY_SIZE] = HELPER_FUNC(wasm_host_memory_size, I32, PTR, PTR),
-    [JIT_HELPER_MEMORY_GROW] = HELPER_FUNC(wasm_host_memory_grow, I32, PTR, PTR, I32),
+    [JIT_HELPER_MEMORY_SIZE] = HELPER_FUNC(wasm_host_memory_size, I64, PTR, PTR, I32),
+    [JIT_HELPER_MEMORY_GROW] = HELPER_FUNC(wasm_host_memory_grow, I64, PTR, PTR, I32, I64),
     
-    [JIT_HELPER_MEMORY_COPY] = HELPER_FUNC(jit_helper_memory_copy, NONE, PTR, PTR, I32),
-    [JIT_HELPER_MEMORY_FILL] = HELPER_FUNC(jit_helper_memory_fill, NONE, PTR, I32, I32),
+    [JIT_HELPER_MEMORY_COPY] = HELPER_FUNC(jit_helper_memory_copy, NONE, PTR, PTR, I64),
+    [JIT_HELPER_MEMORY_FILL] = HELPER_FUNC(jit_helper_memory_fill, NONE, PTR, I32, I64),
     [JIT_HELPER_MEMORY_INIT] = HELPER_FUNC(jit_helper_memory_init, NONE, PTR, PTR, I32, I32, I32),
 
+    [JIT_HELPER_TABLE_GROW] = HELPER_FUNC(jit_helper_table_grow, I32, PTR, PTR, I32, I32),
+    [JIT_HELPER_TABLE_FILL] = HELPER_FUNC(jit_helper_table_fill, NONE, PTR, PTR, I32),
+
+    [JIT_HELPER_EXCEPTION_NEW] = HELPER_FUNC(jit_helper_exception_new, PTR, I32, I32),
+    [JIT_HELPER_EXCEPTION_RETAIN] = HELPER_FUNC(jit_helper_exception_retain, NONE, PTR),
+    [JIT_HELPER_EXCEPTION_RELEASE] = HELPER_FUNC(jit_helper_exception_release, NONE, PTR),
+    [JIT_HELPER_THROW] = HELPER_FUNC(jit_helper_throw, NONE, PTR, PTR),
+    [JIT_HELPER_INVOKE] = HELPER_FUNC(jit_helper_invoke, I32, PTR, PTR, PTR, PTR, PTR),
+
     [JIT_HELPER_F32_ABS] = HELPER_FUNC(f32_abs, F32, F32),
     [JIT_HELPER_F32_NEG] = HELPER_FUNC(f32_neg, F32, F32),
     [JIT_HELPER_F32_CEIL] = HELPER_FUNC(f32_ceil, F32, F32),
@@ -254,8 +423,33 @@ static const helper_def_t m_helper_defs[JIT_HELPER_COUNT] = {
     [JIT_HELPER_ATOMIC_RMW_CMPXCHG_2] = HELPER_FUNC(atomic_rmw_cmpxchg_2, I32, PTR, I32, I32),
     [JIT_HELPER_ATOMIC_RMW_CMPXCHG_4] = HELPER_FUNC(atomic_rmw_cmpxchg_4, I32, PTR, I32, I32),
     [JIT_HELPER_ATOMIC_RMW_CMPXCHG_8] = HELPER_FUNC(atomic_rmw_cmpxchg_8, I64, PTR, I64, I64),
+
+    [JIT_HELPER_SIMD + 14] = SIMD_HELPER_FUNC(i8x16_swizzle),
+
+    [JIT_HELPER_SIMD + 103] = SIMD_HELPER_FUNC(f32x4_ceil),
+    [JIT_HELPER_SIMD + 104] = SIMD_HELPER_FUNC(f32x4_floor),
+    [JIT_HELPER_SIMD + 105] = SIMD_HELPER_FUNC(f32x4_trunc),
+    [JIT_HELPER_SIMD + 106] = SIMD_HELPER_FUNC(f32x4_nearest),
+    [JIT_HELPER_SIMD + 116] = SIMD_HELPER_FUNC(f64x2_ceil),
+    [JIT_HELPER_SIMD + 117] = SIMD_HELPER_FUNC(f64x2_floor),
+    [JIT_HELPER_SIMD + 122] = SIMD_HELPER_FUNC(f64x2_trunc),
+    [JIT_HELPER_SIMD + 148] = SIMD_HELPER_FUNC(f64x2_nearest),
+
+    [JIT_HELPER_SIMD + 227] = SIMD_HELPER_FUNC(f32x4_sqrt),
+    [JIT_HELPER_SIMD + 232] = SIMD_HELPER_FUNC(f32x4_min),
+    [JIT_HELPER_SIMD + 233] = SIMD_HELPER_FUNC(f32x4_max),
+    [JIT_HELPER_SIMD + 239] = SIMD_HELPER_FUNC(f64x2_sqrt),
+    [JIT_HELPER_SIMD + 244] = SIMD_HELPER_FUNC(f64x2_min),
+    [JIT_HELPER_SIMD + 245] = SIMD_HELPER_FUNC(f64x2_max),
+
+    [JIT_HELPER_SIMD + 248] = SIMD_HELPER_FUNC(i32x4_trunc_sat_f32x4_s),
+    [JIT_HELPER_SIMD + 249] = SIMD_HELPER_FUNC(i32x4_trunc_sat_f32x4_u),
+    [JIT_HELPER_SIMD + 252] = SIMD_HELPER_FUNC(i32x4_trunc_sat_f64x2_s_zero),
+    [JIT_HELPER_SIMD + 253] = SIMD_HELPER_FUNC(i32x4_trunc_sat_f64x2_u_zero),
 };
 
+#undef SIMD_HELPER_FUNC
+
 wasm_err_t jit_get_helper(jit_context_t* ctx, jit_helper_kind_t kind, spidir_funcref_t* out) {
     wasm_err_t err = WASM_NO_ERROR;
     CHECK(kind < JIT_HELPER_COUNT);
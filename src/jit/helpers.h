@@ -5,6 +5,45 @@
 
 typedef struct jit_context jit_context_t;
 
+/**
+ * A table as it is laid out in the state, the length sits right next to
+ * the elements so call_indirect can check and load with a single base
+ */
+typedef struct jit_table_state {
+    void** elements;
+    uint32_t length;
+} jit_table_state_t;
+
+/**
+ * A thrown exception, the values are the params of the tag with every
+ * spidir value taking a slot of 8 bytes
+ */
+typedef struct jit_exception {
+    uint32_t tag;
+
+    // the exnrefs to the exception that wasm holds, on the stack, in locals
+    // or in globals, plus one while it is being thrown. throw_ref passes the
+    // ref of the exnref to the throw and catch_ref passes it back, the
+    // exception is freed when the last one is released
+    uint32_t refs;
+
+    uint64_t values[];
+} jit_exception_t;
+
+/**
+ * The exception handling state of an instance, along with the area the
+ * args of an invoke are passed through
+ */
+typedef struct jit_eh_state {
+    // the innermost invoke that is running, null when nothing can catch
+    void* handler;
+
+    // the exception that is being thrown to the handler
+    jit_exception_t* exception;
+
+    uint64_t args[];
+} jit_eh_state_t;
+
 typedef enum jit_helper_kind {
     JIT_HELPER_MEMORY_SIZE,
     JIT_HELPER_MEMORY_GROW,
@@ -13,6 +52,15 @@ typedef enum jit_helper_kind {
     JIT_HELPER_MEMORY_FILL,
     JIT_HELPER_MEMORY_INIT,
 
+    JIT_HELPER_TABLE_GROW,
+    JIT_HELPER_TABLE_FILL,
+
+    JIT_HELPER_EXCEPTION_NEW,
+    JIT_HELPER_EXCEPTION_RETAIN,
+    JIT_HELPER_EXCEPTION_RELEASE,
+    JIT_HELPER_THROW,
+    JIT_HELPER_INVOKE,
+
     JIT_HELPER_F32_ABS,
     JIT_HELPER_F32_NEG,
     JIT_HELPER_F32_CEIL,
@@ -99,6 +147,11 @@ typedef enum jit_helper_kind {
     JIT_HELPER_ATOMIC_RMW_CMPXCHG_4,
     JIT_HELPER_ATOMIC_RMW_CMPXCHG_8,
 
+    // a helper for every simd op that isn't done inline, indexed by
+    // the simd sub-opcode, the rest of the range is left unset
+    JIT_HELPER_SIMD,
+    JIT_HELPER_SIMD_LAST = JIT_HELPER_SIMD + 255,
+
     JIT_HELPER_COUNT,
 } jit_helper_kind_t;
 
@@ -2,6 +2,7 @@
 
 #include "function.h"
 #include "jit/cfi.h"
+#include "jit/eh.h"
 #include "jit/helpers.h"
 #include "jit/jit_internal.h"
 #include "spidir/module.h"
@@ -31,8 +32,6 @@
     })
 
 void jit_free_label(jit_label_t* label) {
-    wasm_host_free(label->locals_phis);
-    wasm_host_free(label->locals_values);
     vec_free(&label->stack);
 }
 
@@ -54,6 +53,133 @@ cleanup:
     return err;
 }
 
+/**
+ * Get the shared trap block of the function, emitting it the first time. spidir's
+ * builder takes no branch weights or cold hints, so the placement of the block is
+ * up to spidir's own layout, all we can do is not have a copy of it per check
+ */
+static wasm_err_t jit_get_trap_block(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, spidir_block_t* out_block) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    if (!func->has_trap_block) {
+        spidir_block_t current;
+        CHECK(spidir_builder_cur_block(builder, &current));
+
+        func->trap_block = spidir_builder_create_block(builder);
+        spidir_builder_set_block(builder, func->trap_block);
+        RETHROW(jit_emit_trap(builder, ctx));
+        func->has_trap_block = true;
+
+        spidir_builder_set_block(builder, current);
+    }
+
+    *out_block = func->trap_block;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Trap unless the given condition is true, continues building in the block where it is
+ */
+static wasm_err_t jit_emit_trap_unless(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, spidir_value_t cond) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    spidir_block_t trap_block;
+    RETHROW(jit_get_trap_block(builder, ctx, func, &trap_block));
+
+    spidir_block_t ok_block = spidir_builder_create_block(builder);
+    spidir_builder_build_brcond(builder, cond, ok_block, trap_block);
+    spidir_builder_set_block(builder, ok_block);
+
+cleanup:
+    return err;
+}
+
+/**
+ * Take another ref to an exnref, which may be null
+ */
+static wasm_err_t jit_emit_exception_retain(spidir_builder_handle_t builder, jit_context_t* ctx, spidir_value_t exception) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    spidir_funcref_t helper;
+    RETHROW(jit_get_helper(ctx, JIT_HELPER_EXCEPTION_RETAIN, &helper));
+    spidir_builder_build_call(builder, helper, 1, &exception);
+
+cleanup:
+    return err;
+}
+
+/**
+ * Give up a ref to an exnref, which may be null, the exception is freed with
+ * the last one
+ */
+static wasm_err_t jit_emit_exception_release(spidir_builder_handle_t builder, jit_context_t* ctx, spidir_value_t exception) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    spidir_funcref_t helper;
+    RETHROW(jit_get_helper(ctx, JIT_HELPER_EXCEPTION_RELEASE, &helper));
+    spidir_builder_build_call(builder, helper, 1, &exception);
+
+cleanup:
+    return err;
+}
+
+/**
+ * Check if the labels from target inwards hold any exnref, skipping the top
+ * keep values of the innermost label
+ */
+static bool jit_stacks_owned(jit_function_ctx_t* func, jit_label_t* target, uint32_t keep) {
+    jit_label_t* last = &func->labels.elements[func->labels.length - 1];
+    for (jit_label_t* label = target; label <= last; label++) {
+        uint32_t count = label->stack.length - (label == last ? keep : 0);
+        for (uint32_t i = 0; i < count; i++) {
+            if (label->stack.elements[i].owned) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Release the exnrefs that a branch to target discards, which are the values on
+ * the stacks of the labels from target inwards, except for the top keep values
+ * of the innermost label which the branch carries
+ */
+static wasm_err_t jit_emit_release_stacks(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* target, uint32_t keep) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_label_t* last = &func->labels.elements[func->labels.length - 1];
+    for (jit_label_t* label = target; label <= last; label++) {
+        uint32_t count = label->stack.length - (label == last ? keep : 0);
+        for (uint32_t i = 0; i < count; i++) {
+            if (label->stack.elements[i].owned) {
+                RETHROW(jit_emit_exception_release(builder, ctx, label->stack.elements[i].value));
+            }
+        }
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * Release the exnrefs of the locals, the params included, when the frame is left
+ */
+static wasm_err_t jit_emit_release_locals(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    for (uint32_t i = 0; i < func->locals.length; i++) {
+        if (func->locals.elements[i].owned) {
+            RETHROW(jit_emit_exception_release(builder, ctx, func->locals.elements[i].value));
+        }
+    }
+
+cleanup:
+    return err;
+}
+
 static wasm_type_t* wasm_get_func_type(jit_context_t* ctx, uint32_t funcidx) {
     size_t imports_count = ctx->module->imports_count;
     typeidx_t typeidx;
@@ -79,7 +205,9 @@ static spidir_value_t jit_emit_zext64(spidir_builder_handle_t builder, spidir_va
 static wasm_err_t jit_wasm_unreachable(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    RETHROW(jit_emit_trap(builder, ctx));
+    spidir_block_t trap_block;
+    RETHROW(jit_get_trap_block(builder, ctx, func, &trap_block));
+    spidir_builder_build_branch(builder, trap_block);
     label->terminated = true;
 
 cleanup:
@@ -97,7 +225,16 @@ static wasm_err_t jit_wasm_drop(spidir_builder_handle_t builder, buffer_t* code,
     wasm_err_t err = WASM_NO_ERROR;
 
     CHECK(label->stack.length >= 1);
-    vec_pop(&label->stack);
+    jit_value_t value = vec_pop(&label->stack);
+
+    // a v128 takes both halves
+    if (value.type == JIT_TYPE_V128_HI) {
+        JIT_POP(SPIDIR_TYPE_I64);
+    }
+
+    if (value.owned) {
+        RETHROW(jit_emit_exception_release(builder, ctx, value.value));
+    }
 
 cleanup:
     return err;
@@ -107,12 +244,42 @@ static wasm_err_t jit_wasm_select(spidir_builder_handle_t builder, buffer_t* cod
     wasm_err_t err = WASM_NO_ERROR;
 
     spidir_value_t c = JIT_POP(SPIDIR_TYPE_I32);
-    jit_value_t val2 = vec_pop(&label->stack);
-    jit_value_t val1 = vec_pop(&label->stack);
-    CHECK(val1.type == val2.type);
 
-    spidir_value_t value = spidir_builder_build_select(builder, c, val1.value, val2.value);
-    JIT_PUSH(val1.type, value);
+    // a v128 is selected one half at a time
+    int count = (vec_last(&label->stack)).type == JIT_TYPE_V128_HI ? 2 : 1;
+    CHECK(label->stack.length >= count * 2);
+
+    // the result replaces the first value
+    jit_value_t* val2 = &label->stack.elements[label->stack.length - count];
+    jit_value_t* val1 = val2 - count;
+    for (int i = 0; i < count; i++) {
+        CHECK(val1[i].type == val2[i].type);
+        CHECK(val1[i].owned == val2[i].owned);
+
+        // the exnref that is not selected is dropped
+        if (val1[i].owned) {
+            RETHROW(jit_emit_exception_release(builder, ctx,
+                spidir_builder_build_select(builder, c, val2[i].value, val1[i].value)));
+        }
+
+        val1[i].value = spidir_builder_build_select(builder, c, val1[i].value, val2[i].value);
+    }
+    label->stack.length -= count;
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_select_t(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // the operands already carry their types, so the annotation is only checked for its shape
+    uint32_t count = BUFFER_PULL_U32(code);
+    CHECK(count == 1);
+    wasm_value_type_t type;
+    RETHROW(buffer_pull_val_type(code, &type));
+
+    RETHROW(jit_wasm_select(builder, code, ctx, func, label));
 
 cleanup:
     return err;
@@ -123,36 +290,258 @@ cleanup:
 // Control Instructions
 //----------------------------------------------------------------------------------------------------------------------
 
-static wasm_err_t jit_wasm_pull_block_type(buffer_t* code, spidir_value_type_t* out_result_type) {
+wasm_err_t jit_get_spidir_value_types(jit_function_ctx_t* func, const wasm_value_type_t* types, uint32_t count, const spidir_value_type_t** out_types, uint32_t* out_count) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    uint8_t byte = BUFFER_PULL(uint8_t, code);
-    switch (byte) {
-        case 0x40: *out_result_type = SPIDIR_TYPE_NONE; break;
-        case 0x7F: *out_result_type = SPIDIR_TYPE_I32; break;
-        case 0x7E: *out_result_type = SPIDIR_TYPE_I64; break;
-        case 0x7D: *out_result_type = SPIDIR_TYPE_F32; break;
-        case 0x7C: *out_result_type = SPIDIR_TYPE_F64; break;
-        default: CHECK_FAIL("unsupported block type 0x%x", byte);
+    size_t values_count = jit_count_spidir_values(types, count);
+    spidir_value_type_t* spidir_types = nullptr;
+    if (values_count != 0) {
+        spidir_types = ARENA_CALLOC(func->arena, spidir_value_type_t, values_count);
+        CHECK(spidir_types != nullptr);
+        jit_fill_spidir_value_types(types, count, spidir_types);
     }
 
+    *out_types = spidir_types;
+    *out_count = values_count;
+
 cleanup:
     return err;
 }
 
-static wasm_err_t jit_wasm_block(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+typedef struct jit_block_type {
+    const spidir_value_type_t* param_types;
+    uint32_t param_count;
+    const spidir_value_type_t* result_types;
+    uint32_t result_count;
+} jit_block_type_t;
+
+static const spidir_value_type_t m_block_value_types[] = {
+    SPIDIR_TYPE_I32,
+    SPIDIR_TYPE_I64,
+    SPIDIR_TYPE_F32,
+    SPIDIR_TYPE_F64,
+    SPIDIR_TYPE_I64, JIT_TYPE_V128_HI,
+    SPIDIR_TYPE_PTR,
+};
+
+static wasm_err_t jit_wasm_pull_block_type(buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_block_type_t* out_type) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    memset(out_type, 0, sizeof(*out_type));
+
+    // the block type is an s33, the empty type and the value types
+    // are the negative single byte encodings, otherwise its a type index
+    int64_t value = BUFFER_PULL_I64(code);
+    switch (value) {
+        case -0x40: break;
+
+        case -0x01: // i32
+        case -0x02: // i64
+        case -0x03: // f32
+        case -0x04: // f64
+            out_type->result_types = &m_block_value_types[-value - 1];
+            out_type->result_count = 1;
+            break;
+
+        case -0x05: // v128
+            out_type->result_types = &m_block_value_types[4];
+            out_type->result_count = 2;
+            break;
+
+        case -0x10: // funcref
+        case -0x11: // externref
+        case -0x17: // exnref
+            out_type->result_types = &m_block_value_types[6];
+            out_type->result_count = 1;
+            break;
+
+        default: {
+            CHECK(value >= 0 && value < ctx->module->types_count, "unsupported block type %lld", (long long)value);
+            wasm_type_t* type = &ctx->module->types[value];
+            RETHROW(jit_get_spidir_value_types(func, type->arg_types, type->arg_types_count, &out_type->param_types, &out_type->param_count));
+            RETHROW(jit_get_spidir_value_types(func, type->result_types, type->result_types_count, &out_type->result_types, &out_type->result_count));
+        } break;
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * Get the top values of the label's stack, making sure they have the expected types,
+ * the values stay on the stack
+ */
+static wasm_err_t jit_peek_values(jit_label_t* label, const spidir_value_type_t* types, uint32_t count, jit_value_t** out_values) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(label->stack.length >= count);
+    jit_value_t* values = &label->stack.elements[label->stack.length - count];
+    for (int i = 0; i < count; i++) {
+        CHECK(values[i].type == types[i], "Unexpected type (%d != %d)", values[i].type, types[i]);
+    }
+
+    *out_values = values;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Same as peek, but removes the values from the stack, the returned values are
+ * valid until the next push
+ */
+static wasm_err_t jit_pop_values(jit_label_t* label, const spidir_value_type_t* types, uint32_t count, jit_value_t** out_values) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    RETHROW(jit_peek_values(label, types, count, out_values));
+    label->stack.length -= count;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Make the area on our stack a call leaves the results of the type that spidir can't
+ * return in, invalid if it has none. Every call gets one of its own, so nothing else
+ * can write to it before the results are loaded
+ */
+static spidir_value_t jit_emit_results_area(spidir_builder_handle_t builder, wasm_type_t* type) {
+    size_t extra_results = jit_count_extra_results(type);
+    if (extra_results == 0) {
+        return SPIDIR_VALUE_INVALID;
+    }
+    return spidir_builder_build_stackslot(builder, extra_results * sizeof(uint64_t), sizeof(uint64_t));
+}
+
+static spidir_value_t jit_emit_result_slot(spidir_builder_handle_t builder, spidir_value_t area, uint32_t index) {
+    // the first result is returned normally so it has no slot
+    return spidir_builder_build_ptroff(builder, area,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, (index - 1) * sizeof(uint64_t)));
+}
+
+/**
+ * Return from the function, only the first result can be returned by spidir so the
+ * rest are stored in the area the caller passed as the last param.
+ * The exnrefs the frame still holds are released, keep is the count of results that
+ * are still on top of the stack of the current label
+ */
+static wasm_err_t jit_emit_return(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, const jit_value_t* values, uint32_t keep) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    RETHROW(jit_emit_release_stacks(builder, ctx, func, &func->labels.elements[0], keep));
+    RETHROW(jit_emit_release_locals(builder, ctx, func));
+
+    if (func->result_count > 1) {
+        spidir_value_t area = spidir_builder_build_param_ref(builder, func->arg_count + 2);
+        for (int i = 1; i < func->result_count; i++) {
+            spidir_builder_build_store(builder,
+                jit_get_spidir_mem_size(jit_lower_value_type(values[i].type)),
+                values[i].value,
+                jit_emit_result_slot(builder, area, i)
+            );
+        }
+    }
+
+    spidir_value_t value = SPIDIR_VALUE_INVALID;
+    if (func->result_count != 0) {
+        value = values[0].value;
+    }
+    spidir_builder_build_return(builder, value);
+
+cleanup:
+    return err;
+}
+
+/**
+ * Push the results of a call, the first one is the value returned by the call and
+ * the rest are loaded from the results area the call was given
+ */
+static wasm_err_t jit_push_call_results(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label, wasm_type_t* type, spidir_value_t ret_val, spidir_value_t results) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    const spidir_value_type_t* types;
+    uint32_t count;
+    RETHROW(jit_get_spidir_value_types(func, type->result_types, type->result_types_count, &types, &count));
+
+    for (int i = 0; i < count; i++) {
+        spidir_value_t value = ret_val;
+        if (i != 0) {
+            spidir_value_type_t stype = jit_lower_value_type(types[i]);
+            value = spidir_builder_build_load(builder,
+                jit_get_spidir_mem_size(stype), stype,
+                jit_emit_result_slot(builder, results, i)
+            );
+        }
+        JIT_PUSH(types[i], value);
+    }
+
+    // the callee passes the refs of the exnrefs over to us
+    jit_mark_owned(ctx, &label->stack.elements[label->stack.length - count], type->result_types, type->result_types_count);
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_open_scope(jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // scopes are opened in the same order the scan has seen them
+    CHECK(func->next_scope < func->scopes.length);
+    jit_scope_t* scope = &func->scopes.elements[func->next_scope++];
+
+    label->written_count = scope->locals_count;
+    if (scope->locals_count != 0) {
+        label->written_locals = &func->scope_locals.elements[scope->locals_offset];
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * Open a new block label, shared by block and try_table
+ */
+static wasm_err_t jit_open_block(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label, jit_label_t** out_label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    spidir_value_type_t result_type;
-    RETHROW(jit_wasm_pull_block_type(code, &result_type));
+    jit_block_type_t block_type;
+    RETHROW(jit_wasm_pull_block_type(code, ctx, func, &block_type));
+
+    // take the params from the enclosing label, the stack memory is
+    // not moved by adding a label so they stay valid
+    jit_value_t* params;
+    RETHROW(jit_pop_values(label, block_type.param_types, block_type.param_count, &params));
 
     // append a new label
     jit_label_t* new_label = vec_add(&func->labels, 1);
     memset(new_label, 0, sizeof(*new_label));
 
-    // this is the block after this block ends
+    // this is the block after this block ends, a branch
+    // into it carries the results
     new_label->block = spidir_builder_create_block(builder);
-    new_label->result_type = result_type;
+    new_label->result_types = block_type.result_types;
+    new_label->result_count = block_type.result_count;
+    new_label->branch_types = block_type.result_types;
+    new_label->branch_count = block_type.result_count;
+    RETHROW(jit_open_scope(func, new_label));
+
+    // and the params start the stack of the block
+    if (block_type.param_count != 0) {
+        jit_value_t* stack = vec_add(&new_label->stack, block_type.param_count);
+        memcpy(stack, params, block_type.param_count * sizeof(jit_value_t));
+    }
+
+    *out_label = new_label;
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_block(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_label_t* new_label;
+    RETHROW(jit_open_block(builder, code, ctx, func, label, &new_label));
 
 cleanup:
     return err;
@@ -161,8 +550,13 @@ cleanup:
 static wasm_err_t jit_wasm_loop(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    spidir_value_type_t result_type;
-    RETHROW(jit_wasm_pull_block_type(code, &result_type));
+    jit_block_type_t block_type;
+    RETHROW(jit_wasm_pull_block_type(code, ctx, func, &block_type));
+
+    // take the params from the enclosing label, the stack memory is
+    // not moved by adding a label so they stay valid
+    jit_value_t* params;
+    RETHROW(jit_pop_values(label, block_type.param_types, block_type.param_count, &params));
 
     // append a new label
     jit_label_t* new_label = vec_add(&func->labels, 1);
@@ -173,21 +567,26 @@ static wasm_err_t jit_wasm_loop(spidir_builder_handle_t builder, buffer_t* code,
     spidir_builder_build_branch(builder, new_label->block);
     spidir_builder_set_block(builder, new_label->block);
 
-    // this is a loop
+    // this is a loop, a branch into it carries the params
     new_label->loop = true;
-    new_label->result_type = result_type;
-
-    // we need to prepare the locals of the label with phis from the get-go,
-    // because a loop has backwards jumps so we can't know ahead of time
-    // what will change
-
-    new_label->locals_values = CALLOC(spidir_value_t, func->locals.length);
+    new_label->result_types = block_type.result_types;
+    new_label->result_count = block_type.result_count;
+    new_label->branch_types = block_type.param_types;
+    new_label->branch_count = block_type.param_count;
+    RETHROW(jit_open_scope(func, new_label));
+
+    // we need to prepare the written locals of the label with phis from the
+    // get-go, because a loop has backwards jumps so we can't know ahead of
+    // time what will change, locals that are never written in the loop keep
+    // their value from the entry and need no phi
+    new_label->locals_values = ARENA_CALLOC(func->arena, spidir_value_t, new_label->written_count);
     CHECK(new_label->locals_values != nullptr);
-    new_label->locals_phis = CALLOC(spidir_phi_t, func->locals.length);
+    new_label->locals_phis = ARENA_CALLOC(func->arena, spidir_phi_t, new_label->written_count);
     CHECK(new_label->locals_phis != nullptr);
 
-    // we have an existing branch, check if we need any phis
-    for (int i = 0; i < func->locals.length; i++) {
+    for (int i = 0; i < new_label->written_count; i++) {
+        jit_value_t* local = &func->locals.elements[new_label->written_locals[i]];
+
         // we mark as invalid to ensure that in the prepare_branch we will
         // always add to the phi, this is required because the values are
         // set in-stone at the entry point
@@ -195,41 +594,64 @@ static wasm_err_t jit_wasm_loop(spidir_builder_handle_t builder, buffer_t* code,
 
         // create the phi, update the local value directly, we ensure
         // to add it as input obviously
-        func->locals.elements[i].value = spidir_builder_build_phi(builder,
-            func->locals.elements[i].type,
-            1, &func->locals.elements[i].value,
+        local->value = spidir_builder_build_phi(builder,
+            jit_lower_value_type(local->type),
+            1, &local->value,
             &new_label->locals_phis[i]
         );
     }
 
+    // the params get the same treatment as the locals, they start
+    // the stack of the loop as phis
+    new_label->branch_values = ARENA_CALLOC(func->arena, spidir_value_t, block_type.param_count);
+    CHECK(new_label->branch_values != nullptr);
+    new_label->branch_phis = ARENA_CALLOC(func->arena, spidir_phi_t, block_type.param_count);
+    CHECK(new_label->branch_phis != nullptr);
+
+    for (int i = 0; i < block_type.param_count; i++) {
+        new_label->branch_values[i] = SPIDIR_VALUE_INVALID;
+
+        spidir_value_t value = spidir_builder_build_phi(builder,
+            jit_lower_value_type(params[i].type),
+            1, &params[i].value,
+            &new_label->branch_phis[i]
+        );
+        vec_push(&new_label->stack, ((jit_value_t){ .type = params[i].type, .value = value, .owned = params[i].owned }));
+    }
+
 cleanup:
     return err;
 }
 
-static wasm_err_t jit_wasm_prepare_branch(spidir_builder_handle_t builder, jit_function_ctx_t* func, jit_label_t* target, spidir_value_t result_value) {
+static wasm_err_t jit_wasm_prepare_branch(spidir_builder_handle_t builder, jit_function_ctx_t* func, jit_label_t* target, const jit_value_t* values) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // we only need to merge the result if we are in a block and it has a result, loops
-    // return their value on the end, so it is handled in there
-    bool merge_result = target->result_type != SPIDIR_TYPE_NONE && !target->loop;
-
-    if (target->locals_values == nullptr) {
+    if (target->inputs == 0 && !target->loop) {
         // first attempt at going to the label, just copy
         // all the values as-is
-        target->locals_values = CALLOC(spidir_value_t, func->locals.length);
+        target->locals_values = ARENA_CALLOC(func->arena, spidir_value_t, target->written_count);
         CHECK(target->locals_values != nullptr);
-        target->locals_phis = CALLOC(spidir_phi_t, func->locals.length);
+        target->locals_phis = ARENA_CALLOC(func->arena, spidir_phi_t, target->written_count);
         CHECK(target->locals_phis != nullptr);
 
-        for (int i = 0; i < func->locals.length; i++) {
-            target->locals_values[i] = func->locals.elements[i].value;
+        for (int i = 0; i < target->written_count; i++) {
+            target->locals_values[i] = func->locals.elements[target->written_locals[i]].value;
             target->locals_phis[i].id = UINT32_MAX;
         }
 
-        // same treatment for the result
-        if (merge_result) {
-            target->result_value = result_value;
-            target->result_phi.id = UINT32_MAX;
+        // same treatment for the values carried by the branch
+        target->branch_values = ARENA_CALLOC(func->arena, spidir_value_t, target->branch_count);
+        CHECK(target->branch_values != nullptr);
+        target->branch_phis = ARENA_CALLOC(func->arena, spidir_phi_t, target->branch_count);
+        CHECK(target->branch_phis != nullptr);
+
+        target->branch_owned = ARENA_CALLOC(func->arena, bool, target->branch_count);
+        CHECK(target->branch_owned != nullptr);
+
+        for (int i = 0; i < target->branch_count; i++) {
+            target->branch_values[i] = values[i].value;
+            target->branch_phis[i].id = UINT32_MAX;
+            target->branch_owned[i] = values[i].owned;
         }
 
     } else {
@@ -238,10 +660,13 @@ static wasm_err_t jit_wasm_prepare_branch(spidir_builder_handle_t builder, jit_f
         CHECK(spidir_builder_cur_block(builder, &current));
         spidir_builder_set_block(builder, target->block);
 
-        // we have an existing branch, check if we need any phis
-        for (int i = 0; i < func->locals.length; i++) {
+        // we have an existing branch, check if we need any phis, only
+        // the locals written inside the label can be different
+        for (int i = 0; i < target->written_count; i++) {
+            jit_value_t* local = &func->locals.elements[target->written_locals[i]];
+
             // ignore if same value
-            if (func->locals.elements[i].value.id == target->locals_values[i].id) {
+            if (local->value.id == target->locals_values[i].id) {
                 continue;
             }
 
@@ -249,7 +674,7 @@ static wasm_err_t jit_wasm_prepare_branch(spidir_builder_handle_t builder, jit_f
             if (target->locals_phis[i].id == UINT32_MAX) {
                 // we need to create a new phi
                 spidir_value_t value = spidir_builder_build_phi(builder,
-                    func->locals.elements[i].type,
+                    jit_lower_value_type(local->type),
                     0, nullptr,
                     &target->locals_phis[i]
                 );
@@ -264,26 +689,34 @@ static wasm_err_t jit_wasm_prepare_branch(spidir_builder_handle_t builder, jit_f
             }
 
             // add as input
-            spidir_builder_add_phi_input(builder, target->locals_phis[i], func->locals.elements[i].value);
+            spidir_builder_add_phi_input(builder, target->locals_phis[i], local->value);
         }
 
-        // and the result value, lazily creating its phi only once it diverges
-        if (merge_result && result_value.id != target->result_value.id) {
-            if (target->result_phi.id == UINT32_MAX) {
+        // and the carried values, lazily creating their phis only once they diverge
+        for (int i = 0; i < target->branch_count; i++) {
+            if (target->branch_owned != nullptr) {
+                target->branch_owned[i] &= values[i].owned;
+            }
+
+            if (values[i].value.id == target->branch_values[i].id) {
+                continue;
+            }
+
+            if (target->branch_phis[i].id == UINT32_MAX) {
                 spidir_value_t value = spidir_builder_build_phi(builder,
-                    target->result_type, 
-                    0, nullptr, 
-                    &target->result_phi
+                    jit_lower_value_type(target->branch_types[i]),
+                    0, nullptr,
+                    &target->branch_phis[i]
                 );
 
                 for (int j = 0; j < target->inputs; j++) {
-                    spidir_builder_add_phi_input(builder, target->result_phi, target->result_value);
+                    spidir_builder_add_phi_input(builder, target->branch_phis[i], target->branch_values[i]);
                 }
 
-                target->result_value = value;
+                target->branch_values[i] = value;
             }
 
-            spidir_builder_add_phi_input(builder, target->result_phi, result_value);
+            spidir_builder_add_phi_input(builder, target->branch_phis[i], values[i].value);
         }
 
         // switch back
@@ -299,7 +732,7 @@ cleanup:
 
 // The outermost label (index 0) is the function body, whose continuation is
 // the function's return rather than a real block. A branch that targets it is
-// therefore a `return` carrying the function result, not a branch to a block.
+// therefore a `return` carrying the function results, not a branch to a block.
 static inline bool jit_is_funcbody_label(jit_function_ctx_t* func, jit_label_t* target) {
     return target == &func->labels.elements[0];
 }
@@ -312,23 +745,18 @@ static wasm_err_t jit_wasm_br(spidir_builder_handle_t builder, buffer_t* code, j
     CHECK(index < func->labels.length);
     jit_label_t* target = &func->labels.elements[func->labels.length - index - 1];
 
+    // the branch carries the results of a block (or the function), and the
+    // params of a loop, since it re-enters it
+    jit_value_t* values;
+    RETHROW(jit_pop_values(label, target->branch_types, target->branch_count, &values));
+
     if (jit_is_funcbody_label(func, target)) {
-        // branch to the function body == return, carrying the result if any
-        spidir_value_t value = SPIDIR_VALUE_INVALID;
-        if (func->ret_type != SPIDIR_TYPE_NONE) {
-            value = JIT_POP(func->ret_type);
-        }
-        spidir_builder_build_return(builder, value);
+        // branch to the function body == return
+        RETHROW(jit_emit_return(builder, ctx, func, values, 0));
     } else {
-        // a branch to a block with a result carries that result on the stack;
-        // a branch to a loop re-enters it and carries nothing.
-        spidir_value_t result = SPIDIR_VALUE_INVALID;
-        if (target->result_type != SPIDIR_TYPE_NONE && !target->loop) {
-            result = JIT_POP(target->result_type);
-        }
-
         // prepare a branch to the target
-        RETHROW(jit_wasm_prepare_branch(builder, func, target, result));
+        RETHROW(jit_emit_release_stacks(builder, ctx, func, target, 0));
+        RETHROW(jit_wasm_prepare_branch(builder, func, target, values));
 
         // branch into the block
         spidir_builder_build_branch(builder, target->block);
@@ -352,29 +780,30 @@ static wasm_err_t jit_wasm_br_if(spidir_builder_handle_t builder, buffer_t* code
     // get the condition
     spidir_value_t c = JIT_POP(SPIDIR_TYPE_I32);
 
+    // taken carries the values to the target, not-taken keeps them on
+    // the stack for the continuation, so peek (not pop) them. Only one
+    // of them runs, so the refs of the exnrefs go to whichever does
+    jit_value_t* values;
+    RETHROW(jit_peek_values(label, target->branch_types, target->branch_count, &values));
+
     // perform the branch
     spidir_block_t continuation = spidir_builder_create_block(builder);
     if (jit_is_funcbody_label(func, target)) {
-        // taken == return; the result stays on the stack for the not-taken
-        // (fallthrough) path, so peek it rather than pop it.
-        spidir_value_t value = SPIDIR_VALUE_INVALID;
-        if (func->ret_type != SPIDIR_TYPE_NONE) {
-            CHECK(label->stack.length >= 1);
-            value = label->stack.elements[label->stack.length - 1].value;
-        }
+        // taken == return
         spidir_block_t ret_block = spidir_builder_create_block(builder);
         spidir_builder_build_brcond(builder, c, ret_block, continuation);
         spidir_builder_set_block(builder, ret_block);
-        spidir_builder_build_return(builder, value);
+        RETHROW(jit_emit_return(builder, ctx, func, values, target->branch_count));
+    } else if (jit_stacks_owned(func, target, target->branch_count)) {
+        // the exnrefs the branch discards are released before it is taken
+        spidir_block_t taken = spidir_builder_create_block(builder);
+        RETHROW(jit_wasm_prepare_branch(builder, func, target, values));
+        spidir_builder_build_brcond(builder, c, taken, continuation);
+        spidir_builder_set_block(builder, taken);
+        RETHROW(jit_emit_release_stacks(builder, ctx, func, target, target->branch_count));
+        spidir_builder_build_branch(builder, target->block);
     } else {
-        // taken carries the block result; not-taken keeps it on the stack for
-        // the continuation, so peek (not pop) it.
-        spidir_value_t result = SPIDIR_VALUE_INVALID;
-        if (target->result_type != SPIDIR_TYPE_NONE && !target->loop) {
-            CHECK(label->stack.length >= 1);
-            result = label->stack.elements[label->stack.length - 1].value;
-        }
-        RETHROW(jit_wasm_prepare_branch(builder, func, target, result));
+        RETHROW(jit_wasm_prepare_branch(builder, func, target, values));
         spidir_builder_build_brcond(builder, c, target->block, continuation);
     }
 
@@ -387,11 +816,10 @@ cleanup:
 
 static wasm_err_t jit_wasm_br_table(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
-    jit_label_t** table = nullptr;
 
     // get the table
     uint32_t table_size = BUFFER_PULL_U32(code);
-    table = CALLOC(jit_label_t*, table_size);
+    jit_label_t** table = ARENA_CALLOC(func->arena, jit_label_t*, table_size);
     CHECK(table != nullptr);
 
     // read all of the target labels
@@ -410,30 +838,37 @@ static wasm_err_t jit_wasm_br_table(spidir_builder_handle_t builder, buffer_t* c
     spidir_value_t index = JIT_POP(SPIDIR_TYPE_I32);
 
     // every br_table target has the same arity, so the default is representative.
-    // pop the single branch operand (block result / function return) once and
-    // feed it to each target. a loop target carries nothing (re-enters its head).
-    spidir_value_t branch_value = SPIDIR_VALUE_INVALID;
-    if (jit_is_funcbody_label(func, default_label)) {
-        if (func->ret_type != SPIDIR_TYPE_NONE) branch_value = JIT_POP(func->ret_type);
-    } else if (default_label->result_type != SPIDIR_TYPE_NONE && !default_label->loop) {
-        branch_value = JIT_POP(default_label->result_type);
+    // pop the branch operands (block results / loop params / function results)
+    // once and feed them to each target, making sure they fit every target
+    jit_value_t* values;
+    for (int64_t i = 0; i < table_size; i++) {
+        CHECK(table[i]->branch_count == default_label->branch_count);
+        RETHROW(jit_peek_values(label, table[i]->branch_types, table[i]->branch_count, &values));
     }
+    RETHROW(jit_pop_values(label, default_label->branch_types, default_label->branch_count, &values));
 
     // the function-body label has no real continuation block to phi into; a
     // branch to it is a return (handled by RESOLVE_TARGET / the block below).
     for (int64_t i = 0; i < table_size; i++) {
         if (!jit_is_funcbody_label(func, table[i])) {
-            RETHROW(jit_wasm_prepare_branch(builder, func, table[i], table[i]->loop ? SPIDIR_VALUE_INVALID : branch_value));
+            RETHROW(jit_wasm_prepare_branch(builder, func, table[i], values));
         }
     }
     if (!jit_is_funcbody_label(func, default_label)) {
-        RETHROW(jit_wasm_prepare_branch(builder, func, default_label, default_label->loop ? SPIDIR_VALUE_INVALID : branch_value));
+        RETHROW(jit_wasm_prepare_branch(builder, func, default_label, values));
     }
 
     // a branch to the function body is a return; lazily create a single shared
-    // return block and resolve each funcbody-targeting case to it.
+    // return block and resolve each funcbody-targeting case to it. A case whose
+    // target discards exnrefs gets a block that releases them on the way, one per
+    // case so the target still has an incoming edge for every prepared branch
     spidir_block_t ret_block = {0};
     bool have_ret = false;
+    spidir_block_t* release_blocks = ARENA_CALLOC(func->arena, spidir_block_t, table_size + 1);
+    CHECK(release_blocks != nullptr);
+    jit_label_t** release_labels = ARENA_CALLOC(func->arena, jit_label_t*, table_size + 1);
+    CHECK(release_labels != nullptr);
+    uint32_t release_count = 0;
     #define RESOLVE_TARGET(_lbl) ({ \
         spidir_block_t b__; \
         if (jit_is_funcbody_label(func, (_lbl))) { \
@@ -442,6 +877,10 @@ static wasm_err_t jit_wasm_br_table(spidir_builder_handle_t builder, buffer_t* c
                 have_ret = true; \
             } \
             b__ = ret_block; \
+        } else if (jit_stacks_owned(func, (_lbl), 0)) { \
+            b__ = spidir_builder_create_block(builder); \
+            release_blocks[release_count] = b__; \
+            release_labels[release_count++] = (_lbl); \
         } else { \
             b__ = (_lbl)->block; \
         } \
@@ -483,33 +922,37 @@ static wasm_err_t jit_wasm_br_table(spidir_builder_handle_t builder, buffer_t* c
     #undef RESOLVE_TARGET
 
     // emit the shared return block (branch-to-function-body == return). the
-    // return value is the branch operand already popped above.
+    // results are the branch operands already popped above.
     if (have_ret) {
         spidir_builder_set_block(builder, ret_block);
-        spidir_builder_build_return(builder, branch_value);
+        RETHROW(jit_emit_return(builder, ctx, func, values, 0));
+    }
+
+    // and the blocks that release the discarded exnrefs before branching
+    for (uint32_t i = 0; i < release_count; i++) {
+        spidir_builder_set_block(builder, release_blocks[i]);
+        RETHROW(jit_emit_release_stacks(builder, ctx, func, release_labels[i], 0));
+        spidir_builder_build_branch(builder, release_labels[i]->block);
     }
 
     // block is now terminated
     label->terminated = true;
 
 cleanup:
-    wasm_host_free(table);
-
     return err;
 }
 
 static wasm_err_t jit_wasm_return(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // handle return value if any
-    spidir_value_t value = SPIDIR_VALUE_INVALID;
-    if (func->ret_type != SPIDIR_TYPE_NONE) {
-        value = JIT_POP(func->ret_type);
-    }
-    // return is stack-polymorphic: any operands left below the result are
+    // handle the results if any
+    jit_value_t* values;
+    RETHROW(jit_pop_values(label, func->result_types, func->result_count, &values));
+    RETHROW(jit_emit_return(builder, ctx, func, values, 0));
+
+    // return is stack-polymorphic: any operands left below the results are
     // unreachable and simply discarded (spec 4.6.2 return / validation §3).
     label->stack.length = 0;
-    spidir_builder_build_return(builder, value);
 
     // we terminated the label
     label->terminated = true;
@@ -518,13 +961,37 @@ cleanup:
     return err;
 }
 
-static wasm_err_t jit_wasm_call(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+/**
+ * Emit a reference to a function, the reference is the address of its cfi thunk
+ * so it can be called through call_indirect, or null for WASM_REF_NULL
+ */
+static wasm_err_t jit_emit_ref(spidir_builder_handle_t builder, jit_context_t* ctx, uint32_t funcidx, spidir_value_t* out_value) {
     wasm_err_t err = WASM_NO_ERROR;
-    spidir_value_t* params = nullptr;
 
-    // prepare the function for jitting
-    uint32_t funcidx = BUFFER_PULL_U32(code);
+    if (funcidx == WASM_REF_NULL) {
+        *out_value = spidir_builder_build_iconst(builder, SPIDIR_TYPE_PTR, 0);
+        goto cleanup;
+    }
+
+    CHECK(funcidx < ctx->module->imports_count + ctx->module->functions_count);
+    RETHROW(jit_prepare_function(ctx, funcidx));
+    RETHROW(jit_create_cfi_thunk(ctx, funcidx));
+
+    *out_value = spidir_builder_build_funcaddr(builder,
+        spidir_funcref_make_internal(ctx->functions[funcidx].cfi_thunk));
+
+cleanup:
+    return err;
+}
+
+/**
+ * Emit a direct call to the function, popping its args from the stack. Only the
+ * first result is returned, the rest are left in the results area
+ */
+static wasm_err_t jit_emit_call(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label, uint32_t funcidx, spidir_value_t results, spidir_value_t* out_ret) {
+    wasm_err_t err = WASM_NO_ERROR;
 
+    // prepare the function for jitting
     RETHROW(jit_prepare_function(ctx, funcidx));
     jit_function_t* callee = &ctx->functions[funcidx];
 
@@ -532,102 +999,140 @@ static wasm_err_t jit_wasm_call(spidir_builder_handle_t builder, buffer_t* code,
     wasm_type_t* type = wasm_get_func_type(ctx, funcidx);
     CHECK(type != nullptr);
 
+    // pop the args from the stack
+    const spidir_value_type_t* arg_types;
+    uint32_t args_count;
+    RETHROW(jit_get_spidir_value_types(func, type->arg_types, type->arg_types_count, &arg_types, &args_count));
+    jit_value_t* args;
+    RETHROW(jit_pop_values(label, arg_types, args_count, &args));
+
     // first two params are the hidden mem/state bases pass them
     // through unchanged from our own frame so the callee sees the same
-    // module-instance state.
-    size_t params_count = type->arg_types_count + 2;
-    params = CALLOC(spidir_value_t, params_count);
+    // module-instance state, the results area goes last
+    size_t params_count = args_count + 2;
+    if (results.id != SPIDIR_VALUE_INVALID.id) {
+        params_count++;
+    }
+    spidir_value_t* params = ARENA_CALLOC(func->arena, spidir_value_t, params_count);
     CHECK(params != nullptr);
 
     params[0] = spidir_builder_build_param_ref(builder, 0);
     params[1] = spidir_builder_build_param_ref(builder, 1);
-
-    // pop the rest of the args from the stack
-    for (int i = 0; i < type->arg_types_count; i++) {
-        size_t arg_index = type->arg_types_count - i - 1;
-        spidir_value_type_t stype = jit_get_spidir_value_type(type->arg_types[arg_index]);
-        spidir_value_t value = JIT_POP(stype);
-        params[arg_index + 2] = value;
+    for (int i = 0; i < args_count; i++) {
+        params[i + 2] = args[i].value;
+    }
+    if (results.id != SPIDIR_VALUE_INVALID.id) {
+        params[params_count - 1] = results;
     }
 
     // perform the call
-    spidir_value_t ret_val = spidir_builder_build_call(builder, callee->spidir, params_count, params);
+    *out_ret = spidir_builder_build_call(builder, callee->spidir, params_count, params);
 
-    // if we have a return push it into the stack
-    if (type->result_types_count > 0) {
-        CHECK(type->result_types_count == 1);
+cleanup:
+    return err;
+}
 
-        spidir_value_type_t stype = jit_get_spidir_value_type(type->result_types[0]);
-        JIT_PUSH(stype, ret_val);
-    }
+/**
+ * Get the pointer to the state of a table
+ */
+static spidir_value_t jit_emit_table_state(spidir_builder_handle_t builder, jit_context_t* ctx, uint32_t tableidx) {
+    spidir_value_t state_base = spidir_builder_build_param_ref(builder, 1);
+    return spidir_builder_build_ptroff(builder, state_base,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, ctx->tables[tableidx].offset));
+}
 
-cleanup:
-    wasm_host_free(params);
+static spidir_value_t jit_emit_table_length(spidir_builder_handle_t builder, spidir_value_t table_state) {
+    spidir_value_t length_ptr = spidir_builder_build_ptroff(builder, table_state,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, offsetof(jit_table_state_t, length)));
+    return spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_4, SPIDIR_TYPE_I32, length_ptr);
+}
 
-    return err;
+/**
+ * Get the pointer to an element of the table, the index must already be checked
+ */
+static spidir_value_t jit_emit_table_element(spidir_builder_handle_t builder, spidir_value_t table_state, spidir_value_t idx) {
+    spidir_value_t elements = spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_8, SPIDIR_TYPE_PTR, table_state);
+    spidir_value_t idx64 = jit_emit_zext64(builder, idx);
+    spidir_value_t element_offset = spidir_builder_build_imul(builder, idx64,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, sizeof(void*)));
+    return spidir_builder_build_ptroff(builder, elements, element_offset);
 }
 
-static wasm_err_t jit_wasm_call_indirect(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+/**
+ * Get the pointer to an element of the table, trapping if the index is out of bounds
+ */
+static wasm_err_t jit_emit_table_check_element(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, spidir_value_t table_state, spidir_value_t idx, spidir_value_t* out_element) {
     wasm_err_t err = WASM_NO_ERROR;
-    spidir_value_t* params = nullptr;
-    spidir_value_type_t* arg_types = nullptr;
-
-    uint32_t typeidx = BUFFER_PULL_U32(code);
-    uint32_t tableidx = BUFFER_PULL_U32(code);
 
-    CHECK(typeidx < ctx->module->types_count);
-    CHECK(tableidx < ctx->module->tables_count);
-    wasm_type_t* type = &ctx->module->types[typeidx];
-    jit_table_t* table = &ctx->tables[tableidx];
+    spidir_value_t length = jit_emit_table_length(builder, table_state);
+    RETHROW(jit_emit_trap_unless(builder, ctx, func,
+        spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULT, SPIDIR_TYPE_I32, idx, length)));
 
-    // mark as used so we know to include it
-    table->used = true;
+    *out_element = jit_emit_table_element(builder, table_state, idx);
 
-    // pop the table index
-    spidir_value_t idx = JIT_POP(SPIDIR_TYPE_I32);
+cleanup:
+    return err;
+}
 
-    // bounds check: trap on idx >= table->length
-    spidir_value_t in_bounds = spidir_builder_build_icmp(
-        builder,
-        SPIDIR_ICMP_ULT, SPIDIR_TYPE_I32,
-        idx,
-        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, table->length)
-    );
-    spidir_block_t ok_block = spidir_builder_create_block(builder);
-    spidir_block_t trap_block = spidir_builder_create_block(builder);
-    spidir_builder_build_brcond(builder, in_bounds, ok_block, trap_block);
+/**
+ * Pop the table index of an indirect call and load the cfi thunk from the table
+ */
+static wasm_err_t jit_emit_indirect_target(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label, uint32_t tableidx, spidir_value_t* out_target) {
+    wasm_err_t err = WASM_NO_ERROR;
 
-    // out-of-bounds path: emit a real trap call so the optimizer
-    // can't eliminate the incoming branch
-    spidir_builder_set_block(builder, trap_block);
-    RETHROW(jit_emit_trap(builder, ctx));
+    CHECK(tableidx < ctx->module->tables_count);
+    CHECK(ctx->module->tables[tableidx].type == WASM_VALUE_TYPE_FUNCREF);
 
-    // in-bounds path: compute &state_base[table.offset + idx*sizeof(void*)]
-    spidir_builder_set_block(builder, ok_block);
-    spidir_value_t table_ptr = spidir_builder_build_globaladdr(builder, table->global);
+    // pop the table index
+    spidir_value_t idx = JIT_POP(SPIDIR_TYPE_I32);
 
-    spidir_value_t idx64 = jit_emit_zext64(builder, idx);
-    spidir_value_t slot_offset = spidir_builder_build_imul(builder, idx64, 
-        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, sizeof(void*)));
-    spidir_value_t slot_ptr = spidir_builder_build_ptroff(builder, table_ptr, slot_offset);
+    // the length and the elements are next to each other in the state, so
+    // the bounds check and the load of the element only need the one base
+    spidir_value_t table_state = jit_emit_table_state(builder, ctx, tableidx);
+    spidir_value_t slot_ptr;
+    RETHROW(jit_emit_table_check_element(builder, ctx, func, table_state, idx, &slot_ptr));
 
     // load the funcref (a host-pointer-sized value)
-    spidir_value_t target = spidir_builder_build_load(
+    *out_target = spidir_builder_build_load(
         builder,
         SPIDIR_MEM_SIZE_8, SPIDIR_TYPE_PTR,
         slot_ptr
     );
 
-    uint64_t callee_type_id = jit_cfi_get_type_id(ctx, type);
+cleanup:
+    return err;
+}
 
-    // build the params: 
+/**
+ * Emit an indirect call through the table, the table holds the cfi thunks
+ * of the functions so the type is checked by the callee
+ */
+static wasm_err_t jit_emit_call_indirect(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label, wasm_type_t* type, uint32_t tableidx, spidir_value_t results, spidir_value_t* out_ret) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    spidir_value_t target;
+    RETHROW(jit_emit_indirect_target(builder, ctx, func, label, tableidx, &target));
+
+    uint64_t callee_type_id = jit_cfi_get_type_id(ctx, type);
+
+    // build the params: 
     // - hidden mem/state passthrough, 
     // - hidden type id
-    // - wasm args.
-    size_t arg_count = type->arg_types_count + 3;
-    params = CALLOC(spidir_value_t, arg_count);
+    // - wasm args
+    // - the results area, if the type needs one
+    const spidir_value_type_t* wasm_arg_types;
+    uint32_t wasm_args_count;
+    RETHROW(jit_get_spidir_value_types(func, type->arg_types, type->arg_types_count, &wasm_arg_types, &wasm_args_count));
+    jit_value_t* args;
+    RETHROW(jit_pop_values(label, wasm_arg_types, wasm_args_count, &args));
+
+    size_t arg_count = wasm_args_count + 3;
+    if (results.id != SPIDIR_VALUE_INVALID.id) {
+        arg_count++;
+    }
+    spidir_value_t* params = ARENA_CALLOC(func->arena, spidir_value_t, arg_count);
     CHECK(params != nullptr);
-    arg_types = CALLOC(spidir_value_type_t, arg_count);
+    spidir_value_type_t* arg_types = ARENA_CALLOC(func->arena, spidir_value_type_t, arg_count);
     CHECK(arg_types != nullptr);
 
     arg_types[0] = SPIDIR_TYPE_PTR;
@@ -637,33 +1142,500 @@ static wasm_err_t jit_wasm_call_indirect(spidir_builder_handle_t builder, buffer
     params[1] = spidir_builder_build_param_ref(builder, 1);
     params[2] = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, callee_type_id);
 
-    for (int i = 0; i < type->arg_types_count; i++) {
-        size_t ai = type->arg_types_count - i - 1;
-        spidir_value_type_t stype = jit_get_spidir_value_type(type->arg_types[ai]);
-        params[ai + 3] = JIT_POP(stype);
-        arg_types[ai + 3] = stype;
+    for (int i = 0; i < wasm_args_count; i++) {
+        params[i + 3] = args[i].value;
+        arg_types[i + 3] = jit_lower_value_type(args[i].type);
+    }
+    if (results.id != SPIDIR_VALUE_INVALID.id) {
+        params[arg_count - 1] = results;
+        arg_types[arg_count - 1] = SPIDIR_TYPE_PTR;
     }
 
+    // only the first result is returned directly
     spidir_value_type_t ret_type = SPIDIR_TYPE_NONE;
-    if (type->result_types_count == 1) {
+    if (type->result_types_count != 0) {
         ret_type = jit_get_spidir_value_type(type->result_types[0]);
-    } else {
-        CHECK(type->result_types_count == 0);
     }
 
-    spidir_value_t ret = spidir_builder_build_callind(
+    *out_ret = spidir_builder_build_callind(
         builder,
         ret_type, arg_count, arg_types,
         target, params
     );
 
-    if (ret_type != SPIDIR_TYPE_NONE) {
-        JIT_PUSH(ret_type, ret);
+cleanup:
+    return err;
+}
+
+//
+// spidir has no landing pads, so a throw never unwinds through jitted frames on
+// its own. The .eh_frame we register can walk the stack, but it can't be used to
+// resume a frame in the middle of its body either: it doesn't describe the
+// callee-saved registers, and spidir may keep values in them across the call.
+//
+// An exception that is caught by the function that throws it is a plain branch
+// to the catch, and a call that is inside of a try_table goes through the invoke
+// helper, which returns to us when the callee throws so the exception can be
+// dispatched the same way. Code that is not inside of a try_table, and calls to
+// functions that can't throw, don't pay anything for it.
+//
+
+/**
+ * Get the pointer to the exception handling state
+ */
+static spidir_value_t jit_emit_eh_state(spidir_builder_handle_t builder, jit_context_t* ctx) {
+    spidir_value_t state_base = spidir_builder_build_param_ref(builder, 1);
+    return spidir_builder_build_ptroff(builder, state_base,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, ctx->eh_offset));
+}
+
+/**
+ * Get the pointer to a value of an exception, every value takes 8 bytes
+ */
+static spidir_value_t jit_emit_exception_value(spidir_builder_handle_t builder, spidir_value_t exception, uint32_t index) {
+    return spidir_builder_build_ptroff(builder, exception,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, offsetof(jit_exception_t, values) + index * sizeof(uint64_t)));
+}
+
+/**
+ * Check if a direct call may throw, imports are not known
+ */
+static bool jit_call_may_throw(jit_context_t* ctx, uint32_t funcidx) {
+    size_t imports_count = ctx->module->imports_count;
+    if (funcidx < imports_count) {
+        return true;
+    }
+    return ctx->infos[funcidx - imports_count].may_throw;
+}
+
+/**
+ * Check if a call to a function of the type must go through the invoke helper,
+ * which is when we are inside of a try_table so the exceptions of the callee are
+ * caught, or when the frame holds exnrefs that must be released if the callee
+ * throws past us. The args are passed to the callee, so they don't count
+ */
+static bool jit_must_invoke(jit_context_t* ctx, jit_function_ctx_t* func, wasm_type_t* type) {
+    if (ctx->eh_offset == -1) {
+        return false;
+    }
+
+    for (int i = 0; i < func->labels.length; i++) {
+        if (func->labels.elements[i].catch_count != 0) {
+            return true;
+        }
+    }
+
+    for (int i = 0; i < func->locals.length; i++) {
+        if (func->locals.elements[i].owned) {
+            return true;
+        }
+    }
+
+    uint32_t args_count = 0;
+    for (int i = 0; i < type->arg_types_count; i++) {
+        args_count += type->arg_types[i] == WASM_VALUE_TYPE_V128 ? 2 : 1;
+    }
+    return jit_stacks_owned(func, &func->labels.elements[0], args_count);
+}
+
+/**
+ * Dispatch a thrown exception to the catches of the try_tables we are inside of,
+ * from the innermost outwards, an exception that nothing catches is thrown to
+ * whoever invoked us. This terminates the current block
+ */
+static wasm_err_t jit_emit_exception_dispatch(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, spidir_value_t exception) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(ctx->eh_offset != -1);
+
+    // the tag is loaded by the first check, which dominates the rest of them
+    spidir_value_t tag = SPIDIR_VALUE_INVALID;
+
+    for (int64_t i = func->labels.length - 1; i >= 0; i--) {
+        jit_label_t* try_label = &func->labels.elements[i];
+        for (uint32_t j = 0; j < try_label->catch_count; j++) {
+            const jit_catch_t* catch = &try_label->catches[j];
+
+            // the labels of the catches are relative to the try_table
+            CHECK(catch->label < i);
+            jit_label_t* target = &func->labels.elements[i - 1 - catch->label];
+
+            const spidir_value_type_t* types = nullptr;
+            uint32_t types_count = 0;
+            spidir_block_t next_block = {};
+            if (catch->tagidx != UINT32_MAX) {
+                wasm_type_t* type = &ctx->module->types[ctx->module->tags[catch->tagidx]];
+                RETHROW(jit_get_spidir_value_types(func, type->arg_types, type->arg_types_count, &types, &types_count));
+
+                if (tag.id == SPIDIR_VALUE_INVALID.id) {
+                    tag = spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_4, SPIDIR_TYPE_I32,
+                        spidir_builder_build_ptroff(builder, exception,
+                            spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, offsetof(jit_exception_t, tag))));
+                }
+
+                spidir_block_t catch_block = spidir_builder_create_block(builder);
+                next_block = spidir_builder_create_block(builder);
+                spidir_builder_build_brcond(builder,
+                    spidir_builder_build_icmp(builder, SPIDIR_ICMP_EQ, SPIDIR_TYPE_I32, tag,
+                        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, catch->tagidx)),
+                    catch_block, next_block);
+                spidir_builder_set_block(builder, catch_block);
+            }
+
+            // the branch carries the values of the tag, and the exnref
+            // for catch_ref and catch_all_ref
+            uint32_t values_count = types_count + (catch->ref ? 1 : 0);
+            CHECK(values_count == target->branch_count);
+            jit_value_t* values = ARENA_CALLOC(func->arena, jit_value_t, values_count);
+            CHECK(values != nullptr);
+
+            for (uint32_t k = 0; k < types_count; k++) {
+                CHECK(types[k] == target->branch_types[k]);
+                spidir_value_type_t stype = jit_lower_value_type(types[k]);
+                values[k].type = types[k];
+                values[k].value = spidir_builder_build_load(builder,
+                    jit_get_spidir_mem_size(stype), stype,
+                    jit_emit_exception_value(builder, exception, k));
+            }
+
+            if (catch->ref) {
+                // the exnref takes over the ref of the throw
+                CHECK(target->branch_types[types_count] == SPIDIR_TYPE_PTR);
+                values[types_count] = (jit_value_t){ .type = SPIDIR_TYPE_PTR, .value = exception, .owned = true };
+            } else {
+                // the values are already loaded, so the throw is done with it
+                RETHROW(jit_emit_exception_release(builder, ctx, exception));
+            }
+
+            if (jit_is_funcbody_label(func, target)) {
+                RETHROW(jit_emit_return(builder, ctx, func, values, 0));
+            } else {
+                RETHROW(jit_emit_release_stacks(builder, ctx, func, target, 0));
+                RETHROW(jit_wasm_prepare_branch(builder, func, target, values));
+                spidir_builder_build_branch(builder, target->block);
+            }
+
+            // catch_all catches everything, the catches after it are unreachable
+            if (catch->tagidx == UINT32_MAX) {
+                goto cleanup;
+            }
+
+            spidir_builder_set_block(builder, next_block);
+        }
+    }
+
+    // nothing in this function catches it, pass it on to our caller
+    RETHROW(jit_emit_release_stacks(builder, ctx, func, &func->labels.elements[0], 0));
+    RETHROW(jit_emit_release_locals(builder, ctx, func));
+
+    spidir_funcref_t throw_helper;
+    RETHROW(jit_get_helper(ctx, JIT_HELPER_THROW, &throw_helper));
+    spidir_value_t args[] = { jit_emit_eh_state(builder, ctx), exception };
+    spidir_builder_build_call(builder, throw_helper, ARRAY_LENGTH(args), args);
+    spidir_builder_build_unreachable(builder);
+
+cleanup:
+    return err;
+}
+
+/**
+ * Call a cfi thunk through the invoke helper, the args are passed through the args
+ * area of the eh state, and if the callee throws the exception is dispatched to our
+ * catches. Only the first result is returned, like a normal call
+ */
+static wasm_err_t jit_emit_invoke(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label, uint32_t typeidx, spidir_value_t target, spidir_value_t results, spidir_value_t* out_ret) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(typeidx < ctx->module->types_count);
+    wasm_type_t* type = &ctx->module->types[typeidx];
+    RETHROW(jit_create_invoke_thunk(ctx, typeidx));
+
+    // pop the args into the args area
+    const spidir_value_type_t* arg_types;
+    uint32_t args_count;
+    RETHROW(jit_get_spidir_value_types(func, type->arg_types, type->arg_types_count, &arg_types, &args_count));
+    jit_value_t* args;
+    RETHROW(jit_pop_values(label, arg_types, args_count, &args));
+
+    spidir_value_t eh_state = jit_emit_eh_state(builder, ctx);
+    spidir_value_t args_area = spidir_builder_build_ptroff(builder, eh_state,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, offsetof(jit_eh_state_t, args)));
+    for (int i = 0; i < args_count; i++) {
+        spidir_builder_build_store(builder,
+            jit_get_spidir_mem_size(jit_lower_value_type(args[i].type)),
+            args[i].value,
+            spidir_builder_build_ptroff(builder, args_area,
+                spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, i * sizeof(uint64_t))));
+    }
+
+    // the results area goes right after the args
+    if (results.id != SPIDIR_VALUE_INVALID.id) {
+        spidir_builder_build_store(builder, SPIDIR_MEM_SIZE_8, results,
+            spidir_builder_build_ptroff(builder, args_area,
+                spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, args_count * sizeof(uint64_t))));
+    }
+
+    spidir_funcref_t helper;
+    RETHROW(jit_get_helper(ctx, JIT_HELPER_INVOKE, &helper));
+    spidir_value_t params[] = {
+        spidir_builder_build_funcaddr(builder, spidir_funcref_make_internal(ctx->invokes[typeidx].thunk)),
+        spidir_builder_build_param_ref(builder, 0),
+        spidir_builder_build_param_ref(builder, 1),
+        eh_state,
+        target,
+    };
+    spidir_value_t thrown = spidir_builder_build_call(builder, helper, ARRAY_LENGTH(params), params);
+
+    spidir_block_t ok_block = spidir_builder_create_block(builder);
+    spidir_block_t throw_block = spidir_builder_create_block(builder);
+    spidir_builder_build_brcond(builder, thrown, throw_block, ok_block);
+
+    // the callee threw, the exception is waiting for us in the eh state
+    spidir_builder_set_block(builder, throw_block);
+    spidir_value_t exception = spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_8, SPIDIR_TYPE_PTR,
+        spidir_builder_build_ptroff(builder, eh_state,
+            spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, offsetof(jit_eh_state_t, exception))));
+    RETHROW(jit_emit_exception_dispatch(builder, ctx, func, exception));
+
+    // the callee returned, the invoke thunk left the first result in the
+    // args area and the rest are in the results area as usual
+    spidir_builder_set_block(builder, ok_block);
+    *out_ret = SPIDIR_VALUE_INVALID;
+    if (type->result_types_count != 0) {
+        spidir_value_type_t ret_type = jit_get_spidir_value_type(type->result_types[0]);
+        *out_ret = spidir_builder_build_load(builder, jit_get_spidir_mem_size(ret_type), ret_type, args_area);
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_call(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t funcidx = BUFFER_PULL_U32(code);
+
+    spidir_value_t ret_val;
+    wasm_type_t* type = wasm_get_func_type(ctx, funcidx);
+    spidir_value_t results = jit_emit_results_area(builder, type);
+    if (jit_call_may_throw(ctx, funcidx) && jit_must_invoke(ctx, func, type)) {
+        // the callee is invoked through its cfi thunk
+        spidir_value_t target;
+        RETHROW(jit_emit_ref(builder, ctx, funcidx, &target));
+        RETHROW(jit_emit_invoke(builder, ctx, func, label, type - ctx->module->types, target, results, &ret_val));
+    } else {
+        RETHROW(jit_emit_call(builder, ctx, func, label, funcidx, results, &ret_val));
+    }
+
+    // push the results into the stack
+    RETHROW(jit_push_call_results(builder, ctx, func, label, type, ret_val, results));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_call_indirect(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t typeidx = BUFFER_PULL_U32(code);
+    uint32_t tableidx = BUFFER_PULL_U32(code);
+
+    CHECK(typeidx < ctx->module->types_count);
+    wasm_type_t* type = &ctx->module->types[typeidx];
+
+    // only needs the invoke helper when a function of the type may throw
+    spidir_value_t ret;
+    spidir_value_t results = jit_emit_results_area(builder, type);
+    if (ctx->invokes[typeidx].may_throw && jit_must_invoke(ctx, func, type)) {
+        spidir_value_t target;
+        RETHROW(jit_emit_indirect_target(builder, ctx, func, label, tableidx, &target));
+        RETHROW(jit_emit_invoke(builder, ctx, func, label, typeidx, target, results, &ret));
+    } else {
+        RETHROW(jit_emit_call_indirect(builder, ctx, func, label, type, tableidx, results, &ret));
+    }
+
+    RETHROW(jit_push_call_results(builder, ctx, func, label, type, ret, results));
+
+cleanup:
+    return err;
+}
+
+/**
+ * A tail call must return exactly what we return
+ */
+static wasm_err_t jit_check_tail_call_type(jit_function_ctx_t* func, wasm_type_t* type) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    const spidir_value_type_t* types;
+    uint32_t count;
+    RETHROW(jit_get_spidir_value_types(func, type->result_types, type->result_types_count, &types, &count));
+
+    CHECK(count == func->result_count);
+    for (int i = 0; i < count; i++) {
+        CHECK(types[i] == func->result_types[i]);
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_return_call(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t funcidx = BUFFER_PULL_U32(code);
+
+    wasm_type_t* type = wasm_get_func_type(ctx, funcidx);
+    CHECK(type != nullptr);
+    RETHROW(jit_check_tail_call_type(func, type));
+
+    // spidir has no tail calls, so only a tail call to ourselves can be a
+    // jump. A call followed by a return would grow the stack on every tail
+    // call, which breaks the guarantee the program relies on, so the
+    // validator already rejected anything else
+    CHECK(funcidx == func->funcidx);
+
+    // a tail call to ourselves is a jump back to the start of the
+    // function, with the args as the new values of the params
+    jit_value_t* args;
+    RETHROW(jit_pop_values(label, func->arg_types, func->arg_count, &args));
+
+    // the frame is left as with a return, the args pass their refs to the params
+    RETHROW(jit_emit_release_stacks(builder, ctx, func, &func->labels.elements[0], 0));
+    RETHROW(jit_emit_release_locals(builder, ctx, func));
+
+    for (int i = 0; i < func->arg_count; i++) {
+        spidir_builder_add_phi_input(builder, func->tail_phis[i], args[i].value);
+    }
+    spidir_builder_build_branch(builder, func->tail_block);
+
+    label->stack.length = 0;
+    label->terminated = true;
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_return_call_indirect(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t typeidx = BUFFER_PULL_U32(code);
+    uint32_t tableidx = BUFFER_PULL_U32(code);
+
+    CHECK(typeidx < ctx->module->types_count);
+    CHECK(tableidx < ctx->module->tables_count);
+
+    // the target is only known at runtime, so this can never be the jump
+    // of a tail call to ourselves, the validator already rejected it, see
+    // jit_wasm_return_call
+    CHECK_FAIL();
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_try_table(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // the labels of the catches don't count the try_table itself
+    uint32_t labels_count = func->labels.length;
+
+    jit_label_t* new_label;
+    RETHROW(jit_open_block(builder, code, ctx, func, label, &new_label));
+
+    uint32_t catch_count = BUFFER_PULL_U32(code);
+    jit_catch_t* catches = ARENA_CALLOC(func->arena, jit_catch_t, catch_count);
+    CHECK(catches != nullptr);
+
+    for (uint32_t i = 0; i < catch_count; i++) {
+        uint8_t kind = BUFFER_PULL(uint8_t, code);
+        CHECK(kind <= 3, "unknown catch kind %d", kind);
+
+        // catch and catch_ref have a tag, catch_all and catch_all_ref don't
+        catches[i].tagidx = UINT32_MAX;
+        if (kind < 2) {
+            catches[i].tagidx = BUFFER_PULL_U32(code);
+            CHECK(catches[i].tagidx < ctx->module->tags_count);
+        }
+
+        catches[i].label = BUFFER_PULL_U32(code);
+        CHECK(catches[i].label < labels_count);
+
+        catches[i].ref = kind == 1 || kind == 3;
+    }
+
+    new_label->catches = catches;
+    new_label->catch_count = catch_count;
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_throw(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t tagidx = BUFFER_PULL_U32(code);
+    CHECK(tagidx < ctx->module->tags_count);
+    wasm_type_t* type = &ctx->module->types[ctx->module->tags[tagidx]];
+
+    const spidir_value_type_t* types;
+    uint32_t count;
+    RETHROW(jit_get_spidir_value_types(func, type->arg_types, type->arg_types_count, &types, &count));
+    jit_value_t* values;
+    RETHROW(jit_pop_values(label, types, count, &values));
+
+    // allocate the exception and move the values into it
+    spidir_funcref_t helper;
+    RETHROW(jit_get_helper(ctx, JIT_HELPER_EXCEPTION_NEW, &helper));
+    spidir_value_t params[] = {
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, tagidx),
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, count),
+    };
+    spidir_value_t exception = spidir_builder_build_call(builder, helper, ARRAY_LENGTH(params), params);
+
+    for (int i = 0; i < count; i++) {
+        spidir_builder_build_store(builder,
+            jit_get_spidir_mem_size(jit_lower_value_type(values[i].type)),
+            values[i].value,
+            jit_emit_exception_value(builder, exception, i));
+    }
+
+    RETHROW(jit_emit_exception_dispatch(builder, ctx, func, exception));
+
+    // throw is stack-polymorphic, same as br
+    label->stack.length = 0;
+    label->terminated = true;
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_throw_ref(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(label->stack.length >= 1);
+    jit_value_t value = vec_pop(&label->stack);
+    CHECK(value.type == SPIDIR_TYPE_PTR, "Unexpected type (%d != %d)", value.type, SPIDIR_TYPE_PTR);
+    spidir_value_t exception = value.value;
+
+    if (ctx->eh_offset == -1) {
+        // without tags nothing can be thrown, so the exnref can only be null
+        RETHROW(jit_emit_trap(builder, ctx));
+    } else {
+        // throwing a null exnref traps
+        RETHROW(jit_emit_trap_unless(builder, ctx, func,
+            spidir_builder_build_icmp(builder, SPIDIR_ICMP_NE, SPIDIR_TYPE_I32, exception,
+                spidir_builder_build_iconst(builder, SPIDIR_TYPE_PTR, 0))));
+
+        // the throw takes over the ref of the exnref
+        CHECK(value.owned);
+
+        RETHROW(jit_emit_exception_dispatch(builder, ctx, func, exception));
     }
 
+    label->stack.length = 0;
+    label->terminated = true;
+
 cleanup:
-    wasm_host_free(params);
-    wasm_host_free(arg_types);
     return err;
 }
 
@@ -671,14 +1643,44 @@ cleanup:
 // Variable Instructions
 //----------------------------------------------------------------------------------------------------------------------
 
+/**
+ * Get the slots of a wasm local, a v128 local has two of them
+ */
+static wasm_err_t jit_get_local_slots(jit_function_ctx_t* func, uint32_t index, uint32_t* out_slot, uint32_t* out_count) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(index < func->local_slots.length);
+    uint32_t slot = func->local_slots.elements[index];
+
+    uint32_t count = 1;
+    if (slot + 1 < func->locals.length && func->locals.elements[slot + 1].type == JIT_TYPE_V128_HI) {
+        count = 2;
+    }
+
+    *out_slot = slot;
+    *out_count = count;
+
+cleanup:
+    return err;
+}
+
 static wasm_err_t jit_wasm_local_get(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
     uint32_t index = BUFFER_PULL_U32(code);
-    CHECK(index < func->locals.length);
-    spidir_value_t value = func->locals.elements[index].value;
-    CHECK(value.id != SPIDIR_VALUE_INVALID.id);
-    JIT_PUSH(func->locals.elements[index].type, value);
+    uint32_t slot, count;
+    RETHROW(jit_get_local_slots(func, index, &slot, &count));
+
+    for (int i = 0; i < count; i++) {
+        jit_value_t* local = &func->locals.elements[slot + i];
+        CHECK(local->value.id != SPIDIR_VALUE_INVALID.id);
+
+        // the local keeps its ref, the copy takes another one
+        if (local->owned) {
+            RETHROW(jit_emit_exception_retain(builder, ctx, local->value));
+        }
+        vec_push(&label->stack, *local);
+    }
 
 cleanup:
     return err;
@@ -688,8 +1690,19 @@ static wasm_err_t jit_wasm_local_set(spidir_builder_handle_t builder, buffer_t*
     wasm_err_t err = WASM_NO_ERROR;
 
     uint32_t index = BUFFER_PULL_U32(code);
-    CHECK(index < func->locals.length);
-    func->locals.elements[index].value = JIT_POP(func->locals.elements[index].type);
+    uint32_t slot, count;
+    RETHROW(jit_get_local_slots(func, index, &slot, &count));
+
+    for (int i = count - 1; i >= 0; i--) {
+        jit_value_t* local = &func->locals.elements[slot + i];
+        spidir_value_t value = JIT_POP(local->type);
+
+        // the ref moves over from the stack, and the one of the old value goes away
+        if (local->owned) {
+            RETHROW(jit_emit_exception_release(builder, ctx, local->value));
+        }
+        local->value = value;
+    }
 
 cleanup:
     return err;
@@ -699,11 +1712,23 @@ static wasm_err_t jit_wasm_local_tee(spidir_builder_handle_t builder, buffer_t*
     wasm_err_t err = WASM_NO_ERROR;
 
     uint32_t index = BUFFER_PULL_U32(code);
-    CHECK(index < func->locals.length);
-    spidir_value_type_t value_type = func->locals.elements[index].type;
-    spidir_value_t value = JIT_POP(value_type);
-    func->locals.elements[index].value = value;
-    JIT_PUSH(value_type, value);
+    uint32_t slot, count;
+    RETHROW(jit_get_local_slots(func, index, &slot, &count));
+
+    // the values stay on the stack
+    CHECK(label->stack.length >= count);
+    jit_value_t* values = &label->stack.elements[label->stack.length - count];
+    for (int i = 0; i < count; i++) {
+        jit_value_t* local = &func->locals.elements[slot + i];
+        CHECK(values[i].type == local->type, "Unexpected type (%d != %d)", values[i].type, local->type);
+
+        // both the stack and the local hold the value now
+        if (local->owned) {
+            RETHROW(jit_emit_exception_retain(builder, ctx, values[i].value));
+            RETHROW(jit_emit_exception_release(builder, ctx, local->value));
+        }
+        local->value = values[i].value;
+    }
 
 cleanup:
     return err;
@@ -724,6 +1749,7 @@ static wasm_err_t jit_wasm_global_get(spidir_builder_handle_t builder, buffer_t*
             case SPIDIR_TYPE_I64: value = spidir_builder_build_iconst(builder, value_type, (uint64_t)ctx->module->globals[index].value.value.i64); break;
             case SPIDIR_TYPE_F32: value = spidir_builder_build_fconst32(builder, ctx->module->globals[index].value.value.f32); break;
             case SPIDIR_TYPE_F64: value = spidir_builder_build_fconst64(builder, ctx->module->globals[index].value.value.f64); break;
+            case SPIDIR_TYPE_PTR: RETHROW(jit_emit_ref(builder, ctx, ctx->module->globals[index].value.value.ref, &value)); break;
             default: CHECK_FAIL();
         }
 
@@ -742,8 +1768,12 @@ static wasm_err_t jit_wasm_global_get(spidir_builder_handle_t builder, buffer_t*
         );
     }
 
-    // and push
-    JIT_PUSH(value_type, value);
+    // and push, an immutable exnref can only be null
+    bool owned = jit_is_owned_type(ctx, ctx->module->globals[index].value.kind);
+    if (owned && ctx->globals[index].offset != -1) {
+        RETHROW(jit_emit_exception_retain(builder, ctx, value));
+    }
+    vec_push(&label->stack, ((jit_value_t){ .type = value_type, .value = value, .owned = owned }));
 
 cleanup:
     return err;
@@ -766,6 +1796,14 @@ static wasm_err_t jit_wasm_global_set(spidir_builder_handle_t builder, buffer_t*
     // read it
     spidir_value_type_t value_type = ctx->globals[index].type;
     spidir_value_t value = JIT_POP(value_type);
+
+    // the ref moves over from the stack, and the one of the old value goes away
+    spidir_value_t old = SPIDIR_VALUE_INVALID;
+    bool owned = jit_is_owned_type(ctx, ctx->module->globals[index].value.kind);
+    if (owned) {
+        old = spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_8, SPIDIR_TYPE_PTR, globals_base);
+    }
+
     spidir_builder_build_store(
         builder,
         jit_get_spidir_mem_size(value_type),
@@ -773,6 +1811,10 @@ static wasm_err_t jit_wasm_global_set(spidir_builder_handle_t builder, buffer_t*
         globals_base
     );
 
+    if (owned) {
+        RETHROW(jit_emit_exception_release(builder, ctx, old));
+    }
+
 cleanup:
     return err;
 }
@@ -786,9 +1828,31 @@ typedef struct wasm_mem_arg {
     uint32_t index;
     uint32_t align;
     uint64_t offset;
+
+    // the memory the index refers to
+    wasm_memory_t* memory;
 } wasm_mem_arg_t;
 
-static wasm_err_t jit_pull_memarg(buffer_t* buffer, wasm_mem_arg_t* arg) {
+/**
+ * Pull a memory index and resolve the memory it refers to
+ */
+static wasm_err_t jit_pull_memidx(buffer_t* buffer, jit_context_t* ctx, uint32_t* out_memidx, wasm_memory_t** out_memory) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t memidx = BUFFER_PULL_U32(buffer);
+    CHECK(memidx < ctx->module->memories_count);
+
+    *out_memidx = memidx;
+    *out_memory = &ctx->module->memories[memidx];
+
+cleanup:
+    return err;
+}
+
+/**
+ * Parse a memarg without resolving its memory, for when it is only skipped
+ */
+static wasm_err_t jit_parse_memarg(buffer_t* buffer, wasm_mem_arg_t* arg) {
     wasm_err_t err = WASM_NO_ERROR;
 
     arg->align = BUFFER_PULL_U32(buffer);
@@ -812,38 +1876,122 @@ cleanup:
     return err;
 }
 
-static wasm_err_t jit_wasm_calculate_addr(spidir_builder_handle_t builder, wasm_mem_arg_t* mem_arg, spidir_value_t offset, spidir_value_t* abs_addr) {
+static wasm_err_t jit_pull_memarg(buffer_t* buffer, jit_context_t* ctx, wasm_mem_arg_t* arg) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // extend the offset to 64bit
-    offset = jit_emit_zext64(builder, offset);
-
-    // if we have an offset add it
-    if (mem_arg->offset != 0) {
-        // because we ensure the offset is at most 32bit, the addition will be 33bit, the runtime
-        // ensures an 8GB region per memory instance, so it will always trap no matter what value 
-        // it gets in here
-        CHECK(mem_arg->offset <= UINT32_MAX);
-        offset = spidir_builder_build_iadd(builder, offset,
-            spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, mem_arg->offset));
-    }
+    RETHROW(jit_parse_memarg(buffer, arg));
 
-    // load the value
-    spidir_value_t mem_base = spidir_builder_build_param_ref(builder, 0);
-    *abs_addr = spidir_builder_build_ptroff(builder, mem_base, offset);
+    // resolve the memory
+    CHECK(arg->index < ctx->module->memories_count);
+    arg->memory = &ctx->module->memories[arg->index];
 
 cleanup:
     return err;
 }
 
-static wasm_err_t jit_wasm_load(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
-    wasm_err_t err = WASM_NO_ERROR;
+/**
+ * The type of the addresses into the memory, a 64bit memory takes i64 addresses
+ */
+static spidir_value_type_t jit_get_address_type(wasm_memory_t* memory) {
+    return memory->is64 ? SPIDIR_TYPE_I64 : SPIDIR_TYPE_I32;
+}
 
-    uint8_t opcode = ((uint8_t*)code->data)[-1];
+/**
+ * Extend an address into the memory to 64bit
+ */
+static spidir_value_t jit_emit_address64(spidir_builder_handle_t builder, wasm_memory_t* memory, spidir_value_t addr) {
+    return memory->is64 ? addr : jit_emit_zext64(builder, addr);
+}
 
-    // get the memory argument
-    wasm_mem_arg_t mem_arg = {};
-    RETHROW(jit_pull_memarg(code, &mem_arg));
+/**
+ * Get the base of a memory, memory 0 is passed in a param so the common case doesn't
+ * need a load, the base of any other memory is kept in the state
+ */
+static spidir_value_t jit_emit_memory_base(spidir_builder_handle_t builder, jit_context_t* ctx, uint32_t memidx) {
+    if (memidx == 0) {
+        return spidir_builder_build_param_ref(builder, 0);
+    }
+
+    spidir_value_t state_base = spidir_builder_build_param_ref(builder, 1);
+    spidir_value_t slot = spidir_builder_build_ptroff(builder, state_base,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, ctx->memories_offset + (memidx - 1) * sizeof(void*)));
+    return spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_8, SPIDIR_TYPE_PTR, slot);
+}
+
+/**
+ * Ensure that [start, start + length) is within the max size of a 64bit memory, so
+ * the bulk memory helpers can't be pointed outside of the memory reservation
+ */
+static wasm_err_t jit_emit_range_check64(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, wasm_memory_t* memory, spidir_value_t start, spidir_value_t length) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // length <= max && start <= max - length
+    spidir_value_t max = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, memory->max);
+    RETHROW(jit_emit_trap_unless(builder, ctx, func,
+        spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULE, SPIDIR_TYPE_I32, length, max)));
+    RETHROW(jit_emit_trap_unless(builder, ctx, func,
+        spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULE, SPIDIR_TYPE_I32, start,
+            spidir_builder_build_isub(builder, max, length))));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_calculate_addr(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, wasm_mem_arg_t* mem_arg, spidir_value_t offset, spidir_value_t* abs_addr) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    if (!mem_arg->memory->is64) {
+        // extend the offset to 64bit
+        offset = jit_emit_zext64(builder, offset);
+
+        // because we ensure the offset is at most 32bit, the addition will be 33bit, the runtime
+        // ensures an 8GB region per memory instance, so it will always trap no matter what value
+        // it gets in here
+        CHECK(mem_arg->offset <= UINT32_MAX);
+    } else {
+        // a 64bit address can't be covered by a guard region, so it is checked against the max
+        // size of the memory, which is a constant. the runtime reserves the max with an 8GB guard
+        // after it, so a 32bit offset and the access itself still land in the reservation, and
+        // anything past the current size is not mapped so it traps like the 32bit case. a larger
+        // offset is folded into the check. mem_walk64 against mem_walk32 in tests/bench.py is
+        // what this check costs over the guard region alone
+        uint64_t max = mem_arg->memory->max;
+        spidir_value_t in_bounds;
+        if (mem_arg->offset <= UINT32_MAX) {
+            in_bounds = spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULE, SPIDIR_TYPE_I32, offset,
+                spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, max));
+        } else if (mem_arg->offset <= max) {
+            in_bounds = spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULE, SPIDIR_TYPE_I32, offset,
+                spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, max - mem_arg->offset));
+        } else {
+            // can never be in bounds
+            in_bounds = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, 0);
+        }
+        RETHROW(jit_emit_trap_unless(builder, ctx, func, in_bounds));
+    }
+
+    // if we have an offset add it
+    if (mem_arg->offset != 0) {
+        offset = spidir_builder_build_iadd(builder, offset,
+            spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, mem_arg->offset));
+    }
+
+    // load the value
+    spidir_value_t mem_base = jit_emit_memory_base(builder, ctx, mem_arg->index);
+    *abs_addr = spidir_builder_build_ptroff(builder, mem_base, offset);
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_load(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint8_t opcode = ((uint8_t*)code->data)[-1];
+
+    // get the memory argument
+    wasm_mem_arg_t mem_arg = {};
+    RETHROW(jit_pull_memarg(code, ctx, &mem_arg));
 
     // figure the exact parameters for the load
     spidir_value_type_t type;
@@ -869,11 +2017,11 @@ static wasm_err_t jit_wasm_load(spidir_builder_handle_t builder, buffer_t* code,
     }
 
     // get the value and offset, the value type depends on the instruction
-    spidir_value_t offset = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t offset = JIT_POP(jit_get_address_type(mem_arg.memory));
 
     // calculate the address
     spidir_value_t addr = SPIDIR_VALUE_INVALID;
-    RETHROW(jit_wasm_calculate_addr(builder, &mem_arg, offset, &addr));
+    RETHROW(jit_wasm_calculate_addr(builder, ctx, func, &mem_arg, offset, &addr));
 
     spidir_value_t value = spidir_builder_build_load(
         builder,
@@ -910,7 +2058,7 @@ static wasm_err_t jit_wasm_store(spidir_builder_handle_t builder, buffer_t* code
 
     // get the memory argument
     wasm_mem_arg_t mem_arg = {};
-    RETHROW(jit_pull_memarg(code, &mem_arg));
+    RETHROW(jit_pull_memarg(code, ctx, &mem_arg));
 
     // figure the parameters for the store
     spidir_value_type_t type;
@@ -930,11 +2078,11 @@ static wasm_err_t jit_wasm_store(spidir_builder_handle_t builder, buffer_t* code
 
     // get the value and offset, the value type depends on the instruction
     spidir_value_t value = JIT_POP(type);
-    spidir_value_t offset = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t offset = JIT_POP(jit_get_address_type(mem_arg.memory));
 
     // calculate the address
     spidir_value_t addr = SPIDIR_VALUE_INVALID;
-    RETHROW(jit_wasm_calculate_addr(builder, &mem_arg, offset, &addr));
+    RETHROW(jit_wasm_calculate_addr(builder, ctx, func, &mem_arg, offset, &addr));
 
     spidir_builder_build_store(
         builder,
@@ -950,18 +2098,24 @@ cleanup:
 static wasm_err_t jit_wasm_memory_size(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // for now we don't have multi-memory support, so it is required to be at zero
-    CHECK(BUFFER_PULL(uint8_t, code) == 0);
+    uint32_t memidx;
+    wasm_memory_t* memory;
+    RETHROW(jit_pull_memidx(code, ctx, &memidx, &memory));
 
     spidir_funcref_t helper;
     RETHROW(jit_get_helper(ctx, JIT_HELPER_MEMORY_SIZE, &helper));
 
-    spidir_value_t mem_base = spidir_builder_build_param_ref(builder, 0);
+    spidir_value_t mem_base = jit_emit_memory_base(builder, ctx, memidx);
     spidir_value_t state_base = spidir_builder_build_param_ref(builder, 1);
 
-    spidir_value_t args[] = { mem_base, state_base };
+    spidir_value_t args[] = { mem_base, state_base, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, memidx) };
     spidir_value_t result = spidir_builder_build_call(builder, helper, ARRAY_LENGTH(args), args);
-    JIT_PUSH(SPIDIR_TYPE_I32, result);
+
+    // the host returns the size as an i64, truncate for a 32bit memory
+    if (!memory->is64) {
+        result = spidir_builder_build_itrunc(builder, result);
+    }
+    JIT_PUSH(jit_get_address_type(memory), result);
 
 cleanup:
     return err;
@@ -970,20 +2124,31 @@ cleanup:
 static wasm_err_t jit_wasm_memory_grow(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // for now we don't have multi-memory support, so it is required to be at zero
-    CHECK(BUFFER_PULL(uint8_t, code) == 0);
+    uint32_t memidx;
+    wasm_memory_t* memory;
+    RETHROW(jit_pull_memidx(code, ctx, &memidx, &memory));
 
-    spidir_value_t n = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t n = JIT_POP(jit_get_address_type(memory));
 
     spidir_funcref_t helper;
     RETHROW(jit_get_helper(ctx, JIT_HELPER_MEMORY_GROW, &helper));
 
-    spidir_value_t mem_base = spidir_builder_build_param_ref(builder, 0);
+    spidir_value_t mem_base = jit_emit_memory_base(builder, ctx, memidx);
     spidir_value_t state_base = spidir_builder_build_param_ref(builder, 1);
 
-    spidir_value_t args[] = { mem_base, state_base, n };
+    // the host takes the delta as an i64, for a 32bit memory it is
+    // unsigned and the -1 on failure truncates back to a 32bit -1
+    spidir_value_t args[] = {
+        mem_base,
+        state_base,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, memidx),
+        jit_emit_address64(builder, memory, n)
+    };
     spidir_value_t result = spidir_builder_build_call(builder, helper, ARRAY_LENGTH(args), args);
-    JIT_PUSH(SPIDIR_TYPE_I32, result);
+    if (!memory->is64) {
+        result = spidir_builder_build_itrunc(builder, result);
+    }
+    JIT_PUSH(jit_get_address_type(memory), result);
 
 cleanup:
     return err;
@@ -992,16 +2157,23 @@ cleanup:
 static wasm_err_t jit_wasm_memory_init(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // for now we don't have multi-memory support, so it is required to be at zero
     uint32_t dataidx = BUFFER_PULL_U32(code);
-    CHECK(BUFFER_PULL(uint8_t, code) == 0);
+    uint32_t memidx;
+    wasm_memory_t* memory;
+    RETHROW(jit_pull_memidx(code, ctx, &memidx, &memory));
 
     CHECK(dataidx < ctx->module->data_count);
     CHECK(ctx->data[dataidx].offset != -1);
 
     spidir_value_t n = JIT_POP(SPIDIR_TYPE_I32);
     spidir_value_t src_offset = JIT_POP(SPIDIR_TYPE_I32);
-    spidir_value_t dst = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t dst = JIT_POP(jit_get_address_type(memory));
+
+    // the destination of a 64bit memory is not covered by the guard region
+    dst = jit_emit_address64(builder, memory, dst);
+    if (memory->is64) {
+        RETHROW(jit_emit_range_check64(builder, ctx, func, memory, dst, jit_emit_zext64(builder, n)));
+    }
 
     // load the data pointer from the state
     spidir_value_t state_base = spidir_builder_build_param_ref(builder, 1);
@@ -1015,10 +2187,10 @@ static wasm_err_t jit_wasm_memory_init(spidir_builder_handle_t builder, buffer_t
     // we are going to let the helper do the rest of the copy. data_len is
     // a JIT-time constant from the module — the helper uses it for the
     // (offset + length) bounds check so it can trap before reading data.
-    spidir_value_t mem_base = spidir_builder_build_param_ref(builder, 0);
+    spidir_value_t mem_base = jit_emit_memory_base(builder, ctx, memidx);
     spidir_value_t data_len = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, ctx->module->data[dataidx].len);
     spidir_value_t args[] = {
-        spidir_builder_build_ptroff(builder, mem_base, jit_emit_zext64(builder, dst)),
+        spidir_builder_build_ptroff(builder, mem_base, dst),
         data_ptr,
         data_len,
         src_offset,
@@ -1033,7 +2205,6 @@ cleanup:
 static wasm_err_t jit_wasm_data_drop(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // for now we don't have multi-memory support, so it is required to be at zero
     uint32_t dataidx = BUFFER_PULL_U32(code);
 
     CHECK(dataidx < ctx->module->data_count);
@@ -1055,21 +2226,33 @@ cleanup:
 static wasm_err_t jit_wasm_memory_copy(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // for now we don't have multi-memory support, so it is required to be at zero
-    CHECK(BUFFER_PULL(uint8_t, code) == 0);
-    CHECK(BUFFER_PULL(uint8_t, code) == 0);
+    uint32_t dst_memidx, src_memidx;
+    wasm_memory_t* dst_memory;
+    wasm_memory_t* src_memory;
+    RETHROW(jit_pull_memidx(code, ctx, &dst_memidx, &dst_memory));
+    RETHROW(jit_pull_memidx(code, ctx, &src_memidx, &src_memory));
 
-    spidir_value_t n = JIT_POP(SPIDIR_TYPE_I32);
-    spidir_value_t src = JIT_POP(SPIDIR_TYPE_I32);
-    spidir_value_t dst = JIT_POP(SPIDIR_TYPE_I32);
+    // the length is only an i64 when both of the memories are 64bit
+    wasm_memory_t* len_memory = dst_memory->is64 ? src_memory : dst_memory;
+
+    spidir_value_t n = jit_emit_address64(builder, len_memory, JIT_POP(jit_get_address_type(len_memory)));
+    spidir_value_t src = jit_emit_address64(builder, src_memory, JIT_POP(jit_get_address_type(src_memory)));
+    spidir_value_t dst = jit_emit_address64(builder, dst_memory, JIT_POP(jit_get_address_type(dst_memory)));
+
+    // a 32bit range always ends within the 8GB reservation, a 64bit one must be checked
+    if (src_memory->is64) {
+        RETHROW(jit_emit_range_check64(builder, ctx, func, src_memory, src, n));
+    }
+    if (dst_memory->is64) {
+        RETHROW(jit_emit_range_check64(builder, ctx, func, dst_memory, dst, n));
+    }
 
     spidir_funcref_t helper;
     RETHROW(jit_get_helper(ctx, JIT_HELPER_MEMORY_COPY, &helper));
 
-    spidir_value_t mem_base = spidir_builder_build_param_ref(builder, 0);
     spidir_value_t args[] = { 
-        spidir_builder_build_ptroff(builder, mem_base, jit_emit_zext64(builder, dst)), 
-        spidir_builder_build_ptroff(builder, mem_base, jit_emit_zext64(builder, src)), 
+        spidir_builder_build_ptroff(builder, jit_emit_memory_base(builder, ctx, dst_memidx), dst), 
+        spidir_builder_build_ptroff(builder, jit_emit_memory_base(builder, ctx, src_memidx), src), 
         n
     };
     spidir_builder_build_call(builder, helper, ARRAY_LENGTH(args), args);
@@ -1081,19 +2264,25 @@ cleanup:
 static wasm_err_t jit_wasm_memory_fill(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // for now we don't have multi-memory support, so it is required to be at zero
-    CHECK(BUFFER_PULL(uint8_t, code) == 0);
+    uint32_t memidx;
+    wasm_memory_t* memory;
+    RETHROW(jit_pull_memidx(code, ctx, &memidx, &memory));
 
-    spidir_value_t n   = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t n   = jit_emit_address64(builder, memory, JIT_POP(jit_get_address_type(memory)));
     spidir_value_t val = JIT_POP(SPIDIR_TYPE_I32);
-    spidir_value_t dst = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t dst = jit_emit_address64(builder, memory, JIT_POP(jit_get_address_type(memory)));
+
+    // a 32bit range always ends within the 8GB reservation, a 64bit one must be checked
+    if (memory->is64) {
+        RETHROW(jit_emit_range_check64(builder, ctx, func, memory, dst, n));
+    }
 
     spidir_funcref_t helper;
     RETHROW(jit_get_helper(ctx, JIT_HELPER_MEMORY_FILL, &helper));
 
-    spidir_value_t mem_base = spidir_builder_build_param_ref(builder, 0);
+    spidir_value_t mem_base = jit_emit_memory_base(builder, ctx, memidx);
     spidir_value_t args[] = { 
-        spidir_builder_build_ptroff(builder, mem_base, jit_emit_zext64(builder, dst)), 
+        spidir_builder_build_ptroff(builder, mem_base, dst), 
         val, 
         n 
     };
@@ -1103,6 +2292,287 @@ cleanup:
     return err;
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// Reference Instructions
+//----------------------------------------------------------------------------------------------------------------------
+
+static wasm_err_t jit_wasm_ref_null(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_value_type_t type;
+    RETHROW(buffer_pull_val_type(code, &type));
+    CHECK(type == WASM_VALUE_TYPE_FUNCREF || type == WASM_VALUE_TYPE_EXTERNREF || type == WASM_VALUE_TYPE_EXNREF);
+
+    // a null exnref is owned like any other, releasing it does nothing
+    spidir_value_t value;
+    RETHROW(jit_emit_ref(builder, ctx, WASM_REF_NULL, &value));
+    vec_push(&label->stack, ((jit_value_t){ .type = SPIDIR_TYPE_PTR, .value = value, .owned = jit_is_owned_type(ctx, type) }));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_ref_is_null(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(label->stack.length >= 1);
+    jit_value_t ref = vec_pop(&label->stack);
+    CHECK(ref.type == SPIDIR_TYPE_PTR, "Unexpected type (%d != %d)", ref.type, SPIDIR_TYPE_PTR);
+
+    spidir_value_t is_null = spidir_builder_build_icmp(builder,
+        SPIDIR_ICMP_EQ, SPIDIR_TYPE_I32,
+        ref.value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_PTR, 0));
+    if (ref.owned) {
+        RETHROW(jit_emit_exception_release(builder, ctx, ref.value));
+    }
+    JIT_PUSH(SPIDIR_TYPE_I32, is_null);
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_ref_func(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t funcidx = BUFFER_PULL_U32(code);
+    CHECK(funcidx != WASM_REF_NULL);
+
+    spidir_value_t value;
+    RETHROW(jit_emit_ref(builder, ctx, funcidx, &value));
+    JIT_PUSH(SPIDIR_TYPE_PTR, value);
+
+cleanup:
+    return err;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Table Instructions
+//----------------------------------------------------------------------------------------------------------------------
+
+static wasm_err_t jit_pull_tableidx(buffer_t* buffer, jit_context_t* ctx, uint32_t* out_tableidx) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t tableidx = BUFFER_PULL_U32(buffer);
+    CHECK(tableidx < ctx->module->tables_count);
+    *out_tableidx = tableidx;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Trap unless [start, start + n) is within the table, done in 64bit so it can't wrap
+ */
+static wasm_err_t jit_emit_table_range_check(spidir_builder_handle_t builder, jit_context_t* ctx, jit_function_ctx_t* func, spidir_value_t table_state, spidir_value_t start, spidir_value_t n) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    spidir_value_t end = spidir_builder_build_iadd(builder, jit_emit_zext64(builder, start), jit_emit_zext64(builder, n));
+    spidir_value_t length = jit_emit_zext64(builder, jit_emit_table_length(builder, table_state));
+    RETHROW(jit_emit_trap_unless(builder, ctx, func,
+        spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULE, SPIDIR_TYPE_I32, end, length)));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_table_get(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t tableidx;
+    RETHROW(jit_pull_tableidx(code, ctx, &tableidx));
+
+    spidir_value_t idx = JIT_POP(SPIDIR_TYPE_I32);
+
+    spidir_value_t table_state = jit_emit_table_state(builder, ctx, tableidx);
+    spidir_value_t element;
+    RETHROW(jit_emit_table_check_element(builder, ctx, func, table_state, idx, &element));
+
+    JIT_PUSH(SPIDIR_TYPE_PTR, spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_8, SPIDIR_TYPE_PTR, element));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_table_set(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t tableidx;
+    RETHROW(jit_pull_tableidx(code, ctx, &tableidx));
+
+    spidir_value_t value = JIT_POP(SPIDIR_TYPE_PTR);
+    spidir_value_t idx = JIT_POP(SPIDIR_TYPE_I32);
+
+    spidir_value_t table_state = jit_emit_table_state(builder, ctx, tableidx);
+    spidir_value_t element;
+    RETHROW(jit_emit_table_check_element(builder, ctx, func, table_state, idx, &element));
+
+    spidir_builder_build_store(builder, SPIDIR_MEM_SIZE_8, value, element);
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_table_copy(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t dst_tableidx, src_tableidx;
+    RETHROW(jit_pull_tableidx(code, ctx, &dst_tableidx));
+    RETHROW(jit_pull_tableidx(code, ctx, &src_tableidx));
+    CHECK(ctx->module->tables[dst_tableidx].type == ctx->module->tables[src_tableidx].type);
+
+    spidir_value_t n = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t src = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t dst = JIT_POP(SPIDIR_TYPE_I32);
+
+    // both ranges are checked before anything is copied
+    spidir_value_t dst_state = jit_emit_table_state(builder, ctx, dst_tableidx);
+    spidir_value_t src_state = jit_emit_table_state(builder, ctx, src_tableidx);
+    RETHROW(jit_emit_table_range_check(builder, ctx, func, dst_state, dst, n));
+    RETHROW(jit_emit_table_range_check(builder, ctx, func, src_state, src, n));
+
+    // the elements are plain pointers, so this is just a memmove
+    spidir_funcref_t helper;
+    RETHROW(jit_get_helper(ctx, JIT_HELPER_MEMORY_COPY, &helper));
+
+    spidir_value_t args[] = {
+        jit_emit_table_element(builder, dst_state, dst),
+        jit_emit_table_element(builder, src_state, src),
+        spidir_builder_build_imul(builder, jit_emit_zext64(builder, n),
+            spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, sizeof(void*))),
+    };
+    spidir_builder_build_call(builder, helper, ARRAY_LENGTH(args), args);
+
+cleanup:
+    return err;
+}
+
+/**
+ * Get the pointer to the state of an elem segment, which is laid out like a table
+ */
+static spidir_value_t jit_emit_elem_state(spidir_builder_handle_t builder, jit_context_t* ctx, uint32_t elemidx) {
+    spidir_value_t state_base = spidir_builder_build_param_ref(builder, 1);
+    return spidir_builder_build_ptroff(builder, state_base,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, ctx->elems[elemidx].offset));
+}
+
+static wasm_err_t jit_wasm_table_init(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t elemidx = BUFFER_PULL_U32(code);
+    CHECK(elemidx < ctx->module->elems_count);
+    uint32_t tableidx;
+    RETHROW(jit_pull_tableidx(code, ctx, &tableidx));
+    CHECK(ctx->module->tables[tableidx].type == WASM_VALUE_TYPE_FUNCREF);
+
+    spidir_value_t n = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t src = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t dst = JIT_POP(SPIDIR_TYPE_I32);
+
+    // a dropped segment has no elements left, so only an empty init at 0 passes
+    spidir_value_t table_state = jit_emit_table_state(builder, ctx, tableidx);
+    spidir_value_t elem_state = jit_emit_elem_state(builder, ctx, elemidx);
+    RETHROW(jit_emit_table_range_check(builder, ctx, func, table_state, dst, n));
+    RETHROW(jit_emit_table_range_check(builder, ctx, func, elem_state, src, n));
+
+    // the segment already holds the cfi thunks, same as the table
+    spidir_funcref_t helper;
+    RETHROW(jit_get_helper(ctx, JIT_HELPER_MEMORY_COPY, &helper));
+
+    spidir_value_t args[] = {
+        jit_emit_table_element(builder, table_state, dst),
+        jit_emit_table_element(builder, elem_state, src),
+        spidir_builder_build_imul(builder, jit_emit_zext64(builder, n),
+            spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, sizeof(void*))),
+    };
+    spidir_builder_build_call(builder, helper, ARRAY_LENGTH(args), args);
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_elem_drop(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t elemidx = BUFFER_PULL_U32(code);
+    CHECK(elemidx < ctx->module->elems_count);
+
+    // the elements are shared by all of the instances, so only the length
+    // is cleared, which is enough for the range check of table.init
+    spidir_value_t elem_state = jit_emit_elem_state(builder, ctx, elemidx);
+    spidir_builder_build_store(builder, SPIDIR_MEM_SIZE_4,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, 0),
+        spidir_builder_build_ptroff(builder, elem_state,
+            spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, offsetof(jit_table_state_t, length))));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_table_grow(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t tableidx;
+    RETHROW(jit_pull_tableidx(code, ctx, &tableidx));
+    wasm_table_t* table = &ctx->module->tables[tableidx];
+
+    spidir_value_t n = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t init = JIT_POP(SPIDIR_TYPE_PTR);
+
+    spidir_funcref_t helper;
+    RETHROW(jit_get_helper(ctx, JIT_HELPER_TABLE_GROW, &helper));
+
+    // tables without a max can grow until the index space runs out
+    spidir_value_t args[] = {
+        jit_emit_table_state(builder, ctx, tableidx),
+        init,
+        n,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, table->max),
+    };
+    JIT_PUSH(SPIDIR_TYPE_I32, spidir_builder_build_call(builder, helper, ARRAY_LENGTH(args), args));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_table_size(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t tableidx;
+    RETHROW(jit_pull_tableidx(code, ctx, &tableidx));
+
+    JIT_PUSH(SPIDIR_TYPE_I32, jit_emit_table_length(builder, jit_emit_table_state(builder, ctx, tableidx)));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_table_fill(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t tableidx;
+    RETHROW(jit_pull_tableidx(code, ctx, &tableidx));
+
+    spidir_value_t n = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t value = JIT_POP(SPIDIR_TYPE_PTR);
+    spidir_value_t dst = JIT_POP(SPIDIR_TYPE_I32);
+
+    spidir_value_t table_state = jit_emit_table_state(builder, ctx, tableidx);
+    RETHROW(jit_emit_table_range_check(builder, ctx, func, table_state, dst, n));
+
+    spidir_funcref_t helper;
+    RETHROW(jit_get_helper(ctx, JIT_HELPER_TABLE_FILL, &helper));
+
+    spidir_value_t args[] = {
+        jit_emit_table_element(builder, table_state, dst),
+        value,
+        n,
+    };
+    spidir_builder_build_call(builder, helper, ARRAY_LENGTH(args), args);
+
+cleanup:
+    return err;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // Numeric Instructions
 //----------------------------------------------------------------------------------------------------------------------
@@ -1546,99 +3016,1386 @@ static wasm_err_t jit_wasm_binopf(spidir_builder_handle_t builder, buffer_t* cod
         default: CHECK_FAIL();
     }
 
-    // in some cases we use an external helper since spidir does not 
-    // contain IR nodes for them
-    if (kind < JIT_HELPER_COUNT) {
-        spidir_funcref_t helper;
-        RETHROW(jit_get_helper(ctx, kind, &helper));
-        spidir_value_t args[] = { arg1, arg2 };
-        result = spidir_builder_build_call(builder, helper, ARRAY_LENGTH(args), args);
+    // in some cases we use an external helper since spidir does not 
+    // contain IR nodes for them
+    if (kind < JIT_HELPER_COUNT) {
+        spidir_funcref_t helper;
+        RETHROW(jit_get_helper(ctx, kind, &helper));
+        spidir_value_t args[] = { arg1, arg2 };
+        result = spidir_builder_build_call(builder, helper, ARRAY_LENGTH(args), args);
+    }
+
+    JIT_PUSH(type, result);
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_unaryopi(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint8_t opcode = ((uint8_t*)code->data)[-1];
+
+    // figure the exact type
+    spidir_value_type_t type;
+    switch (opcode) {
+        case 0x67 ... 0x69: type = SPIDIR_TYPE_I32; opcode -= 0x67; break;
+        case 0x79 ... 0x7B: type = SPIDIR_TYPE_I64; opcode -= 0x79; break;
+        default: CHECK_FAIL();
+    }
+
+    // get the two values
+    spidir_value_t arg = JIT_POP(type);
+
+    // and now perform the action
+    spidir_value_t value;
+    switch (opcode) {
+        case 0: value = spidir_builder_build_lzcount(builder, type, arg); break;
+        case 1: value = spidir_builder_build_tzcount(builder, type, arg); break;
+        case 2: value = spidir_builder_build_popcount(builder, type, arg); break;
+        default: CHECK_FAIL();
+    }
+
+    // and push it back
+    JIT_PUSH(type, value);
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_binopi(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint8_t opcode = ((uint8_t*)code->data)[-1];
+
+    // figure the exact type
+    spidir_value_type_t type;
+    switch (opcode) {
+        case 0x6A ... 0x73: type = SPIDIR_TYPE_I32; opcode -= 0x6A; break;
+        case 0x7C ... 0x85: type = SPIDIR_TYPE_I64; opcode -= 0x7C; break;
+        default: CHECK_FAIL();
+    }
+
+    // get the two values
+    spidir_value_t arg2 = JIT_POP(type);
+    spidir_value_t arg1 = JIT_POP(type);
+
+    // and now perform the action
+    spidir_value_t value;
+    switch (opcode) {
+        case 0: value = spidir_builder_build_iadd(builder, arg1, arg2); break;
+        case 1: value = spidir_builder_build_isub(builder, arg1, arg2); break;
+        case 2: value = spidir_builder_build_imul(builder, arg1, arg2); break;
+        case 3: value = spidir_builder_build_sdiv(builder, arg1, arg2); break;
+        case 4: value = spidir_builder_build_udiv(builder, arg1, arg2); break;
+        case 5: {
+            // we are going to have `(arg1 & ((arg2 == -1) - 1)) % arg2`, that way if arg2 is -1, we will 
+            // mask out the entire arg1 which always results in 1 as expected, meanwhile, if its not -1,
+            // then it will turn into an ffs mask, which will not change anything letting it run normally, 
+            // this is required to handle the edge case of INT_MAX % -1, which is defined in wasm but is not 
+            // defined in spidir (and will actually trap on x86)
+            spidir_value_t minus_one = spidir_builder_build_iconst(builder, type, type == SPIDIR_TYPE_I32 ? (uint32_t)-1 : (uint64_t)-1);
+            spidir_value_t is_neg_one = spidir_builder_build_icmp(builder, SPIDIR_ICMP_EQ, type, arg2, minus_one);
+            spidir_value_t arg1_mask = spidir_builder_build_isub(builder, is_neg_one, spidir_builder_build_iconst(builder, type, 1));
+            arg1 = spidir_builder_build_and(builder, arg1, arg1_mask);
+            value = spidir_builder_build_srem(builder, arg1, arg2); break;
+        } break;
+        case 6: value = spidir_builder_build_urem(builder, arg1, arg2); break;
+        case 7: value = spidir_builder_build_and(builder, arg1, arg2); break;
+        case 8: value = spidir_builder_build_or(builder, arg1, arg2); break;
+        case 9: value = spidir_builder_build_xor(builder, arg1, arg2); break;
+        default: CHECK_FAIL();
+    }
+
+    // and push it back
+    JIT_PUSH(type, value);
+
+cleanup:
+    return err;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// SIMD Instructions
+//----------------------------------------------------------------------------------------------------------------------
+
+//
+// spidir has no vector types, so a v128 is held as two i64 halves. Memory accesses,
+// bitwise operations, lane accesses and shuffles are done directly on the halves.
+// The i8x16 and i16x8 lane-wise ops work on all the lanes of a half at once, and the
+// 4 and 8 byte lanes are done one lane at a time as scalars.
+//
+// What is left calls a helper of its own, written with lane loops so the compiler
+// turns it into SSE/AVX for us. That is swizzle, whose lane indices are only known
+// at runtime, and the float ops the scalar code calls helpers for as well: the
+// rounding, sqrt, min/max and trunc_sat. The helpers take their operands as halves
+// and return the result through a slot on our stack
+//
+
+#define JIT_PUSH_V128(_v) \
+    do { \
+        JIT_PUSH(SPIDIR_TYPE_I64, (_v)[0]); \
+        JIT_PUSH(JIT_TYPE_V128_HI, (_v)[1]); \
+    } while (0)
+
+#define JIT_POP_V128(_v) \
+    do { \
+        (_v)[1] = JIT_POP(JIT_TYPE_V128_HI); \
+        (_v)[0] = JIT_POP(SPIDIR_TYPE_I64); \
+    } while (0)
+
+typedef enum jit_simd_shape {
+    // v128 -> v128
+    JIT_SIMD_UNARY,
+
+    // v128 v128 -> v128
+    JIT_SIMD_BINARY,
+} jit_simd_shape_t;
+
+/**
+ * Call the helper of the given simd sub-opcode, the result is left at the
+ * returned address, which is a slot on our stack
+ */
+static wasm_err_t jit_emit_simd_helper(
+    spidir_builder_handle_t builder, jit_context_t* ctx,
+    uint32_t op, spidir_value_t a[2], spidir_value_t b[2],
+    spidir_value_t* out_area
+) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    spidir_funcref_t helper;
+    RETHROW(jit_get_helper(ctx, JIT_HELPER_SIMD + op, &helper));
+
+    spidir_value_t area = spidir_builder_build_stackslot(builder, 2 * sizeof(uint64_t), sizeof(uint64_t));
+    spidir_value_t args[] = {
+        area,
+        a[0], a[1],
+        b[0], b[1],
+    };
+    spidir_builder_build_call(builder, helper, ARRAY_LENGTH(args), args);
+
+    *out_area = area;
+
+cleanup:
+    return err;
+}
+
+static void jit_emit_load_v128(spidir_builder_handle_t builder, spidir_value_t addr, spidir_value_t v[2]) {
+    v[0] = spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_8, SPIDIR_TYPE_I64, addr);
+    v[1] = spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_8, SPIDIR_TYPE_I64,
+        spidir_builder_build_ptroff(builder, addr, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 8)));
+}
+
+static void jit_emit_store_v128(spidir_builder_handle_t builder, spidir_value_t addr, spidir_value_t v[2]) {
+    spidir_builder_build_store(builder, SPIDIR_MEM_SIZE_8, v[0], addr);
+    spidir_builder_build_store(builder, SPIDIR_MEM_SIZE_8, v[1],
+        spidir_builder_build_ptroff(builder, addr, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 8)));
+}
+
+static spidir_mem_size_t jit_get_lane_mem_size(uint32_t lane_size) {
+    switch (lane_size) {
+        case 1: return SPIDIR_MEM_SIZE_1;
+        case 2: return SPIDIR_MEM_SIZE_2;
+        case 4: return SPIDIR_MEM_SIZE_4;
+        default: return SPIDIR_MEM_SIZE_8;
+    }
+}
+
+static uint64_t jit_get_lane_mask(uint32_t lane_size) {
+    return lane_size == 8 ? UINT64_MAX : (1ull << (lane_size * 8)) - 1;
+}
+
+/**
+ * Get the bits of a lane shifted to the bottom of an i64, the bits above
+ * the lane are left as they are
+ */
+static spidir_value_t jit_emit_get_lane(spidir_builder_handle_t builder, spidir_value_t v[2], uint32_t lane_size, uint32_t lane) {
+    uint32_t offset = lane * lane_size;
+    spidir_value_t half = v[offset / 8];
+    uint32_t shift = (offset % 8) * 8;
+    if (shift != 0) {
+        half = spidir_builder_build_lshr(builder, half, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, shift));
+    }
+    return half;
+}
+
+/**
+ * Replace the bits of a lane with the low bits of an i64
+ */
+static void jit_emit_set_lane(spidir_builder_handle_t builder, spidir_value_t v[2], uint32_t lane_size, uint32_t lane, spidir_value_t value) {
+    uint32_t offset = lane * lane_size;
+    spidir_value_t* half = &v[offset / 8];
+    if (lane_size == 8) {
+        *half = value;
+        return;
+    }
+
+    uint32_t shift = (offset % 8) * 8;
+    uint64_t mask = jit_get_lane_mask(lane_size);
+    value = spidir_builder_build_and(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, mask));
+    if (shift != 0) {
+        value = spidir_builder_build_shl(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, shift));
+    }
+
+    *half = spidir_builder_build_and(builder, *half, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, ~(mask << shift)));
+    *half = spidir_builder_build_or(builder, *half, value);
+}
+
+/**
+ * Repeat the low bits of an i64 over all of the lanes of an i64
+ */
+static spidir_value_t jit_emit_splat(spidir_builder_handle_t builder, spidir_value_t value, uint32_t lane_size) {
+    if (lane_size == 8) {
+        return value;
+    }
+
+    // multiplying the lane by 0x0101..01 (for the lane size) copies it into every lane
+    uint64_t mask = jit_get_lane_mask(lane_size);
+    value = spidir_builder_build_and(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, mask));
+    return spidir_builder_build_imul(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT64_MAX / mask));
+}
+
+/**
+ * The high bit of every lane of an i64
+ */
+static uint64_t jit_get_lanes_high_bits(uint32_t lane_size) {
+    return (UINT64_MAX / jit_get_lane_mask(lane_size)) << (lane_size * 8 - 1);
+}
+
+/**
+ * Add or subtract all the lanes of an i64 at once. The high bit of every lane
+ * is kept out of the arithmetic so nothing carries into the next lane, and is
+ * put back with a xor
+ */
+static spidir_value_t jit_emit_swar_add(spidir_builder_handle_t builder, spidir_value_t x, spidir_value_t y, uint32_t lane_size, bool subtract) {
+    uint64_t high_bits = jit_get_lanes_high_bits(lane_size);
+    spidir_value_t high = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, high_bits);
+    spidir_value_t low = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, ~high_bits);
+
+    spidir_value_t value;
+    spidir_value_t fixup = spidir_builder_build_and(builder, spidir_builder_build_xor(builder, x, y), high);
+    if (subtract) {
+        value = spidir_builder_build_isub(builder, spidir_builder_build_or(builder, x, high), spidir_builder_build_and(builder, y, low));
+        fixup = spidir_builder_build_xor(builder, fixup, high);
+    } else {
+        value = spidir_builder_build_iadd(builder, spidir_builder_build_and(builder, x, low), spidir_builder_build_and(builder, y, low));
+    }
+
+    return spidir_builder_build_xor(builder, value, fixup);
+}
+
+/**
+ * Turn the high bit of every lane into a lane of all zeros or all ones, the
+ * rest of the bits must be clear
+ */
+static spidir_value_t jit_emit_swar_expand(spidir_builder_handle_t builder, spidir_value_t bits, uint32_t lane_size) {
+    // 0x80 - 0x01 leaves 0x7f without borrowing from the lane above
+    spidir_value_t low = spidir_builder_build_lshr(builder, bits, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, lane_size * 8 - 1));
+    return spidir_builder_build_or(builder, spidir_builder_build_isub(builder, bits, low), bits);
+}
+
+/**
+ * Pick the lanes of x where the mask is set and the lanes of y everywhere else
+ */
+static spidir_value_t jit_emit_swar_select(spidir_builder_handle_t builder, spidir_value_t mask, spidir_value_t x, spidir_value_t y) {
+    spidir_value_t ones = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT64_MAX);
+    return spidir_builder_build_or(builder,
+        spidir_builder_build_and(builder, x, mask),
+        spidir_builder_build_and(builder, y, spidir_builder_build_xor(builder, mask, ones)));
+}
+
+/**
+ * The high bit of every lane where x and y differ. Adding the low bits of a lane
+ * to all ones below the high bit carries into it unless they are all zero
+ */
+static spidir_value_t jit_emit_swar_ne(spidir_builder_handle_t builder, spidir_value_t x, spidir_value_t y, uint32_t lane_size) {
+    uint64_t high_bits = jit_get_lanes_high_bits(lane_size);
+    spidir_value_t high = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, high_bits);
+    spidir_value_t low = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, ~high_bits);
+
+    spidir_value_t diff = spidir_builder_build_xor(builder, x, y);
+    spidir_value_t carry = spidir_builder_build_iadd(builder, spidir_builder_build_and(builder, diff, low), low);
+    return spidir_builder_build_and(builder, spidir_builder_build_or(builder, carry, diff), high);
+}
+
+/**
+ * The high bit of every lane where x is below y, which is where subtracting y
+ * from x borrows out of the lane. The signed compare flips the sign bits first
+ * so the lanes are ordered like unsigned ones
+ */
+static spidir_value_t jit_emit_swar_lt(spidir_builder_handle_t builder, spidir_value_t x, spidir_value_t y, uint32_t lane_size, bool is_signed) {
+    spidir_value_t high = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, jit_get_lanes_high_bits(lane_size));
+    spidir_value_t ones = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT64_MAX);
+    if (is_signed) {
+        x = spidir_builder_build_xor(builder, x, high);
+        y = spidir_builder_build_xor(builder, y, high);
+    }
+
+    // the borrow is (~x & y) | (~(x ^ y) & diff) at the high bit of the lane
+    spidir_value_t diff = jit_emit_swar_add(builder, x, y, lane_size, true);
+    spidir_value_t borrow = spidir_builder_build_or(builder,
+        spidir_builder_build_and(builder, spidir_builder_build_xor(builder, x, ones), y),
+        spidir_builder_build_and(builder, spidir_builder_build_xor(builder, spidir_builder_build_xor(builder, x, y), ones), diff));
+    return spidir_builder_build_and(builder, borrow, high);
+}
+
+/**
+ * Do a lane-wise op of the i8x16 and i16x8 shapes on all the lanes of a half
+ * at once, the unary ops ignore y. The extadd_pairwise ops are given the size
+ * of the lanes they add up
+ */
+static wasm_err_t jit_emit_swar_op(spidir_builder_handle_t builder, uint32_t sub, uint32_t lane_size, spidir_value_t x, spidir_value_t y, spidir_value_t* out_value) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint64_t high_bits = jit_get_lanes_high_bits(lane_size);
+    spidir_value_t high = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, high_bits);
+    spidir_value_t low = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, ~high_bits);
+    spidir_value_t ones = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT64_MAX);
+
+    spidir_value_t value;
+    switch (sub) {
+        // the compares come in the order eq, ne, lt_s, lt_u, gt_s, gt_u, le_s, le_u,
+        // ge_s, ge_u, the gt kinds swap the operands and le and ge flip gt and lt
+        case 35 ... 54: {
+            uint32_t op = (sub - 35) % 10;
+            bool is_signed = op % 2 == 0;
+            spidir_value_t bits;
+            switch (op) {
+                case 0: case 1: bits = jit_emit_swar_ne(builder, x, y, lane_size); break;
+                case 2: case 3: case 8: case 9: bits = jit_emit_swar_lt(builder, x, y, lane_size, is_signed); break;
+                default: bits = jit_emit_swar_lt(builder, y, x, lane_size, is_signed); break;
+            }
+            value = jit_emit_swar_expand(builder, bits, lane_size);
+            if (op == 0 || op >= 6) {
+                value = spidir_builder_build_xor(builder, value, ones);
+            }
+        } break;
+
+        // i8x16.abs, i16x8.abs, (x ^ sign) - sign
+        case 96: case 128: {
+            spidir_value_t sign = jit_emit_swar_expand(builder, spidir_builder_build_and(builder, x, high), lane_size);
+            value = jit_emit_swar_add(builder, spidir_builder_build_xor(builder, x, sign), sign, lane_size, true);
+        } break;
+
+        // i8x16.popcnt, count the bits of every 2 bits, then every 4 and then every byte
+        case 98: {
+            spidir_value_t one = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 1);
+            spidir_value_t two = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 2);
+            spidir_value_t four = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 4);
+            spidir_value_t m1 = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 0x5555555555555555ull);
+            spidir_value_t m2 = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 0x3333333333333333ull);
+            spidir_value_t m4 = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 0x0F0F0F0F0F0F0F0Full);
+            value = spidir_builder_build_isub(builder, x,
+                spidir_builder_build_and(builder, spidir_builder_build_lshr(builder, x, one), m1));
+            value = spidir_builder_build_iadd(builder,
+                spidir_builder_build_and(builder, value, m2),
+                spidir_builder_build_and(builder, spidir_builder_build_lshr(builder, value, two), m2));
+            value = spidir_builder_build_and(builder,
+                spidir_builder_build_iadd(builder, value, spidir_builder_build_lshr(builder, value, four)),
+                m4);
+        } break;
+
+        // add_sat_s and sub_sat_s, a lane overflows when the sign of the result
+        // is wrong, and then saturates towards the sign of x
+        case 111: case 114: case 143: case 146: {
+            bool subtract = sub == 114 || sub == 146;
+            spidir_value_t result = jit_emit_swar_add(builder, x, y, lane_size, subtract);
+            spidir_value_t overflow = subtract ?
+                spidir_builder_build_and(builder, spidir_builder_build_xor(builder, x, y), spidir_builder_build_xor(builder, x, result)) :
+                spidir_builder_build_and(builder, spidir_builder_build_xor(builder, result, x), spidir_builder_build_xor(builder, result, y));
+            overflow = spidir_builder_build_and(builder, overflow, high);
+
+            // 0x7f for the positive lanes and 0x80 for the negative ones
+            spidir_value_t saturated = spidir_builder_build_xor(builder,
+                jit_emit_swar_expand(builder, spidir_builder_build_and(builder, x, high), lane_size),
+                low);
+            value = jit_emit_swar_select(builder, jit_emit_swar_expand(builder, overflow, lane_size), saturated, result);
+        } break;
+
+        // add_sat_u, the lanes that carry out become all ones
+        case 112: case 144: {
+            spidir_value_t result = jit_emit_swar_add(builder, x, y, lane_size, false);
+            spidir_value_t carry = spidir_builder_build_or(builder,
+                spidir_builder_build_and(builder, x, y),
+                spidir_builder_build_and(builder, spidir_builder_build_or(builder, x, y), spidir_builder_build_xor(builder, result, ones)));
+            carry = spidir_builder_build_and(builder, carry, high);
+            value = spidir_builder_build_or(builder, result, jit_emit_swar_expand(builder, carry, lane_size));
+        } break;
+
+        // sub_sat_u, the lanes that borrow become zero
+        case 115: case 147: {
+            spidir_value_t result = jit_emit_swar_add(builder, x, y, lane_size, true);
+            spidir_value_t borrow = jit_emit_swar_lt(builder, x, y, lane_size, false);
+            value = spidir_builder_build_and(builder, result,
+                spidir_builder_build_xor(builder, jit_emit_swar_expand(builder, borrow, lane_size), ones));
+        } break;
+
+        // min_s, min_u, max_s, max_u
+        case 118 ... 121: case 150 ... 153: {
+            uint32_t op = sub - (lane_size == 1 ? 118 : 150);
+            bool is_signed = op % 2 == 0;
+            spidir_value_t bits = op < 2 ?
+                jit_emit_swar_lt(builder, x, y, lane_size, is_signed) :
+                jit_emit_swar_lt(builder, y, x, lane_size, is_signed);
+            value = jit_emit_swar_select(builder, jit_emit_swar_expand(builder, bits, lane_size), x, y);
+        } break;
+
+        // avgr_u, (x | y) - ((x ^ y) >> 1) never borrows from the next lane
+        case 123: case 155: {
+            spidir_value_t half = spidir_builder_build_and(builder,
+                spidir_builder_build_lshr(builder, spidir_builder_build_xor(builder, x, y), spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 1)),
+                low);
+            value = spidir_builder_build_isub(builder, spidir_builder_build_or(builder, x, y), half);
+        } break;
+
+        // extadd_pairwise, the even and odd lanes are moved to the bottom of the wide
+        // lanes and added. The signed ones are extended with (v ^ sign) - sign, which
+        // is done once for the sum of the pair
+        case 124 ... 127: {
+            uint32_t lane_bits = lane_size * 8;
+            uint64_t mask = UINT64_MAX / jit_get_lane_mask(lane_size * 2) * jit_get_lane_mask(lane_size);
+            spidir_value_t even = spidir_builder_build_and(builder, x, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, mask));
+            spidir_value_t odd = spidir_builder_build_and(builder,
+                spidir_builder_build_lshr(builder, x, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, lane_bits)),
+                spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, mask));
+            if (sub % 2 == 0) {
+                uint64_t sign_bits = jit_get_lanes_high_bits(lane_size * 2) >> lane_bits;
+                spidir_value_t sign = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, sign_bits);
+                value = spidir_builder_build_iadd(builder,
+                    spidir_builder_build_xor(builder, even, sign),
+                    spidir_builder_build_xor(builder, odd, sign));
+                value = jit_emit_swar_add(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, sign_bits << 1), lane_size * 2, true);
+            } else {
+                value = spidir_builder_build_iadd(builder, even, odd);
+            }
+        } break;
+
+        default: CHECK_FAIL();
+    }
+
+    *out_value = value;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Extend the two i32 lanes of an i64 into a vector of i64 lanes
+ */
+static void jit_emit_extend_i32_lanes(spidir_builder_handle_t builder, spidir_value_t half, bool sign_extend, spidir_value_t v[2]) {
+    spidir_value_t shift = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 32);
+    if (sign_extend) {
+        v[0] = spidir_builder_build_sfill(builder, 32, half);
+        v[1] = spidir_builder_build_ashr(builder, half, shift);
+    } else {
+        v[0] = spidir_builder_build_and(builder, half, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT32_MAX));
+        v[1] = spidir_builder_build_lshr(builder, half, shift);
+    }
+}
+
+/**
+ * Extend the lanes of an i64 into a vector of lanes twice as wide. Every 4 bytes
+ * of the i64 make a half, and their lanes are spread apart by doubling the gap
+ * between them until every lane sits at the bottom of its wide lane
+ */
+static void jit_emit_extend_lanes(spidir_builder_handle_t builder, spidir_value_t half, uint32_t lane_size, bool sign_extend, spidir_value_t v[2]) {
+    if (lane_size == 4) {
+        jit_emit_extend_i32_lanes(builder, half, sign_extend, v);
+        return;
+    }
+
+    spidir_value_t parts[2] = {
+        spidir_builder_build_and(builder, half, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT32_MAX)),
+        spidir_builder_build_lshr(builder, half, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 32)),
+    };
+
+    // the sign bit of the narrow lane, in every wide lane
+    uint64_t sign_bits = jit_get_lanes_high_bits(lane_size * 2) >> (lane_size * 8);
+    spidir_value_t sign = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, sign_bits);
+    for (int i = 0; i < 2; i++) {
+        spidir_value_t value = parts[i];
+        for (uint32_t shift = 16; shift >= lane_size * 8; shift /= 2) {
+            uint64_t mask = UINT64_MAX / jit_get_lane_mask(shift / 4) * jit_get_lane_mask(shift / 8);
+            value = spidir_builder_build_and(builder,
+                spidir_builder_build_or(builder, value,
+                    spidir_builder_build_shl(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, shift))),
+                spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, mask));
+        }
+
+        // (v ^ sign) - sign
+        if (sign_extend) {
+            value = jit_emit_swar_add(builder, spidir_builder_build_xor(builder, value, sign), sign, lane_size * 2, true);
+        }
+        v[i] = value;
+    }
+}
+
+/**
+ * Saturate the 2 or 4 byte signed lanes of an i64 to lanes half as wide, and pack
+ * them into the low 32 bits. This undoes the spreading of jit_emit_extend_lanes
+ */
+static spidir_value_t jit_emit_narrow_lanes(spidir_builder_handle_t builder, spidir_value_t half, uint32_t lane_size, bool is_signed) {
+    uint32_t narrow_bits = lane_size * 4;
+    uint64_t lanes = UINT64_MAX / jit_get_lane_mask(lane_size);
+    uint64_t min = is_signed ? -(1ull << (narrow_bits - 1)) : 0;
+    uint64_t max = is_signed ? (1ull << (narrow_bits - 1)) - 1 : (1ull << narrow_bits) - 1;
+    spidir_value_t min_value = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, lanes * (min & jit_get_lane_mask(lane_size)));
+    spidir_value_t max_value = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, lanes * max);
+
+    // the input lanes are always signed
+    half = jit_emit_swar_select(builder,
+        jit_emit_swar_expand(builder, jit_emit_swar_lt(builder, half, min_value, lane_size, true), lane_size),
+        min_value, half);
+    half = jit_emit_swar_select(builder,
+        jit_emit_swar_expand(builder, jit_emit_swar_lt(builder, max_value, half, lane_size, true), lane_size),
+        max_value, half);
+
+    spidir_value_t value = spidir_builder_build_and(builder, half,
+        spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, lanes * jit_get_lane_mask(lane_size / 2)));
+    for (uint32_t shift = narrow_bits; shift < 32; shift *= 2) {
+        uint64_t mask = UINT64_MAX / jit_get_lane_mask(shift / 2) * jit_get_lane_mask(shift / 4);
+        value = spidir_builder_build_and(builder,
+            spidir_builder_build_or(builder, value,
+                spidir_builder_build_lshr(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, shift))),
+            spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, mask));
+    }
+    return value;
+}
+
+/**
+ * Split a vector into its 4 or 8 byte lanes, as scalars of the lane type
+ */
+static void jit_emit_split_lanes(spidir_builder_handle_t builder, spidir_value_t v[2], spidir_value_type_t type, spidir_value_t lanes[4]) {
+    bool wide = type == SPIDIR_TYPE_I64 || type == SPIDIR_TYPE_F64;
+    for (int i = 0; i < 2; i++) {
+        if (wide) {
+            lanes[i] = v[i];
+        } else {
+            lanes[i * 2] = spidir_builder_build_itrunc(builder, v[i]);
+            lanes[i * 2 + 1] = spidir_builder_build_itrunc(builder,
+                spidir_builder_build_lshr(builder, v[i], spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 32)));
+        }
+    }
+
+    if (type == SPIDIR_TYPE_F32 || type == SPIDIR_TYPE_F64) {
+        for (int i = 0; i < (wide ? 2 : 4); i++) {
+            lanes[i] = spidir_builder_build_bitcast(builder, type, lanes[i]);
+        }
+    }
+}
+
+/**
+ * Put a vector back together from the bits of its 4 or 8 byte lanes
+ */
+static void jit_emit_join_lanes(spidir_builder_handle_t builder, spidir_value_t lanes[4], bool wide, spidir_value_t v[2]) {
+    for (int i = 0; i < 2; i++) {
+        if (wide) {
+            v[i] = lanes[i];
+        } else {
+            spidir_value_t high = spidir_builder_build_shl(builder,
+                spidir_builder_build_iext(builder, lanes[i * 2 + 1]),
+                spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 32));
+            v[i] = spidir_builder_build_or(builder, jit_emit_zext64(builder, lanes[i * 2]), high);
+        }
+    }
+}
+
+/**
+ * Do a single lane of a lane-wise op on 4 or 8 byte lanes, the result is given
+ * as the bits of the lane. The abs and neg of the floats only touch the sign bit
+ * so they get their lanes as integers
+ */
+static wasm_err_t jit_emit_simd_lane_op(spidir_builder_handle_t builder, uint32_t sub, spidir_value_type_t type, spidir_value_t x, spidir_value_t y, spidir_value_t* out_value) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    bool wide = type == SPIDIR_TYPE_I64 || type == SPIDIR_TYPE_F64;
+    spidir_value_type_t int_type = wide ? SPIDIR_TYPE_I64 : SPIDIR_TYPE_I32;
+    spidir_value_t zero = spidir_builder_build_iconst(builder, int_type, 0);
+    uint64_t sign = wide ? (1ull << 63) : (1ull << 31);
+
+    spidir_value_t value;
+    switch (sub) {
+        // the integer compares, for the gt kinds we just swap
+        case 55: case 214: value = spidir_builder_build_icmp(builder, SPIDIR_ICMP_EQ, SPIDIR_TYPE_I32, x, y); break;
+        case 56: case 215: value = spidir_builder_build_icmp(builder, SPIDIR_ICMP_NE, SPIDIR_TYPE_I32, x, y); break;
+        case 57: case 216: value = spidir_builder_build_icmp(builder, SPIDIR_ICMP_SLT, SPIDIR_TYPE_I32, x, y); break;
+        case 58: value = spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULT, SPIDIR_TYPE_I32, x, y); break;
+        case 59: case 217: value = spidir_builder_build_icmp(builder, SPIDIR_ICMP_SLT, SPIDIR_TYPE_I32, y, x); break;
+        case 60: value = spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULT, SPIDIR_TYPE_I32, y, x); break;
+        case 61: case 218: value = spidir_builder_build_icmp(builder, SPIDIR_ICMP_SLE, SPIDIR_TYPE_I32, x, y); break;
+        case 62: value = spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULE, SPIDIR_TYPE_I32, x, y); break;
+        case 63: case 219: value = spidir_builder_build_icmp(builder, SPIDIR_ICMP_SLE, SPIDIR_TYPE_I32, y, x); break;
+        case 64: value = spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULE, SPIDIR_TYPE_I32, y, x); break;
+
+        // the float compares, same as the scalar ones
+        case 65: case 71: value = spidir_builder_build_fcmp(builder, SPIDIR_FCMP_OEQ, SPIDIR_TYPE_I32, x, y); break;
+        case 66: case 72: value = spidir_builder_build_fcmp(builder, SPIDIR_FCMP_UNE, SPIDIR_TYPE_I32, x, y); break;
+        case 67: case 73: value = spidir_builder_build_fcmp(builder, SPIDIR_FCMP_OLT, SPIDIR_TYPE_I32, x, y); break;
+        case 68: case 74: value = spidir_builder_build_fcmp(builder, SPIDIR_FCMP_OLT, SPIDIR_TYPE_I32, y, x); break;
+        case 69: case 75: value = spidir_builder_build_fcmp(builder, SPIDIR_FCMP_OLE, SPIDIR_TYPE_I32, x, y); break;
+        case 70: case 76: value = spidir_builder_build_fcmp(builder, SPIDIR_FCMP_OLE, SPIDIR_TYPE_I32, y, x); break;
+
+        // i32x4 and i64x2
+        case 160: case 192: {
+            spidir_value_t negative = spidir_builder_build_icmp(builder, SPIDIR_ICMP_SLT, SPIDIR_TYPE_I32, x, zero);
+            value = spidir_builder_build_select(builder, negative, spidir_builder_build_isub(builder, zero, x), x);
+        } break;
+        case 161: case 193: value = spidir_builder_build_isub(builder, zero, x); break;
+        case 174: case 206: value = spidir_builder_build_iadd(builder, x, y); break;
+        case 177: case 209: value = spidir_builder_build_isub(builder, x, y); break;
+        case 181: case 213: value = spidir_builder_build_imul(builder, x, y); break;
+        case 182: value = spidir_builder_build_select(builder, spidir_builder_build_icmp(builder, SPIDIR_ICMP_SLT, SPIDIR_TYPE_I32, x, y), x, y); break;
+        case 183: value = spidir_builder_build_select(builder, spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULT, SPIDIR_TYPE_I32, x, y), x, y); break;
+        case 184: value = spidir_builder_build_select(builder, spidir_builder_build_icmp(builder, SPIDIR_ICMP_SLT, SPIDIR_TYPE_I32, y, x), x, y); break;
+        case 185: value = spidir_builder_build_select(builder, spidir_builder_build_icmp(builder, SPIDIR_ICMP_ULT, SPIDIR_TYPE_I32, y, x), x, y); break;
+
+        // the i16x8 ops that multiply, done on the pair of i16 lanes in every i32 lane
+        case 130: case 149: case 186: {
+            spidir_value_t sixteen = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, 16);
+            spidir_value_t low_mask = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, UINT16_MAX);
+            if (sub == 149) {
+                // the low lane is the low bits of the whole product, the high lane
+                // is multiplied with the low bits of y cleared
+                spidir_value_t high = spidir_builder_build_imul(builder,
+                    spidir_builder_build_lshr(builder, x, sixteen),
+                    spidir_builder_build_and(builder, y, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, ~(uint32_t)UINT16_MAX)));
+                value = spidir_builder_build_or(builder,
+                    spidir_builder_build_and(builder, spidir_builder_build_imul(builder, x, y), low_mask),
+                    high);
+                break;
+            }
+
+            spidir_value_t low = spidir_builder_build_imul(builder,
+                spidir_builder_build_sfill(builder, 16, x), spidir_builder_build_sfill(builder, 16, y));
+            spidir_value_t high = spidir_builder_build_imul(builder,
+                spidir_builder_build_ashr(builder, x, sixteen), spidir_builder_build_ashr(builder, y, sixteen));
+            if (sub == 186) {
+                // i32x4.dot_i16x8_s
+                value = spidir_builder_build_iadd(builder, low, high);
+                break;
+            }
+
+            // i16x8.q15mulr_sat_s, only -0x8000 * -0x8000 saturates
+            spidir_value_t round = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, 0x4000);
+            spidir_value_t fifteen = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, 15);
+            spidir_value_t overflow = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, 0x8000);
+            spidir_value_t max = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, INT16_MAX);
+            spidir_value_t lanes[] = { low, high };
+            for (int i = 0; i < 2; i++) {
+                spidir_value_t lane = spidir_builder_build_ashr(builder, spidir_builder_build_iadd(builder, lanes[i], round), fifteen);
+                lanes[i] = spidir_builder_build_select(builder,
+                    spidir_builder_build_icmp(builder, SPIDIR_ICMP_EQ, SPIDIR_TYPE_I32, lane, overflow), max, lane);
+            }
+            value = spidir_builder_build_or(builder,
+                spidir_builder_build_and(builder, lanes[0], low_mask),
+                spidir_builder_build_shl(builder, lanes[1], sixteen));
+        } break;
+
+        // f32x4.convert_i32x4_s, f32x4.convert_i32x4_u
+        case 250: value = spidir_builder_build_bitcast(builder, SPIDIR_TYPE_I32, spidir_builder_build_sinttofloat(builder, SPIDIR_TYPE_F32, x)); break;
+        case 251: value = spidir_builder_build_bitcast(builder, SPIDIR_TYPE_I32, spidir_builder_build_uinttofloat(builder, SPIDIR_TYPE_F32, x)); break;
+
+        // f32x4 and f64x2
+        case 224: case 236: value = spidir_builder_build_and(builder, x, spidir_builder_build_iconst(builder, int_type, sign - 1)); break;
+        case 225: case 237: value = spidir_builder_build_xor(builder, x, spidir_builder_build_iconst(builder, int_type, sign)); break;
+        case 228: case 240: value = spidir_builder_build_fadd(builder, x, y); break;
+        case 229: case 241: value = spidir_builder_build_fsub(builder, x, y); break;
+        case 230: case 242: value = spidir_builder_build_fmul(builder, x, y); break;
+        case 231: case 243: value = spidir_builder_build_fdiv(builder, x, y); break;
+
+        // pmin is b < a ? b : a, and pmax is a < b ? b : a
+        case 234: case 246: value = spidir_builder_build_select(builder, spidir_builder_build_fcmp(builder, SPIDIR_FCMP_OLT, SPIDIR_TYPE_I32, y, x), y, x); break;
+        case 235: case 247: value = spidir_builder_build_select(builder, spidir_builder_build_fcmp(builder, SPIDIR_FCMP_OLT, SPIDIR_TYPE_I32, x, y), y, x); break;
+
+        default: CHECK_FAIL();
+    }
+
+    if ((sub >= 55 && sub <= 76) || (sub >= 214 && sub <= 219)) {
+        // turn the 0 or 1 of the compare into a lane of all zeros or all ones
+        if (wide) {
+            value = jit_emit_zext64(builder, value);
+        }
+        value = spidir_builder_build_isub(builder, zero, value);
+    } else if (type == SPIDIR_TYPE_F32 || type == SPIDIR_TYPE_F64) {
+        value = spidir_builder_build_bitcast(builder, int_type, value);
+    }
+
+    *out_value = value;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Do a lane-wise op on 4 or 8 byte lanes one lane at a time, the result is
+ * written over a. The unary ops have no b
+ */
+static wasm_err_t jit_emit_simd_lanewise(spidir_builder_handle_t builder, uint32_t sub, spidir_value_type_t type, spidir_value_t a[2], spidir_value_t* b) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    bool wide = type == SPIDIR_TYPE_I64 || type == SPIDIR_TYPE_F64;
+    spidir_value_t x[4], y[4] = {}, r[4];
+    jit_emit_split_lanes(builder, a, type, x);
+    if (b != nullptr) {
+        jit_emit_split_lanes(builder, b, type, y);
+    }
+
+    for (int i = 0; i < (wide ? 2 : 4); i++) {
+        RETHROW(jit_emit_simd_lane_op(builder, sub, type, x[i], y[i], &r[i]));
+    }
+
+    jit_emit_join_lanes(builder, r, wide, a);
+
+cleanup:
+    return err;
+}
+
+/**
+ * Pop a scalar lane value and get its bits in an i64
+ */
+static wasm_err_t jit_pop_lane_value(spidir_builder_handle_t builder, jit_label_t* label, spidir_value_type_t type, spidir_value_t* out_value) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    spidir_value_t value = JIT_POP(type);
+    switch (type) {
+        case SPIDIR_TYPE_F32: value = spidir_builder_build_bitcast(builder, SPIDIR_TYPE_I32, value); // fallthrough
+        case SPIDIR_TYPE_I32: value = jit_emit_zext64(builder, value); break;
+        case SPIDIR_TYPE_F64: value = spidir_builder_build_bitcast(builder, SPIDIR_TYPE_I64, value); break;
+        case SPIDIR_TYPE_I64: break;
+        default: CHECK_FAIL();
+    }
+
+    *out_value = value;
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_wasm_simd_memory(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label, uint32_t sub) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_mem_arg_t mem_arg = {};
+    RETHROW(jit_pull_memarg(code, ctx, &mem_arg));
+
+    // the lane accesses carry the lane index, and the vector
+    // they access is above the address
+    uint32_t lane = 0;
+    spidir_value_t v[2];
+    if (sub >= 84 && sub <= 91) {
+        lane = BUFFER_PULL(uint8_t, code);
+        JIT_POP_V128(v);
+    } else if (sub == 11) {
+        JIT_POP_V128(v);
+    }
+
+    spidir_value_t offset = JIT_POP(jit_get_address_type(mem_arg.memory));
+    spidir_value_t addr = SPIDIR_VALUE_INVALID;
+    RETHROW(jit_wasm_calculate_addr(builder, ctx, func, &mem_arg, offset, &addr));
+
+    spidir_value_t zero = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 0);
+    switch (sub) {
+        // v128.load
+        case 0: jit_emit_load_v128(builder, addr, v); break;
+
+        // v128.load8x8_s/u ... v128.load32x2_s/u, load the 64 bits and extend
+        // them the same way extend_low does
+        case 1 ... 6: {
+            spidir_value_t half = spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_8, SPIDIR_TYPE_I64, addr);
+            jit_emit_extend_lanes(builder, half, 1 << ((sub - 1) / 2), sub % 2 == 1, v);
+        } break;
+
+        // v128.load8_splat ... v128.load64_splat
+        case 7 ... 10: {
+            uint32_t lane_size = 1 << (sub - 7);
+            spidir_value_t value = spidir_builder_build_load(builder, jit_get_lane_mem_size(lane_size), SPIDIR_TYPE_I64, addr);
+            v[0] = v[1] = jit_emit_splat(builder, value, lane_size);
+        } break;
+
+        // v128.store
+        case 11: jit_emit_store_v128(builder, addr, v); break;
+
+        // v128.load8_lane ... v128.load64_lane
+        case 84 ... 87: {
+            uint32_t lane_size = 1 << (sub - 84);
+            CHECK(lane < 16 / lane_size);
+            spidir_value_t value = spidir_builder_build_load(builder, jit_get_lane_mem_size(lane_size), SPIDIR_TYPE_I64, addr);
+            jit_emit_set_lane(builder, v, lane_size, lane, value);
+        } break;
+
+        // v128.store8_lane ... v128.store64_lane, the store only takes the low bits
+        case 88 ... 91: {
+            uint32_t lane_size = 1 << (sub - 88);
+            CHECK(lane < 16 / lane_size);
+            spidir_builder_build_store(builder, jit_get_lane_mem_size(lane_size), jit_emit_get_lane(builder, v, lane_size, lane), addr);
+        } break;
+
+        // v128.load32_zero
+        case 92: {
+            spidir_value_t value = spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_4, SPIDIR_TYPE_I64, addr);
+            v[0] = spidir_builder_build_and(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT32_MAX));
+            v[1] = zero;
+        } break;
+
+        // v128.load64_zero
+        case 93: {
+            v[0] = spidir_builder_build_load(builder, SPIDIR_MEM_SIZE_8, SPIDIR_TYPE_I64, addr);
+            v[1] = zero;
+        } break;
+
+        default: CHECK_FAIL();
+    }
+
+    // everything but the stores produces a vector
+    if (sub != 11 && !(sub >= 88 && sub <= 91)) {
+        JIT_PUSH_V128(v);
     }
 
-    JIT_PUSH(type, result);
-
 cleanup:
     return err;
 }
 
-static wasm_err_t jit_wasm_unaryopi(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+static wasm_err_t jit_wasm_simd_lane(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label, uint32_t sub) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    uint8_t opcode = ((uint8_t*)code->data)[-1];
+    uint8_t lane = BUFFER_PULL(uint8_t, code);
 
-    // figure the exact type
+    // the lane shape of the instruction, they come in the order
+    // of i8x16, i16x8, i32x4, i64x2, f32x4, f64x2
+    uint32_t lane_size;
     spidir_value_type_t type;
-    switch (opcode) {
-        case 0x67 ... 0x69: type = SPIDIR_TYPE_I32; opcode -= 0x67; break;
-        case 0x79 ... 0x7B: type = SPIDIR_TYPE_I64; opcode -= 0x79; break;
+    bool replace = false;
+    bool sign_extend = false;
+    switch (sub) {
+        case 21: lane_size = 1; type = SPIDIR_TYPE_I32; sign_extend = true; break;
+        case 22: lane_size = 1; type = SPIDIR_TYPE_I32; break;
+        case 23: lane_size = 1; type = SPIDIR_TYPE_I32; replace = true; break;
+        case 24: lane_size = 2; type = SPIDIR_TYPE_I32; sign_extend = true; break;
+        case 25: lane_size = 2; type = SPIDIR_TYPE_I32; break;
+        case 26: lane_size = 2; type = SPIDIR_TYPE_I32; replace = true; break;
+        case 27: lane_size = 4; type = SPIDIR_TYPE_I32; break;
+        case 28: lane_size = 4; type = SPIDIR_TYPE_I32; replace = true; break;
+        case 29: lane_size = 8; type = SPIDIR_TYPE_I64; break;
+        case 30: lane_size = 8; type = SPIDIR_TYPE_I64; replace = true; break;
+        case 31: lane_size = 4; type = SPIDIR_TYPE_F32; break;
+        case 32: lane_size = 4; type = SPIDIR_TYPE_F32; replace = true; break;
+        case 33: lane_size = 8; type = SPIDIR_TYPE_F64; break;
+        case 34: lane_size = 8; type = SPIDIR_TYPE_F64; replace = true; break;
         default: CHECK_FAIL();
     }
+    CHECK(lane < 16 / lane_size);
 
-    // get the two values
-    spidir_value_t arg = JIT_POP(type);
+    if (replace) {
+        spidir_value_t value;
+        RETHROW(jit_pop_lane_value(builder, label, type, &value));
 
-    // and now perform the action
-    spidir_value_t value;
-    switch (opcode) {
-        case 0: value = spidir_builder_build_lzcount(builder, type, arg); break;
-        case 1: value = spidir_builder_build_tzcount(builder, type, arg); break;
-        case 2: value = spidir_builder_build_popcount(builder, type, arg); break;
-        default: CHECK_FAIL();
-    }
+        spidir_value_t v[2];
+        JIT_POP_V128(v);
+        jit_emit_set_lane(builder, v, lane_size, lane, value);
+        JIT_PUSH_V128(v);
+    } else {
+        spidir_value_t v[2];
+        JIT_POP_V128(v);
+        spidir_value_t value = jit_emit_get_lane(builder, v, lane_size, lane);
+
+        // narrow the lane bits into the scalar
+        if (lane_size < 8) {
+            value = spidir_builder_build_itrunc(builder, value);
+            if (sign_extend) {
+                value = spidir_builder_build_sfill(builder, lane_size * 8, value);
+            } else if (lane_size < 4) {
+                value = spidir_builder_build_and(builder, value,
+                    spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, jit_get_lane_mask(lane_size)));
+            }
+        }
 
-    // and push it back
-    JIT_PUSH(type, value);
+        if (type == SPIDIR_TYPE_F32 || type == SPIDIR_TYPE_F64) {
+            value = spidir_builder_build_bitcast(builder, type, value);
+        }
+
+        JIT_PUSH(type, value);
+    }
 
 cleanup:
     return err;
 }
 
-static wasm_err_t jit_wasm_binopi(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
+static wasm_err_t jit_wasm_simd_prefix(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    uint8_t opcode = ((uint8_t*)code->data)[-1];
+    uint32_t sub = BUFFER_PULL_U32(code);
 
-    // figure the exact type
-    spidir_value_type_t type;
-    switch (opcode) {
-        case 0x6A ... 0x73: type = SPIDIR_TYPE_I32; opcode -= 0x6A; break;
-        case 0x7C ... 0x85: type = SPIDIR_TYPE_I64; opcode -= 0x7C; break;
-        default: CHECK_FAIL();
+    spidir_value_t a[2], b[2], c[2];
+    jit_simd_shape_t shape;
+
+    // the lane type of the ops that are done one lane at a time, and the lane
+    // size of the ones done on a half at once, anything that is left at none
+    // goes to its helper
+    spidir_value_type_t lane_type = SPIDIR_TYPE_NONE;
+    uint32_t swar_lane_size = 0;
+    switch (sub) {
+        //
+        // Memory and lane accesses
+        //
+
+        case 0 ... 11:
+        case 84 ... 93:
+            RETHROW(jit_wasm_simd_memory(builder, code, ctx, func, label, sub));
+            goto cleanup;
+
+        case 21 ... 34:
+            RETHROW(jit_wasm_simd_lane(builder, code, ctx, func, label, sub));
+            goto cleanup;
+
+        //
+        // Done directly on the halves
+        //
+
+        // v128.const
+        case 12: {
+            a[0] = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, BUFFER_PULL(uint64_t, code));
+            a[1] = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, BUFFER_PULL(uint64_t, code));
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // i8x16.splat ... f64x2.splat
+        case 15 ... 20: {
+            static const uint32_t lane_sizes[] = { 1, 2, 4, 8, 4, 8 };
+            static const spidir_value_type_t lane_types[] = {
+                SPIDIR_TYPE_I32, SPIDIR_TYPE_I32, SPIDIR_TYPE_I32, SPIDIR_TYPE_I64, SPIDIR_TYPE_F32, SPIDIR_TYPE_F64
+            };
+            spidir_value_t value;
+            RETHROW(jit_pop_lane_value(builder, label, lane_types[sub - 15], &value));
+            a[0] = a[1] = jit_emit_splat(builder, value, lane_sizes[sub - 15]);
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // v128.not
+        case 77: {
+            JIT_POP_V128(a);
+            spidir_value_t ones = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT64_MAX);
+            for (int i = 0; i < 2; i++) {
+                a[i] = spidir_builder_build_xor(builder, a[i], ones);
+            }
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // v128.and, v128.andnot, v128.or, v128.xor
+        case 78 ... 81: {
+            JIT_POP_V128(b);
+            JIT_POP_V128(a);
+            spidir_value_t ones = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT64_MAX);
+            for (int i = 0; i < 2; i++) {
+                switch (sub) {
+                    case 78: a[i] = spidir_builder_build_and(builder, a[i], b[i]); break;
+                    case 79: a[i] = spidir_builder_build_and(builder, a[i], spidir_builder_build_xor(builder, b[i], ones)); break;
+                    case 80: a[i] = spidir_builder_build_or(builder, a[i], b[i]); break;
+                    case 81: a[i] = spidir_builder_build_xor(builder, a[i], b[i]); break;
+                }
+            }
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // v128.bitselect, (a & c) | (b & ~c)
+        case 82: {
+            JIT_POP_V128(c);
+            JIT_POP_V128(b);
+            JIT_POP_V128(a);
+            spidir_value_t ones = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT64_MAX);
+            for (int i = 0; i < 2; i++) {
+                a[i] = spidir_builder_build_or(builder,
+                    spidir_builder_build_and(builder, a[i], c[i]),
+                    spidir_builder_build_and(builder, b[i], spidir_builder_build_xor(builder, c[i], ones)));
+            }
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // v128.any_true
+        case 83: {
+            JIT_POP_V128(a);
+            spidir_value_t any = spidir_builder_build_or(builder, a[0], a[1]);
+            JIT_PUSH(SPIDIR_TYPE_I32, spidir_builder_build_icmp(builder, SPIDIR_ICMP_NE, SPIDIR_TYPE_I32,
+                any, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 0)));
+        } goto cleanup;
+
+        // i8x16.all_true ... i64x2.all_true, a lane is zero when subtracting 1 from
+        // it borrows into its high bit while the high bit of the lane is clear. The
+        // borrow can carry into the lanes above, but only when there is a zero lane
+        case 99: case 131: case 163: case 195: {
+            uint32_t lane_size = 1 << ((sub - 99) / 32);
+            JIT_POP_V128(a);
+            spidir_value_t ones = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT64_MAX);
+            spidir_value_t low = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT64_MAX / jit_get_lane_mask(lane_size));
+            spidir_value_t high = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, jit_get_lanes_high_bits(lane_size));
+            spidir_value_t zeros[2];
+            for (int i = 0; i < 2; i++) {
+                zeros[i] = spidir_builder_build_and(builder,
+                    spidir_builder_build_and(builder,
+                        spidir_builder_build_isub(builder, a[i], low),
+                        spidir_builder_build_xor(builder, a[i], ones)),
+                    high);
+            }
+            JIT_PUSH(SPIDIR_TYPE_I32, spidir_builder_build_icmp(builder, SPIDIR_ICMP_EQ, SPIDIR_TYPE_I32,
+                spidir_builder_build_or(builder, zeros[0], zeros[1]), spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 0)));
+        } goto cleanup;
+
+        // i8x16.bitmask ... i64x2.bitmask, the high bit of every lane is moved to the
+        // bottom of the lane, and a multiply gathers all of them at the top of the half
+        case 100: case 132: case 164: case 196: {
+            uint32_t lane_size = 1 << ((sub - 100) / 32);
+            uint32_t lane_bits = lane_size * 8;
+            uint32_t lanes = 8 / lane_size;
+            uint64_t gather = 0;
+            for (int i = 0; i < lanes; i++) {
+                gather |= 1ull << (64 - lanes - i * (lane_bits - 1));
+            }
+
+            JIT_POP_V128(a);
+            spidir_value_t high = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, jit_get_lanes_high_bits(lane_size));
+            spidir_value_t mask[2];
+            for (int i = 0; i < 2; i++) {
+                spidir_value_t bits = spidir_builder_build_lshr(builder,
+                    spidir_builder_build_and(builder, a[i], high),
+                    spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, lane_bits - 1));
+                bits = spidir_builder_build_imul(builder, bits, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, gather));
+                mask[i] = spidir_builder_build_lshr(builder, bits, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 64 - lanes));
+            }
+            mask[1] = spidir_builder_build_shl(builder, mask[1], spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, lanes));
+            JIT_PUSH(SPIDIR_TYPE_I32, spidir_builder_build_itrunc(builder, spidir_builder_build_or(builder, mask[0], mask[1])));
+        } goto cleanup;
+
+        // i8x16.neg, i16x8.neg
+        case 97: case 129: {
+            JIT_POP_V128(a);
+            spidir_value_t zero = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 0);
+            for (int i = 0; i < 2; i++) {
+                a[i] = jit_emit_swar_add(builder, zero, a[i], sub == 97 ? 1 : 2, true);
+            }
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // i8x16.add, i8x16.sub, i16x8.add, i16x8.sub
+        case 110: case 113: case 142: case 145: {
+            JIT_POP_V128(b);
+            JIT_POP_V128(a);
+            for (int i = 0; i < 2; i++) {
+                a[i] = jit_emit_swar_add(builder, a[i], b[i], sub < 128 ? 1 : 2, sub == 113 || sub == 145);
+            }
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // the shifts come in the order shl, shr_s, shr_u for every shape, the bits
+        // that move into the next lane are masked away
+        case 107 ... 109:
+        case 139 ... 141:
+        case 171 ... 173:
+        case 203 ... 205: {
+            uint32_t lane_size = 1 << ((sub - 107) / 32);
+            uint32_t op = (sub - 107) % 32;
+            spidir_value_t count = spidir_builder_build_and(builder,
+                jit_emit_zext64(builder, JIT_POP(SPIDIR_TYPE_I32)),
+                spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, lane_size * 8 - 1));
+            JIT_POP_V128(a);
+
+            if (lane_size == 8) {
+                for (int i = 0; i < 2; i++) {
+                    switch (op) {
+                        case 0: a[i] = spidir_builder_build_shl(builder, a[i], count); break;
+                        case 1: a[i] = spidir_builder_build_ashr(builder, a[i], count); break;
+                        case 2: a[i] = spidir_builder_build_lshr(builder, a[i], count); break;
+                    }
+                }
+            } else if (op == 1 && lane_size == 4) {
+                // i32x4.shr_s, the high lane already has the sign above it
+                spidir_value_t low_mask = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT32_MAX);
+                spidir_value_t high_mask = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, ~(uint64_t)UINT32_MAX);
+                for (int i = 0; i < 2; i++) {
+                    spidir_value_t low = spidir_builder_build_ashr(builder, spidir_builder_build_sfill(builder, 32, a[i]), count);
+                    spidir_value_t high = spidir_builder_build_ashr(builder, a[i], count);
+                    a[i] = spidir_builder_build_or(builder,
+                        spidir_builder_build_and(builder, low, low_mask),
+                        spidir_builder_build_and(builder, high, high_mask));
+                }
+            } else {
+                spidir_value_t lane_mask = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, jit_get_lane_mask(lane_size));
+                spidir_value_t keep = op == 0 ?
+                    spidir_builder_build_shl(builder, lane_mask, count) :
+                    spidir_builder_build_lshr(builder, lane_mask, count);
+                keep = jit_emit_splat(builder, keep, lane_size);
+                spidir_value_t high = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, jit_get_lanes_high_bits(lane_size));
+                spidir_value_t ones = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, UINT64_MAX);
+                for (int i = 0; i < 2; i++) {
+                    spidir_value_t value = spidir_builder_build_and(builder,
+                        op == 0 ? spidir_builder_build_shl(builder, a[i], count) : spidir_builder_build_lshr(builder, a[i], count),
+                        keep);
+
+                    // i8x16.shr_s and i16x8.shr_s fill the bits the shift cleared
+                    // with the sign of their lane
+                    if (op == 1) {
+                        spidir_value_t sign = jit_emit_swar_expand(builder, spidir_builder_build_and(builder, a[i], high), lane_size);
+                        value = spidir_builder_build_or(builder, value,
+                            spidir_builder_build_and(builder, sign, spidir_builder_build_xor(builder, keep, ones)));
+                    }
+                    a[i] = value;
+                }
+            }
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // the extends come in the order extend_low_s, extend_high_s, extend_low_u,
+        // extend_high_u for i16x8, i32x4 and i64x2
+        case 135 ... 138:
+        case 167 ... 170:
+        case 199 ... 202: {
+            uint32_t lane_size = 1 << ((sub - 135) / 32);
+            uint32_t op = (sub - 135) % 32;
+            JIT_POP_V128(a);
+            jit_emit_extend_lanes(builder, a[op % 2], lane_size, op < 2, a);
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // the extmuls come in the same order as the extends, both sides are
+        // extended and then multiplied like the wide lanes
+        case 156 ... 159:
+        case 188 ... 191:
+        case 220 ... 223: {
+            static const uint32_t mul_ops[] = { 149, 181, 213 };
+            uint32_t shape_index = (sub - 156) / 32;
+            uint32_t lane_size = 1 << shape_index;
+            uint32_t op = (sub - 156) % 32;
+            JIT_POP_V128(b);
+            JIT_POP_V128(a);
+            jit_emit_extend_lanes(builder, a[op % 2], lane_size, op < 2, a);
+            jit_emit_extend_lanes(builder, b[op % 2], lane_size, op < 2, b);
+            RETHROW(jit_emit_simd_lanewise(builder, mul_ops[shape_index], lane_size == 4 ? SPIDIR_TYPE_I64 : SPIDIR_TYPE_I32, a, b));
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // i8x16.narrow_i16x8_s/u, i16x8.narrow_i32x4_s/u, every half of the
+        // inputs packs into a quarter of the result
+        case 101: case 102:
+        case 133: case 134: {
+            uint32_t lane_size = sub < 128 ? 2 : 4;
+            bool is_signed = sub == 101 || sub == 133;
+            JIT_POP_V128(b);
+            JIT_POP_V128(a);
+            spidir_value_t thirty_two = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 32);
+            spidir_value_t* halves[] = { a, b };
+            spidir_value_t v[2];
+            for (int i = 0; i < 2; i++) {
+                v[i] = spidir_builder_build_or(builder,
+                    jit_emit_narrow_lanes(builder, halves[i][0], lane_size, is_signed),
+                    spidir_builder_build_shl(builder, jit_emit_narrow_lanes(builder, halves[i][1], lane_size, is_signed), thirty_two));
+            }
+            JIT_PUSH_V128(v);
+        } goto cleanup;
+
+        // i8x16.shuffle, the lane indices are known so every result byte is moved
+        // from its source with shifts. Bytes that come one after the other in the
+        // same half of the source are moved together
+        case 13: {
+            uint8_t lanes[16];
+            for (int i = 0; i < 16; i++) {
+                lanes[i] = BUFFER_PULL(uint8_t, code);
+                CHECK(lanes[i] < 32);
+            }
+            JIT_POP_V128(b);
+            JIT_POP_V128(a);
+            spidir_value_t sources[] = { a[0], a[1], b[0], b[1] };
+
+            spidir_value_t v[2];
+            for (int i = 0; i < 2; i++) {
+                v[i] = SPIDIR_VALUE_INVALID;
+                uint8_t* half = &lanes[i * 8];
+                for (uint32_t j = 0; j < 8;) {
+                    uint32_t run = 1;
+                    while (j + run < 8 && half[j + run] == half[j] + run && (half[j] + run) % 8 != 0) {
+                        run++;
+                    }
+
+                    uint32_t from = (half[j] % 8) * 8;
+                    spidir_value_t value = sources[half[j] / 8];
+                    if (from != 0) {
+                        value = spidir_builder_build_lshr(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, from));
+                    }
+                    if ((half[j] % 8) + run != 8) {
+                        value = spidir_builder_build_and(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, jit_get_lane_mask(run)));
+                    }
+                    if (j != 0) {
+                        value = spidir_builder_build_shl(builder, value, spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, j * 8));
+                    }
+
+                    v[i] = v[i].id == SPIDIR_VALUE_INVALID.id ? value : spidir_builder_build_or(builder, v[i], value);
+                    j += run;
+                }
+            }
+            JIT_PUSH_V128(v);
+        } goto cleanup;
+
+        // f32x4.demote_f64x2_zero
+        case 94: {
+            JIT_POP_V128(a);
+            spidir_value_t lanes[4];
+            jit_emit_split_lanes(builder, a, SPIDIR_TYPE_F64, lanes);
+            for (int i = 0; i < 2; i++) {
+                lanes[i] = spidir_builder_build_bitcast(builder, SPIDIR_TYPE_I32, spidir_builder_build_fnarrow(builder, lanes[i]));
+            }
+            lanes[2] = lanes[3] = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I32, 0);
+            jit_emit_join_lanes(builder, lanes, false, a);
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // f64x2.promote_low_f32x4
+        case 95: {
+            JIT_POP_V128(a);
+            spidir_value_t lanes[4];
+            jit_emit_split_lanes(builder, a, SPIDIR_TYPE_F32, lanes);
+            for (int i = 0; i < 2; i++) {
+                lanes[i] = spidir_builder_build_bitcast(builder, SPIDIR_TYPE_I64, spidir_builder_build_fwiden(builder, lanes[i]));
+            }
+            jit_emit_join_lanes(builder, lanes, true, a);
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        // f64x2.convert_low_i32x4_s/u, the lanes are extended to i64 first
+        // which fits the unsigned ones as well
+        case 254: case 255: {
+            JIT_POP_V128(a);
+            jit_emit_extend_i32_lanes(builder, a[0], sub == 254, a);
+            for (int i = 0; i < 2; i++) {
+                a[i] = spidir_builder_build_bitcast(builder, SPIDIR_TYPE_I64, spidir_builder_build_sinttofloat(builder, SPIDIR_TYPE_F64, a[i]));
+            }
+            JIT_PUSH_V128(a);
+        } goto cleanup;
+
+        //
+        // Done on all the lanes of a half at once
+        //
+
+        case 35 ... 44:         // i8x16 comparisons
+        case 111 ... 112:       // i8x16.add_sat_*
+        case 114 ... 115:       // i8x16.sub_sat_*
+        case 118 ... 121:       // i8x16 min/max
+        case 123:               // i8x16.avgr_u
+            swar_lane_size = 1;
+            shape = JIT_SIMD_BINARY;
+            break;
+
+        case 45 ... 54:         // i16x8 comparisons
+        case 143 ... 144:       // i16x8.add_sat_*
+        case 146 ... 147:       // i16x8.sub_sat_*
+        case 150 ... 153:       // i16x8 min/max
+        case 155:               // i16x8.avgr_u
+            swar_lane_size = 2;
+            shape = JIT_SIMD_BINARY;
+            break;
+
+        case 96: case 98:       // i8x16.abs, i8x16.popcnt
+        case 124: case 125:     // i16x8.extadd_pairwise_i8x16_*
+            swar_lane_size = 1;
+            shape = JIT_SIMD_UNARY;
+            break;
+
+        case 128:               // i16x8.abs
+        case 126: case 127:     // i32x4.extadd_pairwise_i16x8_*
+            swar_lane_size = 2;
+            shape = JIT_SIMD_UNARY;
+            break;
+
+        //
+        // Done one lane at a time
+        //
+
+        case 55 ... 64:         // i32x4 comparisons
+        case 130:               // i16x8.q15mulr_sat_s
+        case 149:               // i16x8.mul
+        case 174: case 177:     // i32x4.add, i32x4.sub
+        case 181 ... 186:       // i32x4.mul, i32x4 min/max, i32x4.dot_i16x8_s
+            lane_type = SPIDIR_TYPE_I32;
+            shape = JIT_SIMD_BINARY;
+            break;
+
+        case 160: case 161:     // i32x4.abs, i32x4.neg
+        case 224: case 225:     // f32x4.abs, f32x4.neg
+        case 250: case 251:     // f32x4.convert_i32x4_*
+            lane_type = SPIDIR_TYPE_I32;
+            shape = JIT_SIMD_UNARY;
+            break;
+
+        case 206: case 209:     // i64x2.add, i64x2.sub
+        case 213 ... 219:       // i64x2.mul, i64x2 comparisons
+            lane_type = SPIDIR_TYPE_I64;
+            shape = JIT_SIMD_BINARY;
+            break;
+
+        case 192: case 193:     // i64x2.abs, i64x2.neg
+        case 236: case 237:     // f64x2.abs, f64x2.neg
+            lane_type = SPIDIR_TYPE_I64;
+            shape = JIT_SIMD_UNARY;
+            break;
+
+        case 65 ... 70:         // f32x4 comparisons
+        case 228 ... 231:       // f32x4 arithmetic
+        case 234: case 235:     // f32x4.pmin, f32x4.pmax
+            lane_type = SPIDIR_TYPE_F32;
+            shape = JIT_SIMD_BINARY;
+            break;
+
+        case 71 ... 76:         // f64x2 comparisons
+        case 240 ... 243:       // f64x2 arithmetic
+        case 246: case 247:     // f64x2.pmin, f64x2.pmax
+            lane_type = SPIDIR_TYPE_F64;
+            shape = JIT_SIMD_BINARY;
+            break;
+
+        //
+        // Done by the helpers
+        //
+
+        case 103 ... 106:       // f32x4.ceil ... f32x4.nearest
+        case 116: case 117:     // f64x2.ceil, f64x2.floor
+        case 122:               // f64x2.trunc
+        case 148:               // f64x2.nearest
+        case 227:               // f32x4.sqrt
+        case 239:               // f64x2.sqrt
+        case 248: case 249:     // i32x4.trunc_sat_f32x4_*
+        case 252: case 253:     // i32x4.trunc_sat_f64x2_*_zero
+            shape = JIT_SIMD_UNARY;
+            break;
+
+        case 14:                // i8x16.swizzle
+        case 232: case 233:     // f32x4.min, f32x4.max
+        case 244: case 245:     // f64x2.min, f64x2.max
+            shape = JIT_SIMD_BINARY;
+            break;
+
+        default: CHECK_FAIL("Unsupported simd sub-opcode %d", sub);
     }
 
-    // get the two values
-    spidir_value_t arg2 = JIT_POP(type);
-    spidir_value_t arg1 = JIT_POP(type);
+    // pop the operands based on the shape
+    spidir_value_t zero = spidir_builder_build_iconst(builder, SPIDIR_TYPE_I64, 0);
+    b[0] = b[1] = zero;
+    switch (shape) {
+        case JIT_SIMD_UNARY:
+            JIT_POP_V128(a);
+            break;
 
-    // and now perform the action
-    spidir_value_t value;
-    switch (opcode) {
-        case 0: value = spidir_builder_build_iadd(builder, arg1, arg2); break;
-        case 1: value = spidir_builder_build_isub(builder, arg1, arg2); break;
-        case 2: value = spidir_builder_build_imul(builder, arg1, arg2); break;
-        case 3: value = spidir_builder_build_sdiv(builder, arg1, arg2); break;
-        case 4: value = spidir_builder_build_udiv(builder, arg1, arg2); break;
-        case 5: {
-            // we are going to have `(arg1 & ((arg2 == -1) - 1)) % arg2`, that way if arg2 is -1, we will 
-            // mask out the entire arg1 which always results in 1 as expected, meanwhile, if its not -1,
-            // then it will turn into an ffs mask, which will not change anything letting it run normally, 
-            // this is required to handle the edge case of INT_MAX % -1, which is defined in wasm but is not 
-            // defined in spidir (and will actually trap on x86)
-            spidir_value_t minus_one = spidir_builder_build_iconst(builder, type, type == SPIDIR_TYPE_I32 ? (uint32_t)-1 : (uint64_t)-1);
-            spidir_value_t is_neg_one = spidir_builder_build_icmp(builder, SPIDIR_ICMP_EQ, type, arg2, minus_one);
-            spidir_value_t arg1_mask = spidir_builder_build_isub(builder, is_neg_one, spidir_builder_build_iconst(builder, type, 1));
-            arg1 = spidir_builder_build_and(builder, arg1, arg1_mask);
-            value = spidir_builder_build_srem(builder, arg1, arg2); break;
-        } break;
-        case 6: value = spidir_builder_build_urem(builder, arg1, arg2); break;
-        case 7: value = spidir_builder_build_and(builder, arg1, arg2); break;
-        case 8: value = spidir_builder_build_or(builder, arg1, arg2); break;
-        case 9: value = spidir_builder_build_xor(builder, arg1, arg2); break;
-        default: CHECK_FAIL();
+        case JIT_SIMD_BINARY:
+            JIT_POP_V128(b);
+            JIT_POP_V128(a);
+            break;
     }
 
-    // and push it back
-    JIT_PUSH(type, value);
+    if (lane_type != SPIDIR_TYPE_NONE) {
+        RETHROW(jit_emit_simd_lanewise(builder, sub, lane_type, a, shape == JIT_SIMD_BINARY ? b : nullptr));
+    } else if (swar_lane_size != 0) {
+        for (int i = 0; i < 2; i++) {
+            RETHROW(jit_emit_swar_op(builder, sub, swar_lane_size, a[i], b[i], &a[i]));
+        }
+    } else {
+        spidir_value_t area;
+        RETHROW(jit_emit_simd_helper(builder, ctx, sub, a, b, &area));
+        jit_emit_load_v128(builder, area, a);
+    }
+    JIT_PUSH_V128(a);
 
 cleanup:
     return err;
@@ -1653,14 +4410,14 @@ static wasm_err_t jit_wasm_atomic_notify(spidir_builder_handle_t builder, buffer
 
     // get the memory argument
     wasm_mem_arg_t mem_arg = {};
-    RETHROW(jit_pull_memarg(code, &mem_arg));
+    RETHROW(jit_pull_memarg(code, ctx, &mem_arg));
 
     spidir_value_t count = JIT_POP(SPIDIR_TYPE_I32);
-    spidir_value_t offset = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t offset = JIT_POP(jit_get_address_type(mem_arg.memory));
 
     // calculate the address
     spidir_value_t addr = SPIDIR_VALUE_INVALID;
-    RETHROW(jit_wasm_calculate_addr(builder, &mem_arg, offset, &addr));
+    RETHROW(jit_wasm_calculate_addr(builder, ctx, func, &mem_arg, offset, &addr));
 
     // get the helper
     spidir_funcref_t helper;
@@ -1680,7 +4437,7 @@ static wasm_err_t jit_wasm_atomic_wait(spidir_builder_handle_t builder, buffer_t
 
     // get the memory argument
     wasm_mem_arg_t mem_arg = {};
-    RETHROW(jit_pull_memarg(code, &mem_arg));
+    RETHROW(jit_pull_memarg(code, ctx, &mem_arg));
 
     // the size of the waiter
     spidir_value_type_t type;
@@ -1694,11 +4451,11 @@ static wasm_err_t jit_wasm_atomic_wait(spidir_builder_handle_t builder, buffer_t
     // the arguments
     spidir_value_t timeout = JIT_POP(SPIDIR_TYPE_I64);
     spidir_value_t expected = JIT_POP(type);
-    spidir_value_t offset = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t offset = JIT_POP(jit_get_address_type(mem_arg.memory));
 
     // calculate the address
     spidir_value_t addr = SPIDIR_VALUE_INVALID;
-    RETHROW(jit_wasm_calculate_addr(builder, &mem_arg, offset, &addr));
+    RETHROW(jit_wasm_calculate_addr(builder, ctx, func, &mem_arg, offset, &addr));
 
     // get the helper
     spidir_funcref_t helper;
@@ -1718,7 +4475,7 @@ static wasm_err_t jit_wasm_atomic_store(spidir_builder_handle_t builder, buffer_
 
     // get the memory argument
     wasm_mem_arg_t mem_arg = {};
-    RETHROW(jit_pull_memarg(code, &mem_arg));
+    RETHROW(jit_pull_memarg(code, ctx, &mem_arg));
 
     // figure the operand size
     spidir_value_type_t type;
@@ -1733,11 +4490,11 @@ static wasm_err_t jit_wasm_atomic_store(spidir_builder_handle_t builder, buffer_
 
     // get the values
     spidir_value_t value = JIT_POP(type);
-    spidir_value_t offset = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t offset = JIT_POP(jit_get_address_type(mem_arg.memory));
 
     // calculate the address
     spidir_value_t addr = SPIDIR_VALUE_INVALID;
-    RETHROW(jit_wasm_calculate_addr(builder, &mem_arg, offset, &addr));
+    RETHROW(jit_wasm_calculate_addr(builder, ctx, func, &mem_arg, offset, &addr));
 
     // get the helper
     spidir_funcref_t helper;
@@ -1756,7 +4513,7 @@ static wasm_err_t jit_wasm_atomic_load(spidir_builder_handle_t builder, buffer_t
 
     // get the memory argument
     wasm_mem_arg_t mem_arg = {};
-    RETHROW(jit_pull_memarg(code, &mem_arg));
+    RETHROW(jit_pull_memarg(code, ctx, &mem_arg));
 
     // figure the operand size
     spidir_value_type_t type;
@@ -1770,11 +4527,11 @@ static wasm_err_t jit_wasm_atomic_load(spidir_builder_handle_t builder, buffer_t
     }
 
     // get the values
-    spidir_value_t offset = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t offset = JIT_POP(jit_get_address_type(mem_arg.memory));
 
     // calculate the address
     spidir_value_t addr = SPIDIR_VALUE_INVALID;
-    RETHROW(jit_wasm_calculate_addr(builder, &mem_arg, offset, &addr));
+    RETHROW(jit_wasm_calculate_addr(builder, ctx, func, &mem_arg, offset, &addr));
 
     // get the helper
     spidir_funcref_t helper;
@@ -1798,7 +4555,7 @@ static wasm_err_t jit_wasm_atomic_rmw_cmpexchg(spidir_builder_handle_t builder,
 
     // get the memory argument
     wasm_mem_arg_t mem_arg = {};
-    RETHROW(jit_pull_memarg(code, &mem_arg));
+    RETHROW(jit_pull_memarg(code, ctx, &mem_arg));
 
     // figure the operand size
     spidir_value_type_t type;
@@ -1814,11 +4571,11 @@ static wasm_err_t jit_wasm_atomic_rmw_cmpexchg(spidir_builder_handle_t builder,
     // get the values
     spidir_value_t replacement = JIT_POP(type);
     spidir_value_t expected = JIT_POP(type);
-    spidir_value_t offset = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t offset = JIT_POP(jit_get_address_type(mem_arg.memory));
 
     // calculate the address
     spidir_value_t addr = SPIDIR_VALUE_INVALID;
-    RETHROW(jit_wasm_calculate_addr(builder, &mem_arg, offset, &addr));
+    RETHROW(jit_wasm_calculate_addr(builder, ctx, func, &mem_arg, offset, &addr));
 
     // get the helper
     spidir_funcref_t helper;
@@ -1840,7 +4597,7 @@ static wasm_err_t jit_wasm_atomic_rmw_binop(spidir_builder_handle_t builder, buf
 
     // get the memory argument
     wasm_mem_arg_t mem_arg = {};
-    RETHROW(jit_pull_memarg(code, &mem_arg));
+    RETHROW(jit_pull_memarg(code, ctx, &mem_arg));
 
     // figure the operand size
     spidir_value_type_t type;
@@ -1881,11 +4638,11 @@ static wasm_err_t jit_wasm_atomic_rmw_binop(spidir_builder_handle_t builder, buf
 
     // get the values
     spidir_value_t arg2 = JIT_POP(type);
-    spidir_value_t offset = JIT_POP(SPIDIR_TYPE_I32);
+    spidir_value_t offset = JIT_POP(jit_get_address_type(mem_arg.memory));
 
     // calculate the address
     spidir_value_t addr = SPIDIR_VALUE_INVALID;
-    RETHROW(jit_wasm_calculate_addr(builder, &mem_arg, offset, &addr));
+    RETHROW(jit_wasm_calculate_addr(builder, ctx, func, &mem_arg, offset, &addr));
 
     // get the helper
     spidir_funcref_t helper;
@@ -1932,6 +4689,12 @@ static wasm_err_t jit_wasm_fc_prefix(spidir_builder_handle_t builder, buffer_t*
         case 9: RETHROW(jit_wasm_data_drop(builder, code, ctx, func, label)); break;
         case 10: RETHROW(jit_wasm_memory_copy(builder, code, ctx, func, label)); break;
         case 11: RETHROW(jit_wasm_memory_fill(builder, code, ctx, func, label)); break;
+        case 12: RETHROW(jit_wasm_table_init(builder, code, ctx, func, label)); break;
+        case 13: RETHROW(jit_wasm_elem_drop(builder, code, ctx, func, label)); break;
+        case 14: RETHROW(jit_wasm_table_copy(builder, code, ctx, func, label)); break;
+        case 15: RETHROW(jit_wasm_table_grow(builder, code, ctx, func, label)); break;
+        case 16: RETHROW(jit_wasm_table_size(builder, code, ctx, func, label)); break;
+        case 17: RETHROW(jit_wasm_table_fill(builder, code, ctx, func, label)); break;
         default: CHECK_FAIL("Unsupported bulk-memory sub-opcode %x", sub);
     }
 
@@ -1942,11 +4705,11 @@ cleanup:
 static wasm_err_t jit_wasm_end(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // a block/loop result to hand back to the enclosing label once this one is
-    // popped (the function-body case returns instead, so never pushes).
-    bool push_result = false;
-    spidir_value_type_t push_type = SPIDIR_TYPE_NONE;
-    spidir_value_t push_value = SPIDIR_VALUE_INVALID;
+    // the block/loop results to hand back to the enclosing label once this one
+    // is popped (the function-body case returns instead, so never pushes).
+    const spidir_value_t* push_values = nullptr;
+    const bool* push_owned = nullptr;
+    uint32_t push_count = 0;
 
     // set when this label's continuation turns out to be unreachable (a loop
     // that only exits via inner branches, or a terminated block that nothing
@@ -1961,65 +4724,70 @@ static wasm_err_t jit_wasm_end(spidir_builder_handle_t builder, buffer_t* code,
         if (!label->terminated) {
             // this is a fallthrough from the entire function,
             // handle it like a return
-            spidir_value_t value = SPIDIR_VALUE_INVALID;
-            if (func->ret_type != SPIDIR_TYPE_NONE) {
-                value = JIT_POP(func->ret_type);
-            }
-            spidir_builder_build_return(builder, value);
+            jit_value_t* values;
+            RETHROW(jit_pop_values(label, func->result_types, func->result_count, &values));
+            RETHROW(jit_emit_return(builder, ctx, func, values, 0));
         }
 
     } else if (!label->loop) {
         if (!label->terminated) {
             // handle fallthrough from a block into its label, carrying the
-            // result (if any) as just another incoming edge to the merge
-            spidir_value_t result = SPIDIR_VALUE_INVALID;
-            if (label->result_type != SPIDIR_TYPE_NONE) {
-                result = JIT_POP(label->result_type);
-            }
-            RETHROW(jit_wasm_prepare_branch(builder, func, label, result));
+            // results (if any) as just another incoming edge to the merge
+            jit_value_t* values;
+            RETHROW(jit_pop_values(label, label->result_types, label->result_count, &values));
+            RETHROW(jit_wasm_prepare_branch(builder, func, label, values));
             spidir_builder_build_branch(builder, label->block);
         }
 
-        // locals_values is allocated lazily by the first prepare_branch into
-        // this label (the fallthrough above, or any inner `br` to it). If it's
-        // still null, nothing reaches the continuation: the block was terminated
-        // *and* no branch targeted it, so label->block has no predecessors and
-        // is dead code. Mirror the loop case — terminate the empty block and
-        // mark the enclosing label unreachable — rather than dereferencing the
-        // null locals array.
-        if (label->locals_values == nullptr) {
+        // inputs is counted by every prepare_branch into this label (the
+        // fallthrough above, or any inner `br` to it). If it's still zero,
+        // nothing reaches the continuation: the block was terminated *and* no
+        // branch targeted it, so label->block has no predecessors and is dead
+        // code. Mirror the loop case — terminate the empty block and mark the
+        // enclosing label unreachable — rather than reading the merged locals.
+        if (label->inputs == 0) {
             spidir_builder_set_block(builder, label->block);
             spidir_builder_build_unreachable(builder);
             propagate_terminated = true;
         } else {
-            // copy over all the locals from the merge
-            for (int i = 0; i < func->locals.length; i++) {
-                func->locals.elements[i].value = label->locals_values[i];
+            // copy over the written locals from the merge, the rest
+            // still hold the value they had when entering the block
+            for (int i = 0; i < label->written_count; i++) {
+                func->locals.elements[label->written_locals[i]].value = label->locals_values[i];
             }
 
             // and use the new block
             spidir_builder_set_block(builder, label->block);
 
-            // the merged result (a plain value or result_phi) lives in
-            // label->block and dominates the continuation, so hand it to the
-            // enclosing label
-            if (label->result_type != SPIDIR_TYPE_NONE) {
-                push_result = true;
-                push_type = label->result_type;
-                push_value = label->result_value;
-            }
+            // the merged results (plain values or branch_phis) live in
+            // label->block and dominate the continuation, so hand them to
+            // the enclosing label
+            push_values = label->branch_values;
+            push_owned = label->branch_owned;
+            push_count = label->result_count;
         }
     } else {
         spidir_block_t next_block = spidir_builder_create_block(builder);
 
-        // a loop's result is produced only on the fallthrough exit, so it has a
-        // single source and needs no phi: the value computed before the branch
-        // dominates next_block.
-        spidir_value_t result = SPIDIR_VALUE_INVALID;
+        // a loop's results are produced only on the fallthrough exit, so they
+        // have a single source and need no phi: the values computed before the
+        // branch dominate next_block.
+        spidir_value_t* results = nullptr;
+        bool* results_owned = nullptr;
         if (!label->terminated) {
-            if (label->result_type != SPIDIR_TYPE_NONE) {
-                result = JIT_POP(label->result_type);
+            jit_value_t* values;
+            RETHROW(jit_pop_values(label, label->result_types, label->result_count, &values));
+
+            // the label's stack goes away with it, so keep the results aside
+            results = ARENA_CALLOC(func->arena, spidir_value_t, label->result_count);
+            CHECK(results != nullptr);
+            results_owned = ARENA_CALLOC(func->arena, bool, label->result_count);
+            CHECK(results_owned != nullptr);
+            for (int i = 0; i < label->result_count; i++) {
+                results[i] = values[i].value;
+                results_owned[i] = values[i].owned;
             }
+
             spidir_builder_build_branch(builder, next_block);
         }
 
@@ -2030,11 +4798,9 @@ static wasm_err_t jit_wasm_end(spidir_builder_handle_t builder, buffer_t* code,
         spidir_builder_set_block(builder, next_block);
 
         if (!label->terminated) {
-            if (label->result_type != SPIDIR_TYPE_NONE) {
-                push_result = true;
-                push_type = label->result_type;
-                push_value = result;
-            }
+            push_values = results;
+            push_owned = results_owned;
+            push_count = label->result_count;
         } else {
             // the loop never falls through (it only exits via inner branches, e.g.
             // an infinite loop with an inner return), so next_block is unreachable:
@@ -2049,16 +4815,22 @@ static wasm_err_t jit_wasm_end(spidir_builder_handle_t builder, buffer_t* code,
     // which case the leftover operands are unreachable and discarded.
     CHECK(label->terminated || label->stack.length == 0);
 
-    // remove the block
+    // remove the block, the result types are not owned by
+    // the label so they are still valid after it is gone
+    const spidir_value_type_t* push_types = label->result_types;
     label = nullptr;
     jit_label_t top_label = vec_pop(&func->labels);
     jit_free_label(&top_label);
 
-    // hand the result back to the now-current (enclosing) label
-    if (push_result) {
+    // hand the results back to the now-current (enclosing) label
+    if (push_count != 0) {
         jit_label_t* parent = &vec_last(&func->labels);
-        jit_value_t v = { .type = push_type, .value = push_value };
-        vec_push(&parent->stack, v);
+        jit_value_t* values = vec_add(&parent->stack, push_count);
+        for (int i = 0; i < push_count; i++) {
+            values[i].type = push_types[i];
+            values[i].value = push_values[i];
+            values[i].owned = push_owned != nullptr && push_owned[i];
+        }
     }
 
     // the code right after a label whose continuation is unreachable is dead
@@ -2083,45 +4855,37 @@ cleanup:
     return err;
 }
 
-static wasm_err_t jit_skip_unreachable(
-    spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx,
-    jit_function_ctx_t* func, jit_label_t* label, uint8_t opcode
-) {
+/**
+ * Skip over the immediates of an already pulled opcode without emitting anything,
+ * this is shared between skipping unreachable code and scanning the function body
+ */
+static wasm_err_t jit_skip_immediates(buffer_t* code, uint8_t opcode) {
     wasm_err_t err = WASM_NO_ERROR;
 
     switch (opcode) {
-        // Structured control: each opens a nested frame that is itself entirely
-        // unreachable. Count the nesting so we know which `end` closes us.
+        // Structured control: only carries the block type.
         case 0x02:   // block
         case 0x03:   // loop
-        case 0x04: { // if
-            spidir_value_type_t ignored_type;
-            RETHROW(jit_wasm_pull_block_type(code, &ignored_type));
-            label->unreachable_depth++;
-        } break;
-
-        // `else` splits an if; it neither opens nor closes a frame. if/else is
-        // unimplemented, so a depth-0 else can't occur for a module we accept —
-        // treat it as a no-op that keeps skipping.
-        case 0x05: break;
+        case 0x04:   // if
+            // the block type is an s33, so it can be skipped like any other leb
+            RETHROW(jit_skip_leb(code));
+            break;
 
-        // `end` closes the innermost dead nested block; when none are left it
-        // closes the terminated frame itself, which the real handler finishes
-        // (restore the enclosing block, pop the label, propagate the result).
+        // `else` and `end` have no immediates.
+        case 0x05:
         case 0x0B:
-            if (label->unreachable_depth == 0) {
-                RETHROW(jit_wasm_end(builder, code, ctx, func, label));
-            } else {
-                label->unreachable_depth--;
-            }
             break;
 
         // Single LEB immediate (label / func / local / global index, or an
         // i32/i64 const — jit_skip_leb is value-agnostic so it covers both).
         case 0x0C:          // br
         case 0x0D:          // br_if
+        case 0x08:          // throw
         case 0x10:          // call
+        case 0x12:          // return_call
         case 0x20 ... 0x24: // local.get/set/tee, global.get/set
+        case 0x25 ... 0x26: // table.get/set
+        case 0xD2:          // ref.func
         case 0x41:          // i32.const
         case 0x42:          // i64.const
             RETHROW(jit_skip_leb(code));
@@ -2135,8 +4899,9 @@ static wasm_err_t jit_skip_unreachable(
             }
         } break;
 
-        // call_indirect: typeidx + tableidx.
+        // call_indirect / return_call_indirect: typeidx + tableidx.
         case 0x11:
+        case 0x13:
             RETHROW(jit_skip_leb(code));
             RETHROW(jit_skip_leb(code));
             break;
@@ -2145,15 +4910,38 @@ static wasm_err_t jit_skip_unreachable(
         // index quirk that jit_pull_memarg handles).
         case 0x28 ... 0x3E: { // loads / stores
             wasm_mem_arg_t ignored_arg;
-            RETHROW(jit_pull_memarg(code, &ignored_arg));
+            RETHROW(jit_parse_memarg(code, &ignored_arg));
         } break;
 
-        // memidx byte.
+        // memidx.
         case 0x3F: // memory.size
         case 0x40: // memory.grow
-            BUFFER_PULL(uint8_t, code);
+            RETHROW(jit_skip_leb(code));
             break;
 
+        // try_table: the block type and the vector of the catches, only
+        // catch and catch_ref have a tag before the label.
+        case 0x1F: {
+            RETHROW(jit_skip_leb(code));
+            uint32_t count = BUFFER_PULL_U32(code);
+            for (uint32_t i = 0; i < count; i++) {
+                uint8_t kind = BUFFER_PULL(uint8_t, code);
+                if (kind < 2) {
+                    RETHROW(jit_skip_leb(code));
+                }
+                RETHROW(jit_skip_leb(code));
+            }
+        } break;
+
+        // select with the vector of the result types.
+        case 0x1C: {
+            uint32_t count = BUFFER_PULL_U32(code);
+            CHECK(buffer_pull(code, count) != nullptr);
+        } break;
+
+        // ref.null carries the reference type.
+        case 0xD0: CHECK(buffer_pull(code, 1) != nullptr); break;
+
         // Fixed-width float constants.
         case 0x43: CHECK(buffer_pull(code, 4) != nullptr); break; // f32.const
         case 0x44: CHECK(buffer_pull(code, 8) != nullptr); break; // f64.const
@@ -2162,10 +4950,12 @@ static wasm_err_t jit_skip_unreachable(
         // numeric/comparison/conversion range.
         case 0x00:
         case 0x01:
+        case 0x0A: // throw_ref
         case 0x0F:
         case 0x1A:
         case 0x1B:
         case 0x45 ... 0xC4:
+        case 0xD1: // ref.is_null
             break;
 
         // Bulk-memory prefix — immediates mirror jit_wasm_fc_prefix.
@@ -2175,12 +4965,48 @@ static wasm_err_t jit_skip_unreachable(
                 case 0 ... 7: break;                                    // trunc_sat: none
                 case 8:                                                 // memory.init
                     RETHROW(jit_skip_leb(code));                        //   dataidx
-                    CHECK(buffer_pull(code, 1) != nullptr);            //   memidx
+                    RETHROW(jit_skip_leb(code));                        //   memidx
                     break;
                 case 9: RETHROW(jit_skip_leb(code)); break;             // data.drop: dataidx
-                case 10: CHECK(buffer_pull(code, 2) != nullptr); break; // memory.copy: 2 memidx
-                case 11: CHECK(buffer_pull(code, 1) != nullptr); break; // memory.fill: memidx
-                default: CHECK_FAIL("unsupported bulk-memory sub-opcode %x in unreachable code", sub);
+                case 10:                                                // memory.copy
+                    RETHROW(jit_skip_leb(code));                        //   dst memidx
+                    RETHROW(jit_skip_leb(code));                        //   src memidx
+                    break;
+                case 11: RETHROW(jit_skip_leb(code)); break;            // memory.fill: memidx
+                case 12:                                                // table.init
+                    RETHROW(jit_skip_leb(code));                        //   elemidx
+                    RETHROW(jit_skip_leb(code));                        //   tableidx
+                    break;
+                case 13: RETHROW(jit_skip_leb(code)); break;            // elem.drop: elemidx
+                case 14:                                                // table.copy
+                    RETHROW(jit_skip_leb(code));                        //   dst tableidx
+                    RETHROW(jit_skip_leb(code));                        //   src tableidx
+                    break;
+                case 15 ... 17: RETHROW(jit_skip_leb(code)); break;     // table.grow/size/fill: tableidx
+                default: CHECK_FAIL("unsupported bulk-memory sub-opcode %x", sub);
+            }
+        } break;
+
+        // SIMD prefix — immediates mirror jit_wasm_simd_prefix.
+        case 0xFD: {
+            uint32_t sub = BUFFER_PULL_U32(code);
+            switch (sub) {
+                case 0 ... 11:                                          // loads / stores
+                case 92 ... 93: {                                       // load zero
+                    wasm_mem_arg_t ignored_arg;
+                    RETHROW(jit_parse_memarg(code, &ignored_arg));
+                } break;
+                case 84 ... 91: {                                       // load / store lane
+                    wasm_mem_arg_t ignored_arg;
+                    RETHROW(jit_parse_memarg(code, &ignored_arg));
+                    CHECK(buffer_pull(code, 1) != nullptr);            //   lane
+                } break;
+                case 12 ... 13: CHECK(buffer_pull(code, 16) != nullptr); break; // v128.const, i8x16.shuffle
+                case 21 ... 34: CHECK(buffer_pull(code, 1) != nullptr); break;  // extract / replace lane
+                case 14 ... 20:
+                case 35 ... 83:
+                case 94 ... 255: break;                                 // none
+                default: CHECK_FAIL("unsupported simd sub-opcode %x", sub);
             }
         } break;
 
@@ -2192,17 +5018,170 @@ static wasm_err_t jit_skip_unreachable(
                 case 0x01 ... 0x02: // memory.atomic.wait32/64
                 case 0x10 ... 0x4E: { // atomic load/store/rmw/cmpxchg
                     wasm_mem_arg_t ignored_arg;
-                    RETHROW(jit_pull_memarg(code, &ignored_arg));
+                    RETHROW(jit_parse_memarg(code, &ignored_arg));
                 } break;
-                default: CHECK_FAIL("unsupported atomic sub-opcode %x in unreachable code", sub);
+                default: CHECK_FAIL("unsupported atomic sub-opcode %x", sub);
             }
         } break;
 
         default:
-            CHECK_FAIL("Unknown opcode 0x%x in unreachable code", opcode);
+            CHECK_FAIL("Unknown opcode 0x%x", opcode);
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_skip_unreachable(
+    spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx,
+    jit_function_ctx_t* func, jit_label_t* label, uint8_t opcode
+) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    RETHROW(jit_skip_immediates(code, opcode));
+
+    switch (opcode) {
+        // Structured control: each opens a nested frame that is itself entirely
+        // unreachable. Count the nesting so we know which `end` closes us, the
+        // scope is still consumed so the ones after it line up with the scan.
+        case 0x02:   // block
+        case 0x03:   // loop
+        case 0x04:   // if
+        case 0x1F:   // try_table
+            label->unreachable_depth++;
+            func->next_scope++;
+            break;
+
+        // `else` splits an if; it neither opens nor closes a frame. if/else is
+        // unimplemented, so a depth-0 else can't occur for a module we accept —
+        // treat it as a no-op that keeps skipping.
+        case 0x05: break;
+
+        // `end` closes the innermost dead nested block; when none are left it
+        // closes the terminated frame itself, which the real handler finishes
+        // (restore the enclosing block, pop the label, propagate the result).
+        case 0x0B:
+            if (label->unreachable_depth == 0) {
+                RETHROW(jit_wasm_end(builder, code, ctx, func, label));
+            } else {
+                label->unreachable_depth--;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+cleanup:
+    return err;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Locals scan
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct jit_scan_frame {
+    // the scope this frame belongs to
+    uint32_t scope;
+
+    // the locals written so far in the scope
+    vec(uint32_t) written;
+} jit_scan_frame_t;
+
+wasm_err_t jit_scan_locals(buffer_t code, jit_function_ctx_t* func) {
+    wasm_err_t err = WASM_NO_ERROR;
+    vec(jit_scan_frame_t) frames = {};
+    uint32_t depth = 0;
+
+    // For every local, how many of the outermost open frames already have it
+    // as written. A write always goes into all the open frames, so the frames
+    // that have it are always a prefix of the open frames, which means every
+    // local is added at most once to every frame.
+    uint32_t* covered = ARENA_CALLOC(func->arena, uint32_t, func->locals.length);
+    CHECK(covered != nullptr);
+
+    while (code.len != 0) {
+        uint8_t opcode = BUFFER_PULL(uint8_t, &code);
+        switch (opcode) {
+            case 0x02:   // block
+            case 0x03:   // loop
+            case 0x04:   // if
+            case 0x1F: { // try_table
+                RETHROW(jit_skip_immediates(&code, opcode));
+
+                // frames are kept around when closed so their
+                // written vectors are reused by later scopes
+                if (depth == frames.length) {
+                    jit_scan_frame_t* frame = vec_add(&frames, 1);
+                    memset(frame, 0, sizeof(*frame));
+                }
+                frames.elements[depth++].scope = func->scopes.length;
+
+                jit_scope_t* scope = vec_add(&func->scopes, 1);
+                memset(scope, 0, sizeof(*scope));
+            } break;
+
+            case 0x0B: {
+                // the last end closes the function body which is not a scope
+                if (depth == 0) {
+                    break;
+                }
+
+                // the enclosing frames keep these locals
+                jit_scan_frame_t* frame = &frames.elements[--depth];
+                for (int i = 0; i < frame->written.length; i++) {
+                    covered[frame->written.elements[i]] = depth;
+                }
+
+                // and move the written locals into the scope
+                jit_scope_t* scope = &func->scopes.elements[frame->scope];
+                scope->locals_offset = func->scope_locals.length;
+                scope->locals_count = frame->written.length;
+                if (frame->written.length != 0) {
+                    uint32_t* locals = vec_add(&func->scope_locals, frame->written.length);
+                    memcpy(locals, frame->written.elements, frame->written.length * sizeof(uint32_t));
+                }
+                frame->written.length = 0;
+            } break;
+
+            case 0x12: { // return_call
+                // a tail call to ourselves needs the params to be phis
+                if (BUFFER_PULL_U32(&code) == func->funcidx) {
+                    func->tail_call_self = true;
+                }
+            } break;
+
+            case 0x21:   // local.set
+            case 0x22: { // local.tee
+                uint32_t index = BUFFER_PULL_U32(&code);
+                uint32_t slot, count;
+                RETHROW(jit_get_local_slots(func, index, &slot, &count));
+
+                // add to all of the open frames that don't have it yet, both
+                // halves of a v128 are written together
+                for (uint32_t j = slot; j < slot + count; j++) {
+                    for (uint32_t i = covered[j]; i < depth; i++) {
+                        vec_push(&frames.elements[i].written, j);
+                    }
+                    covered[j] = depth;
+                }
+            } break;
+
+            default:
+                RETHROW(jit_skip_immediates(&code, opcode));
+                break;
+        }
     }
 
+    // every scope must have been closed
+    CHECK(depth == 0);
+
 cleanup:
+    for (int i = 0; i < frames.length; i++) {
+        vec_free(&frames.elements[i].written);
+    }
+    vec_free(&frames);
+
     return err;
 }
 
@@ -2228,16 +5207,22 @@ wasm_err_t jit_wasm_opcode(spidir_builder_handle_t builder, buffer_t* code, jit_
         case 0x01: RETHROW(jit_wasm_nop(builder, code, ctx, func, label)); break;
         case 0x1A: RETHROW(jit_wasm_drop(builder, code, ctx, func, label)); break;
         case 0x1B: RETHROW(jit_wasm_select(builder, code, ctx, func, label)); break;
+        case 0x1C: RETHROW(jit_wasm_select_t(builder, code, ctx, func, label)); break;
 
         // Control Instructions
         case 0x02: RETHROW(jit_wasm_block(builder, code, ctx, func, label)); break;
         case 0x03: RETHROW(jit_wasm_loop(builder, code, ctx, func, label)); break;
+        case 0x08: RETHROW(jit_wasm_throw(builder, code, ctx, func, label)); break;
+        case 0x0A: RETHROW(jit_wasm_throw_ref(builder, code, ctx, func, label)); break;
         case 0x0C: RETHROW(jit_wasm_br(builder, code, ctx, func, label)); break;
         case 0x0D: RETHROW(jit_wasm_br_if(builder, code, ctx, func, label)); break;
         case 0x0E: RETHROW(jit_wasm_br_table(builder, code, ctx, func, label)); break;
         case 0x0F: RETHROW(jit_wasm_return(builder, code, ctx, func, label)); break;
         case 0x10: RETHROW(jit_wasm_call(builder, code, ctx, func, label)); break;
         case 0x11: RETHROW(jit_wasm_call_indirect(builder, code, ctx, func, label)); break;
+        case 0x12: RETHROW(jit_wasm_return_call(builder, code, ctx, func, label)); break;
+        case 0x13: RETHROW(jit_wasm_return_call_indirect(builder, code, ctx, func, label)); break;
+        case 0x1F: RETHROW(jit_wasm_try_table(builder, code, ctx, func, label)); break;
 
         // Variable Instructions
         case 0x20: RETHROW(jit_wasm_local_get(builder, code, ctx, func, label)); break;
@@ -2246,6 +5231,10 @@ wasm_err_t jit_wasm_opcode(spidir_builder_handle_t builder, buffer_t* code, jit_
         case 0x23: RETHROW(jit_wasm_global_get(builder, code, ctx, func, label)); break;
         case 0x24: RETHROW(jit_wasm_global_set(builder, code, ctx, func, label)); break;
 
+        // Table Instructions
+        case 0x25: RETHROW(jit_wasm_table_get(builder, code, ctx, func, label)); break;
+        case 0x26: RETHROW(jit_wasm_table_set(builder, code, ctx, func, label)); break;
+
         // Memory Instructions
         case 0x28 ... 0x35: RETHROW(jit_wasm_load(builder, code, ctx, func, label)); break;
         case 0x36 ... 0x3E: RETHROW(jit_wasm_store(builder, code, ctx, func, label)); break;
@@ -2280,8 +5269,14 @@ wasm_err_t jit_wasm_opcode(spidir_builder_handle_t builder, buffer_t* code, jit_
         case 0xBC ... 0xBF: RETHROW(jit_wasm_bitcast(builder, code, ctx, func, label)); break;
         case 0xC0 ... 0xC4: RETHROW(jit_wasm_iconv(builder, code, ctx, func, label)); break;
 
+        // Reference Instructions
+        case 0xD0: RETHROW(jit_wasm_ref_null(builder, code, ctx, func, label)); break;
+        case 0xD1: RETHROW(jit_wasm_ref_is_null(builder, code, ctx, func, label)); break;
+        case 0xD2: RETHROW(jit_wasm_ref_func(builder, code, ctx, func, label)); break;
+
         // Multi-byte prefix instructions
         case 0xFC: RETHROW(jit_wasm_fc_prefix(builder, code, ctx, func, label)); break;
+        case 0xFD: RETHROW(jit_wasm_simd_prefix(builder, code, ctx, func, label)); break;
         case 0xFE: RETHROW(jit_wasm_atomic_prefix(builder, code, ctx, func, label)); break;
 
         default:
@@ -5,15 +5,41 @@
 
 #include "jit_internal.h"
 #include "buffer.h"
+#include "util/arena.h"
 #include "util/vec.h"
 
 typedef struct jit_value {
     spidir_value_t value;
     spidir_value_type_t type;
+
+    // the value is an exnref and holds one of the refs of its exception, see
+    // jit_is_owned_type. Whatever consumes it takes the ref over, and a copy
+    // takes another one
+    bool owned;
 } jit_value_t;
 
 typedef vec(jit_value_t) jit_values_t;
 
+typedef struct jit_scope {
+    // the range in jit_function_ctx_t::scope_locals of the
+    // locals written inside of the scope, including nested scopes
+    uint32_t locals_offset;
+    uint32_t locals_count;
+} jit_scope_t;
+
+typedef vec(jit_scope_t) jit_scopes_t;
+
+typedef struct jit_catch {
+    // the tag that is caught, UINT32_MAX for catch_all
+    uint32_t tagidx;
+
+    // the label the catch branches to, relative to the try_table
+    uint32_t label;
+
+    // the exnref is pushed after the values of the tag
+    bool ref;
+} jit_catch_t;
+
 typedef struct jit_label {
     // the block of this label
     spidir_block_t block;
@@ -21,10 +47,15 @@ typedef struct jit_label {
     // the current stack of the label
     jit_values_t stack;
 
-    // the phis of all the locals in this block
+    // the locals written inside of this label, these are the only
+    // locals that can change between the branches into the label
+    const uint32_t* written_locals;
+    uint32_t written_count;
+
+    // the phis of the written locals in this block
     spidir_phi_t* locals_phis;
 
-    // the values of the locals
+    // the values of the written locals
     spidir_value_t* locals_values;
 
     // how many inputs we have so far to the phis
@@ -44,30 +75,113 @@ typedef struct jit_label {
     // the terminated frame itself; deeper ones just close dead nested blocks.
     uint32_t unreachable_depth;
 
-    // if the label has a result type this will be non-null, 
-    // behaves the same as local_phis/local_values
-    spidir_value_type_t result_type;
-    spidir_phi_t result_phi;
-    spidir_value_t result_value;
+    // the results of the label, pushed into the enclosing
+    // label once this one ends
+    const spidir_value_type_t* result_types;
+    uint32_t result_count;
+
+    // the values carried by a branch into the label, the results of a
+    // block or the params of a loop, behaves the same as local_phis/local_values
+    const spidir_value_type_t* branch_types;
+    uint32_t branch_count;
+    spidir_phi_t* branch_phis;
+    spidir_value_t* branch_values;
+
+    // the carried values that are owned by every branch so far, only blocks
+    // track it, the params of a loop are owned when their entry values are
+    bool* branch_owned;
+
+    // the catches of a try_table, an exception thrown inside of the
+    // label is dispatched to them
+    const jit_catch_t* catches;
+    uint32_t catch_count;
 } jit_label_t;
 
 typedef vec(jit_label_t) jit_labels_t;
 
 typedef struct jit_function_ctx {
+    // the index of the function that is being built
+    uint32_t funcidx;
+
     // the types of all the locals
     jit_values_t locals;
 
-    // handle returning values
-    spidir_value_type_t ret_type;
+    // the index in locals of every wasm local, they differ
+    // because a v128 local takes two of them
+    vec(uint32_t) local_slots;
+
+    // the results of the function, the first is returned normally and the
+    // rest are passed through the area the caller gives as the last param
+    const spidir_value_type_t* result_types;
+    uint32_t result_count;
+
+    // the params of the function, they are the first locals
+    const spidir_value_type_t* arg_types;
+    uint32_t arg_count;
+
+    // a return_call to the function itself jumps back into the tail block,
+    // where the params are phis that take the args of the call
+    bool tail_call_self;
+    spidir_block_t tail_block;
+    spidir_phi_t* tail_phis;
+
+    // every failing check of the function branches to the same trap block,
+    // created on first use, so the trap call is emitted once instead of
+    // inline after every bounds check
+    bool has_trap_block;
+    spidir_block_t trap_block;
 
     // the labels stack
     jit_labels_t labels;
+
+    // the scopes (block/loop/if) of the function in the order they
+    // are opened, along with the locals written in each of them
+    jit_scopes_t scopes;
+    vec(uint32_t) scope_locals;
+
+    // the next scope that will be opened
+    uint32_t next_scope;
+
+    // temporary allocations that live until the function is built, there
+    // is no need to free anything allocated from it
+    arena_t* arena;
 } jit_function_ctx_t;
 
+/**
+ * Check if a value of the type holds a reference, only an exnref does, and only
+ * when the module has tags, without them nothing is thrown and it is always null
+ */
+static inline bool jit_is_owned_type(jit_context_t* ctx, wasm_value_type_t type) {
+    return type == WASM_VALUE_TYPE_EXNREF && ctx->eh_offset != -1;
+}
+
+/**
+ * Set which of the values hold a reference, from the wasm types they hold,
+ * a v128 takes two of the values
+ */
+static inline void jit_mark_owned(jit_context_t* ctx, jit_value_t* values, const wasm_value_type_t* types, uint32_t count) {
+    for (uint32_t i = 0, slot = 0; i < count; i++) {
+        values[slot].owned = jit_is_owned_type(ctx, types[i]);
+        slot += jit_count_spidir_values(&types[i], 1);
+    }
+}
+
 typedef wasm_err_t (*jit_instruction_t)(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* inst, jit_label_t* label);
 
 void jit_free_label(jit_label_t* label);
 
+/**
+ * Scan the function body and find the locals written inside of each scope, this
+ * lets labels only track (and create phis for) locals that can actually change
+ */
+wasm_err_t jit_scan_locals(buffer_t code, jit_function_ctx_t* func);
+
+/**
+ * Get the types of the values that hold the given wasm values, allocated from
+ * the function's arena, a v128 takes two values so the count may differ
+ */
+wasm_err_t jit_get_spidir_value_types(jit_function_ctx_t* func, const wasm_value_type_t* types, uint32_t count, const spidir_value_type_t** out_types, uint32_t* out_count);
+
 wasm_err_t jit_wasm_opcode(spidir_builder_handle_t builder, buffer_t* code, jit_context_t* ctx, jit_function_ctx_t* func, jit_label_t* label);
 
 /**
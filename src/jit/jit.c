@@ -3,8 +3,10 @@
 #include "function.h"
 #include "jit/cfi.h"
 #include "jit/codegen.h"
+#include "jit/eh.h"
 #include "jit/helpers.h"
 #include "jit_internal.h"
+#include "validate.h"
 #include "libcall.h"
 #include "buffer.h"
 
@@ -19,6 +21,7 @@
 #include "spidir/opt.h"
 #include "wasm/error.h"
 #include "wasm/host.h"
+#include <stdatomic.h>
 #include <stdint.h>
 #include <cpuid.h>
 
@@ -30,40 +33,58 @@ void wasm_module_jit_free(wasm_module_jit_t* jit) {
         wasm_host_jit_free(jit->binary, jit->rx_page_count, jit->ro_page_count);
         jit->binary = nullptr;
     }
+    for (size_t i = 0; i < jit->tables_count; i++) {
+        wasm_host_free(jit->tables[i].elements);
+    }
     wasm_host_free(jit->exports);
+    wasm_host_free(jit->tables);
+    wasm_host_free(jit->exnref_globals);
+    wasm_host_free(jit->elems);
     wasm_host_free(jit->state_init);
     wasm_host_free(jit->debug.funcs);
     wasm_host_free(jit->debug.relocs);
+    wasm_host_free(jit->eh_frame);
     jit->exports = nullptr;
+    jit->tables = nullptr;
+    jit->tables_count = 0;
+    jit->exnref_globals = nullptr;
+    jit->exnref_globals_count = 0;
+    jit->elems = nullptr;
+    jit->elems_count = 0;
     jit->state_init = nullptr;
     jit->debug.funcs = nullptr;
     jit->debug.relocs = nullptr;
     jit->debug.funcs_count = 0;
     jit->debug.relocs_count = 0;
+    jit->eh_frame = nullptr;
+    jit->eh_frame_size = 0;
 }
 
-static wasm_err_t jit_prepare_table(jit_context_t* ctx, uint32_t id) {
-    wasm_err_t err = WASM_NO_ERROR;
-
-    // generate a name for the table
-    char name[64];
-    name[0] = 't';
-    name[1] = 'a';
-    name[2] = 'b';
-    name[3] = 'l';
-    name[4] = 'e';
-    name[5] = '_';
-    int digits = u64toa(id, &name[6]);
-    name[6 + digits] = '\0';
-
-    // create it as a relocation
-    // TODO: when we support expanding tables we will need to do something 
-    //       about it
-    ctx->tables[id].global = spidir_module_create_extern_global(ctx->spidir, name);
-    ctx->tables[id].length = ctx->module->tables[id].min;
-
-cleanup:
-    return err;
+/**
+ * Take count zeroed entries from one of the session's vectors, the
+ * vector keeps its capacity so this only allocates when it grows
+ */
+#define JIT_SESSION_ARRAY(_vec, _count) \
+    ({ \
+        typeof(_vec) vec__ = (_vec); \
+        size_t count__ = (_count); \
+        CHECK(count__ <= UINT32_MAX); \
+        vec__->length = 0; \
+        vec_grow(vec__, count__, 0); \
+        vec__->length = count__; \
+        if (count__ != 0) { \
+            memset(vec__->elements, 0, count__ * sizeof(*vec__->elements)); \
+        } \
+        vec__->elements; \
+    })
+
+/**
+ * Free the callees of the infos of the session, before the infos are reset
+ */
+static void jit_free_infos(wasm_jit_session_t* session) {
+    for (uint32_t i = 0; i < session->infos.length; i++) {
+        vec_free(&session->infos.elements[i].callees);
+    }
 }
 
 static wasm_err_t jit_emit_spidir(jit_context_t* ctx) {
@@ -78,14 +99,10 @@ static wasm_err_t jit_emit_spidir(jit_context_t* ctx) {
         }
     }
 
-    // prepare the tables
-    for (int i = 0; i < ctx->module->tables_count; i++) {
-        RETHROW(jit_prepare_table(ctx, i));
-    } 
-
     // Anything referenced by an elem segment is also reachable through
     // call_indirect at runtime so it must be prepared and queued for
-    // codegen even when no direct call exists in the module.
+    // codegen even when no direct call exists in the module. The same
+    // goes for the functions that are declared for ref.func.
     for (int i = 0; i < ctx->module->elems_count; i++) {
         wasm_elem_segment_t* elem = &ctx->module->elems[i];
         for (uint32_t j = 0; j < elem->funcs_count; j++) {
@@ -104,11 +121,16 @@ static wasm_err_t jit_emit_spidir(jit_context_t* ctx) {
     }
 
     // prepare the IR for everything
-    while (ctx->queue.length != 0) {
-        uint32_t funcidx = vec_pop(&ctx->queue);
+    while (ctx->session->queue.length != 0) {
+        uint32_t funcidx = vec_pop(&ctx->session->queue);
+        RETHROW(jit_check_interrupt(ctx));
         RETHROW(jit_function(ctx, funcidx));
     }
 
+    // and the thunks that the functions or the tables reference
+    RETHROW(jit_build_invoke_thunks(ctx));
+    RETHROW(jit_build_cfi_thunks(ctx));
+
 cleanup:
     return err;
 }
@@ -127,6 +149,12 @@ static wasm_err_t jit_build_state_init(jit_context_t* ctx, wasm_module_jit_t* ji
     // lay out the global values
     //
 
+    // an exnref global holds a ref to its exception, see jit_is_owned_type
+    if (ctx->eh_offset != -1 && ctx->module->globals_count != 0) {
+        jit->exnref_globals = CALLOC(size_t, ctx->module->globals_count);
+        CHECK(jit->exnref_globals != nullptr);
+    }
+
     for (int64_t i = 0; i < ctx->module->globals_count; i++) {
         wasm_global_t* global = &ctx->module->globals[i];
         if (!global->mutable) continue;
@@ -138,6 +166,18 @@ static wasm_err_t jit_build_state_init(jit_context_t* ctx, wasm_module_jit_t* ji
             case WASM_VALUE_TYPE_F64: POKE(double, data) = global->value.value.f64; break;
             case WASM_VALUE_TYPE_I32: POKE(int32_t, data) = global->value.value.i32; break;
             case WASM_VALUE_TYPE_I64: POKE(int64_t, data) = global->value.value.i64; break;
+
+            // the address of a function is only known once we are linked
+            case WASM_VALUE_TYPE_FUNCREF:
+            case WASM_VALUE_TYPE_EXTERNREF:
+            case WASM_VALUE_TYPE_EXNREF:
+                CHECK(global->value.value.ref == WASM_REF_NULL, "ref.func in a mutable global is not supported");
+                POKE(void*, data) = nullptr;
+                if (global->value.kind == WASM_VALUE_TYPE_EXNREF && jit->exnref_globals != nullptr) {
+                    jit->exnref_globals[jit->exnref_globals_count++] = jit_global->offset;
+                }
+                break;
+
             default: CHECK_FAIL();
         }
     }
@@ -159,6 +199,25 @@ static wasm_err_t jit_build_state_init(jit_context_t* ctx, wasm_module_jit_t* ji
         }
     }
 
+    //
+    // point the passive elem segments at their functions
+    //
+
+    // the rest of the segments are dropped from the start, so they stay empty
+    size_t elem_start = 0;
+    for (int64_t i = 0; i < ctx->module->elems_count; i++) {
+        wasm_elem_segment_t* elem = &ctx->module->elems[i];
+        if (elem->active || elem->declarative) {
+            continue;
+        }
+
+        CHECK(elem_start + elem->funcs_count <= jit->elems_count);
+        jit_table_state_t* elem_state = jit->state_init + ctx->elems[i].offset;
+        elem_state->elements = jit->elems + elem_start;
+        elem_state->length = elem->funcs_count;
+        elem_start += elem->funcs_count;
+    }
+
 cleanup:
     return err;
 }
@@ -169,8 +228,7 @@ static wasm_err_t jit_prepare_state(jit_context_t* ctx, wasm_module_jit_t* jit)
     size_t offset = 0;
 
     if (ctx->module->globals_count != 0) {
-        ctx->globals = CALLOC(jit_global_t, ctx->module->globals_count);
-        CHECK(ctx->globals != nullptr);
+        ctx->globals = JIT_SESSION_ARRAY(&ctx->session->globals, ctx->module->globals_count);
         for (int64_t i = 0; i < ctx->module->globals_count; i++) {
             wasm_global_t* global = &ctx->module->globals[i];
             spidir_value_type_t type = jit_get_spidir_value_type(global->value.kind);
@@ -192,8 +250,7 @@ static wasm_err_t jit_prepare_state(jit_context_t* ctx, wasm_module_jit_t* jit)
     //
 
     if (ctx->module->data_count != 0) {
-        ctx->data = CALLOC(jit_data_t, ctx->module->data_count);
-        CHECK(ctx->data != nullptr);
+        ctx->data = JIT_SESSION_ARRAY(&ctx->session->data, ctx->module->data_count);
         for (int64_t i = 0; i < ctx->module->data_count; i++) {
             wasm_data_t* data = &ctx->module->data[i];
             if (!data->active) {
@@ -208,15 +265,186 @@ static wasm_err_t jit_prepare_state(jit_context_t* ctx, wasm_module_jit_t* jit)
         }
     }
 
+    //
+    // Layout the elem segments
+    //
+
+    // every segment gets the elements pointer and length it has left, the
+    // ones that are not passive are already dropped when we start running
+    if (ctx->module->elems_count != 0) {
+        ctx->elems = JIT_SESSION_ARRAY(&ctx->session->elems, ctx->module->elems_count);
+        offset = ALIGN_UP(offset, _Alignof(jit_table_state_t));
+        for (int64_t i = 0; i < ctx->module->elems_count; i++) {
+            ctx->elems[i].offset = offset;
+            offset += sizeof(jit_table_state_t);
+        }
+    }
+
+    //
+    // Layout the tables
+    //
+
+    // the tables are writable and can grow, so they only have their
+    // elements pointer and length in the state
+    if (ctx->module->tables_count != 0) {
+        jit->tables = CALLOC(wasm_jit_table_t, ctx->module->tables_count);
+        CHECK(jit->tables != nullptr);
+        jit->tables_count = ctx->module->tables_count;
+
+        offset = ALIGN_UP(offset, _Alignof(jit_table_state_t));
+        for (int64_t i = 0; i < ctx->module->tables_count; i++) {
+            ctx->tables[i].offset = offset;
+            jit->tables[i].offset = offset;
+            jit->tables[i].length = ctx->module->tables[i].min;
+            offset += sizeof(jit_table_state_t);
+        }
+    }
+
+    //
+    // Layout the memory bases
+    //
+
+    // memory 0 is passed as a param so the common case doesn't need a load,
+    // every other memory gets a slot for its base which the host fills in
+    offset = ALIGN_UP(offset, sizeof(void*));
+    ctx->memories_offset = offset;
+    jit->memories_offset = offset;
+    if (ctx->module->memories_count > 1) {
+        offset += (ctx->module->memories_count - 1) * sizeof(void*);
+    }
+
+    //
+    // Layout the exception handling state
+    //
+
+    // the args of an invoke are passed through the state right after it, so
+    // it needs room for the most args any type has along with the pointer to
+    // the area of the extra results, and for the first result
+    ctx->eh_offset = -1;
+    if (ctx->module->tags_count != 0) {
+        size_t invoke_slots = 1;
+        for (int64_t i = 0; i < ctx->module->types_count; i++) {
+            wasm_type_t* type = &ctx->module->types[i];
+            size_t args = jit_count_spidir_values(type->arg_types, type->arg_types_count);
+            if (jit_count_extra_results(type) != 0) {
+                args++;
+            }
+            if (args > invoke_slots) {
+                invoke_slots = args;
+            }
+        }
+
+        offset = ALIGN_UP(offset, _Alignof(jit_eh_state_t));
+        ctx->eh_offset = offset;
+        offset += sizeof(jit_eh_state_t) + invoke_slots * sizeof(uint64_t);
+    }
+
     jit->state_size = offset;
 
 cleanup:
     return err;
 }
 
+wasm_err_t wasm_module_jit_init_tables(wasm_module_jit_t* jit, void* state) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // start from empty tables so a failure can free whatever was copied so far
+    for (size_t i = 0; i < jit->tables_count; i++) {
+        jit_table_state_t* table = state + jit->tables[i].offset;
+        table->elements = nullptr;
+        table->length = 0;
+    }
+
+    for (size_t i = 0; i < jit->tables_count; i++) {
+        wasm_jit_table_t* init = &jit->tables[i];
+        jit_table_state_t* table = state + init->offset;
+        if (init->length == 0) {
+            continue;
+        }
+
+        // allocated with the host allocator so table.grow can realloc it
+        table->elements = wasm_host_calloc(init->length, sizeof(void*));
+        CHECK(table->elements != nullptr);
+        memcpy(table->elements, init->elements, init->length * sizeof(void*));
+        table->length = init->length;
+    }
+
+cleanup:
+    if (IS_ERROR(err)) {
+        wasm_module_jit_free_tables(jit, state);
+    }
+
+    return err;
+}
+
+void wasm_module_jit_free_tables(wasm_module_jit_t* jit, void* state) {
+    for (size_t i = 0; i < jit->tables_count; i++) {
+        jit_table_state_t* table = state + jit->tables[i].offset;
+        wasm_host_free(table->elements);
+        table->elements = nullptr;
+        table->length = 0;
+    }
+
+    for (size_t i = 0; i < jit->exnref_globals_count; i++) {
+        jit_exception_t** global = state + jit->exnref_globals[i];
+        if (*global != nullptr && --(*global)->refs == 0) {
+            wasm_host_free(*global);
+        }
+        *global = nullptr;
+    }
+}
+
+wasm_err_t wasm_jit_session_create(wasm_jit_session_t** out_session) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_jit_session_t* session = CALLOC(wasm_jit_session_t, 1);
+    CHECK(session != nullptr);
+    RETHROW(jit_codegen_ctx_create(&session->codegen));
+
+    *out_session = session;
+    session = nullptr;
+
+cleanup:
+    wasm_jit_session_destroy(session);
+    return err;
+}
+
+void wasm_jit_session_destroy(wasm_jit_session_t* session) {
+    if (session == nullptr) {
+        return;
+    }
+
+    jit_codegen_ctx_destroy(session->codegen);
+    vec_free(&session->functions);
+    vec_free(&session->globals);
+    vec_free(&session->tables);
+    vec_free(&session->data);
+    vec_free(&session->elems);
+    vec_free(&session->invokes);
+    jit_free_infos(session);
+    vec_free(&session->infos);
+    vec_free(&session->validate_tasks);
+    vec_free(&session->queue);
+    hmap_free(&session->bodies);
+    arena_free(&session->arena);
+    wasm_host_free(session);
+}
 
 wasm_err_t wasm_module_jit(wasm_module_t* module, wasm_module_jit_t* jit, wasm_jit_config_t* config) {
     wasm_err_t err = WASM_NO_ERROR;
+    wasm_jit_session_t* session = nullptr;
+
+    RETHROW(wasm_jit_session_create(&session));
+    RETHROW(wasm_module_jit_with_session(session, module, jit, config));
+
+cleanup:
+    wasm_jit_session_destroy(session);
+    return err;
+}
+
+static wasm_err_t jit_module(wasm_jit_session_t* session, wasm_module_t* module, wasm_module_jit_t* jit, wasm_jit_config_t* config, _Atomic(uint32_t)* cancelled) {
+    wasm_err_t err = WASM_NO_ERROR;
+
     // use a default config when one is not provided
     if (config == nullptr) {
         static wasm_jit_config_t default_config = {
@@ -228,16 +456,39 @@ wasm_err_t wasm_module_jit(wasm_module_t* module, wasm_module_jit_t* jit, wasm_j
     jit_context_t ctx = {
         .module = module,
         .config = config,
+        .session = session,
+        .cancelled = cancelled,
     };
 
+    // the compile time limit counts from here
+    if (config->limits.max_compile_time_ns != 0 && config->now_ns != nullptr) {
+        uint64_t now = config->now_ns(config->now_ns_arg);
+        ctx.deadline = now + MIN(config->limits.max_compile_time_ns, UINT64_MAX - now);
+    }
+
+    // anything left from a failed compilation is stale
+    session->queue.length = 0;
+    hmap_clear(&session->bodies);
+
     // it should be cheap enough to allocate it linearly
-    ctx.functions = CALLOC(jit_function_t, module->functions_count + module->imports_count);
-    CHECK(ctx.functions != nullptr);
+    ctx.functions = JIT_SESSION_ARRAY(&session->functions, module->functions_count + module->imports_count);
+    ctx.tables = JIT_SESSION_ARRAY(&session->tables, module->tables_count);
+    ctx.invokes = JIT_SESSION_ARRAY(&session->invokes, module->types_count);
+
+    // keep what was validated while the module was streaming in, anything else
+    // is left over from the last compilation
+    if (session->streamed_infos && session->infos.length == module->functions_count) {
+        ctx.infos = session->infos.elements;
+    } else {
+        jit_free_infos(session);
+        ctx.infos = JIT_SESSION_ARRAY(&session->infos, module->functions_count);
+    }
+    session->streamed_infos = false;
 
-    ctx.tables = CALLOC(jit_table_t, module->tables_count);
-    CHECK(ctx.tables != nullptr);
+    // reject invalid code before doing anything with it
+    RETHROW(jit_validate_functions(&ctx));
 
-    // setup the runtime state buffer (globals + tables)
+    // setup the runtime state buffer (globals + tables + memories)
     RETHROW(jit_prepare_state(&ctx, jit));
 
     ctx.spidir = spidir_module_create();
@@ -248,6 +499,7 @@ wasm_err_t wasm_module_jit(wasm_module_t* module, wasm_module_jit_t* jit, wasm_j
     // optimize the module
     if (config->optimize) {
         spidir_opt_run(ctx.spidir);
+        RETHROW(jit_check_interrupt(&ctx));
     }
 
     // dump the module if we need to
@@ -265,11 +517,172 @@ cleanup:
     if (ctx.spidir != nullptr) {
         spidir_module_destroy(ctx.spidir);
     }
-    wasm_host_free(ctx.functions);
-    wasm_host_free(ctx.globals);
-    wasm_host_free(ctx.tables);
-    wasm_host_free(ctx.data);
-    vec_free(&ctx.queue);
 
     return err;
 }
+
+wasm_err_t wasm_jit_session_validate_function(wasm_jit_session_t* session, wasm_module_t* module, const wasm_jit_config_t* config, uint32_t funcidx) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(funcidx >= module->imports_count);
+    uint32_t index = funcidx - module->imports_count;
+    CHECK(index < module->functions_count);
+
+    // the bodies arrive in order, so the first one starts a new module
+    if (index == 0 || !session->streamed_infos) {
+        jit_free_infos(session);
+        JIT_SESSION_ARRAY(&session->infos, module->functions_count);
+        session->streamed_infos = true;
+    }
+    CHECK(session->infos.length == module->functions_count);
+
+    wasm_jit_limits_t no_limits = {};
+    const wasm_jit_limits_t* limits = config != nullptr ? &config->limits : &no_limits;
+    RETHROW(jit_validate_function_info(module, limits, index, &session->infos.elements[index]));
+
+cleanup:
+    return err;
+}
+
+wasm_err_t wasm_module_jit_with_session(wasm_jit_session_t* session, wasm_module_t* module, wasm_module_jit_t* jit, wasm_jit_config_t* config) {
+    return jit_module(session, module, jit, config, nullptr);
+}
+
+struct wasm_jit_async {
+    // the session of the compilation, and whether we created it
+    wasm_jit_session_t* session;
+    bool owns_session;
+
+    wasm_module_t* module;
+
+    // our own copy, the caller doesn't need to keep theirs around
+    wasm_jit_config_t config;
+
+    // the result, owned by us until it is taken by wasm_jit_async_wait
+    wasm_module_jit_t jit;
+    wasm_err_t err;
+    bool taken;
+
+    // set once the compilation finished, waited on with the host atomics
+    _Atomic(uint32_t) done;
+
+    _Atomic(uint32_t) cancelled;
+
+    // the handle and the task each hold a reference, the task still notifies
+    // the waiters after setting done, so whoever lets go last frees the handle
+    _Atomic(uint32_t) refs;
+};
+
+static void jit_async_release(wasm_jit_async_t* async) {
+    if (atomic_fetch_sub(&async->refs, 1) == 1) {
+        wasm_host_free(async);
+    }
+}
+
+static void jit_async_task(void* arg) {
+    wasm_jit_async_t* async = arg;
+
+    async->err = jit_module(async->session, async->module, &async->jit, &async->config, &async->cancelled);
+
+    // a failed compilation can leave a partial jit behind, nothing
+    // will ever use it so free it right away
+    if (IS_ERROR(async->err)) {
+        wasm_module_jit_free(&async->jit);
+    }
+
+    atomic_store(&async->done, 1);
+    wasm_host_atomic_notify(&async->done, UINT32_MAX);
+    jit_async_release(async);
+}
+
+wasm_err_t wasm_module_jit_async(wasm_jit_session_t* session, wasm_module_t* module, wasm_jit_config_t* config, wasm_jit_async_t** out_async) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_jit_async_t* async = CALLOC(wasm_jit_async_t, 1);
+    CHECK(async != nullptr);
+
+    async->module = module;
+    if (config != nullptr) {
+        async->config = *config;
+    } else {
+        async->config.optimize = true;
+    }
+
+    // without a session use a temporary one, like wasm_module_jit
+    if (session == nullptr) {
+        RETHROW(wasm_jit_session_create(&async->session));
+        async->owns_session = true;
+    } else {
+        async->session = session;
+    }
+
+    // without a way to run it in the background the
+    // compilation is done by the time we return
+    async->refs = 2;
+    if (async->config.run_async != nullptr) {
+        async->config.run_async(async->config.run_async_arg, jit_async_task, async);
+    } else {
+        jit_async_task(async);
+    }
+
+    *out_async = async;
+    async = nullptr;
+
+cleanup:
+    if (async != nullptr) {
+        if (async->owns_session) {
+            wasm_jit_session_destroy(async->session);
+        }
+        wasm_host_free(async);
+    }
+
+    return err;
+}
+
+bool wasm_jit_async_poll(wasm_jit_async_t* async) {
+    return atomic_load(&async->done) != 0;
+}
+
+void wasm_jit_async_cancel(wasm_jit_async_t* async) {
+    atomic_store(&async->cancelled, 1);
+}
+
+wasm_err_t wasm_jit_async_wait(wasm_jit_async_t* async, wasm_module_jit_t* out_jit) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    while (atomic_load(&async->done) == 0) {
+        wasm_host_atomic_wait_4(&async->done, 0, -1);
+    }
+
+    RETHROW(async->err);
+
+    CHECK(!async->taken, "The jit was already taken");
+    *out_jit = async->jit;
+    async->taken = true;
+
+cleanup:
+    return err;
+}
+
+void wasm_jit_async_destroy(wasm_jit_async_t* async) {
+    if (async == nullptr) {
+        return;
+    }
+
+    // the compilation can't outlive the handle, stop it as
+    // soon as possible and wait for it to let go of everything
+    wasm_jit_async_cancel(async);
+    while (atomic_load(&async->done) == 0) {
+        wasm_host_atomic_wait_4(&async->done, 0, -1);
+    }
+
+    if (!async->taken) {
+        wasm_module_jit_free(&async->jit);
+    }
+
+    if (async->owns_session) {
+        wasm_jit_session_destroy(async->session);
+    }
+
+    jit_async_release(async);
+}
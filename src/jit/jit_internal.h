@@ -3,10 +3,13 @@
 #include "wasm/wasm.h"
 
 #include "helpers.h"
+#include "util/arena.h"
+#include "util/hmap.h"
 #include "util/vec.h"
 #include "util/except.h"
 #include "spidir/module.h"
 #include "wasm/jit.h"
+#include <stdatomic.h>
 
 typedef struct jit_function {
     spidir_funcref_t spidir;
@@ -14,6 +17,12 @@ typedef struct jit_function {
     void* address;
     bool inited;
     bool has_cfi;
+    bool cfi_built;
+
+    // the function has the same type and body as folded_into, so it
+    // shares its code (and cfi thunk) instead of being jitted again
+    bool folded;
+    uint32_t folded_into;
 } jit_function_t;
 
 typedef struct jit_global {
@@ -22,17 +31,103 @@ typedef struct jit_global {
 } jit_global_t;
 
 typedef struct jit_table {
-    spidir_extern_global_t global;
-    uint32_t length;
-    bool used;
+    // where the jit_table_state_t of the table is in the state
+    size_t offset;
 } jit_table_t;
 
 typedef struct jit_data {
     size_t offset;
 } jit_data_t;
 
+typedef struct jit_elem {
+    // where the jit_table_state_t of the segment is in the state, it
+    // is laid out like a table so table.init can check it the same way
+    size_t offset;
+} jit_elem_t;
+
+typedef struct jit_invoke {
+    // the thunk that unpacks the args of an invoke and calls the
+    // target, one per function type
+    spidir_function_t thunk;
+    bool created;
+    bool built;
+
+    // an indirect call of the type may throw, see jit_validate_may_throw
+    bool may_throw;
+} jit_invoke_t;
+
+typedef struct jit_function_info {
+    // the deepest the operand stack gets, in spidir values
+    uint32_t max_stack_depth;
+
+    // the deepest the labels nest, the body of the function included
+    uint32_t max_label_depth;
+
+    // the wasm locals (params included) and the spidir values that hold them
+    uint32_t locals_count;
+    uint32_t local_slots_count;
+
+    // the instructions in the body, for the limit on the whole module
+    uint32_t instructions_count;
+
+    // the function may throw, so calling it inside of a try_table must go through
+    // the invoke helper. The validation only sets it for a function that throws or
+    // calls an import, jit_validate_may_throw then follows the calls
+    bool may_throw;
+
+    // the internal functions the function calls, along with functions_count plus
+    // the typeidx of every indirect call, only used to find may_throw
+    vec(uint32_t) callees;
+
+    // the body the info was collected from, set once it is valid, a function
+    // that was validated while the module was streaming in is not validated again
+    const uint8_t* code;
+} jit_function_info_t;
+
+typedef struct jit_validate_task {
+    // the range of internal functions validated by the task
+    uint32_t first;
+    uint32_t count;
+    wasm_err_t err;
+} jit_validate_task_t;
+
 typedef vec(uint32_t) function_queue_t;
 
+typedef struct codegen_ctx codegen_ctx_t;
+
+struct wasm_jit_session {
+    // the memory behind the per-module arrays of the jit context, these
+    // keep their capacity between compilations
+    vec(jit_function_t) functions;
+    vec(jit_global_t) globals;
+    vec(jit_table_t) tables;
+    vec(jit_data_t) data;
+    vec(jit_elem_t) elems;
+    vec(jit_invoke_t) invokes;
+    vec(jit_function_info_t) infos;
+
+    // the infos were filled by wasm_jit_session_validate_function for
+    // the next compilation, instead of being left over from the last one
+    bool streamed_infos;
+
+    // the validation tasks of the module
+    vec(jit_validate_task_t) validate_tasks;
+
+    // queue of functions to do
+    function_queue_t queue;
+
+    // the hash of the type and body of every function that was prepared to
+    // the first function with it, identical functions are folded into it
+    hmap_t bodies;
+
+    // scratch memory of the function currently being built, reset
+    // for every function so the memory is reused between them
+    arena_t arena;
+
+    // the state of the codegen, private to codegen.c
+    codegen_ctx_t* codegen;
+};
+
 typedef struct jit_context {
     spidir_module_handle_t spidir;
     wasm_module_t* module;
@@ -49,8 +144,38 @@ typedef struct jit_context {
     // the data segments
     jit_data_t* data;
 
-    // queue of functions to do
-    function_queue_t queue;
+    // the elem segments
+    jit_elem_t* elems;
+
+    // the invoke thunks, by typeidx
+    jit_invoke_t* invokes;
+
+    // when the compile time limit runs out, in the clock of the
+    // config, zero when there is no limit
+    uint64_t deadline;
+
+    // set from another thread to stop an async compilation, null
+    // when the compilation can't be cancelled
+    _Atomic(uint32_t)* cancelled;
+
+    // the instructions of the functions validated so far, shared by the
+    // validation tasks so they stop as soon as the limit is reached
+    _Atomic(uint64_t) instructions_count;
+
+    // what the validation found about each of the internal functions,
+    // used to size the vectors of the function builder up front
+    jit_function_info_t* infos;
+
+    // where the jit_eh_state_t is in the state, -1 when the
+    // module has no tags and nothing can be thrown
+    size_t eh_offset;
+
+    // where the bases of the memories past the first are in the state,
+    // memory 0 is passed as a param instead
+    size_t memories_offset;
+
+    // the session we are compiling in
+    wasm_jit_session_t* session;
 
     // Lazy registry of JIT runtime helpers. Filled on first call to
     // jit_get_helper(kind); the relocation applier resolves the spidir
@@ -62,22 +187,96 @@ typedef struct jit_context {
     wasm_jit_config_t* config;
 } jit_context_t;
 
+/**
+ * Fail with WASM_ERROR_CANCELLED once the compilation was cancelled, or with
+ * WASM_ERROR_COMPILE_TIMEOUT once the compile time limit ran out. Called between
+ * functions, so the compilation stops at the next one
+ */
+static inline wasm_err_t jit_check_interrupt(jit_context_t* ctx) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    if (ctx->cancelled != nullptr) {
+        CHECK_ERROR(!atomic_load_explicit(ctx->cancelled, memory_order_relaxed),
+            WASM_ERROR_CANCELLED, "Compilation cancelled");
+    }
+
+    if (ctx->deadline != 0) {
+        CHECK_ERROR(ctx->config->now_ns(ctx->config->now_ns_arg) < ctx->deadline,
+            WASM_ERROR_COMPILE_TIMEOUT, "Compile time limit exceeded");
+    }
+
+cleanup:
+    return err;
+}
+
+// spidir has no vector types, so a v128 is held in two i64 values, the low half
+// first. The high half is tagged with its own type so instructions that don't
+// carry a type (drop/select) know to take both halves, for spidir its an i64
+#define JIT_TYPE_V128_HI ((spidir_value_type_t)0x100)
+
 static inline spidir_value_type_t jit_get_spidir_value_type(wasm_value_type_t type) {
     switch (type) {
         case WASM_VALUE_TYPE_F64: return SPIDIR_TYPE_F64;
         case WASM_VALUE_TYPE_F32: return SPIDIR_TYPE_F32;
         case WASM_VALUE_TYPE_I64: return SPIDIR_TYPE_I64;
         case WASM_VALUE_TYPE_I32: return SPIDIR_TYPE_I32;
+        case WASM_VALUE_TYPE_V128: return SPIDIR_TYPE_I64; // the low half
+        case WASM_VALUE_TYPE_FUNCREF: return SPIDIR_TYPE_PTR;
+        case WASM_VALUE_TYPE_EXTERNREF: return SPIDIR_TYPE_PTR;
+        case WASM_VALUE_TYPE_EXNREF: return SPIDIR_TYPE_PTR;
         default: ASSERT(!"Invalid wasm type");
     }
 }
 
+/**
+ * Get the type spidir sees for a value, which only differs for the high half of a v128
+ */
+static inline spidir_value_type_t jit_lower_value_type(spidir_value_type_t type) {
+    return type == JIT_TYPE_V128_HI ? SPIDIR_TYPE_I64 : type;
+}
+
+/**
+ * Count the spidir values needed to hold the given wasm values
+ */
+static inline size_t jit_count_spidir_values(const wasm_value_type_t* types, size_t count) {
+    size_t values = count;
+    for (size_t i = 0; i < count; i++) {
+        if (types[i] == WASM_VALUE_TYPE_V128) {
+            values++;
+        }
+    }
+    return values;
+}
+
+/**
+ * Count the results of a function that spidir can't return, the caller passes
+ * an area on its stack for them as the last param, with a slot of 8 bytes each
+ */
+static inline size_t jit_count_extra_results(const wasm_type_t* type) {
+    size_t results = jit_count_spidir_values(type->result_types, type->result_types_count);
+    return results > 1 ? results - 1 : 0;
+}
+
+/**
+ * Fill the types of the spidir values that hold the given wasm values, the out
+ * array must have room for jit_count_spidir_values of them
+ */
+static inline void jit_fill_spidir_value_types(const wasm_value_type_t* types, size_t count, spidir_value_type_t* out_types) {
+    for (size_t i = 0; i < count; i++) {
+        *out_types++ = jit_get_spidir_value_type(types[i]);
+        if (types[i] == WASM_VALUE_TYPE_V128) {
+            *out_types++ = JIT_TYPE_V128_HI;
+        }
+    }
+}
+
 static inline size_t jit_get_spidir_size(spidir_value_type_t type) {
     switch (type) {
         case SPIDIR_TYPE_F64: return 8;
         case SPIDIR_TYPE_F32: return 4;
         case SPIDIR_TYPE_I64: return 8;
         case SPIDIR_TYPE_I32: return 4;
+        case SPIDIR_TYPE_PTR: return 8;
         default: ASSERT(!"Invalid spidir type");
     }
 }
@@ -88,6 +287,7 @@ static inline spidir_mem_size_t jit_get_spidir_mem_size(spidir_value_type_t type
         case SPIDIR_TYPE_F32: return SPIDIR_MEM_SIZE_4;
         case SPIDIR_TYPE_I64: return SPIDIR_MEM_SIZE_8;
         case SPIDIR_TYPE_I32: return SPIDIR_MEM_SIZE_4;
+        case SPIDIR_TYPE_PTR: return SPIDIR_MEM_SIZE_8;
         default: ASSERT(!"Invalid spidir type");
     }
 }
@@ -0,0 +1,240 @@
+#include "unwind.h"
+
+#include "util/except.h"
+#include "util/string.h"
+#include "wasm/error.h"
+
+//
+// spidir doesn't give us any unwind info, but on x64 it always sets up an rbp
+// frame in the prologue and tears it down right before the ret, so the frame
+// is fully described by the position of those instructions: the CFA is rbp+16
+// in the body, and rsp-based only in the prologue and at the ret itself. The
+// callee-saved registers are not described, which is fine for walking the
+// stack, only rbp and the return address are needed for that.
+//
+// The pointers are encoded as absolute, since the .eh_frame is allocated on
+// the heap and is not guaranteed to be in pc-relative range of the code.
+//
+
+#define DW_CFA_nop              0x00
+#define DW_CFA_advance_loc1     0x02
+#define DW_CFA_advance_loc2     0x03
+#define DW_CFA_advance_loc4     0x04
+#define DW_CFA_remember_state   0x0a
+#define DW_CFA_restore_state    0x0b
+#define DW_CFA_def_cfa          0x0c
+#define DW_CFA_def_cfa_register 0x0d
+#define DW_CFA_def_cfa_offset   0x0e
+#define DW_CFA_advance_loc      0x40
+#define DW_CFA_offset           0x80
+#define DW_CFA_restore          0xc0
+
+#define DW_EH_PE_absptr         0x00
+
+// the dwarf numbers of the registers we describe
+#define DWARF_REG_RBP           6
+#define DWARF_REG_RSP           7
+#define DWARF_REG_RA            16
+
+// the data alignment factor, register offsets are in 8 byte slots
+#define DWARF_DATA_ALIGN        (-8)
+
+static wasm_err_t jit_eh_push(jit_eh_frame_t* eh_frame, const void* data, size_t len) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint8_t* ptr = vec_add(eh_frame, len);
+    memcpy(ptr, data, len);
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_eh_push_u8(jit_eh_frame_t* eh_frame, uint8_t value) {
+    wasm_err_t err = WASM_NO_ERROR;
+    vec_push(eh_frame, value);
+cleanup:
+    return err;
+}
+
+/**
+ * Start a CIE/FDE, returns the offset of its length which is filled by jit_eh_end_entry
+ */
+static wasm_err_t jit_eh_begin_entry(jit_eh_frame_t* eh_frame, size_t* out_start) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    *out_start = eh_frame->length;
+    uint32_t length = 0;
+    RETHROW(jit_eh_push(eh_frame, &length, sizeof(length)));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_eh_end_entry(jit_eh_frame_t* eh_frame, size_t start) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // pad with nops so the next entry stays aligned
+    while ((eh_frame->length - start) % sizeof(uint64_t) != 0) {
+        RETHROW(jit_eh_push_u8(eh_frame, DW_CFA_nop));
+    }
+
+    // the length doesn't include itself
+    uint32_t length = eh_frame->length - start - sizeof(uint32_t);
+    memcpy(&eh_frame->elements[start], &length, sizeof(length));
+
+cleanup:
+    return err;
+}
+
+/**
+ * Advance the location of the FDE's instructions to the given offset in the code
+ */
+static wasm_err_t jit_eh_advance(jit_eh_frame_t* eh_frame, size_t* loc, size_t offset) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    size_t delta = offset - *loc;
+    if (delta < 0x40) {
+        RETHROW(jit_eh_push_u8(eh_frame, DW_CFA_advance_loc | delta));
+    } else if (delta <= UINT8_MAX) {
+        uint8_t value = delta;
+        RETHROW(jit_eh_push_u8(eh_frame, DW_CFA_advance_loc1));
+        RETHROW(jit_eh_push(eh_frame, &value, sizeof(value)));
+    } else if (delta <= UINT16_MAX) {
+        uint16_t value = delta;
+        RETHROW(jit_eh_push_u8(eh_frame, DW_CFA_advance_loc2));
+        RETHROW(jit_eh_push(eh_frame, &value, sizeof(value)));
+    } else {
+        CHECK(delta <= UINT32_MAX);
+        uint32_t value = delta;
+        RETHROW(jit_eh_push_u8(eh_frame, DW_CFA_advance_loc4));
+        RETHROW(jit_eh_push(eh_frame, &value, sizeof(value)));
+    }
+
+    *loc = offset;
+
+cleanup:
+    return err;
+}
+
+wasm_err_t jit_unwind_begin(jit_eh_frame_t* eh_frame) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    eh_frame->length = 0;
+
+    size_t start;
+    RETHROW(jit_eh_begin_entry(eh_frame, &start));
+
+    static const uint8_t cie[] = {
+        0x00, 0x00, 0x00, 0x00,         // CIE id
+        0x01,                           // version
+        'z', 'R', '\0',                 // augmentation, has the FDE pointer encoding
+        0x01,                           // code alignment factor
+        DWARF_DATA_ALIGN & 0x7f,        // data alignment factor (sleb128)
+        DWARF_REG_RA,                   // return address register
+        0x01,                           // augmentation data length
+        DW_EH_PE_absptr,                // FDE pointer encoding
+
+        // on entry the CFA is right above the return address
+        DW_CFA_def_cfa, DWARF_REG_RSP, 8,
+        DW_CFA_offset | DWARF_REG_RA, 1,
+    };
+    RETHROW(jit_eh_push(eh_frame, cie, sizeof(cie)));
+
+    RETHROW(jit_eh_end_entry(eh_frame, start));
+
+cleanup:
+    return err;
+}
+
+/**
+ * Check for `push rbp; mov rbp, rsp`, both encodings of the mov are accepted
+ */
+static bool jit_has_frame_prologue(const uint8_t* code, size_t code_size) {
+    if (code_size < 4 || code[0] != 0x55 || code[1] != 0x48) {
+        return false;
+    }
+    return (code[2] == 0x89 && code[3] == 0xE5) || (code[2] == 0x8B && code[3] == 0xEC);
+}
+
+wasm_err_t jit_unwind_add_code(jit_eh_frame_t* eh_frame, const uint8_t* code, size_t code_size, size_t entry_offset) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(entry_offset <= code_size);
+
+    size_t start;
+    RETHROW(jit_eh_begin_entry(eh_frame, &start));
+
+    // the CIE is always the first entry, the pointer is relative to this field
+    uint32_t cie_pointer = eh_frame->length;
+    RETHROW(jit_eh_push(eh_frame, &cie_pointer, sizeof(cie_pointer)));
+
+    uint64_t pc_begin = (uintptr_t)code;
+    uint64_t pc_range = code_size;
+    RETHROW(jit_eh_push(eh_frame, &pc_begin, sizeof(pc_begin)));
+    RETHROW(jit_eh_push(eh_frame, &pc_range, sizeof(pc_range)));
+
+    // no augmentation data
+    RETHROW(jit_eh_push_u8(eh_frame, 0));
+
+    // code without a frame (the veneers) runs in the entry state all along
+    const uint8_t* entry = code + entry_offset;
+    size_t entry_size = code_size - entry_offset;
+    if (jit_has_frame_prologue(entry, entry_size)) {
+        size_t loc = 0;
+
+        // push rbp
+        RETHROW(jit_eh_advance(eh_frame, &loc, entry_offset + 1));
+        static const uint8_t push_rbp[] = {
+            DW_CFA_def_cfa_offset, 16,
+            DW_CFA_offset | DWARF_REG_RBP, 2,
+        };
+        RETHROW(jit_eh_push(eh_frame, push_rbp, sizeof(push_rbp)));
+
+        // mov rbp, rsp
+        RETHROW(jit_eh_advance(eh_frame, &loc, entry_offset + 4));
+        static const uint8_t mov_rbp[] = {
+            DW_CFA_def_cfa_register, DWARF_REG_RBP,
+        };
+        RETHROW(jit_eh_push(eh_frame, mov_rbp, sizeof(mov_rbp)));
+
+        // every ret comes right after the `pop rbp` or `leave` that tears the
+        // frame down, an rbp based CFA is correct up to it. A match that is
+        // not a real ret is in the middle of an instruction, so its row can
+        // never be looked up
+        for (size_t i = 5; i < entry_size; i++) {
+            if (entry[i] != 0xC3 || (entry[i - 1] != 0x5D && entry[i - 1] != 0xC9)) {
+                continue;
+            }
+
+            RETHROW(jit_eh_advance(eh_frame, &loc, entry_offset + i));
+            static const uint8_t ret[] = {
+                DW_CFA_remember_state,
+                DW_CFA_def_cfa, DWARF_REG_RSP, 8,
+                DW_CFA_restore | DWARF_REG_RBP,
+            };
+            RETHROW(jit_eh_push(eh_frame, ret, sizeof(ret)));
+
+            // the code after the ret still has the frame
+            if (i + 1 < entry_size) {
+                RETHROW(jit_eh_advance(eh_frame, &loc, entry_offset + i + 1));
+                RETHROW(jit_eh_push_u8(eh_frame, DW_CFA_restore_state));
+            }
+        }
+    }
+
+    RETHROW(jit_eh_end_entry(eh_frame, start));
+
+cleanup:
+    return err;
+}
+
+wasm_err_t jit_unwind_end(jit_eh_frame_t* eh_frame) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // a zero length entry terminates the section
+    uint32_t terminator = 0;
+    RETHROW(jit_eh_push(eh_frame, &terminator, sizeof(terminator)));
+
+cleanup:
+    return err;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/vec.h"
+#include "wasm/error.h"
+
+typedef vec(uint8_t) jit_eh_frame_t;
+
+/**
+ * Start a new .eh_frame, emitting the CIE that all the FDEs share
+ */
+wasm_err_t jit_unwind_begin(jit_eh_frame_t* eh_frame);
+
+/**
+ * Emit the FDE of a range of jitted code, the code must already be in its final
+ * place since the FDE points at it and it is scanned for the frame setup. The
+ * code starting at entry_offset is a function, anything before it (the endbr64
+ * slot) runs before the frame is set up
+ */
+wasm_err_t jit_unwind_add_code(jit_eh_frame_t* eh_frame, const uint8_t* code, size_t code_size, size_t entry_offset);
+
+/**
+ * Terminate the .eh_frame, after this it can be handed to __register_frame
+ */
+wasm_err_t jit_unwind_end(jit_eh_frame_t* eh_frame);
@@ -0,0 +1,1679 @@
+#include "validate.h"
+
+#include "buffer.h"
+#include "util/defs.h"
+#include "util/except.h"
+#include "util/string.h"
+#include "util/vec.h"
+#include "wasm/error.h"
+#include "wasm/host.h"
+#include "wasm/wasm.h"
+#include <stdint.h>
+
+//
+// The function bodies are validated on their own before anything is compiled,
+// following the algorithm from the appendix of the spec: a stack of operand
+// types and a stack of control frames, where the rest of a frame becomes stack
+// polymorphic after an unconditional branch. The module is only read, so any
+// number of functions can be validated at the same time.
+//
+// This checks the whole instruction set the loader can represent, and not only
+// what the jit implements, a function that is never compiled doesn't make the
+// module invalid just because it has an instruction the jit doesn't support.
+// The jit still rejects those when it gets to them. The exception are the tail
+// calls the jit can't turn into jumps and the tags with exnref params, whose
+// refs the jit can't count, those are rejected here already with
+// WASM_ERROR_UNSUPPORTED, so a module that relies on them fails up front.
+//
+
+// the functions are split into tasks of about this much code each
+#define JIT_VALIDATE_TASK_SIZE (64 * 1024)
+
+// the type of an operand popped from a polymorphic stack, it matches any type
+#define JIT_VALIDATE_ANY WASM_VALUE_TYPE_INVALID
+
+typedef enum jit_validate_frame_kind : uint8_t {
+    JIT_VALIDATE_BLOCK,
+    JIT_VALIDATE_LOOP,
+    JIT_VALIDATE_IF,
+    JIT_VALIDATE_ELSE,
+} jit_validate_frame_kind_t;
+
+typedef struct jit_validate_frame {
+    const wasm_value_type_t* param_types;
+    const wasm_value_type_t* result_types;
+    uint32_t param_count;
+    uint32_t result_count;
+
+    // the height of the operand stack when the frame was entered, both in
+    // operands and in the values the jit holds them in
+    uint32_t height;
+    uint32_t slots;
+
+    jit_validate_frame_kind_t kind;
+
+    // the rest of the frame is unreachable, popping past the height
+    // gives operands of any type
+    bool unreachable;
+} jit_validate_frame_t;
+
+typedef struct jit_validate_locals {
+    // the index right after the last local of the run
+    uint32_t end;
+    wasm_value_type_t type;
+} jit_validate_locals_t;
+
+typedef struct jit_validator {
+    wasm_module_t* module;
+    const wasm_jit_limits_t* limits;
+    wasm_type_t* type;
+    jit_function_info_t* info;
+
+    // the index of the function, including the imports
+    uint32_t funcidx;
+
+    vec(wasm_value_type_t) stack;
+    vec(jit_validate_frame_t) frames;
+
+    // the locals in the runs they are declared in, so a large
+    // count of locals doesn't need any memory for itself
+    vec(jit_validate_locals_t) locals;
+    uint32_t locals_count;
+
+    // the height of the stack in the values of the jit
+    uint32_t slots;
+} jit_validator_t;
+
+#define VALIDATE_PUSH(_type) RETHROW(jit_validate_push(v, _type))
+#define VALIDATE_POP(_type) RETHROW(jit_validate_pop(v, _type, nullptr))
+
+static bool jit_is_num_or_vec_type(wasm_value_type_t type) {
+    switch (type) {
+        case WASM_VALUE_TYPE_I32:
+        case WASM_VALUE_TYPE_I64:
+        case WASM_VALUE_TYPE_F32:
+        case WASM_VALUE_TYPE_F64:
+        case WASM_VALUE_TYPE_V128:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool jit_is_ref_type(wasm_value_type_t type) {
+    switch (type) {
+        case WASM_VALUE_TYPE_FUNCREF:
+        case WASM_VALUE_TYPE_EXTERNREF:
+        case WASM_VALUE_TYPE_EXNREF:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Operand and control stacks
+//----------------------------------------------------------------------------------------------------------------------
+
+static wasm_err_t jit_validate_push(jit_validator_t* v, wasm_value_type_t type) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    vec_push(&v->stack, type);
+    v->slots += jit_count_spidir_values(&type, 1);
+    v->info->max_stack_depth = MAX(v->info->max_stack_depth, v->slots);
+
+cleanup:
+    return err;
+}
+
+/**
+ * Pop an operand of the expected type, JIT_VALIDATE_ANY takes an operand of any
+ * type. The type of the operand is returned, which is only JIT_VALIDATE_ANY when
+ * both it and the expected type are unknown
+ */
+static wasm_err_t jit_validate_pop(jit_validator_t* v, wasm_value_type_t expected, wasm_value_type_t* out_type) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_validate_frame_t* frame = &vec_last(&v->frames);
+
+    wasm_value_type_t type = JIT_VALIDATE_ANY;
+    if (v->stack.length == frame->height) {
+        CHECK(frame->unreachable, "Operand stack underflow");
+    } else {
+        type = v->stack.elements[--v->stack.length];
+        v->slots -= jit_count_spidir_values(&type, 1);
+        CHECK(type == expected || type == JIT_VALIDATE_ANY || expected == JIT_VALIDATE_ANY,
+            "Unexpected type (%d != %d)", type, expected);
+    }
+
+    if (out_type != nullptr) {
+        *out_type = type == JIT_VALIDATE_ANY ? expected : type;
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_push_values(jit_validator_t* v, const wasm_value_type_t* types, uint32_t count) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    for (uint32_t i = 0; i < count; i++) {
+        VALIDATE_PUSH(types[i]);
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_pop_values(jit_validator_t* v, const wasm_value_type_t* types, uint32_t count) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    for (int64_t i = (int64_t)count - 1; i >= 0; i--) {
+        VALIDATE_POP(types[i]);
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_push_frame(
+    jit_validator_t* v, jit_validate_frame_kind_t kind,
+    const wasm_value_type_t* param_types, uint32_t param_count,
+    const wasm_value_type_t* result_types, uint32_t result_count
+) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_validate_frame_t frame = {
+        .param_types = param_types,
+        .result_types = result_types,
+        .param_count = param_count,
+        .result_count = result_count,
+        .height = v->stack.length,
+        .slots = v->slots,
+        .kind = kind,
+    };
+    vec_push(&v->frames, frame);
+    v->info->max_label_depth = MAX(v->info->max_label_depth, v->frames.length);
+    CHECK_ERROR(v->limits->max_labels == 0 || v->frames.length <= v->limits->max_labels,
+        WASM_ERROR_TOO_MANY_LABELS, "Blocks nested deeper than %u", v->limits->max_labels);
+
+    RETHROW(jit_validate_push_values(v, param_types, param_count));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_pop_frame(jit_validator_t* v, jit_validate_frame_t* out_frame) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_validate_frame_t* frame = &vec_last(&v->frames);
+    RETHROW(jit_validate_pop_values(v, frame->result_types, frame->result_count));
+    CHECK(v->stack.length == frame->height, "Operand stack is not balanced at the end of a block");
+
+    *out_frame = vec_pop(&v->frames);
+
+cleanup:
+    return err;
+}
+
+/**
+ * The rest of the current frame can't be reached, after br, return, throw and such
+ */
+static wasm_err_t jit_validate_unreachable(jit_validator_t* v) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_validate_frame_t* frame = &vec_last(&v->frames);
+    v->stack.length = frame->height;
+    v->slots = frame->slots;
+    frame->unreachable = true;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Get the frame a branch to the given label goes to, the pointer is valid
+ * until the next frame is pushed
+ */
+static wasm_err_t jit_validate_get_label(jit_validator_t* v, uint32_t index, jit_validate_frame_t** out_frame) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(index < v->frames.length, "Label %u out of bounds", index);
+    *out_frame = &v->frames.elements[v->frames.length - index - 1];
+
+cleanup:
+    return err;
+}
+
+/**
+ * The values a branch to the frame carries, the params of a loop since the
+ * branch enters it again, and the results of anything else
+ */
+static void jit_validate_label_types(jit_validate_frame_t* frame, const wasm_value_type_t** out_types, uint32_t* out_count) {
+    if (frame->kind == JIT_VALIDATE_LOOP) {
+        *out_types = frame->param_types;
+        *out_count = frame->param_count;
+    } else {
+        *out_types = frame->result_types;
+        *out_count = frame->result_count;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Immediates
+//----------------------------------------------------------------------------------------------------------------------
+
+static const wasm_value_type_t m_block_value_types[] = {
+    WASM_VALUE_TYPE_I32,
+    WASM_VALUE_TYPE_I64,
+    WASM_VALUE_TYPE_F32,
+    WASM_VALUE_TYPE_F64,
+    WASM_VALUE_TYPE_V128,
+    WASM_VALUE_TYPE_FUNCREF,
+    WASM_VALUE_TYPE_EXTERNREF,
+    WASM_VALUE_TYPE_EXNREF,
+};
+
+static wasm_err_t jit_validate_pull_block_type(
+    jit_validator_t* v, buffer_t* code,
+    const wasm_value_type_t** out_param_types, uint32_t* out_param_count,
+    const wasm_value_type_t** out_result_types, uint32_t* out_result_count
+) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    *out_param_types = nullptr;
+    *out_param_count = 0;
+    *out_result_types = nullptr;
+    *out_result_count = 0;
+
+    // the empty type and the value types are the negative single byte
+    // encodings of the s33, anything else is a type index
+    int64_t value = BUFFER_PULL_I64(code);
+    switch (value) {
+        case -0x40: break;
+
+        // i32, i64, f32, f64, v128
+        case -0x05 ... -0x01:
+            *out_result_types = &m_block_value_types[-value - 1];
+            *out_result_count = 1;
+            break;
+
+        case -0x10: *out_result_types = &m_block_value_types[5]; *out_result_count = 1; break; // funcref
+        case -0x11: *out_result_types = &m_block_value_types[6]; *out_result_count = 1; break; // externref
+        case -0x17: *out_result_types = &m_block_value_types[7]; *out_result_count = 1; break; // exnref
+
+        default: {
+            CHECK(value >= 0 && value < v->module->types_count, "Invalid block type %lld", (long long)value);
+            wasm_type_t* type = &v->module->types[value];
+            *out_param_types = type->arg_types;
+            *out_param_count = type->arg_types_count;
+            *out_result_types = type->result_types;
+            *out_result_count = type->result_types_count;
+        } break;
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * Pull the memarg of an access with the given natural alignment, atomic accesses
+ * must be exactly aligned. Returns the type of the address of the memory
+ */
+static wasm_err_t jit_validate_pull_memarg(jit_validator_t* v, buffer_t* code, uint32_t natural, bool exact, wasm_value_type_t* out_address_type) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // an alignment of 64 or above is followed by the memory index
+    uint32_t align = BUFFER_PULL_U32(code);
+    uint32_t memidx = 0;
+    if (align >= 64) {
+        align -= 64;
+        memidx = BUFFER_PULL_U32(code);
+    }
+    uint64_t offset = BUFFER_PULL_U64(code);
+
+    CHECK(memidx < v->module->memories_count, "Memory %u out of bounds", memidx);
+    wasm_memory_t* memory = &v->module->memories[memidx];
+
+    if (exact) {
+        CHECK(align == natural, "Atomic access must be naturally aligned");
+    } else {
+        CHECK(align <= natural, "Alignment larger than natural");
+    }
+
+    CHECK(memory->is64 || offset <= UINT32_MAX, "Offset out of range for a 32bit memory");
+
+    *out_address_type = memory->is64 ? WASM_VALUE_TYPE_I64 : WASM_VALUE_TYPE_I32;
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_pull_memidx(jit_validator_t* v, buffer_t* code, wasm_memory_t** out_memory) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t memidx = BUFFER_PULL_U32(code);
+    CHECK(memidx < v->module->memories_count, "Memory %u out of bounds", memidx);
+    *out_memory = &v->module->memories[memidx];
+
+cleanup:
+    return err;
+}
+
+static wasm_value_type_t jit_validate_address_type(wasm_memory_t* memory) {
+    return memory->is64 ? WASM_VALUE_TYPE_I64 : WASM_VALUE_TYPE_I32;
+}
+
+static wasm_err_t jit_validate_pull_table(jit_validator_t* v, buffer_t* code, wasm_table_t** out_table) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t tableidx = BUFFER_PULL_U32(code);
+    CHECK(tableidx < v->module->tables_count, "Table %u out of bounds", tableidx);
+    *out_table = &v->module->tables[tableidx];
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_local_type(jit_validator_t* v, uint32_t index, wasm_value_type_t* out_type) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(index < v->locals_count, "Local %u out of bounds", index);
+
+    // find the first run that ends after the local
+    uint32_t low = 0;
+    uint32_t high = v->locals.length - 1;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (v->locals.elements[mid].end > index) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    *out_type = v->locals.elements[low].type;
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_add_locals(jit_validator_t* v, uint32_t count, wasm_value_type_t type) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    if (count == 0) {
+        goto cleanup;
+    }
+
+    CHECK(count <= UINT32_MAX - v->locals_count, "Too many locals");
+    v->locals_count += count;
+    CHECK_ERROR(v->limits->max_locals == 0 || v->locals_count <= v->limits->max_locals,
+        WASM_ERROR_TOO_MANY_LOCALS, "More than %u locals", v->limits->max_locals);
+    vec_push(&v->locals, ((jit_validate_locals_t){ .end = v->locals_count, .type = type }));
+
+    // the slots are only a hint for the jit, so they saturate
+    uint64_t slots = (uint64_t)v->info->local_slots_count + (uint64_t)count * jit_count_spidir_values(&type, 1);
+    v->info->local_slots_count = MIN(slots, UINT32_MAX);
+
+cleanup:
+    return err;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Instructions
+//----------------------------------------------------------------------------------------------------------------------
+
+typedef struct jit_validate_op {
+    wasm_value_type_t operand;
+    uint8_t operand_count;
+    wasm_value_type_t result;
+} jit_validate_op_t;
+
+#define NUMERIC_OP(_first, _last, _operand, _count, _result) \
+    [(_first) ... (_last)] = { WASM_VALUE_TYPE_##_operand, _count, WASM_VALUE_TYPE_##_result }
+
+// the numeric instructions, all of their operands have the same type
+static const jit_validate_op_t m_numeric_ops[256] = {
+    NUMERIC_OP(0x45, 0x45, I32, 1, I32),    // i32.eqz
+    NUMERIC_OP(0x46, 0x4F, I32, 2, I32),    // i32 comparisons
+    NUMERIC_OP(0x50, 0x50, I64, 1, I32),    // i64.eqz
+    NUMERIC_OP(0x51, 0x5A, I64, 2, I32),    // i64 comparisons
+    NUMERIC_OP(0x5B, 0x60, F32, 2, I32),    // f32 comparisons
+    NUMERIC_OP(0x61, 0x66, F64, 2, I32),    // f64 comparisons
+    NUMERIC_OP(0x67, 0x69, I32, 1, I32),    // i32.clz, i32.ctz, i32.popcnt
+    NUMERIC_OP(0x6A, 0x78, I32, 2, I32),    // i32 arithmetic
+    NUMERIC_OP(0x79, 0x7B, I64, 1, I64),    // i64.clz, i64.ctz, i64.popcnt
+    NUMERIC_OP(0x7C, 0x8A, I64, 2, I64),    // i64 arithmetic
+    NUMERIC_OP(0x8B, 0x91, F32, 1, F32),    // f32 unary
+    NUMERIC_OP(0x92, 0x98, F32, 2, F32),    // f32 arithmetic
+    NUMERIC_OP(0x99, 0x9F, F64, 1, F64),    // f64 unary
+    NUMERIC_OP(0xA0, 0xA6, F64, 2, F64),    // f64 arithmetic
+    NUMERIC_OP(0xA7, 0xA7, I64, 1, I32),    // i32.wrap_i64
+    NUMERIC_OP(0xA8, 0xA9, F32, 1, I32),    // i32.trunc_f32_s/u
+    NUMERIC_OP(0xAA, 0xAB, F64, 1, I32),    // i32.trunc_f64_s/u
+    NUMERIC_OP(0xAC, 0xAD, I32, 1, I64),    // i64.extend_i32_s/u
+    NUMERIC_OP(0xAE, 0xAF, F32, 1, I64),    // i64.trunc_f32_s/u
+    NUMERIC_OP(0xB0, 0xB1, F64, 1, I64),    // i64.trunc_f64_s/u
+    NUMERIC_OP(0xB2, 0xB3, I32, 1, F32),    // f32.convert_i32_s/u
+    NUMERIC_OP(0xB4, 0xB5, I64, 1, F32),    // f32.convert_i64_s/u
+    NUMERIC_OP(0xB6, 0xB6, F64, 1, F32),    // f32.demote_f64
+    NUMERIC_OP(0xB7, 0xB8, I32, 1, F64),    // f64.convert_i32_s/u
+    NUMERIC_OP(0xB9, 0xBA, I64, 1, F64),    // f64.convert_i64_s/u
+    NUMERIC_OP(0xBB, 0xBB, F32, 1, F64),    // f64.promote_f32
+    NUMERIC_OP(0xBC, 0xBC, F32, 1, I32),    // i32.reinterpret_f32
+    NUMERIC_OP(0xBD, 0xBD, F64, 1, I64),    // i64.reinterpret_f64
+    NUMERIC_OP(0xBE, 0xBE, I32, 1, F32),    // f32.reinterpret_i32
+    NUMERIC_OP(0xBF, 0xBF, I64, 1, F64),    // f64.reinterpret_i64
+    NUMERIC_OP(0xC0, 0xC1, I32, 1, I32),    // i32.extend8_s, i32.extend16_s
+    NUMERIC_OP(0xC2, 0xC4, I64, 1, I64),    // i64.extend8_s ... i64.extend32_s
+};
+
+#undef NUMERIC_OP
+
+typedef struct jit_validate_access {
+    wasm_value_type_t type;
+    uint8_t align;
+} jit_validate_access_t;
+
+// the value type and the natural alignment (log2) of the loads and stores
+static const jit_validate_access_t m_memory_accesses[] = {
+    [0x28 - 0x28] = { WASM_VALUE_TYPE_I32, 2 },   // i32.load
+    [0x29 - 0x28] = { WASM_VALUE_TYPE_I64, 3 },   // i64.load
+    [0x2A - 0x28] = { WASM_VALUE_TYPE_F32, 2 },   // f32.load
+    [0x2B - 0x28] = { WASM_VALUE_TYPE_F64, 3 },   // f64.load
+    [0x2C - 0x28] = { WASM_VALUE_TYPE_I32, 0 },   // i32.load8_s
+    [0x2D - 0x28] = { WASM_VALUE_TYPE_I32, 0 },   // i32.load8_u
+    [0x2E - 0x28] = { WASM_VALUE_TYPE_I32, 1 },   // i32.load16_s
+    [0x2F - 0x28] = { WASM_VALUE_TYPE_I32, 1 },   // i32.load16_u
+    [0x30 - 0x28] = { WASM_VALUE_TYPE_I64, 0 },   // i64.load8_s
+    [0x31 - 0x28] = { WASM_VALUE_TYPE_I64, 0 },   // i64.load8_u
+    [0x32 - 0x28] = { WASM_VALUE_TYPE_I64, 1 },   // i64.load16_s
+    [0x33 - 0x28] = { WASM_VALUE_TYPE_I64, 1 },   // i64.load16_u
+    [0x34 - 0x28] = { WASM_VALUE_TYPE_I64, 2 },   // i64.load32_s
+    [0x35 - 0x28] = { WASM_VALUE_TYPE_I64, 2 },   // i64.load32_u
+    [0x36 - 0x28] = { WASM_VALUE_TYPE_I32, 2 },   // i32.store
+    [0x37 - 0x28] = { WASM_VALUE_TYPE_I64, 3 },   // i64.store
+    [0x38 - 0x28] = { WASM_VALUE_TYPE_F32, 2 },   // f32.store
+    [0x39 - 0x28] = { WASM_VALUE_TYPE_F64, 3 },   // f64.store
+    [0x3A - 0x28] = { WASM_VALUE_TYPE_I32, 0 },   // i32.store8
+    [0x3B - 0x28] = { WASM_VALUE_TYPE_I32, 1 },   // i32.store16
+    [0x3C - 0x28] = { WASM_VALUE_TYPE_I64, 0 },   // i64.store8
+    [0x3D - 0x28] = { WASM_VALUE_TYPE_I64, 1 },   // i64.store16
+    [0x3E - 0x28] = { WASM_VALUE_TYPE_I64, 2 },   // i64.store32
+};
+
+static wasm_err_t jit_validate_call(jit_validator_t* v, wasm_type_t* type) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    RETHROW(jit_validate_pop_values(v, type->arg_types, type->arg_types_count));
+    RETHROW(jit_validate_push_values(v, type->result_types, type->result_types_count));
+
+cleanup:
+    return err;
+}
+
+/**
+ * Remember a call for jit_validate_may_throw, the index is of an internal function,
+ * or functions_count plus the typeidx for an indirect call. Calls to the same
+ * target right after each other are only kept once
+ */
+static wasm_err_t jit_validate_add_callee(jit_validator_t* v, uint32_t index) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_function_info_t* info = v->info;
+    if (info->callees.length == 0 || vec_last(&info->callees) != index) {
+        vec_push(&info->callees, index);
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * A tail call pops the args and returns whatever the callee returns, so the
+ * callee must return exactly what we return
+ */
+static wasm_err_t jit_validate_tail_call(jit_validator_t* v, wasm_type_t* type) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(type->result_types_count == v->type->result_types_count, "Tail call with a different result count");
+    for (uint32_t i = 0; i < type->result_types_count; i++) {
+        CHECK(type->result_types[i] == v->type->result_types[i], "Tail call with a different result type");
+    }
+
+    RETHROW(jit_validate_pop_values(v, type->arg_types, type->arg_types_count));
+    RETHROW(jit_validate_unreachable(v));
+
+cleanup:
+    return err;
+}
+
+/**
+ * Validate a catch of a try_table, the branch to its label carries the params
+ * of the tag, followed by the exnref for the _ref variants
+ */
+static wasm_err_t jit_validate_catch(jit_validator_t* v, const wasm_value_type_t* types, uint32_t count, bool ref, uint32_t label) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_validate_frame_t* frame;
+    RETHROW(jit_validate_get_label(v, label, &frame));
+
+    const wasm_value_type_t* label_types;
+    uint32_t label_count;
+    jit_validate_label_types(frame, &label_types, &label_count);
+
+    CHECK(label_count == count + (ref ? 1 : 0), "Catch doesn't match the label");
+    for (uint32_t i = 0; i < count; i++) {
+        CHECK(label_types[i] == types[i], "Catch doesn't match the label");
+    }
+    if (ref) {
+        CHECK(label_types[count] == WASM_VALUE_TYPE_EXNREF, "Catch doesn't match the label");
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_block(jit_validator_t* v, buffer_t* code, jit_validate_frame_kind_t kind) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    const wasm_value_type_t* param_types;
+    const wasm_value_type_t* result_types;
+    uint32_t param_count, result_count;
+    RETHROW(jit_validate_pull_block_type(v, code, &param_types, &param_count, &result_types, &result_count));
+
+    if (kind == JIT_VALIDATE_IF) {
+        VALIDATE_POP(WASM_VALUE_TYPE_I32);
+    }
+
+    RETHROW(jit_validate_pop_values(v, param_types, param_count));
+    RETHROW(jit_validate_push_frame(v, kind, param_types, param_count, result_types, result_count));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_try_table(jit_validator_t* v, buffer_t* code) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    const wasm_value_type_t* param_types;
+    const wasm_value_type_t* result_types;
+    uint32_t param_count, result_count;
+    RETHROW(jit_validate_pull_block_type(v, code, &param_types, &param_count, &result_types, &result_count));
+
+    // the labels of the catches don't count the try_table itself
+    uint32_t catch_count = BUFFER_PULL_U32(code);
+    for (uint32_t i = 0; i < catch_count; i++) {
+        uint8_t kind = BUFFER_PULL(uint8_t, code);
+        CHECK(kind <= 3, "Unknown catch kind %d", kind);
+
+        // catch and catch_ref have a tag, catch_all and catch_all_ref don't
+        const wasm_value_type_t* types = nullptr;
+        uint32_t count = 0;
+        if (kind < 2) {
+            uint32_t tagidx = BUFFER_PULL_U32(code);
+            CHECK(tagidx < v->module->tags_count, "Tag %u out of bounds", tagidx);
+            wasm_type_t* type = &v->module->types[v->module->tags[tagidx]];
+            types = type->arg_types;
+            count = type->arg_types_count;
+        }
+
+        uint32_t label = BUFFER_PULL_U32(code);
+        RETHROW(jit_validate_catch(v, types, count, kind == 1 || kind == 3, label));
+    }
+
+    RETHROW(jit_validate_pop_values(v, param_types, param_count));
+    RETHROW(jit_validate_push_frame(v, JIT_VALIDATE_BLOCK, param_types, param_count, result_types, result_count));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_else(jit_validator_t* v) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_validate_frame_t frame;
+    RETHROW(jit_validate_pop_frame(v, &frame));
+    CHECK(frame.kind == JIT_VALIDATE_IF, "else without an if");
+
+    // the else starts from the params again
+    RETHROW(jit_validate_push_frame(v, JIT_VALIDATE_ELSE,
+        frame.param_types, frame.param_count,
+        frame.result_types, frame.result_count));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_end(jit_validator_t* v) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_validate_frame_t frame;
+    RETHROW(jit_validate_pop_frame(v, &frame));
+
+    // an if without an else passes its params through as the results
+    if (frame.kind == JIT_VALIDATE_IF) {
+        CHECK(frame.param_count == frame.result_count, "if without an else must have the same params and results");
+        for (uint32_t i = 0; i < frame.param_count; i++) {
+            CHECK(frame.param_types[i] == frame.result_types[i], "if without an else must have the same params and results");
+        }
+    }
+
+    // the end of the function body leaves the results for the return
+    if (v->frames.length != 0) {
+        RETHROW(jit_validate_push_values(v, frame.result_types, frame.result_count));
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * Check that the operands on top of the stack can be taken by a br_table target.
+ * The operands are only looked at and stay where they are, so every target is
+ * checked against the operands themselves and not against the types of the
+ * target before it. Below the height of an unreachable frame the operands are
+ * of any type, and match every target.
+ */
+static wasm_err_t jit_validate_br_table_operands(jit_validator_t* v, const wasm_value_type_t* types, uint32_t count) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_validate_frame_t* frame = &vec_last(&v->frames);
+    for (uint32_t i = 0; i < count; i++) {
+        int64_t position = (int64_t)v->stack.length - count + i;
+        if (position < frame->height) {
+            CHECK(frame->unreachable, "Operand stack underflow");
+            continue;
+        }
+
+        wasm_value_type_t type = v->stack.elements[position];
+        CHECK(type == types[i] || type == JIT_VALIDATE_ANY, "Unexpected type (%d != %d)", type, types[i]);
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_br_table(jit_validator_t* v, buffer_t* code) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t count = BUFFER_PULL_U32(code);
+    CHECK_ERROR(v->limits->max_br_table_size == 0 || count < v->limits->max_br_table_size,
+        WASM_ERROR_BR_TABLE_TOO_LARGE, "br_table with more than %u targets", v->limits->max_br_table_size);
+    VALIDATE_POP(WASM_VALUE_TYPE_I32);
+
+    // every target must take the operands, and they all carry the same
+    // amount of them, the last one is the default
+    uint32_t arity = 0;
+    for (uint64_t i = 0; i <= count; i++) {
+        uint32_t index = BUFFER_PULL_U32(code);
+        jit_validate_frame_t* frame;
+        RETHROW(jit_validate_get_label(v, index, &frame));
+
+        const wasm_value_type_t* types;
+        uint32_t label_count;
+        jit_validate_label_types(frame, &types, &label_count);
+        if (i == 0) {
+            arity = label_count;
+        }
+        CHECK(label_count == arity, "br_table targets with a different arity");
+
+        RETHROW(jit_validate_br_table_operands(v, types, label_count));
+    }
+
+    RETHROW(jit_validate_unreachable(v));
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_fc_prefix(jit_validator_t* v, buffer_t* code) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_module_t* module = v->module;
+    wasm_memory_t* memory;
+    wasm_table_t* table;
+
+    uint32_t sub = BUFFER_PULL_U32(code);
+    switch (sub) {
+        // i32.trunc_sat_f32_s ... i64.trunc_sat_f64_u
+        case 0 ... 7: {
+            static const wasm_value_type_t operands[] = { WASM_VALUE_TYPE_F32, WASM_VALUE_TYPE_F64 };
+            static const wasm_value_type_t results[] = { WASM_VALUE_TYPE_I32, WASM_VALUE_TYPE_I64 };
+            VALIDATE_POP(operands[(sub / 2) % 2]);
+            VALIDATE_PUSH(results[sub / 4]);
+        } break;
+
+        // memory.init
+        case 8: {
+            uint32_t dataidx = BUFFER_PULL_U32(code);
+            CHECK(module->has_data_count, "Data segment access without a data count section");
+            CHECK(dataidx < module->data_count, "Data segment %u out of bounds", dataidx);
+            RETHROW(jit_validate_pull_memidx(v, code, &memory));
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(jit_validate_address_type(memory));
+        } break;
+
+        // data.drop
+        case 9: {
+            uint32_t dataidx = BUFFER_PULL_U32(code);
+            CHECK(module->has_data_count, "Data segment access without a data count section");
+            CHECK(dataidx < module->data_count, "Data segment %u out of bounds", dataidx);
+        } break;
+
+        // memory.copy, the length is only an i64 when both memories are 64bit
+        case 10: {
+            wasm_memory_t* src_memory;
+            RETHROW(jit_validate_pull_memidx(v, code, &memory));
+            RETHROW(jit_validate_pull_memidx(v, code, &src_memory));
+            VALIDATE_POP(jit_validate_address_type(memory->is64 ? src_memory : memory));
+            VALIDATE_POP(jit_validate_address_type(src_memory));
+            VALIDATE_POP(jit_validate_address_type(memory));
+        } break;
+
+        // memory.fill
+        case 11: {
+            RETHROW(jit_validate_pull_memidx(v, code, &memory));
+            VALIDATE_POP(jit_validate_address_type(memory));
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(jit_validate_address_type(memory));
+        } break;
+
+        // table.init, elem segments only hold functions
+        case 12: {
+            uint32_t elemidx = BUFFER_PULL_U32(code);
+            CHECK(elemidx < module->elems_count, "Elem segment %u out of bounds", elemidx);
+            RETHROW(jit_validate_pull_table(v, code, &table));
+            CHECK(table->type == WASM_VALUE_TYPE_FUNCREF, "table.init into a table that is not a funcref table");
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+        } break;
+
+        // elem.drop
+        case 13: {
+            uint32_t elemidx = BUFFER_PULL_U32(code);
+            CHECK(elemidx < module->elems_count, "Elem segment %u out of bounds", elemidx);
+        } break;
+
+        // table.copy
+        case 14: {
+            wasm_table_t* src_table;
+            RETHROW(jit_validate_pull_table(v, code, &table));
+            RETHROW(jit_validate_pull_table(v, code, &src_table));
+            CHECK(table->type == src_table->type, "table.copy between tables of different types");
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+        } break;
+
+        // table.grow
+        case 15: {
+            RETHROW(jit_validate_pull_table(v, code, &table));
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(table->type);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_I32);
+        } break;
+
+        // table.size
+        case 16: {
+            RETHROW(jit_validate_pull_table(v, code, &table));
+            VALIDATE_PUSH(WASM_VALUE_TYPE_I32);
+        } break;
+
+        // table.fill
+        case 17: {
+            RETHROW(jit_validate_pull_table(v, code, &table));
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(table->type);
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+        } break;
+
+        default: CHECK_FAIL("Unknown 0xFC sub-opcode %u", sub);
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_simd_prefix(jit_validator_t* v, buffer_t* code) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_value_type_t address;
+
+    uint32_t sub = BUFFER_PULL_U32(code);
+    switch (sub) {
+        // v128.load, v128.load8x8_s ... v128.load64_splat, v128.load32_zero, v128.load64_zero
+        case 0 ... 10:
+        case 92 ... 93: {
+            static const uint8_t aligns[] = { 4, 3, 3, 3, 3, 3, 3, 0, 1, 2, 3 };
+            RETHROW(jit_validate_pull_memarg(v, code, sub <= 10 ? aligns[sub] : sub - 90, false, &address));
+            VALIDATE_POP(address);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_V128);
+        } break;
+
+        // v128.store
+        case 11: {
+            RETHROW(jit_validate_pull_memarg(v, code, 4, false, &address));
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_POP(address);
+        } break;
+
+        // v128.const
+        case 12: {
+            CHECK(buffer_pull(code, 16) != nullptr);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_V128);
+        } break;
+
+        // i8x16.shuffle, every lane index selects from both of the vectors
+        case 13: {
+            uint8_t* lanes = buffer_pull(code, 16);
+            CHECK(lanes != nullptr);
+            for (int i = 0; i < 16; i++) {
+                CHECK(lanes[i] < 32, "Shuffle lane %d out of bounds", lanes[i]);
+            }
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_V128);
+        } break;
+
+        // i8x16.splat ... f64x2.splat
+        case 15 ... 20: {
+            static const wasm_value_type_t types[] = {
+                WASM_VALUE_TYPE_I32, WASM_VALUE_TYPE_I32, WASM_VALUE_TYPE_I32,
+                WASM_VALUE_TYPE_I64, WASM_VALUE_TYPE_F32, WASM_VALUE_TYPE_F64,
+            };
+            VALIDATE_POP(types[sub - 15]);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_V128);
+        } break;
+
+        // extract_lane and replace_lane, in the order of i8x16 (with a signed and
+        // unsigned extract), i16x8 (same), i32x4, i64x2, f32x4 and f64x2
+        case 21 ... 34: {
+            static const struct { uint8_t lanes; bool replace; wasm_value_type_t type; } shapes[] = {
+                { 16, false, WASM_VALUE_TYPE_I32 }, { 16, false, WASM_VALUE_TYPE_I32 }, { 16, true, WASM_VALUE_TYPE_I32 },
+                { 8, false, WASM_VALUE_TYPE_I32 }, { 8, false, WASM_VALUE_TYPE_I32 }, { 8, true, WASM_VALUE_TYPE_I32 },
+                { 4, false, WASM_VALUE_TYPE_I32 }, { 4, true, WASM_VALUE_TYPE_I32 },
+                { 2, false, WASM_VALUE_TYPE_I64 }, { 2, true, WASM_VALUE_TYPE_I64 },
+                { 4, false, WASM_VALUE_TYPE_F32 }, { 4, true, WASM_VALUE_TYPE_F32 },
+                { 2, false, WASM_VALUE_TYPE_F64 }, { 2, true, WASM_VALUE_TYPE_F64 },
+            };
+            uint8_t lane = BUFFER_PULL(uint8_t, code);
+            CHECK(lane < shapes[sub - 21].lanes, "Lane %d out of bounds", lane);
+            if (shapes[sub - 21].replace) {
+                VALIDATE_POP(shapes[sub - 21].type);
+                VALIDATE_POP(WASM_VALUE_TYPE_V128);
+                VALIDATE_PUSH(WASM_VALUE_TYPE_V128);
+            } else {
+                VALIDATE_POP(WASM_VALUE_TYPE_V128);
+                VALIDATE_PUSH(shapes[sub - 21].type);
+            }
+        } break;
+
+        // v128.bitselect
+        case 82: {
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_V128);
+        } break;
+
+        // v128.load8_lane ... v128.store64_lane
+        case 84 ... 91: {
+            uint32_t align = (sub - 84) % 4;
+            RETHROW(jit_validate_pull_memarg(v, code, align, false, &address));
+            uint8_t lane = BUFFER_PULL(uint8_t, code);
+            CHECK(lane < 16 >> align, "Lane %d out of bounds", lane);
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_POP(address);
+            if (sub <= 87) {
+                VALIDATE_PUSH(WASM_VALUE_TYPE_V128);
+            }
+        } break;
+
+        // v128.any_true, all_true and bitmask
+        case 83:
+        case 99: case 100:
+        case 131: case 132:
+        case 163: case 164:
+        case 195: case 196:
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_I32);
+            break;
+
+        // the shifts
+        case 107 ... 109:
+        case 139 ... 141:
+        case 171 ... 173:
+        case 203 ... 205:
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_V128);
+            break;
+
+        // the unary operations
+        case 77:
+        case 94 ... 98:
+        case 103 ... 106:
+        case 116: case 117:
+        case 122:
+        case 124 ... 129:
+        case 135 ... 138:
+        case 148:
+        case 160: case 161:
+        case 167 ... 170:
+        case 192: case 193:
+        case 199 ... 202:
+        case 224: case 225:
+        case 227:
+        case 236: case 237:
+        case 239:
+        case 248 ... 255:
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_V128);
+            break;
+
+        // the binary operations
+        case 14:
+        case 35 ... 76:
+        case 78 ... 81:
+        case 101: case 102:
+        case 110 ... 115:
+        case 118 ... 121:
+        case 123:
+        case 130:
+        case 133: case 134:
+        case 142 ... 147:
+        case 149 ... 153:
+        case 155 ... 159:
+        case 174: case 177:
+        case 181 ... 186:
+        case 188 ... 191:
+        case 206: case 209:
+        case 213 ... 223:
+        case 228 ... 235:
+        case 240 ... 247:
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_POP(WASM_VALUE_TYPE_V128);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_V128);
+            break;
+
+        default: CHECK_FAIL("Unknown simd sub-opcode %u", sub);
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_atomic_prefix(jit_validator_t* v, buffer_t* code) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_value_type_t address;
+
+    uint32_t sub = BUFFER_PULL_U32(code);
+    switch (sub) {
+        // memory.atomic.notify
+        case 0x00:
+            RETHROW(jit_validate_pull_memarg(v, code, 2, true, &address));
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(address);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_I32);
+            break;
+
+        // memory.atomic.wait32, memory.atomic.wait64
+        case 0x01 ... 0x02: {
+            wasm_value_type_t type = sub == 0x01 ? WASM_VALUE_TYPE_I32 : WASM_VALUE_TYPE_I64;
+            RETHROW(jit_validate_pull_memarg(v, code, sub + 1, true, &address));
+            VALIDATE_POP(WASM_VALUE_TYPE_I64);
+            VALIDATE_POP(type);
+            VALIDATE_POP(address);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_I32);
+        } break;
+
+        // atomic.fence, followed by a reserved zero byte
+        case 0x03:
+            CHECK(BUFFER_PULL(uint8_t, code) == 0);
+            break;
+
+        // the loads, stores and read-modify-writes come in groups of seven
+        // with the same order of sizes: i32, i64, i32 8u, i32 16u, i64 8u,
+        // i64 16u and i64 32u
+        case 0x10 ... 0x4E: {
+            static const wasm_value_type_t types[] = {
+                WASM_VALUE_TYPE_I32, WASM_VALUE_TYPE_I64, WASM_VALUE_TYPE_I32, WASM_VALUE_TYPE_I32,
+                WASM_VALUE_TYPE_I64, WASM_VALUE_TYPE_I64, WASM_VALUE_TYPE_I64,
+            };
+            static const uint8_t aligns[] = { 2, 3, 0, 1, 0, 1, 2 };
+
+            uint32_t group = (sub - 0x10) / 7;
+            uint32_t size = (sub - 0x10) % 7;
+            RETHROW(jit_validate_pull_memarg(v, code, aligns[size], true, &address));
+
+            wasm_value_type_t type = types[size];
+            switch (group) {
+                // load
+                case 0:
+                    VALIDATE_POP(address);
+                    VALIDATE_PUSH(type);
+                    break;
+
+                // store
+                case 1:
+                    VALIDATE_POP(type);
+                    VALIDATE_POP(address);
+                    break;
+
+                // cmpxchg
+                case 8:
+                    VALIDATE_POP(type);
+                    VALIDATE_POP(type);
+                    VALIDATE_POP(address);
+                    VALIDATE_PUSH(type);
+                    break;
+
+                // add, sub, and, or, xor, xchg
+                default:
+                    VALIDATE_POP(type);
+                    VALIDATE_POP(address);
+                    VALIDATE_PUSH(type);
+                    break;
+            }
+        } break;
+
+        default: CHECK_FAIL("Unknown atomic sub-opcode %x", sub);
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_opcode(jit_validator_t* v, buffer_t* code) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_module_t* module = v->module;
+    jit_validate_frame_t* frame;
+    wasm_table_t* table;
+    wasm_memory_t* memory;
+    wasm_value_type_t type;
+
+    uint8_t opcode = BUFFER_PULL(uint8_t, code);
+
+    // all of the numeric instructions go through the table
+    const jit_validate_op_t* op = &m_numeric_ops[opcode];
+    if (op->operand_count != 0) {
+        for (int i = 0; i < op->operand_count; i++) {
+            VALIDATE_POP(op->operand);
+        }
+        VALIDATE_PUSH(op->result);
+        goto cleanup;
+    }
+
+    switch (opcode) {
+        //
+        // Control Instructions
+        //
+
+        case 0x00: RETHROW(jit_validate_unreachable(v)); break;
+        case 0x01: break;
+        case 0x02: RETHROW(jit_validate_block(v, code, JIT_VALIDATE_BLOCK)); break;
+        case 0x03: RETHROW(jit_validate_block(v, code, JIT_VALIDATE_LOOP)); break;
+        case 0x04: RETHROW(jit_validate_block(v, code, JIT_VALIDATE_IF)); break;
+        case 0x05: RETHROW(jit_validate_else(v)); break;
+        case 0x0B: RETHROW(jit_validate_end(v)); break;
+        case 0x1F: RETHROW(jit_validate_try_table(v, code)); break;
+
+        // throw
+        case 0x08: {
+            uint32_t tagidx = BUFFER_PULL_U32(code);
+            CHECK(tagidx < module->tags_count, "Tag %u out of bounds", tagidx);
+            wasm_type_t* tag_type = &module->types[module->tags[tagidx]];
+            RETHROW(jit_validate_pop_values(v, tag_type->arg_types, tag_type->arg_types_count));
+            RETHROW(jit_validate_unreachable(v));
+            v->info->may_throw = true;
+        } break;
+
+        // throw_ref
+        case 0x0A:
+            VALIDATE_POP(WASM_VALUE_TYPE_EXNREF);
+            RETHROW(jit_validate_unreachable(v));
+            v->info->may_throw = true;
+            break;
+
+        // br
+        case 0x0C: {
+            RETHROW(jit_validate_get_label(v, BUFFER_PULL_U32(code), &frame));
+            const wasm_value_type_t* types;
+            uint32_t count;
+            jit_validate_label_types(frame, &types, &count);
+            RETHROW(jit_validate_pop_values(v, types, count));
+            RETHROW(jit_validate_unreachable(v));
+        } break;
+
+        // br_if, the operands stay for when the branch is not taken
+        case 0x0D: {
+            RETHROW(jit_validate_get_label(v, BUFFER_PULL_U32(code), &frame));
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            const wasm_value_type_t* types;
+            uint32_t count;
+            jit_validate_label_types(frame, &types, &count);
+            RETHROW(jit_validate_pop_values(v, types, count));
+            RETHROW(jit_validate_push_values(v, types, count));
+        } break;
+
+        case 0x0E: RETHROW(jit_validate_br_table(v, code)); break;
+
+        // return
+        case 0x0F:
+            RETHROW(jit_validate_pop_values(v, v->type->result_types, v->type->result_types_count));
+            RETHROW(jit_validate_unreachable(v));
+            break;
+
+        // call, return_call
+        case 0x10:
+        case 0x12: {
+            uint32_t funcidx = BUFFER_PULL_U32(code);
+            wasm_type_t* func_type = wasm_get_func(module, funcidx);
+            CHECK(func_type != nullptr, "Function %u out of bounds", funcidx);
+            if (opcode == 0x10) {
+                RETHROW(jit_validate_call(v, func_type));
+
+                // even an import can throw, if the host calls back into us,
+                // the rest throw when anything they call does
+                if (funcidx < module->imports_count) {
+                    v->info->may_throw = true;
+                } else {
+                    RETHROW(jit_validate_add_callee(v, funcidx - module->imports_count));
+                }
+            } else {
+                RETHROW(jit_validate_tail_call(v, func_type));
+
+                // spidir has no tail calls, only a tail call to ourselves
+                // can be a jump back to the start of the function
+                CHECK_ERROR(funcidx == v->funcidx, WASM_ERROR_UNSUPPORTED,
+                    "return_call from function %u to function %u is not supported", v->funcidx, funcidx);
+            }
+        } break;
+
+        // call_indirect, return_call_indirect
+        case 0x11:
+        case 0x13: {
+            uint32_t typeidx = BUFFER_PULL_U32(code);
+            CHECK(typeidx < module->types_count, "Type %u out of bounds", typeidx);
+            RETHROW(jit_validate_pull_table(v, code, &table));
+            CHECK(table->type == WASM_VALUE_TYPE_FUNCREF, "Indirect call through a table that is not a funcref table");
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            if (opcode == 0x11) {
+                RETHROW(jit_validate_call(v, &module->types[typeidx]));
+
+                // throws when any function of the type does
+                RETHROW(jit_validate_add_callee(v, module->functions_count + typeidx));
+            } else {
+                RETHROW(jit_validate_tail_call(v, &module->types[typeidx]));
+
+                // the target is only known at runtime, so it can't be the
+                // jump of a tail call to ourselves
+                CHECK_ERROR(false, WASM_ERROR_UNSUPPORTED,
+                    "return_call_indirect in function %u is not supported", v->funcidx);
+            }
+        } break;
+
+        //
+        // Parametric Instructions
+        //
+
+        // drop
+        case 0x1A: VALIDATE_POP(JIT_VALIDATE_ANY); break;
+
+        // select, without the type only numbers and vectors can be selected
+        case 0x1B: {
+            wasm_value_type_t type1, type2;
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            RETHROW(jit_validate_pop(v, JIT_VALIDATE_ANY, &type1));
+            RETHROW(jit_validate_pop(v, JIT_VALIDATE_ANY, &type2));
+            CHECK(type1 == JIT_VALIDATE_ANY || jit_is_num_or_vec_type(type1), "select of a reference needs a type");
+            CHECK(type2 == JIT_VALIDATE_ANY || jit_is_num_or_vec_type(type2), "select of a reference needs a type");
+            CHECK(type1 == type2 || type1 == JIT_VALIDATE_ANY || type2 == JIT_VALIDATE_ANY, "select of different types");
+            VALIDATE_PUSH(type1 == JIT_VALIDATE_ANY ? type2 : type1);
+        } break;
+
+        // select t
+        case 0x1C: {
+            uint32_t count = BUFFER_PULL_U32(code);
+            CHECK(count == 1, "select must have a single type");
+            RETHROW(buffer_pull_val_type(code, &type));
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_POP(type);
+            VALIDATE_POP(type);
+            VALIDATE_PUSH(type);
+        } break;
+
+        //
+        // Variable Instructions
+        //
+
+        // local.get
+        case 0x20:
+            RETHROW(jit_validate_local_type(v, BUFFER_PULL_U32(code), &type));
+            VALIDATE_PUSH(type);
+            break;
+
+        // local.set
+        case 0x21:
+            RETHROW(jit_validate_local_type(v, BUFFER_PULL_U32(code), &type));
+            VALIDATE_POP(type);
+            break;
+
+        // local.tee
+        case 0x22:
+            RETHROW(jit_validate_local_type(v, BUFFER_PULL_U32(code), &type));
+            VALIDATE_POP(type);
+            VALIDATE_PUSH(type);
+            break;
+
+        // global.get
+        case 0x23: {
+            uint32_t globalidx = BUFFER_PULL_U32(code);
+            CHECK(globalidx < module->globals_count, "Global %u out of bounds", globalidx);
+            VALIDATE_PUSH(module->globals[globalidx].value.kind);
+        } break;
+
+        // global.set
+        case 0x24: {
+            uint32_t globalidx = BUFFER_PULL_U32(code);
+            CHECK(globalidx < module->globals_count, "Global %u out of bounds", globalidx);
+            CHECK(module->globals[globalidx].mutable, "global.set of an immutable global");
+            VALIDATE_POP(module->globals[globalidx].value.kind);
+        } break;
+
+        //
+        // Table Instructions
+        //
+
+        // table.get
+        case 0x25:
+            RETHROW(jit_validate_pull_table(v, code, &table));
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            VALIDATE_PUSH(table->type);
+            break;
+
+        // table.set
+        case 0x26:
+            RETHROW(jit_validate_pull_table(v, code, &table));
+            VALIDATE_POP(table->type);
+            VALIDATE_POP(WASM_VALUE_TYPE_I32);
+            break;
+
+        //
+        // Memory Instructions
+        //
+
+        // loads
+        case 0x28 ... 0x35: {
+            const jit_validate_access_t* access = &m_memory_accesses[opcode - 0x28];
+            wasm_value_type_t address;
+            RETHROW(jit_validate_pull_memarg(v, code, access->align, false, &address));
+            VALIDATE_POP(address);
+            VALIDATE_PUSH(access->type);
+        } break;
+
+        // stores
+        case 0x36 ... 0x3E: {
+            const jit_validate_access_t* access = &m_memory_accesses[opcode - 0x28];
+            wasm_value_type_t address;
+            RETHROW(jit_validate_pull_memarg(v, code, access->align, false, &address));
+            VALIDATE_POP(access->type);
+            VALIDATE_POP(address);
+        } break;
+
+        // memory.size
+        case 0x3F:
+            RETHROW(jit_validate_pull_memidx(v, code, &memory));
+            VALIDATE_PUSH(jit_validate_address_type(memory));
+            break;
+
+        // memory.grow
+        case 0x40:
+            RETHROW(jit_validate_pull_memidx(v, code, &memory));
+            VALIDATE_POP(jit_validate_address_type(memory));
+            VALIDATE_PUSH(jit_validate_address_type(memory));
+            break;
+
+        //
+        // Numeric Instructions
+        //
+
+        case 0x41: BUFFER_PULL_I32(code); VALIDATE_PUSH(WASM_VALUE_TYPE_I32); break;
+        case 0x42: BUFFER_PULL_I64(code); VALIDATE_PUSH(WASM_VALUE_TYPE_I64); break;
+        case 0x43: CHECK(buffer_pull(code, 4) != nullptr); VALIDATE_PUSH(WASM_VALUE_TYPE_F32); break;
+        case 0x44: CHECK(buffer_pull(code, 8) != nullptr); VALIDATE_PUSH(WASM_VALUE_TYPE_F64); break;
+
+        //
+        // Reference Instructions
+        //
+
+        // ref.null
+        case 0xD0:
+            RETHROW(buffer_pull_val_type(code, &type));
+            CHECK(jit_is_ref_type(type), "ref.null of a type that is not a reference");
+            VALIDATE_PUSH(type);
+            break;
+
+        // ref.is_null
+        case 0xD1:
+            RETHROW(jit_validate_pop(v, JIT_VALIDATE_ANY, &type));
+            CHECK(type == JIT_VALIDATE_ANY || jit_is_ref_type(type), "ref.is_null of a value that is not a reference");
+            VALIDATE_PUSH(WASM_VALUE_TYPE_I32);
+            break;
+
+        // ref.func
+        case 0xD2: {
+            uint32_t funcidx = BUFFER_PULL_U32(code);
+            CHECK(funcidx < module->imports_count + module->functions_count, "Function %u out of bounds", funcidx);
+            VALIDATE_PUSH(WASM_VALUE_TYPE_FUNCREF);
+        } break;
+
+        //
+        // Multi-byte prefix instructions
+        //
+
+        case 0xFC: RETHROW(jit_validate_fc_prefix(v, code)); break;
+        case 0xFD: RETHROW(jit_validate_simd_prefix(v, code)); break;
+        case 0xFE: RETHROW(jit_validate_atomic_prefix(v, code)); break;
+
+        default:
+            CHECK_FAIL("Unknown opcode 0x%x", opcode);
+    }
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t jit_validate_function(jit_validator_t* v, uint32_t index, jit_function_info_t* info) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_module_t* module = v->module;
+    typeidx_t typeidx = module->functions[index];
+    CHECK(typeidx < module->types_count);
+
+    v->type = &module->types[typeidx];
+    v->info = info;
+    v->funcidx = module->imports_count + index;
+    v->stack.length = 0;
+    v->frames.length = 0;
+    v->locals.length = 0;
+    v->locals_count = 0;
+    v->slots = 0;
+    vec_free(&info->callees);
+    memset(info, 0, sizeof(*info));
+
+    buffer_t code = {
+        .data = module->code[index].code,
+        .len = module->code[index].length
+    };
+    CHECK_ERROR(v->limits->max_function_size == 0 || code.len <= v->limits->max_function_size,
+        WASM_ERROR_FUNCTION_TOO_LARGE, "Function %u is larger than %u bytes", index, v->limits->max_function_size);
+
+    // the params are the first locals
+    for (uint32_t i = 0; i < v->type->arg_types_count; i++) {
+        RETHROW(jit_validate_add_locals(v, 1, v->type->arg_types[i]));
+    }
+
+    uint32_t runs = BUFFER_PULL_U32(&code);
+    for (uint32_t i = 0; i < runs; i++) {
+        uint32_t count = BUFFER_PULL_U32(&code);
+        wasm_value_type_t type;
+        RETHROW(buffer_pull_val_type(&code, &type));
+        RETHROW(jit_validate_add_locals(v, count, type));
+    }
+    info->locals_count = v->locals_count;
+
+    // the body is a block that returns the results of the function,
+    // which the last end closes
+    RETHROW(jit_validate_push_frame(v, JIT_VALIDATE_BLOCK, nullptr, 0, v->type->result_types, v->type->result_types_count));
+    while (v->frames.length != 0) {
+        RETHROW(jit_validate_opcode(v, &code));
+        info->instructions_count++;
+    }
+
+    CHECK(code.len == 0, "Code after the end of the function");
+
+    info->code = module->code[index].code;
+
+cleanup:
+    return err;
+}
+
+static void jit_validate_task(void* arg, uint32_t index) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    jit_context_t* ctx = arg;
+    jit_validate_task_t* task = &ctx->session->validate_tasks.elements[index];
+    jit_validator_t validator = { .module = ctx->module, .limits = &ctx->config->limits };
+
+    uint64_t max_instructions = ctx->config->limits.max_instructions;
+    for (uint32_t i = task->first; i < task->first + task->count; i++) {
+        // already validated while the module was streaming in
+        if (ctx->infos[i].code != ctx->module->code[i].code) {
+            RETHROW(jit_check_interrupt(ctx));
+            RETHROW(jit_validate_function(&validator, i, &ctx->infos[i]));
+        }
+
+        // the instructions are limited for the module as a whole
+        uint64_t instructions_count = atomic_fetch_add(&ctx->instructions_count, ctx->infos[i].instructions_count)
+                                    + ctx->infos[i].instructions_count;
+        CHECK_ERROR(max_instructions == 0 || instructions_count <= max_instructions,
+            WASM_ERROR_TOO_MANY_INSTRUCTIONS, "More than %llu instructions", (unsigned long long)max_instructions);
+    }
+
+cleanup:
+    vec_free(&validator.stack);
+    vec_free(&validator.frames);
+    vec_free(&validator.locals);
+
+    task->err = err;
+}
+
+wasm_err_t jit_validate_function_info(wasm_module_t* module, const wasm_jit_limits_t* limits, uint32_t index, jit_function_info_t* info) {
+    wasm_err_t err = WASM_NO_ERROR;
+    jit_validator_t validator = { .module = module, .limits = limits };
+
+    CHECK(index < module->functions_count);
+    RETHROW(jit_validate_function(&validator, index, info));
+
+cleanup:
+    vec_free(&validator.stack);
+    vec_free(&validator.frames);
+    vec_free(&validator.locals);
+
+    return err;
+}
+
+/**
+ * Check if a function of another module can end up in one of our tables, it
+ * gets in either through a table or a global that is exported, or as a funcref
+ * the host passes to us
+ */
+static bool jit_tables_may_hold_foreign_functions(wasm_module_t* module) {
+    for (uint32_t i = 0; i < module->exports_count; i++) {
+        wasm_export_t* export = &module->exports[i];
+        if (export->kind == WASM_EXPORT_TABLE) {
+            return true;
+        }
+
+        if (
+            export->kind == WASM_EXPORT_GLOBAL &&
+            module->globals[export->index].mutable &&
+            module->globals[export->index].value.kind == WASM_VALUE_TYPE_FUNCREF
+        ) {
+            return true;
+        }
+
+        // the host calls us with a funcref
+        wasm_type_t* type = export->kind == WASM_EXPORT_FUNC ? wasm_get_func(module, export->index) : nullptr;
+        for (uint32_t j = 0; type != nullptr && j < type->arg_types_count; j++) {
+            if (type->arg_types[j] == WASM_VALUE_TYPE_FUNCREF) {
+                return true;
+            }
+        }
+    }
+
+    // the host returns a funcref to us
+    for (uint32_t i = 0; i < module->imports_count; i++) {
+        wasm_type_t* type = wasm_get_func(module, i);
+        for (uint32_t j = 0; type != nullptr && j < type->result_types_count; j++) {
+            if (type->result_types[j] == WASM_VALUE_TYPE_FUNCREF) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Propagate may_throw from the functions that throw to everything that calls
+ * them, so only a call that can actually reach a throw has to go through the
+ * invoke helper inside of a try_table. An indirect call may throw when any
+ * function of its type does, which is kept in the invoke of the type. This is
+ * a worklist over the callers of every function and type, so every call is
+ * only looked at once no matter how deep the call graph is
+ */
+static wasm_err_t jit_validate_may_throw(jit_context_t* ctx) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_module_t* module = ctx->module;
+    uint32_t functions_count = module->functions_count;
+    uint32_t nodes_count = functions_count + module->types_count;
+
+    // the callers of every node are the range between its offset and the
+    // offset of the next one
+    vec(uint32_t) offsets = {};
+    vec(uint32_t) callers = {};
+    vec(uint32_t) queue = {};
+
+    // count the callers, and turn the counts into the ends of the ranges
+    uint32_t* offset = vec_add(&offsets, nodes_count + 1);
+    memset(offset, 0, (nodes_count + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < functions_count; i++) {
+        for (uint32_t j = 0; j < ctx->infos[i].callees.length; j++) {
+            offset[ctx->infos[i].callees.elements[j]]++;
+        }
+    }
+    for (uint32_t i = 1; i <= nodes_count; i++) {
+        offset[i] += offset[i - 1];
+    }
+
+    // fill every range from its end, which leaves its offset at the start
+    uint32_t* caller = vec_add(&callers, offset[nodes_count]);
+    for (uint32_t i = 0; i < functions_count; i++) {
+        for (uint32_t j = 0; j < ctx->infos[i].callees.length; j++) {
+            caller[--offset[ctx->infos[i].callees.elements[j]]] = i;
+        }
+    }
+
+    // a function of another module or an import may be called through
+    // the table, nothing is known about either of them
+    bool foreign = jit_tables_may_hold_foreign_functions(module);
+    for (uint32_t i = 0; i < module->types_count; i++) {
+        ctx->invokes[i].may_throw = foreign;
+    }
+    for (uint32_t i = 0; i < module->imports_count; i++) {
+        if (module->imports[i].kind == WASM_EXTERN_FUNC) {
+            ctx->invokes[module->imports[i].index].may_throw = true;
+        }
+    }
+
+    for (uint32_t i = 0; i < functions_count; i++) {
+        if (ctx->infos[i].may_throw) {
+            vec_push(&queue, i);
+        }
+    }
+    for (uint32_t i = 0; i < module->types_count; i++) {
+        if (ctx->invokes[i].may_throw) {
+            vec_push(&queue, functions_count + i);
+        }
+    }
+
+    while (queue.length != 0) {
+        uint32_t node = vec_pop(&queue);
+
+        // the indirect calls of its type may reach it
+        if (node < functions_count) {
+            typeidx_t typeidx = module->functions[node];
+            if (!ctx->invokes[typeidx].may_throw) {
+                ctx->invokes[typeidx].may_throw = true;
+                vec_push(&queue, functions_count + typeidx);
+            }
+        }
+
+        for (uint32_t i = offset[node]; i < offset[node + 1]; i++) {
+            jit_function_info_t* info = &ctx->infos[caller[i]];
+            if (!info->may_throw) {
+                info->may_throw = true;
+                vec_push(&queue, caller[i]);
+            }
+        }
+    }
+
+cleanup:
+    vec_free(&offsets);
+    vec_free(&callers);
+    vec_free(&queue);
+
+    return err;
+}
+
+wasm_err_t jit_validate_functions(jit_context_t* ctx) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_module_t* module = ctx->module;
+    wasm_jit_session_t* session = ctx->session;
+
+    // the refs of the exceptions are only counted for the exnrefs on the
+    // stack, in locals and in globals (the loader has no exnref tables),
+    // not for the ones held by the values of another exception
+    for (uint32_t i = 0; i < module->tags_count; i++) {
+        wasm_type_t* type = &module->types[module->tags[i]];
+        for (uint32_t j = 0; j < type->arg_types_count; j++) {
+            CHECK_ERROR(type->arg_types[j] != WASM_VALUE_TYPE_EXNREF, WASM_ERROR_UNSUPPORTED,
+                "Tag %u with an exnref param is not supported", i);
+        }
+    }
+
+    // split the functions into tasks with about the same amount of code
+    // in each, a task per function would mostly be scheduling overhead
+    session->validate_tasks.length = 0;
+    uint32_t first = 0;
+    size_t size = 0;
+    for (uint32_t i = 0; i < module->functions_count; i++) {
+        size += module->code[i].length;
+        if (size >= JIT_VALIDATE_TASK_SIZE || i == module->functions_count - 1) {
+            jit_validate_task_t task = { .first = first, .count = i + 1 - first };
+            vec_push(&session->validate_tasks, task);
+            first = i + 1;
+            size = 0;
+        }
+    }
+
+    uint32_t tasks_count = session->validate_tasks.length;
+    if (ctx->config->parallel_for != nullptr && tasks_count > 1) {
+        ctx->config->parallel_for(ctx->config->parallel_for_arg, tasks_count, jit_validate_task, ctx);
+    } else {
+        for (uint32_t i = 0; i < tasks_count; i++) {
+            jit_validate_task(ctx, i);
+        }
+    }
+
+    // report the first invalid function, so it doesn't depend on the order
+    // the tasks happened to run in, only the task that goes over the limit
+    // on the instructions does
+    for (uint32_t i = 0; i < tasks_count; i++) {
+        RETHROW(session->validate_tasks.elements[i].err);
+    }
+
+    RETHROW(jit_validate_may_throw(ctx));
+
+cleanup:
+    return err;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "jit_internal.h"
+#include "wasm/error.h"
+
+/**
+ * Validate all the function bodies of the module and fill the info of every one
+ * of them, this is done before anything is compiled so an invalid module is
+ * rejected up front. The functions are validated through the parallel_for of
+ * the config when there is one, or one after the other otherwise
+ */
+wasm_err_t jit_validate_functions(jit_context_t* ctx);
+
+/**
+ * Validate a single function body and fill its info, the index doesn't include
+ * the imports. Only needs the sections before the code section, so it works on a
+ * module that is still being streamed in
+ */
+wasm_err_t jit_validate_function_info(wasm_module_t* module, const wasm_jit_limits_t* limits, uint32_t index, jit_function_info_t* info);
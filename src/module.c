@@ -1,8 +1,10 @@
 #include "wasm/wasm.h"
 
 #include "buffer.h"
+#include "util/arena.h"
 #include "util/defs.h"
 #include "util/except.h"
+#include "util/vec.h"
 #include "wasm/host.h"
 #include <stdint.h>
 
@@ -28,12 +30,43 @@ typedef struct wasm_section {
     buffer_t contents;
 } wasm_section_t;
 
+/**
+ * Allocate zeroed memory owned by the module, from its arena when it has one
+ */
+static void* wasm_module_calloc(wasm_module_t* module, size_t nmemb, size_t size, size_t align) {
+    if (module->arena != nullptr) {
+        return arena_calloc(module->arena, nmemb, size, align);
+    }
+    return wasm_host_calloc(nmemb, size);
+}
+
+#define MODULE_CALLOC(module, type, count) \
+    (type*)wasm_module_calloc((module), (count), sizeof(type), alignof(type))
+
+/**
+ * Free a single allocation of the module, the arena allocations
+ * are only freed with the rest of the arena
+ */
+static void wasm_module_release(wasm_module_t* module, void* ptr) {
+    if (module->arena == nullptr) {
+        wasm_host_free(ptr);
+    }
+}
+
 static void wasm_type_free(wasm_type_t* type) {
     wasm_host_free(type->arg_types);
     wasm_host_free(type->result_types);
 }
 
 void wasm_module_free(wasm_module_t* module) {
+    // everything the module owns is in the arena
+    if (module->arena != nullptr) {
+        arena_free(module->arena);
+        wasm_host_free(module->arena);
+        memset(module, 0, sizeof(*module));
+        return;
+    }
+
     for (int i = 0; i < module->types_count; i++) {
         wasm_type_free(&module->types[i]);
     }
@@ -43,7 +76,8 @@ void wasm_module_free(wasm_module_t* module) {
         wasm_host_free(module->imports[i].module_name);
     }
 
-    if (module->code != nullptr) {
+    // borrowed bodies and segments belong to the caller's buffer
+    if (module->code != nullptr && !module->borrowed) {
         for (int i = 0; i < module->functions_count; i++) {
             wasm_host_free(module->code[i].code);
         }
@@ -57,8 +91,11 @@ void wasm_module_free(wasm_module_t* module) {
         wasm_host_free(module->elems[i].funcs);
     }
 
-    for (int i = 0; i < module->data_count; i++) {
-        wasm_host_free(module->data[i].data);
+    // the data count section gives the count before the segments are there
+    if (!module->borrowed && module->data != nullptr) {
+        for (int i = 0; i < module->data_count; i++) {
+            wasm_host_free(module->data[i].data);
+        }
     }
 
     if (module->function_names != nullptr) {
@@ -71,11 +108,14 @@ void wasm_module_free(wasm_module_t* module) {
     wasm_host_free(module->module_name);
     wasm_host_free(module->function_names);
     wasm_host_free(module->data);
+    wasm_host_free(module->memories);
+    wasm_host_free(module->tags);
     wasm_host_free(module->types);
     wasm_host_free(module->imports);
     wasm_host_free(module->functions);
     wasm_host_free(module->globals);
     wasm_host_free(module->exports);
+    wasm_host_free(module->export_slots);
     wasm_host_free(module->tables);
     wasm_host_free(module->elems);
     wasm_host_free(module->code);
@@ -83,6 +123,41 @@ void wasm_module_free(wasm_module_t* module) {
     memset(module, 0, sizeof(*module));
 }
 
+void wasm_module_trim(wasm_module_t* module) {
+    // nothing in the arena can be freed on its own, but drop it all
+    // the same so the module looks the same either way
+    if (module->arena == nullptr) {
+        if (module->code != nullptr && !module->borrowed) {
+            for (int i = 0; i < module->functions_count; i++) {
+                wasm_host_free(module->code[i].code);
+            }
+        }
+
+        for (int i = 0; i < module->elems_count; i++) {
+            wasm_host_free(module->elems[i].funcs);
+        }
+
+        if (module->function_names != nullptr) {
+            size_t total_funcs = (size_t)module->imports_count + module->functions_count;
+            for (size_t i = 0; i < total_funcs; i++) {
+                wasm_host_free(module->function_names[i]);
+            }
+        }
+
+        wasm_host_free(module->code);
+        wasm_host_free(module->elems);
+        wasm_host_free(module->function_names);
+        wasm_host_free(module->module_name);
+    }
+
+    // the functions keep their types, only the bodies are gone
+    module->code = nullptr;
+    module->elems = nullptr;
+    module->elems_count = 0;
+    module->function_names = nullptr;
+    module->module_name = nullptr;
+}
+
 static wasm_err_t module_pull_magic_version(buffer_t* buffer) {
     wasm_err_t err = WASM_NO_ERROR;
 
@@ -138,13 +213,13 @@ static int find_section_index(wasm_section_id_t id, int index) {
     return -1;
 }
 
-static wasm_err_t wasm_pull_result_type(buffer_t* buffer, wasm_value_type_t** out_types, uint32_t* out_count) {
+static wasm_err_t wasm_pull_result_type(wasm_module_t* module, buffer_t* buffer, wasm_value_type_t** out_types, uint32_t* out_count) {
     wasm_err_t err = WASM_NO_ERROR;
     wasm_value_type_t* types = nullptr;
 
     uint32_t count = BUFFER_PULL_U32(buffer);
     CHECK(count <= buffer->len);
-    types = CALLOC(wasm_value_type_t, count);
+    types = MODULE_CALLOC(module, wasm_value_type_t, count);
     CHECK(types != nullptr);
     *out_count = count;
 
@@ -158,7 +233,7 @@ static wasm_err_t wasm_pull_result_type(buffer_t* buffer, wasm_value_type_t** ou
 
 cleanup:
     if (IS_ERROR(err)) {
-        wasm_host_free(types);
+        wasm_module_release(module, types);
     }
 
     return err;
@@ -169,7 +244,7 @@ static wasm_err_t wasm_parse_type_section(wasm_module_t* module, buffer_t* buffe
 
     uint32_t type_count = BUFFER_PULL_U32(buffer);    
     CHECK(type_count < buffer->len);
-    module->types = CALLOC(wasm_type_t, type_count);
+    module->types = MODULE_CALLOC(module, wasm_type_t, type_count);
     CHECK(module->types != nullptr);
     module->types_count = type_count;
 
@@ -179,8 +254,8 @@ static wasm_err_t wasm_parse_type_section(wasm_module_t* module, buffer_t* buffe
 
         switch (type) {
             case 0x60: {
-                RETHROW(wasm_pull_result_type(buffer, &wasm_type->arg_types, &wasm_type->arg_types_count));
-                RETHROW(wasm_pull_result_type(buffer, &wasm_type->result_types, &wasm_type->result_types_count));
+                RETHROW(wasm_pull_result_type(module, buffer, &wasm_type->arg_types, &wasm_type->arg_types_count));
+                RETHROW(wasm_pull_result_type(module, buffer, &wasm_type->result_types, &wasm_type->result_types_count));
             } break;
 
             default: {
@@ -201,7 +276,7 @@ static wasm_err_t wasm_parse_import_section(wasm_module_t* module, buffer_t* buf
 
     uint32_t count = BUFFER_PULL_U32(buffer);
     CHECK(count <= buffer->len);
-    module->imports = CALLOC(wasm_import_t, count);
+    module->imports = MODULE_CALLOC(module, wasm_import_t, count);
     CHECK(module->imports != nullptr);
     module->imports_count = count;
 
@@ -210,7 +285,7 @@ static wasm_err_t wasm_parse_import_section(wasm_module_t* module, buffer_t* buf
         buffer_t module_name_buf = {};
         RETHROW(buffer_pull_name(buffer, &module_name_buf));
         CHECK(module_name_buf.len > 0);
-        module_name = wasm_host_calloc(1, module_name_buf.len + 1);
+        module_name = wasm_module_calloc(module, 1, module_name_buf.len + 1, 1);
         memcpy(module_name, module_name_buf.data, module_name_buf.len);
         module_name[module_name_buf.len] = '\0';
 
@@ -218,7 +293,7 @@ static wasm_err_t wasm_parse_import_section(wasm_module_t* module, buffer_t* buf
         buffer_t item_name_buf = {};
         RETHROW(buffer_pull_name(buffer, &item_name_buf));
         CHECK(item_name_buf.len > 0);
-        item_name = wasm_host_calloc(1, item_name_buf.len + 1);
+        item_name = wasm_module_calloc(module, 1, item_name_buf.len + 1, 1);
         memcpy(item_name, item_name_buf.data, item_name_buf.len);
         item_name[item_name_buf.len] = '\0';
 
@@ -254,8 +329,8 @@ static wasm_err_t wasm_parse_import_section(wasm_module_t* module, buffer_t* buf
     CHECK(buffer->len == 0);
 
 cleanup:
-    wasm_host_free(module_name);
-    wasm_host_free(item_name);
+    wasm_module_release(module, module_name);
+    wasm_module_release(module, item_name);
 
     return err;
 }
@@ -265,7 +340,7 @@ static wasm_err_t wasm_parse_function_section(wasm_module_t* module, buffer_t* b
 
     uint32_t count = BUFFER_PULL_U32(buffer);
     CHECK(count <= buffer->len);
-    module->functions = CALLOC(typeidx_t, count);
+    module->functions = MODULE_CALLOC(module, typeidx_t, count);
     CHECK(module->functions != nullptr);
     module->functions_count = count;
 
@@ -281,31 +356,53 @@ cleanup:
     return err;
 }
 
-static wasm_err_t wasm_parse_memory_section(wasm_module_t* module, buffer_t* buffer) {
+static wasm_err_t wasm_parse_tag_section(wasm_module_t* module, buffer_t* buffer) {
     wasm_err_t err = WASM_NO_ERROR;
 
     uint32_t count = BUFFER_PULL_U32(buffer);
-    CHECK(count == 1, "Multi-memory is not supported");
+    CHECK(count <= buffer->len);
+    module->tags = MODULE_CALLOC(module, typeidx_t, count);
+    CHECK(module->tags != nullptr);
+    module->tags_count = count;
+
+    for (int i = 0; i < count; i++) {
+        // the only attribute is an exception
+        uint8_t attribute = BUFFER_PULL(uint8_t, buffer);
+        CHECK(attribute == 0x00);
+
+        uint32_t typeidx = BUFFER_PULL_U32(buffer);
+        CHECK(typeidx < module->types_count);
+        CHECK(module->types[typeidx].result_types_count == 0);
+        module->tags[i] = typeidx;
+    }
 
-    // TODO: multi-memory support
-    // TODO: support for 64bit addresses
+    CHECK(buffer->len == 0);
 
-    wasm_memory_t* memory = &module->memory;
+cleanup:
+    return err;
+}
+
+static wasm_err_t wasm_parse_memory_type(buffer_t* buffer, wasm_memory_t* memory) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // the limit flags, bit 0 says there is a max, bit 1 that the memory
+    // is shared and bit 2 that it uses 64bit addresses
     uint8_t limit_type = BUFFER_PULL(uint8_t, buffer);
-    if (limit_type == 0x00) {
-        memory->min = BUFFER_PULL_U64(buffer);
-        memory->max = (UINT32_MAX / WASM_PAGE_SIZE) - 1;
-        memory->shared = false;
-    } else if (limit_type == 0x01) {
-        memory->min = BUFFER_PULL_U64(buffer);
-        memory->max = BUFFER_PULL_U64(buffer);
-        memory->shared = false;
-    } else if (limit_type == 0x03) {
-        memory->min = BUFFER_PULL_U64(buffer);
+    CHECK((limit_type & ~0x07) == 0 && limit_type != 0x02 && limit_type != 0x06,
+        "Invalid memory limit %02x", limit_type);
+    memory->shared = (limit_type & 0x02) != 0;
+    memory->is64 = (limit_type & 0x04) != 0;
+
+    // the max size of the address space of the memory
+    uint64_t limit = memory->is64 ? WASM_MEMORY64_MAX_SIZE : SIZE_4GB;
+
+    memory->min = BUFFER_PULL_U64(buffer);
+    if (limit_type & 0x01) {
         memory->max = BUFFER_PULL_U64(buffer);
-        memory->shared = true;
+    } else if (memory->is64) {
+        memory->max = limit / WASM_PAGE_SIZE;
     } else {
-        CHECK_FAIL("Invalid memory limit %02x", limit_type);
+        memory->max = (UINT32_MAX / WASM_PAGE_SIZE) - 1;
     }
 
     // ensure the min is less or equals to the max
@@ -315,9 +412,26 @@ static wasm_err_t wasm_parse_memory_section(wasm_module_t* module, buffer_t* buf
     CHECK(!__builtin_mul_overflow(memory->min, WASM_PAGE_SIZE, &memory->min));
     CHECK(!__builtin_mul_overflow(memory->max, WASM_PAGE_SIZE, &memory->max));
 
-    // ensure both stay within 4GB
-    CHECK(memory->min <= SIZE_4GB);
-    CHECK(memory->max <= SIZE_4GB);
+    // ensure both stay within the address space
+    CHECK(memory->min <= limit);
+    CHECK(memory->max <= limit);
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t wasm_parse_memory_section(wasm_module_t* module, buffer_t* buffer) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t count = BUFFER_PULL_U32(buffer);
+    CHECK(count <= buffer->len);
+    module->memories = MODULE_CALLOC(module, wasm_memory_t, count);
+    CHECK(count == 0 || module->memories != nullptr);
+    module->memories_count = count;
+
+    for (int i = 0; i < count; i++) {
+        RETHROW(wasm_parse_memory_type(buffer, &module->memories[i]));
+    }
 
     CHECK(buffer->len == 0);
 
@@ -325,7 +439,7 @@ cleanup:
     return err;
 }
 
-static wasm_err_t wasm_parse_constant_expr(buffer_t* buffer, wasm_value_t* value) {
+static wasm_err_t wasm_parse_constant_expr(wasm_module_t* module, buffer_t* buffer, wasm_value_t* value) {
     wasm_err_t err = WASM_NO_ERROR;
 
     // get the expression
@@ -351,6 +465,20 @@ static wasm_err_t wasm_parse_constant_expr(buffer_t* buffer, wasm_value_t* value
             value->value.f64 = BUFFER_PULL(double, buffer);
         } break;
 
+        // ref.null
+        case 0xD0: {
+            RETHROW(buffer_pull_val_type(buffer, &value->kind));
+            CHECK(value->kind == WASM_VALUE_TYPE_FUNCREF || value->kind == WASM_VALUE_TYPE_EXTERNREF || value->kind == WASM_VALUE_TYPE_EXNREF);
+            value->value.ref = WASM_REF_NULL;
+        } break;
+
+        // ref.func
+        case 0xD2: {
+            value->kind = WASM_VALUE_TYPE_FUNCREF;
+            value->value.ref = BUFFER_PULL_U32(buffer);
+            CHECK(value->value.ref < module->functions_count + module->imports_count);
+        } break;
+
         default:
             CHECK_FAIL("%x", byte);
     }
@@ -367,7 +495,7 @@ wasm_err_t wasm_parse_global_section(wasm_module_t* module, buffer_t* buffer) {
 
     uint32_t count = BUFFER_PULL_U32(buffer);
     CHECK(count <= buffer->len);
-    module->globals = CALLOC(wasm_global_t, count);
+    module->globals = MODULE_CALLOC(module, wasm_global_t, count);
     CHECK(module->globals != nullptr);
     module->globals_count = count;
 
@@ -383,7 +511,7 @@ wasm_err_t wasm_parse_global_section(wasm_module_t* module, buffer_t* buffer) {
 
         // parse the expression and ensure we get the correct
         // type at the end of it
-        RETHROW(wasm_parse_constant_expr(buffer, &global.value));
+        RETHROW(wasm_parse_constant_expr(module, buffer, &global.value));
         CHECK(global.value.kind == type);
 
         // append it
@@ -401,15 +529,17 @@ static wasm_err_t wasm_parse_table_section(wasm_module_t* module, buffer_t* buff
 
     uint32_t count = BUFFER_PULL_U32(buffer);
     CHECK(count <= buffer->len);
-    module->tables = CALLOC(wasm_table_t, count);
+    module->tables = MODULE_CALLOC(module, wasm_table_t, count);
     CHECK(module->tables != nullptr);
     module->tables_count = count;
 
     for (int i = 0; i < count; i++) {
-        // MVP-only reftype: funcref (0x70). Externref (0x6F) and any
-        // other reference types are out of scope.
-        uint8_t reftype = BUFFER_PULL(uint8_t, buffer);
-        CHECK(reftype == 0x70, "Unsupported reftype %02x", reftype);
+        // the element type, either funcref or externref
+        wasm_value_type_t type;
+        RETHROW(buffer_pull_val_type(buffer, &type));
+        CHECK(type == WASM_VALUE_TYPE_FUNCREF || type == WASM_VALUE_TYPE_EXTERNREF,
+            "Unsupported table element type %d", type);
+        module->tables[i].type = type;
 
         uint8_t limit_type = BUFFER_PULL(uint8_t, buffer);
         if (limit_type == 0x00) {
@@ -431,33 +561,55 @@ cleanup:
     return err;
 }
 
-// Parses an active funcref element segment of the form supported by MVP:
-// kind 0 = (i32.const offset) vec(funcidx). Other kinds (passive, decla-
-// rative, expr-vector, externref) are intentionally rejected so unknown
-// shapes produce a clear error rather than a silent miscompile.
+// Parses the element segments that hold a vector of funcidx: kind 0 is an
+// active segment of table 0, (i32.const offset) vec(funcidx), kind 2 is an
+// active segment with an explicit tableidx, and kinds 1 and 3 are passive and
+// declarative segments, (elemkind) vec(funcidx), which are only kept for the
+// functions they declare. The kinds that hold a vector of expressions are
+// rejected so unknown shapes produce a clear error rather than a silent
+// miscompile.
 static wasm_err_t wasm_parse_element_section(wasm_module_t* module, buffer_t* buffer) {
     wasm_err_t err = WASM_NO_ERROR;
     uint32_t* funcs = nullptr;
 
     uint32_t count = BUFFER_PULL_U32(buffer);
     CHECK(count <= buffer->len);
-    module->elems = CALLOC(wasm_elem_segment_t, count);
+    module->elems = MODULE_CALLOC(module, wasm_elem_segment_t, count);
     CHECK(module->elems != nullptr);
     module->elems_count = count;
 
     for (int i = 0; i < count; i++) {
         uint32_t kind = BUFFER_PULL_U32(buffer);
-        CHECK(kind == 0, "Unsupported elem segment kind %u", kind);
+        CHECK(kind <= 3, "Unsupported elem segment kind %u", kind);
 
-        // active segment, default tableidx 0, offset is a constant expr
-        wasm_value_t offset_expr = {};
-        RETHROW(wasm_parse_constant_expr(buffer, &offset_expr));
-        CHECK(offset_expr.kind == WASM_VALUE_TYPE_I32);
+        bool active = kind == 0 || kind == 2;
+        uint32_t tableidx = 0;
+        uint32_t offset = 0;
+
+        if (active) {
+            // the table the segment is for
+            if (kind == 2) {
+                tableidx = BUFFER_PULL_U32(buffer);
+            }
+            CHECK(tableidx < module->tables_count);
+            CHECK(module->tables[tableidx].type == WASM_VALUE_TYPE_FUNCREF);
+
+            // the offset is a constant expr
+            wasm_value_t offset_expr = {};
+            RETHROW(wasm_parse_constant_expr(module, buffer, &offset_expr));
+            CHECK(offset_expr.kind == WASM_VALUE_TYPE_I32);
+            offset = (uint32_t)offset_expr.value.i32;
+        }
+
+        // only the funcref elemkind exists
+        if (kind != 0) {
+            CHECK(BUFFER_PULL(uint8_t, buffer) == 0x00);
+        }
 
         uint32_t funcs_count = BUFFER_PULL_U32(buffer);
-        CHECK(funcs_count < buffer->len);
-        funcs = CALLOC(uint32_t, funcs_count);
-        CHECK(funcs != nullptr);
+        CHECK(funcs_count <= buffer->len);
+        funcs = MODULE_CALLOC(module, uint32_t, funcs_count);
+        CHECK(funcs_count == 0 || funcs != nullptr);
 
         for (int j = 0; j < funcs_count; j++) {
             uint32_t fidx = BUFFER_PULL_U32(buffer);
@@ -466,10 +618,12 @@ static wasm_err_t wasm_parse_element_section(wasm_module_t* module, buffer_t* bu
         }
 
         module->elems[i] = (wasm_elem_segment_t){
-            .tableidx = 0,
-            .offset = (uint32_t)offset_expr.value.i32,
+            .tableidx = tableidx,
+            .offset = offset,
             .funcs_count = funcs_count,
             .funcs = funcs,
+            .active = active,
+            .declarative = kind == 3,
         };
         funcs = nullptr;
     }
@@ -477,46 +631,95 @@ static wasm_err_t wasm_parse_element_section(wasm_module_t* module, buffer_t* bu
     CHECK(buffer->len == 0);
 
 cleanup:
-    wasm_host_free(funcs);
+    wasm_module_release(module, funcs);
+    return err;
+}
+
+/**
+ * Pull the contents of a data segment, either copied out or
+ * borrowed from the buffer
+ */
+static wasm_err_t wasm_pull_data(wasm_module_t* module, buffer_t* buffer, uint32_t len, void** out_data) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    void* src = buffer_pull(buffer, len);
+    CHECK(src != nullptr);
+
+    if (module->borrowed) {
+        *out_data = src;
+    } else {
+        void* data = wasm_module_calloc(module, 1, len, 1);
+        CHECK(len == 0 || data != nullptr);
+        memcpy(data, src, len);
+        *out_data = data;
+    }
+
+cleanup:
+    return err;
+}
+
+// The data count section comes before the code section, so the function bodies
+// can be validated before the data section arrives. Until then the module has
+// the count of the segments but not the segments themselves.
+static wasm_err_t wasm_parse_data_count_section(wasm_module_t* module, buffer_t* buffer) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    module->data_count = BUFFER_PULL_U32(buffer);
+    module->has_data_count = true;
+    CHECK(buffer->len == 0);
+
+cleanup:
     return err;
 }
 
-// Parses a kind-0 active data segment of the form supported by MVP:
-// (i32.const offset) vec(byte). Other kinds (passive, memidx-explicit)
-// are intentionally rejected so unknown shapes produce a clear error
-// rather than a silent miscompile. The bytes are copied into a freshly
-// allocated buffer owned by the module so callers don't need to keep
-// the original input alive.
+// Parses the data segments: kind 0 is an active segment of memory 0,
+// (const offset) vec(byte), kind 1 is a passive segment and kind 2 is an
+// active segment with an explicit memidx before the offset. Anything else
+// is rejected so unknown shapes produce a clear error rather than a silent
+// miscompile.
 static wasm_err_t wasm_parse_data_section(wasm_module_t* module, buffer_t* buffer) {
     wasm_err_t err = WASM_NO_ERROR;
     void* data = nullptr;
 
     uint32_t count = BUFFER_PULL_U32(buffer);
     CHECK(count <= buffer->len);
-    module->data = CALLOC(wasm_data_t, count);
+    CHECK(!module->has_data_count || module->data_count == count, "Data count section doesn't match the data section");
+    module->data = MODULE_CALLOC(module, wasm_data_t, count);
     CHECK(module->data != nullptr);
     module->data_count = count;
 
     for (int i = 0; i < count; i++) {
         uint32_t kind = BUFFER_PULL_U32(buffer);
-        if (kind == 0) {
+        if (kind == 0 || kind == 2) {
+            // the memory the segment is for
+            uint32_t memidx = 0;
+            if (kind == 2) {
+                memidx = BUFFER_PULL_U32(buffer);
+            }
+            CHECK(memidx < module->memories_count);
+
             // find the offset
             wasm_value_t offset_expr = {};
-            RETHROW(wasm_parse_constant_expr(buffer, &offset_expr));
-            CHECK(offset_expr.kind == WASM_VALUE_TYPE_I32);
+            RETHROW(wasm_parse_constant_expr(module, buffer, &offset_expr));
+
+            // the offset has the index type of the memory
+            uint64_t offset;
+            if (module->memories[memidx].is64) {
+                CHECK(offset_expr.kind == WASM_VALUE_TYPE_I64);
+                offset = offset_expr.value.i64;
+            } else {
+                CHECK(offset_expr.kind == WASM_VALUE_TYPE_I32);
+                offset = (uint32_t)offset_expr.value.i32;
+            }
 
             // get the data
             uint32_t len = BUFFER_PULL_U32(buffer);
-            void* src = buffer_pull(buffer, len);
-            CHECK(src != nullptr);
-
-            data = wasm_host_calloc(1, len);
-            CHECK(len == 0 || data != nullptr);
-            memcpy(data, src, len);
+            RETHROW(wasm_pull_data(module, buffer, len, &data));
 
             // setup the segment
             module->data[i] = (wasm_data_t){
-                .offset = (uint32_t)offset_expr.value.i32,
+                .memidx = memidx,
+                .offset = offset,
                 .len = len,
                 .data = data,
                 .active = true
@@ -526,12 +729,7 @@ static wasm_err_t wasm_parse_data_section(wasm_module_t* module, buffer_t* buffe
         } else if (kind == 1) {
             // get the data
             uint32_t len = BUFFER_PULL_U32(buffer);
-            void* src = buffer_pull(buffer, len);
-            CHECK(src != nullptr);
-
-            data = wasm_host_calloc(1, len);
-            CHECK(len == 0 || data != nullptr);
-            memcpy(data, src, len);
+            RETHROW(wasm_pull_data(module, buffer, len, &data));
 
             // setup the segment
             module->data[i] = (wasm_data_t){
@@ -551,7 +749,55 @@ static wasm_err_t wasm_parse_data_section(wasm_module_t* module, buffer_t* buffe
     CHECK(buffer->len == 0);
 
 cleanup:
-    wasm_host_free(data);
+    if (!module->borrowed) {
+        wasm_module_release(module, data);
+    }
+    return err;
+}
+
+/**
+ * FNV-1a over the name of an export
+ */
+static uint32_t wasm_hash_export_name(const char* name) {
+    uint32_t hash = 0x811c9dc5;
+    for (const uint8_t* ptr = (const uint8_t*)name; *ptr != '\0'; ptr++) {
+        hash ^= *ptr;
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+/**
+ * Build the hash index over the export names, which also rejects duplicate
+ * names. The table is kept at most half full so the probes stay short.
+ */
+static wasm_err_t wasm_build_export_index(wasm_module_t* module) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    if (module->exports_count == 0) {
+        goto cleanup;
+    }
+
+    uint32_t slots_count = 2;
+    while (slots_count < (uint64_t)module->exports_count * 2) {
+        slots_count *= 2;
+    }
+    module->export_slots = MODULE_CALLOC(module, uint32_t, slots_count);
+    CHECK(module->export_slots != nullptr);
+    module->export_slots_mask = slots_count - 1;
+
+    for (uint32_t i = 0; i < module->exports_count; i++) {
+        const char* name = module->exports[i].name;
+        uint32_t slot = wasm_hash_export_name(name) & module->export_slots_mask;
+        while (module->export_slots[slot] != 0) {
+            wasm_export_t* other = &module->exports[module->export_slots[slot] - 1];
+            CHECK(strcmp(other->name, name) != 0, "duplicate export name %s", name);
+            slot = (slot + 1) & module->export_slots_mask;
+        }
+        module->export_slots[slot] = i + 1;
+    }
+
+cleanup:
     return err;
 }
 
@@ -561,7 +807,7 @@ static wasm_err_t wasm_parse_export_section(wasm_module_t* module, buffer_t* buf
 
     uint32_t count = BUFFER_PULL_U32(buffer);
     CHECK(count <= buffer->len);
-    module->exports = CALLOC(wasm_export_t, count);
+    module->exports = MODULE_CALLOC(module, wasm_export_t, count);
     CHECK(module->exports != nullptr);
     module->exports_count = count;
 
@@ -570,7 +816,7 @@ static wasm_err_t wasm_parse_export_section(wasm_module_t* module, buffer_t* buf
         buffer_t name_buf = {};
         RETHROW(buffer_pull_name(buffer, &name_buf));
         CHECK(name_buf.len > 0);
-        name = wasm_host_calloc(1, name_buf.len + 1);
+        name = wasm_module_calloc(module, 1, name_buf.len + 1, 1);
         memcpy(name, name_buf.data, name_buf.len);
         name[name_buf.len] = '\0';
 
@@ -582,12 +828,13 @@ static wasm_err_t wasm_parse_export_section(wasm_module_t* module, buffer_t* buf
         uint32_t index = BUFFER_PULL_U32(buffer);
         switch (byte) {
             case 0x00: CHECK(index < module->functions_count + module->imports_count); kind = WASM_EXPORT_FUNC; break;
-            case 0x02: CHECK(index == 0); kind = WASM_EXPORT_MEMORY; break;
+            case 0x01: CHECK(index < module->tables_count); kind = WASM_EXPORT_TABLE; break;
+            case 0x02: CHECK(index < module->memories_count); kind = WASM_EXPORT_MEMORY; break;
             case 0x03: CHECK(index < module->globals_count); kind = WASM_EXPORT_GLOBAL; break;
+            case 0x04: CHECK(index < module->tags_count); kind = WASM_EXPORT_TAG; break;
             default: CHECK_FAIL("Unknown export type %x (%s)", byte, name);
         }
 
-        // and now insert it into the hashmap
         module->exports[i] = (wasm_export_t){
             .kind = kind,
             .index = index,
@@ -598,8 +845,10 @@ static wasm_err_t wasm_parse_export_section(wasm_module_t* module, buffer_t* buf
 
     CHECK(buffer->len == 0);
 
+    RETHROW(wasm_build_export_index(module));
+
 cleanup:
-    wasm_host_free(name);
+    wasm_module_release(module, name);
 
     return err;
 }
@@ -632,26 +881,51 @@ cleanup:
     return err;
 }
 
-static wasm_err_t wasm_parse_code_section(wasm_module_t* module, buffer_t* buffer) {
+static wasm_err_t wasm_begin_code_section(wasm_module_t* module, buffer_t* buffer, uint32_t* out_count) {
     wasm_err_t err = WASM_NO_ERROR;
 
     uint32_t count = BUFFER_PULL_U32(buffer);
     CHECK(count == module->functions_count);
-    module->code = CALLOC(wasm_code_t, count);
+    module->code = MODULE_CALLOC(module, wasm_code_t, count);
     CHECK(module->code != nullptr);
 
-    for (int i = 0; i < count; i++) {
-        wasm_code_t* code = &module->code[i];
+    *out_count = count;
+
+cleanup:
+    return err;
+}
+
+static wasm_err_t wasm_pull_code(wasm_module_t* module, buffer_t* buffer, uint32_t index) {
+    wasm_err_t err = WASM_NO_ERROR;
 
-        code->length = BUFFER_PULL_U32(buffer);
-        void* data = buffer_pull(buffer, code->length);
-        CHECK(data != nullptr);
+    wasm_code_t* code = &module->code[index];
 
-        code->code = wasm_host_calloc(1, code->length);
+    code->length = BUFFER_PULL_U32(buffer);
+    void* data = buffer_pull(buffer, code->length);
+    CHECK(data != nullptr);
+
+    if (module->borrowed) {
+        code->code = data;
+    } else {
+        code->code = wasm_module_calloc(module, 1, code->length, 1);
         CHECK(code->code != nullptr);
         memcpy(code->code, data, code->length);
     }
 
+cleanup:
+    return err;
+}
+
+static wasm_err_t wasm_parse_code_section(wasm_module_t* module, buffer_t* buffer) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    uint32_t count;
+    RETHROW(wasm_begin_code_section(module, buffer, &count));
+
+    for (uint32_t i = 0; i < count; i++) {
+        RETHROW(wasm_pull_code(module, buffer, i));
+    }
+
     CHECK(buffer->len == 0);
 
 cleanup:
@@ -661,7 +935,7 @@ cleanup:
 // Copy a wasm `name` (length-prefixed UTF-8) into a freshly-allocated, NUL-
 // terminated C string. Empty names return NULL — the caller treats the slot as
 // "no debug name available", same as if the entry was missing entirely.
-static wasm_err_t name_section_copy_str(buffer_t* contents, char** out) {
+static wasm_err_t name_section_copy_str(wasm_module_t* module, buffer_t* contents, char** out) {
     wasm_err_t err = WASM_NO_ERROR;
     char* result = nullptr;
 
@@ -673,7 +947,7 @@ static wasm_err_t name_section_copy_str(buffer_t* contents, char** out) {
         goto cleanup;
     }
 
-    result = wasm_host_calloc(1, name_buf.len + 1);
+    result = wasm_module_calloc(module, 1, name_buf.len + 1, 1);
     CHECK(result != nullptr);
     memcpy(result, name_buf.data, name_buf.len);
     result[name_buf.len] = '\0';
@@ -682,7 +956,7 @@ static wasm_err_t name_section_copy_str(buffer_t* contents, char** out) {
     result = nullptr;
 
 cleanup:
-    wasm_host_free(result);
+    wasm_module_release(module, result);
     return err;
 }
 
@@ -717,14 +991,14 @@ static wasm_err_t wasm_parse_name_section(wasm_module_t* module, buffer_t* buffe
             case 0: {
                 // module name
                 if (module->module_name == nullptr) {
-                    RETHROW(name_section_copy_str(&contents, &module->module_name));
+                    RETHROW(name_section_copy_str(module, &contents, &module->module_name));
                 }
             } break;
 
             case 1: {
                 // function names: vec((funcidx, name))
                 if (module->function_names == nullptr && total_funcs != 0) {
-                    module->function_names = CALLOC(char*, total_funcs);
+                    module->function_names = MODULE_CALLOC(module, char*, total_funcs);
                     CHECK(module->function_names != nullptr);
                 }
 
@@ -732,16 +1006,16 @@ static wasm_err_t wasm_parse_name_section(wasm_module_t* module, buffer_t* buffe
                 for (uint32_t i = 0; i < name_count; i++) {
                     uint32_t funcidx = BUFFER_PULL_U32(&contents);
                     char* name = nullptr;
-                    RETHROW(name_section_copy_str(&contents, &name));
+                    RETHROW(name_section_copy_str(module, &contents, &name));
 
                     // Out-of-range indices are silently dropped — the section
                     // is informational, so a producer mistake shouldn't take
                     // the module down.
                     if (funcidx < total_funcs && module->function_names != nullptr) {
-                        wasm_host_free(module->function_names[funcidx]);
+                        wasm_module_release(module, module->function_names[funcidx]);
                         module->function_names[funcidx] = name;
                     } else {
-                        wasm_host_free(name);
+                        wasm_module_release(module, name);
                     }
                 }
             } break;
@@ -756,61 +1030,62 @@ cleanup:
     return err;
 }
 
-wasm_err_t wasm_load_module(wasm_module_t* module, void* data, size_t size) {
+static wasm_err_t wasm_check_section_order(wasm_section_id_t id, int* current_index) {
     wasm_err_t err = WASM_NO_ERROR;
 
-    // setup the defaults
-    memset(module, 0, sizeof(*module));
-    module->start_func = -1;
+    // custom sections can be anywhere
+    if (id != WASM_SECTION_CUSTOM) {
+        int index = find_section_index(id, *current_index);
+        CHECK(index >= *current_index);
+        *current_index = index + 1;
+    }
 
-    buffer_t buffer = init_buffer(data, size);
-    RETHROW(module_pull_magic_version(&buffer));
+cleanup:
+    return err;
+}
 
-    int current_index = 0;
-    while (buffer.len != 0) {
-        wasm_section_t section = {};
-        RETHROW(wasm_pull_section(&buffer, &section));
+static wasm_err_t wasm_parse_section(wasm_module_t* module, wasm_section_t* section) {
+    wasm_err_t err = WASM_NO_ERROR;
 
-        // check ordering
-        if (section.id != 0) {
-            int index = find_section_index(section.id, current_index);
-            CHECK(index >= current_index);
-            current_index = index + 1;
-        }
+    buffer_t* contents = &section->contents;
+    switch (section->id) {
+        case WASM_SECTION_CUSTOM: {
+            buffer_t name = {};
+            RETHROW(buffer_pull_name(contents, &name));
+
+            // Recognize the wasm `name` custom section so jit consumers
+            // can surface debug names (e.g. in the debug ELF). Other
+            // custom sections are still ignored.
+            if (name.len == 4 && memcmp(name.data, "name", 4) == 0) {
+                RETHROW(wasm_parse_name_section(module, contents));
+            }
+        } break;
 
-        // actually check the section
-        buffer_t* contents = &section.contents;
-        switch (section.id) {
-            case WASM_SECTION_CUSTOM: {
-                buffer_t name = {};
-                RETHROW(buffer_pull_name(contents, &name));
-
-                // Recognize the wasm `name` custom section so jit consumers
-                // can surface debug names (e.g. in the debug ELF). Other
-                // custom sections are still ignored.
-                if (name.len == 4 && memcmp(name.data, "name", 4) == 0) {
-                    RETHROW(wasm_parse_name_section(module, contents));
-                }
-            } break;
+        case WASM_SECTION_TYPE: RETHROW(wasm_parse_type_section(module, contents)); break;
+        case WASM_SECTION_IMPORT: RETHROW(wasm_parse_import_section(module, contents)); break;
+        case WASM_SECTION_FUNCTION: RETHROW(wasm_parse_function_section(module, contents)); break;
+        case WASM_SECTION_TABLE: RETHROW(wasm_parse_table_section(module, contents)); break;
+        case WASM_SECTION_MEMORY: RETHROW(wasm_parse_memory_section(module, contents)); break;
+        case WASM_SECTION_TAG: RETHROW(wasm_parse_tag_section(module, contents)); break;
+        case WASM_SECTION_GLOBAL: RETHROW(wasm_parse_global_section(module, contents)); break;
+        case WASM_SECTION_EXPORT: RETHROW(wasm_parse_export_section(module, contents)); break;
+        case WASM_SECTION_START: RETHROW(wasm_parse_start_section(module, contents)); break;
+        case WASM_SECTION_ELEMENT: RETHROW(wasm_parse_element_section(module, contents)); break;
+        case WASM_SECTION_CODE: RETHROW(wasm_parse_code_section(module, contents)); break;
+        case WASM_SECTION_DATA: RETHROW(wasm_parse_data_section(module, contents)); break;
+        case WASM_SECTION_DATA_COUNT: RETHROW(wasm_parse_data_count_section(module, contents)); break;
+
+        default: {
+            CHECK_FAIL("wasm: unknown section %d", section->id);
+        } break;
+    }
 
-            case WASM_SECTION_TYPE: RETHROW(wasm_parse_type_section(module, contents)); break;
-            case WASM_SECTION_IMPORT: RETHROW(wasm_parse_import_section(module, contents)); break;
-            case WASM_SECTION_FUNCTION: RETHROW(wasm_parse_function_section(module, contents)); break;
-            case WASM_SECTION_TABLE: RETHROW(wasm_parse_table_section(module, contents)); break;
-            case WASM_SECTION_MEMORY: RETHROW(wasm_parse_memory_section(module, contents)); break;
-            case WASM_SECTION_GLOBAL: RETHROW(wasm_parse_global_section(module, contents)); break;
-            case WASM_SECTION_EXPORT: RETHROW(wasm_parse_export_section(module, contents)); break;
-            case WASM_SECTION_START: RETHROW(wasm_parse_start_section(module, contents)); break;
-            case WASM_SECTION_ELEMENT: RETHROW(wasm_parse_element_section(module, contents)); break;
-            case WASM_SECTION_CODE: RETHROW(wasm_parse_code_section(module, contents)); break;
-            case WASM_SECTION_DATA: RETHROW(wasm_parse_data_section(module, contents)); break;
-            case WASM_SECTION_DATA_COUNT: /* we don't care for this, but maybe we should validate regardless? */ break;
+cleanup:
+    return err;
+}
 
-            default: {
-                CHECK_FAIL("wasm: unknown section %d", section.id);
-            } break;
-        }
-    }
+static wasm_err_t wasm_check_module_complete(wasm_module_t* module) {
+    wasm_err_t err = WASM_NO_ERROR;
 
     // if we have functions we must have 
     // a code section as well
@@ -818,6 +1093,52 @@ wasm_err_t wasm_load_module(wasm_module_t* module, void* data, size_t size) {
         CHECK(module->code != nullptr);
     }
 
+    // a data count section promises a data section
+    if (module->data_count > 0) {
+        CHECK(module->data != nullptr);
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * Setup an empty module with the defaults
+ */
+static wasm_err_t wasm_module_init(wasm_module_t* module, bool borrowed, bool use_arena) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    memset(module, 0, sizeof(*module));
+    module->start_func = -1;
+    module->borrowed = borrowed;
+
+    if (use_arena) {
+        module->arena = CALLOC(arena_t, 1);
+        CHECK(module->arena != nullptr);
+    }
+
+cleanup:
+    return err;
+}
+
+wasm_err_t wasm_load_module_with_config(wasm_module_t* module, void* data, size_t size, const wasm_load_config_t* config) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    RETHROW(wasm_module_init(module, config->borrow, config->use_arena));
+
+    buffer_t buffer = init_buffer(data, size);
+    RETHROW(module_pull_magic_version(&buffer));
+
+    int current_index = 0;
+    while (buffer.len != 0) {
+        wasm_section_t section = {};
+        RETHROW(wasm_pull_section(&buffer, &section));
+        RETHROW(wasm_check_section_order(section.id, &current_index));
+        RETHROW(wasm_parse_section(module, &section));
+    }
+
+    RETHROW(wasm_check_module_complete(module));
+
 cleanup:
     if (IS_ERROR(err)) {
         wasm_module_free(module);
@@ -826,23 +1147,46 @@ cleanup:
     return err;
 }
 
-void wasm_module_init_memory(wasm_module_t* module, void* memory) {
+wasm_err_t wasm_load_module(wasm_module_t* module, void* data, size_t size) {
+    return wasm_load_module_with_config(module, data, size, &(wasm_load_config_t){});
+}
+
+wasm_err_t wasm_load_module_borrowed(wasm_module_t* module, void* data, size_t size) {
+    return wasm_load_module_with_config(module, data, size, &(wasm_load_config_t){ .borrow = true });
+}
+
+void wasm_module_init_memory(wasm_module_t* module, uint32_t memidx, void* memory) {
     for (int64_t i = 0; i < module->data_count; i++) {
         wasm_data_t* data = &module->data[i];
-        if (!data->active) continue;
+        if (!data->active || data->memidx != memidx) continue;
         memcpy(memory + data->offset, data->data, data->len);
     }
 }
 
 int64_t wasm_find_export(wasm_module_t* module, const char* name) {
-    for (int64_t i = 0; i < module->exports_count; i++) {
-        if (strcmp(module->exports[i].name, name) == 0) {
-            return i;
+    if (module->export_slots == nullptr) {
+        return -1;
+    }
+
+    uint32_t slot = wasm_hash_export_name(name) & module->export_slots_mask;
+    while (module->export_slots[slot] != 0) {
+        uint32_t index = module->export_slots[slot] - 1;
+        if (strcmp(module->exports[index].name, name) == 0) {
+            return index;
         }
+        slot = (slot + 1) & module->export_slots_mask;
     }
     return -1;
 }
 
+int64_t wasm_find_export_of_kind(wasm_module_t* module, const char* name, wasm_export_type_t kind) {
+    int64_t index = wasm_find_export(module, name);
+    if (index < 0 || module->exports[index].kind != kind) {
+        return -1;
+    }
+    return index;
+}
+
 wasm_type_t* wasm_get_func(wasm_module_t* module, int64_t index) {
     if (index < 0) {
         return nullptr;
@@ -867,3 +1211,265 @@ wasm_type_t* wasm_get_func(wasm_module_t* module, int64_t index) {
 
     return &module->types[idx];
 }
+
+// The streaming loader parses everything it can straight out of the chunk it
+// was fed, and only keeps the bytes it can't parse yet (a partial section, or
+// a partial function body) around for the next chunk. Sections are parsed as
+// soon as they are complete, except for the code section which is parsed one
+// function body at a time, so the bodies can be handed off while the rest of
+// the module is still arriving.
+
+typedef enum wasm_stream_state {
+    WASM_STREAM_MAGIC,
+    WASM_STREAM_SECTION_HEADER,
+    WASM_STREAM_SECTION,
+    WASM_STREAM_CODE_COUNT,
+    WASM_STREAM_CODE,
+    WASM_STREAM_DONE,
+    WASM_STREAM_FAILED,
+} wasm_stream_state_t;
+
+struct wasm_stream {
+    wasm_module_t module;
+    wasm_stream_config_t config;
+    wasm_stream_state_t state;
+
+    // the bytes that were fed but couldn't be parsed yet
+    vec(uint8_t) pending;
+
+    // for checking the section order
+    int current_index;
+
+    // the section we are in, for the code section the size
+    // is of what is left of it
+    wasm_section_id_t section_id;
+    uint32_t section_size;
+
+    // the function bodies in the code section, and the next one
+    uint32_t code_count;
+    uint32_t code_index;
+};
+
+/**
+ * Check if the buffer starts with a whole LEB128, an overlong one is
+ * reported as whole so the parser gets to reject it
+ */
+static bool wasm_stream_has_leb128(buffer_t* buffer) {
+    const uint8_t* data = buffer->data;
+    size_t max = MIN(buffer->len, (size_t)5);
+    for (size_t i = 0; i < max; i++) {
+        if ((data[i] & 0x80) == 0) {
+            return true;
+        }
+    }
+    return buffer->len >= 5;
+}
+
+static wasm_err_t wasm_stream_code_step(wasm_stream_t* stream, buffer_t* buffer, bool* out_progress) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // only look at what belongs to the code section, once all of it
+    // is here there is no point in waiting for more
+    size_t available = MIN(buffer->len, (size_t)stream->section_size);
+    buffer_t view = init_buffer(buffer->data, available);
+    bool complete = available == stream->section_size;
+
+    if (stream->state == WASM_STREAM_CODE_COUNT) {
+        if (!complete && !wasm_stream_has_leb128(&view)) {
+            goto cleanup;
+        }
+        RETHROW(wasm_begin_code_section(&stream->module, &view, &stream->code_count));
+
+    } else {
+        // wait for the whole body
+        if (!complete) {
+            buffer_t peek = view;
+            if (!wasm_stream_has_leb128(&peek)) {
+                goto cleanup;
+            }
+            uint32_t length = BUFFER_PULL_U32(&peek);
+            if (peek.len < length) {
+                goto cleanup;
+            }
+        }
+
+        RETHROW(wasm_pull_code(&stream->module, &view, stream->code_index));
+        if (stream->config.on_function != nullptr) {
+            stream->config.on_function(
+                stream->config.on_function_arg,
+                &stream->module,
+                stream->module.imports_count + stream->code_index
+            );
+        }
+        stream->code_index++;
+    }
+
+    // consume what we parsed from the section
+    size_t consumed = available - view.len;
+    buffer_pull(buffer, consumed);
+    stream->section_size -= consumed;
+
+    if (stream->code_index == stream->code_count) {
+        CHECK(stream->section_size == 0);
+        stream->state = WASM_STREAM_SECTION_HEADER;
+    } else {
+        stream->state = WASM_STREAM_CODE;
+    }
+
+    *out_progress = true;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Parse the next thing in the stream if all of it is in the buffer,
+ * otherwise leave the buffer alone
+ */
+static wasm_err_t wasm_stream_step(wasm_stream_t* stream, buffer_t* buffer, bool* out_progress) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    switch (stream->state) {
+        case WASM_STREAM_MAGIC: {
+            if (buffer->len < 8) {
+                goto cleanup;
+            }
+            RETHROW(module_pull_magic_version(buffer));
+            stream->state = WASM_STREAM_SECTION_HEADER;
+        } break;
+
+        case WASM_STREAM_SECTION_HEADER: {
+            // the id and the whole size
+            if (buffer->len < 1) {
+                goto cleanup;
+            }
+            buffer_t size = init_buffer(buffer->data + 1, buffer->len - 1);
+            if (!wasm_stream_has_leb128(&size)) {
+                goto cleanup;
+            }
+
+            stream->section_id = BUFFER_PULL(wasm_section_id_t, buffer);
+            stream->section_size = BUFFER_PULL_U32(buffer);
+            RETHROW(wasm_check_section_order(stream->section_id, &stream->current_index));
+
+            if (stream->section_id == WASM_SECTION_CODE) {
+                stream->state = WASM_STREAM_CODE_COUNT;
+            } else {
+                stream->state = WASM_STREAM_SECTION;
+            }
+        } break;
+
+        case WASM_STREAM_SECTION: {
+            if (buffer->len < stream->section_size) {
+                goto cleanup;
+            }
+
+            wasm_section_t section = {
+                .id = stream->section_id,
+                .contents = init_buffer(buffer_pull(buffer, stream->section_size), stream->section_size),
+            };
+            RETHROW(wasm_parse_section(&stream->module, &section));
+            stream->state = WASM_STREAM_SECTION_HEADER;
+        } break;
+
+        case WASM_STREAM_CODE_COUNT:
+        case WASM_STREAM_CODE: {
+            RETHROW(wasm_stream_code_step(stream, buffer, out_progress));
+            goto cleanup;
+        } break;
+
+        default:
+            CHECK_FAIL();
+    }
+
+    *out_progress = true;
+
+cleanup:
+    return err;
+}
+
+wasm_err_t wasm_stream_create(wasm_stream_t** out_stream, const wasm_stream_config_t* config) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    wasm_stream_t* stream = CALLOC(wasm_stream_t, 1);
+    CHECK(stream != nullptr);
+
+    if (config != nullptr) {
+        stream->config = *config;
+    }
+    RETHROW(wasm_module_init(&stream->module, false, stream->config.use_arena));
+
+    *out_stream = stream;
+    stream = nullptr;
+
+cleanup:
+    wasm_stream_destroy(stream);
+    return err;
+}
+
+wasm_err_t wasm_stream_feed(wasm_stream_t* stream, const void* chunk, size_t size) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    CHECK(stream->state != WASM_STREAM_FAILED && stream->state != WASM_STREAM_DONE);
+    CHECK(stream->pending.length + size <= UINT32_MAX);
+
+    // the chunk continues whatever is pending, when nothing is
+    // it can be parsed in place
+    buffer_t buffer;
+    if (stream->pending.length != 0) {
+        uint8_t* ptr = vec_add(&stream->pending, size);
+        memcpy(ptr, chunk, size);
+        buffer = init_buffer(stream->pending.elements, stream->pending.length);
+    } else {
+        buffer = init_buffer((void*)chunk, size);
+    }
+
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        RETHROW(wasm_stream_step(stream, &buffer, &progress));
+    }
+
+    // keep the rest for the next chunk
+    if (stream->pending.length != 0) {
+        memmove(stream->pending.elements, buffer.data, buffer.len);
+        stream->pending.length = buffer.len;
+    } else if (buffer.len != 0) {
+        uint8_t* ptr = vec_add(&stream->pending, buffer.len);
+        memcpy(ptr, buffer.data, buffer.len);
+    }
+
+cleanup:
+    if (IS_ERROR(err)) {
+        stream->state = WASM_STREAM_FAILED;
+    }
+    return err;
+}
+
+wasm_err_t wasm_stream_finish(wasm_stream_t* stream, wasm_module_t* module) {
+    wasm_err_t err = WASM_NO_ERROR;
+
+    // we must be between sections, with nothing left over
+    CHECK(stream->state == WASM_STREAM_SECTION_HEADER && stream->pending.length == 0, "wasm: truncated module");
+    RETHROW(wasm_check_module_complete(&stream->module));
+
+    *module = stream->module;
+    memset(&stream->module, 0, sizeof(stream->module));
+    stream->state = WASM_STREAM_DONE;
+
+cleanup:
+    if (IS_ERROR(err)) {
+        stream->state = WASM_STREAM_FAILED;
+    }
+    return err;
+}
+
+void wasm_stream_destroy(wasm_stream_t* stream) {
+    if (stream == nullptr) {
+        return;
+    }
+
+    wasm_module_free(&stream->module);
+    vec_free(&stream->pending);
+    wasm_host_free(stream);
+}
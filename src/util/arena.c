@@ -0,0 +1,92 @@
+#include "arena.h"
+
+#include "util/defs.h"
+#include "util/string.h"
+#include "wasm/host.h"
+
+// the default size of a chunk, bigger allocations get a chunk of their own size
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct arena_chunk {
+    arena_chunk_t* next;
+    size_t size;
+    size_t used;
+    uint8_t data[];
+};
+
+static arena_chunk_t* arena_new_chunk(size_t size) {
+    arena_chunk_t* chunk = wasm_host_calloc(1, sizeof(arena_chunk_t) + size);
+    if (chunk == nullptr) {
+        return nullptr;
+    }
+    chunk->size = size;
+    return chunk;
+}
+
+void* arena_calloc(arena_t* arena, size_t nmemb, size_t size, size_t align) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        return nullptr;
+    }
+
+    // try to fit in the current chunk, and otherwise in any of the
+    // chunks that were left from before the last reset
+    arena_chunk_t* chunk = arena->current;
+    while (chunk != nullptr) {
+        size_t offset = ALIGN_UP((uintptr_t)chunk->data + chunk->used, align) - (uintptr_t)chunk->data;
+        if (offset <= chunk->size && total <= chunk->size - offset) {
+            chunk->used = offset + total;
+            arena->current = chunk;
+
+            void* ptr = &chunk->data[offset];
+            memset(ptr, 0, total);
+            return ptr;
+        }
+        chunk = chunk->next;
+    }
+
+    // we need a new chunk, link it after the current one so the
+    // chunks we skipped are still reused after a reset
+    size_t chunk_size = ARENA_CHUNK_SIZE;
+    if (total > chunk_size - align) {
+        if (__builtin_add_overflow(total, align, &chunk_size)) {
+            return nullptr;
+        }
+    }
+
+    chunk = arena_new_chunk(chunk_size);
+    if (chunk == nullptr) {
+        return nullptr;
+    }
+
+    if (arena->current == nullptr) {
+        arena->first = chunk;
+    } else {
+        chunk->next = arena->current->next;
+        arena->current->next = chunk;
+    }
+    arena->current = chunk;
+
+    // the memory is fresh from calloc so its already zeroed
+    size_t offset = ALIGN_UP((uintptr_t)chunk->data, align) - (uintptr_t)chunk->data;
+    chunk->used = offset + total;
+    return &chunk->data[offset];
+}
+
+void arena_reset(arena_t* arena) {
+    for (arena_chunk_t* chunk = arena->first; chunk != nullptr; chunk = chunk->next) {
+        chunk->used = 0;
+    }
+    arena->current = arena->first;
+}
+
+void arena_free(arena_t* arena) {
+    arena_chunk_t* chunk = arena->first;
+    while (chunk != nullptr) {
+        arena_chunk_t* next = chunk->next;
+        wasm_host_free(chunk);
+        chunk = next;
+    }
+    arena->first = nullptr;
+    arena->current = nullptr;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct arena_chunk arena_chunk_t;
+
+/**
+ * A simple bump allocator, allocations are never freed one by one, instead
+ * the whole arena is reset at once. Resetting keeps the chunks around so
+ * they are reused by the next round of allocations.
+ */
+typedef struct arena {
+    // the first chunk, and the one we are allocating from
+    arena_chunk_t* first;
+    arena_chunk_t* current;
+} arena_t;
+
+/**
+ * Allocate zeroed memory from the arena, returns null if
+ * we ran out of memory
+ */
+void* arena_calloc(arena_t* arena, size_t nmemb, size_t size, size_t align);
+
+/**
+ * Release all the allocations of the arena, keeping the memory
+ * around for the next allocations
+ */
+void arena_reset(arena_t* arena);
+
+/**
+ * Free all the memory of the arena
+ */
+void arena_free(arena_t* arena);
+
+#define ARENA_CALLOC(arena, type, count) (type*)arena_calloc((arena), (count), sizeof(type), alignof(type))
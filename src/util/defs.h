@@ -10,6 +10,13 @@
 
 #define CALLOC(type, count) (type*)wasm_host_calloc(sizeof(type), (count))
 
+#define MIN(a, b) \
+    ({ \
+        typeof(a) __a = a; \
+        typeof(b) __b = b; \
+        __a < __b ? __a : __b; \
+    })
+
 #define MAX(a, b) \
     ({ \
         typeof(a) __a = a; \
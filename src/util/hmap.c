@@ -5,6 +5,7 @@
 
 #include "defs.h"
 #include "except.h"
+#include "string.h"
 
 #define GOLDEN_RATIO_64 0x61C8864680B583EBull
 
@@ -143,6 +144,15 @@ void hmap_free(hmap_t* table) {
     *table = HMAP_INIT;
 }
 
+// Remove all the entries but keep the slots, so refilling
+// the table doesn't need to allocate again.
+void hmap_clear(hmap_t* table) {
+    if (table->slots) {
+        memset(table->slots, 0, hmap_capacity(table) * sizeof(hmap_slot_t));
+    }
+    table->size = 0;
+}
+
 wasm_err_t hmap_insert(hmap_t* table, uint64_t key, uint64_t value) {
     wasm_err_t err = WASM_NO_ERROR;
 
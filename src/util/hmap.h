@@ -23,6 +23,7 @@ typedef struct hmap_iter {
 } hmap_iter_t;
 
 void hmap_free(hmap_t* table);
+void hmap_clear(hmap_t* table);
 wasm_err_t hmap_insert(hmap_t* table, uint64_t key, uint64_t value);
 bool hmap_lookup(const hmap_t* table, uint64_t key, uint64_t* out_value);
 void hmap_delete(hmap_t* table, uint64_t key);
@@ -0,0 +1,429 @@
+#!/usr/bin/env -S uv run --script
+# /// script
+# requires-python = ">=3.10"
+# dependencies = ["rich>=13"]
+# ///
+"""Compile-time and runtime benchmarks for the JIT.
+
+Each benchmark generates a synthetic wasm module that stresses one part of
+the frontend, then times `build/main -m <wasm> --jit-only --time` over a few
+runs and reports the median load and JIT times, along with the size of the
+jitted code and rodata, so codegen changes can be compared on size too. The
+modules are encoded directly here so the benchmarks don't depend on wat2wasm.
+
+The runtime benchmarks are run to completion instead, and also report how
+long running `_start` took. Their `_start` returns 0 only when it computed
+the expected result.
+
+Every run JITs the module several times back to back in the same session, so
+besides the cold compile we also get the time of a warm one. When the test
+corpus is built (tests/build) it is compiled the same way, and its times are
+summed up into a single row.
+
+The same modules also go through `build/bench-leb128` (tests/bench_leb128.c),
+a microbenchmark of the LEB128 decoding over their code section, reported
+next to the plain byte at a time decoder it replaced. The corpus row is the
+median over its modules.
+
+Run with `make bench`, or pass benchmark names to run only those.
+"""
+
+import re
+import statistics
+import subprocess
+import sys
+from pathlib import Path
+from typing import Callable
+
+from rich.console import Console
+from rich.table import Table
+
+RUNS = 5
+
+# how many times every run compiles the module
+REPEAT = 5
+
+#
+# Minimal wasm binary encoding
+#
+
+I32 = 0x7F
+I64 = 0x7E
+
+
+def uleb(value: int) -> bytes:
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def sleb(value: int) -> bytes:
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if (value == 0 and not byte & 0x40) or (value == -1 and byte & 0x40):
+            out.append(byte)
+            return bytes(out)
+        out.append(byte | 0x80)
+
+
+def vec(items: list[bytes]) -> bytes:
+    return uleb(len(items)) + b"".join(items)
+
+
+def section(id: int, payload: bytes) -> bytes:
+    return bytes([id]) + uleb(len(payload)) + payload
+
+
+def func_body(local_count: int, code: bytes, local_types: list[int] | None = None) -> bytes:
+    """A function with `local_count` i32 locals, or with a local of every
+    type in `local_types` when given."""
+    if local_types:
+        locals = vec([uleb(1) + bytes([t]) for t in local_types])
+    else:
+        locals = vec([uleb(local_count) + bytes([I32])]) if local_count else vec([])
+    body = locals + code + b"\x0b"
+    return uleb(len(body)) + body
+
+
+def func_type(params: list[int], results: list[int]) -> bytes:
+    return b"\x60" + vec([bytes([t]) for t in params]) + vec([bytes([t]) for t in results])
+
+
+def module(
+    bodies: list[bytes],
+    types: list[bytes] | None = None,
+    func_types: list[int] | None = None,
+    memory: bytes | None = None,
+) -> bytes:
+    """A module of functions, the first exported as _start. By default they
+    are all `() -> i32`. `memory` is the encoded type of its memory, if any."""
+    types = section(1, vec(types or [func_type([], [I32])]))
+    funcs = section(3, vec([uleb(t) for t in func_types or [0] * len(bodies)]))
+    memories = section(5, vec([memory])) if memory is not None else b""
+    exports = section(7, vec([uleb(len(b"_start")) + b"_start" + b"\x00" + uleb(0)]))
+    code = section(10, vec(bodies))
+    return b"\0asm\x01\0\0\0" + types + funcs + memories + exports + code
+
+
+def local_get(index: int) -> bytes:
+    return b"\x20" + uleb(index)
+
+
+def local_set(index: int) -> bytes:
+    return b"\x21" + uleb(index)
+
+
+def local_tee(index: int) -> bytes:
+    return b"\x22" + uleb(index)
+
+
+def i32_const(value: int) -> bytes:
+    return b"\x41" + sleb(value)
+
+
+#
+# Benchmarks
+#
+
+
+def many_locals() -> bytes:
+    """Functions with thousands of locals and hundreds of loops, where every
+    loop only touches a couple of them. Stresses the per-label local tracking."""
+    local_count = 4000
+    loop_count = 400
+    bodies = []
+    for _ in range(8):
+        code = bytearray()
+        for i in range(loop_count):
+            counter = (i * 7) % local_count
+            acc = (i * 13 + 1) % local_count
+            code += b"\x02\x40"  # block
+            code += b"\x03\x40"  # loop
+            code += local_get(acc) + local_get(counter) + b"\x6a" + local_set(acc)  # acc += counter
+            code += local_get(counter) + i32_const(1) + b"\x6a" + local_tee(counter)  # ++counter
+            code += i32_const(16) + b"\x49" + b"\x0d\x00"  # br_if 0 (counter < 16)
+            code += b"\x0b"  # end loop
+            code += b"\x0b"  # end block
+        code += local_get(1)
+        bodies.append(func_body(local_count, bytes(code)))
+    return module(bodies)
+
+
+def many_calls() -> bytes:
+    """Functions made mostly of calls and br_tables, which need temporary
+    argument and target arrays for every instruction."""
+    call_count = 4000
+    bodies = []
+    for f in range(64):
+        code = bytearray()
+        code += i32_const(0)
+        for i in range(call_count):
+            callee = (f + i + 1) % 64
+            code += b"\x10" + uleb(callee) + b"\x6a"  # call, i32.add
+            if i % 16 == 0:
+                # block, block, br_table 0 1 1, end, end
+                code += b"\x02\x40\x02\x40" + local_get(0) + b"\x0e\x02\x00\x01\x01\x0b\x0b"
+        bodies.append(func_body(1, bytes(code)))
+    return module(bodies)
+
+
+#
+# Runtime benchmarks
+#
+
+# how many instructions the interpreters run
+INTERP_STEPS = 5_000_000
+
+
+def interp_expected() -> int:
+    """What the interpreters below compute, as a signed i32."""
+    acc = 0
+    for pc in range(INTERP_STEPS):
+        match pc & 3:
+            case 0: acc = acc + pc
+            case 1: acc = acc ^ pc
+            case 2: acc = acc * 3
+            case 3: acc = acc - 7
+        acc &= 0xFFFFFFFF
+    return acc - (1 << 32) if acc & 0x80000000 else acc
+
+
+def interp_handlers(next_op: Callable[[bytes], bytes]) -> bytes:
+    """The dispatch of a `(pc, acc)` interpreter step over the four opcodes
+    (pc & 3), `next_op` gets the code of the new acc and ends the handler."""
+    handlers = [
+        local_get(1) + local_get(0) + b"\x6a",  # acc + pc
+        local_get(1) + local_get(0) + b"\x73",  # acc ^ pc
+        local_get(1) + i32_const(3) + b"\x6c",  # acc * 3
+        local_get(1) + i32_const(7) + b"\x6b",  # acc - 7
+    ]
+    code = bytearray()
+    code += b"\x02\x40" * len(handlers)  # a block per handler
+    code += local_get(0) + i32_const(3) + b"\x71"  # pc & 3
+    code += b"\x0e" + vec([uleb(i) for i in range(len(handlers))]) + uleb(len(handlers) - 1)  # br_table
+    for handler in handlers:
+        code += b"\x0b" + next_op(handler)  # end
+    return bytes(code)
+
+
+def interp_tail_call() -> bytes:
+    """A threaded interpreter where every handler tail calls the dispatch with
+    the next pc, so the whole run is a single chain of return_calls. The dispatch
+    calls itself, which is the only tail call the jit supports."""
+    step = bytearray()
+    # block, br_if 0 (pc != steps), return acc, end
+    step += b"\x02\x40" + local_get(0) + i32_const(INTERP_STEPS) + b"\x47\x0d\x00" + local_get(1) + b"\x0f\x0b"
+    step += interp_handlers(lambda acc: local_get(0) + i32_const(1) + b"\x6a" + acc + b"\x12\x01")  # return_call 1
+    start = i32_const(0) + i32_const(0) + b"\x10\x01" + i32_const(interp_expected()) + b"\x47"  # call 1, i32.ne
+    return module(
+        [func_body(0, start), func_body(0, bytes(step))],
+        types=[func_type([], [I32]), func_type([I32, I32], [I32])],
+        func_types=[0, 1],
+    )
+
+
+def interp_trampoline() -> bytes:
+    """The same interpreter without tail calls, where a driver loop calls the
+    dispatch for every instruction and every handler returns to it."""
+    step = interp_handlers(lambda acc: acc + b"\x0f")  # return
+    start = bytearray()
+    start += b"\x03\x40"  # loop
+    start += local_get(0) + local_get(1) + b"\x10\x01" + local_set(1)  # acc = step(pc, acc)
+    start += local_get(0) + i32_const(1) + b"\x6a" + local_tee(0)  # ++pc
+    start += i32_const(INTERP_STEPS) + b"\x47\x0d\x00"  # br_if 0 (pc != steps)
+    start += b"\x0b"  # end loop
+    start += local_get(1) + i32_const(interp_expected()) + b"\x47"  # i32.ne
+    return module(
+        [func_body(2, bytes(start)), func_body(0, step)],
+        types=[func_type([], [I32]), func_type([I32, I32], [I32])],
+        func_types=[0, 1],
+    )
+
+
+# the size of the memory the memory benchmarks walk, and how many times
+MEM_PAGES = 16
+MEM_PASSES = 64
+
+
+def mem_walk_expected() -> int:
+    """What the memory walks below compute, as a signed i32."""
+    acc = MEM_PASSES * sum(range(0, MEM_PAGES * 65536, 4)) & 0xFFFFFFFF
+    return acc - (1 << 32) if acc & 0x80000000 else acc
+
+
+def mem_walk(is64: bool) -> bytes:
+    """Stores the address of every word of the memory in it, then sums all the
+    words over and over. Mostly loads through the address type of the memory,
+    a 64-bit memory has to bounds check them where a 32-bit one doesn't."""
+    if is64:
+        addr_type, const, add, lt_u, wrap = I64, b"\x42", b"\x7c", b"\x54", b"\xa7"
+    else:
+        addr_type, const, add, lt_u, wrap = I32, b"\x41", b"\x6a", b"\x49", b""
+
+    def walk(body: bytes) -> bytes:
+        """A loop over the address of every word in local 0"""
+        code = const + sleb(0) + local_set(0)
+        code += b"\x03\x40" + body  # loop
+        code += local_get(0) + const + sleb(4) + add + local_tee(0)  # addr += 4
+        code += const + sleb(MEM_PAGES * 65536) + lt_u + b"\x0d\x00"  # br_if 0 (addr < size)
+        return code + b"\x0b"  # end loop
+
+    code = bytearray()
+    code += walk(local_get(0) + local_get(0) + wrap + b"\x36\x02\x00")  # i32.store
+    code += b"\x03\x40"  # loop
+    code += walk(local_get(1) + local_get(0) + b"\x28\x02\x00\x6a" + local_set(1))  # acc += i32.load
+    code += local_get(2) + i32_const(1) + b"\x6a" + local_tee(2)  # ++pass
+    code += i32_const(MEM_PASSES) + b"\x49\x0d\x00"  # br_if 0 (pass < passes)
+    code += b"\x0b"  # end loop
+    code += local_get(1) + i32_const(mem_walk_expected()) + b"\x47"  # i32.ne
+    limits = bytes([0x05 if is64 else 0x01]) + uleb(MEM_PAGES) + uleb(MEM_PAGES)
+    return module([func_body(0, bytes(code), [addr_type, I32, I32])], memory=limits)
+
+
+BENCHMARKS: dict[str, Callable[[], bytes]] = {
+    "many_locals": many_locals,
+    "many_calls": many_calls,
+    "interp_tail_call": interp_tail_call,
+    "interp_trampoline": interp_trampoline,
+    "mem_walk32": lambda: mem_walk(False),
+    "mem_walk64": lambda: mem_walk(True),
+}
+
+# the benchmarks that are also run and not only compiled
+RUNTIME_BENCHMARKS = {"interp_tail_call", "interp_trampoline", "mem_walk32", "mem_walk64"}
+
+#
+# Runner
+#
+
+def is_wasm(path: Path) -> bool:
+    if not path.is_file():
+        return False
+    with path.open("rb") as f:
+        return f.read(4) == b"\0asm"
+
+
+TIME_RE = re.compile(r"\[\*\] (load|jit|jit \(warm\)|run): ([0-9.]+) ms")
+CODE_RE = re.compile(r"\[\*\] jit code: ([0-9]+) bytes, rodata: ([0-9]+) bytes")
+
+
+def run_once(main_bin: Path, wasm: Path, run: bool) -> dict[str, float]:
+    args = [str(main_bin), "-m", str(wasm), "--time", f"--repeat={REPEAT}"]
+    if not run:
+        args.append("--jit-only")
+    proc = subprocess.run(args, capture_output=True, text=True)
+    if proc.returncode != 0:
+        raise RuntimeError(f"{wasm.name}: exit code {proc.returncode}\n{proc.stdout}{proc.stderr}")
+    times = {m.group(1): float(m.group(2)) for m in TIME_RE.finditer(proc.stdout)}
+    code = CODE_RE.search(proc.stdout)
+    if code:
+        times["code"] = float(code.group(1))
+        times["rodata"] = float(code.group(2))
+    return times
+
+
+LEB128_RE = re.compile(r"\[\*\] leb128( \(bytewise\))?: ([0-9.]+) MiB/s")
+
+
+def run_leb128(leb128_bin: Path, wasm: Path) -> dict[str, float]:
+    args = [str(leb128_bin), str(wasm)]
+    proc = subprocess.run(args, capture_output=True, text=True)
+    if proc.returncode != 0:
+        raise RuntimeError(f"{wasm.name}: exit code {proc.returncode}\n{proc.stdout}{proc.stderr}")
+    return {"bytewise" if m.group(1) else "fast": float(m.group(2)) for m in LEB128_RE.finditer(proc.stdout)}
+
+
+def run_median(main_bin: Path, wasm: Path, run: bool = False) -> dict[str, float]:
+    runs = [run_once(main_bin, wasm, run) for _ in range(RUNS)]
+    keys = ("load", "jit", "jit (warm)", "code", "rodata", "run") if run else ("load", "jit", "jit (warm)", "code", "rodata")
+    return {key: statistics.median(r[key] for r in runs) for key in keys}
+
+
+def main() -> int:
+    console = Console()
+
+    repo_root = Path(__file__).resolve().parent.parent
+    main_bin = repo_root / "build" / "main"
+    leb128_bin = repo_root / "build" / "bench-leb128"
+    out_dir = repo_root / "build" / "bench"
+
+    for binary in (main_bin, leb128_bin):
+        if not binary.exists():
+            console.print(f"[bold red]error:[/] {binary} not found — build it first")
+            return 2
+
+    names = sys.argv[1:] or [*BENCHMARKS, "corpus"]
+    for name in names:
+        if name not in BENCHMARKS and name != "corpus":
+            console.print(f"[bold red]error:[/] unknown benchmark {name}")
+            return 2
+
+    out_dir.mkdir(parents=True, exist_ok=True)
+
+    table = Table(title=f"JIT compile and run time (median of {RUNS} runs)")
+    table.add_column("benchmark")
+    table.add_column("size", justify="right")
+    table.add_column("load (ms)", justify="right")
+    table.add_column("jit (ms)", justify="right")
+    table.add_column("warm jit (ms)", justify="right")
+    table.add_column("run (ms)", justify="right")
+    table.add_column("code", justify="right")
+    table.add_column("rodata", justify="right")
+
+    leb128_table = Table(title="LEB128 decoding of the code section")
+    leb128_table.add_column("benchmark")
+    leb128_table.add_column("decode (MiB/s)", justify="right")
+    leb128_table.add_column("bytewise (MiB/s)", justify="right")
+    leb128_table.add_column("speedup", justify="right")
+
+    for name in names:
+        if name == "corpus":
+            corpus = sorted(p for p in (repo_root / "tests" / "build").rglob("*") if is_wasm(p))
+            if not corpus:
+                console.print("[yellow]note:[/] tests/build is empty, skipping the corpus (run `make -C tests`)")
+                continue
+            size = sum(p.stat().st_size for p in corpus)
+            times = [run_median(main_bin, wasm) for wasm in corpus]
+            total = {key: sum(t[key] for t in times) for key in times[0]}
+            decodes = [d for d in (run_leb128(leb128_bin, wasm) for wasm in corpus) if d]
+            decode = {key: statistics.median(d[key] for d in decodes) for key in ("fast", "bytewise")}
+            name = f"corpus ({len(corpus)} modules)"
+        else:
+            wasm = out_dir / f"{name}.wasm"
+            wasm.write_bytes(BENCHMARKS[name]())
+            size = wasm.stat().st_size
+            total = run_median(main_bin, wasm, name in RUNTIME_BENCHMARKS)
+            decode = run_leb128(leb128_bin, wasm)
+
+        table.add_row(
+            name,
+            f"{size / 1024:.0f} KiB",
+            f"{total['load']:.2f}",
+            f"{total['jit']:.2f}",
+            f"{total['jit (warm)']:.2f}",
+            f"{total['run']:.2f}" if "run" in total else "-",
+            f"{total['code'] / 1024:.1f} KiB",
+            f"{total['rodata'] / 1024:.1f} KiB",
+        )
+        leb128_table.add_row(
+            name,
+            f"{decode['fast']:.1f}",
+            f"{decode['bytewise']:.1f}",
+            f"{decode['fast'] / decode['bytewise']:.2f}x",
+        )
+
+    console.print(table)
+    console.print(leb128_table)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,190 @@
+// LEB128 decoding microbenchmark, run by tests/bench.py over the same modules
+// it jits. It decodes the code section of every module given on the command
+// line as a stream of LEB128s, once with the decoder of the loader and once
+// with the plain byte at a time decoder it replaced.
+//
+//     build/bench-leb128 <module>...
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <wasm/wasm.h>
+#include <wasm/host.h>
+#include <wasm/error.h>
+
+#include <util/except.h>
+#include <buffer.h>
+
+// every module is decoded over and over until this many bytes were
+// decoded, to get a stable timing out of small modules
+#define BENCH_LEB128_BYTES  (256ull * 1024 * 1024)
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Read a whole file, the caller owns the buffer (release with wasm_host_free)
+ */
+static wasm_err_t read_file(const char* path, void** out_data, size_t* out_size) {
+    wasm_err_t err = WASM_NO_ERROR;
+    void* data = nullptr;
+
+    FILE* file = fopen(path, "rb");
+    CHECK(file != nullptr, "%s: %s", strerror(errno), path);
+
+    CHECK(fseek(file, 0, SEEK_END) == 0, "%s", strerror(errno));
+    long size = ftell(file);
+    CHECK(size > 0, "%s: empty file", path);
+    CHECK(fseek(file, 0, SEEK_SET) == 0, "%s", strerror(errno));
+
+    data = wasm_host_calloc(1, size);
+    CHECK(data != nullptr);
+    CHECK(fread(data, size, 1, file) == 1, "%s", strerror(errno));
+
+    *out_data = data;
+    *out_size = size;
+    data = nullptr;
+
+cleanup:
+    wasm_host_free(data);
+    if (file != nullptr) fclose(file);
+    return err;
+}
+
+/**
+ * The plain byte at a time decoder, as the baseline.
+ * Returns false on an overlong encoding or when the buffer runs out.
+ */
+static bool leb128_decode_bytewise(const uint8_t** data, const uint8_t* end, uint32_t* value) {
+    const uint8_t* ptr = *data;
+    uint32_t result = 0;
+    uint32_t shift = 0;
+    uint8_t byte = 0;
+    do {
+        if (shift > 28 || ptr == end) {
+            return false;
+        }
+        byte = *ptr++;
+        result |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while ((byte & 0x80) != 0);
+
+    *data = ptr;
+    *value = result;
+    return true;
+}
+
+/**
+ * Time decoding the function bodies as a stream of LEB128s, which is roughly
+ * what the loader and the opcode loop see: mostly single byte opcodes and
+ * indices with the occasional multi-byte constant or offset. The bytes that
+ * don't start a valid u32 (prefixed opcodes, v128 constants) are left out up
+ * front, so both decoders see exactly the same values.
+ */
+static wasm_err_t bench_leb128(wasm_module_t* module) {
+    wasm_err_t err = WASM_NO_ERROR;
+    uint8_t* values = nullptr;
+    size_t size = 0;
+
+    for (uint32_t i = 0; i < module->functions_count; i++) {
+        size += module->code[i].length;
+    }
+    values = wasm_host_calloc(1, size + 1);
+    CHECK(values != nullptr);
+
+    // keep only the valid encodings
+    size_t values_size = 0;
+    size_t values_count = 0;
+    for (uint32_t i = 0; i < module->functions_count; i++) {
+        const uint8_t* ptr = module->code[i].code;
+        const uint8_t* end = ptr + module->code[i].length;
+        while (ptr != end) {
+            const uint8_t* start = ptr;
+            uint32_t value;
+            if (leb128_decode_bytewise(&ptr, end, &value)) {
+                memcpy(values + values_size, start, ptr - start);
+                values_size += ptr - start;
+                values_count++;
+            } else {
+                ptr = start + 1;
+            }
+        }
+    }
+    if (values_size == 0) {
+        TRACE("leb128: no code to decode");
+        goto cleanup;
+    }
+
+    size_t rounds = (BENCH_LEB128_BYTES + values_size - 1) / values_size;
+
+    uint64_t bytewise_start = now_ns();
+    uint32_t bytewise_sum = 0;
+    for (size_t round = 0; round < rounds; round++) {
+        const uint8_t* ptr = values;
+        const uint8_t* end = values + values_size;
+        while (ptr != end) {
+            uint32_t value = 0;
+            leb128_decode_bytewise(&ptr, end, &value);
+            bytewise_sum += value;
+        }
+    }
+    uint64_t bytewise_end = now_ns();
+
+    uint32_t sum = 0;
+    for (size_t round = 0; round < rounds; round++) {
+        buffer_t buffer = init_buffer(values, values_size);
+        while (buffer.len != 0) {
+            uint32_t value = 0;
+            RETHROW(buffer_pull_u32(&buffer, &value));
+            sum += value;
+        }
+    }
+    uint64_t end = now_ns();
+
+    // also keeps the loops from being optimized away
+    CHECK(sum == bytewise_sum);
+
+    double mib = (double)values_size * (double)rounds / (1024.0 * 1024.0);
+    double values_m = (double)values_count * (double)rounds / 1e6;
+    double seconds = (double)(end - bytewise_end) / 1e9;
+    double bytewise_seconds = (double)(bytewise_end - bytewise_start) / 1e9;
+    TRACE("leb128 values: %zu in %zu bytes", values_count, values_size);
+    TRACE("leb128: %.1f MiB/s, %.1f M values/s", mib / seconds, values_m / seconds);
+    TRACE("leb128 (bytewise): %.1f MiB/s, %.1f M values/s", mib / bytewise_seconds, values_m / bytewise_seconds);
+
+cleanup:
+    wasm_host_free(values);
+    return err;
+}
+
+int main(int argc, char** argv) {
+    wasm_err_t err = WASM_NO_ERROR;
+    void* binary = nullptr;
+    size_t size = 0;
+    wasm_module_t module = {};
+
+    CHECK(argc > 1, "usage: %s <module>...", argv[0]);
+
+    for (int i = 1; i < argc; i++) {
+        RETHROW(read_file(argv[i], &binary, &size));
+        RETHROW(wasm_load_module_borrowed(&module, binary, size));
+
+        TRACE("%s", argv[i]);
+        RETHROW(bench_leb128(&module));
+
+        wasm_module_free(&module);
+        wasm_host_free(binary);
+        binary = nullptr;
+    }
+
+cleanup:
+    wasm_module_free(&module);
+    wasm_host_free(binary);
+    return IS_ERROR(err) ? 1 : 0;
+}
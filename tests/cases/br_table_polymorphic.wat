@@ -0,0 +1,26 @@
+;; br_table in unreachable code can go to targets of the same arity but of
+;; different types: the operands it takes are of any type there, and every
+;; target is checked against them rather than against the target before it.
+(module
+  (func $inc (param $x i32) (result i32)
+    block $i (result i32)
+      block $f (result f32)
+        local.get $x
+        i32.const 1
+        i32.add
+        br $i
+
+        ;; unreachable, an i32 and an f32 target taking the same operand
+        local.get $x
+        br_table $i $f $i
+      end
+      drop
+      i32.const -1
+    end)
+
+  (func $_start (result i32)
+    i32.const 5
+    call $inc
+    i32.const 6
+    i32.ne)
+  (export "_start" (func $_start)))
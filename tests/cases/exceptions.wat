@@ -0,0 +1,298 @@
+;; Exercises exception handling: throws caught in the same function and across
+;; calls (direct, indirect and through functions without a try_table), payloads
+;; with several values, catch_ref with throw_ref, catch_all, results of calls
+;; made inside of a try_table, locals written before the throw and exnrefs that
+;; are dropped, rethrown and copied in a loop. Returns 0 on success.
+(module
+  (type $thrower (func (param i32)))
+  (tag $e (param i32))
+  (tag $pair (param i64 f64))
+  (tag $empty)
+  (table 1 funcref)
+  (elem (i32.const 0) $throw_e)
+
+  (func $throw_e (param $x i32)
+    local.get $x
+    throw $e)
+
+  ;; has no try_table, so the exception passes right through it
+  (func $middle (param $x i32) (result i32)
+    local.get $x
+    call $throw_e
+    i32.const -1)
+
+  ;; throws $pair when x is zero, otherwise returns x
+  (func $maybe_pair (param $x i32) (result i32)
+    block
+      local.get $x
+      br_if 0
+      i64.const 42
+      f64.const 2.5
+      throw $pair
+    end
+    local.get $x)
+
+  (func $two (param $x i32) (result i32 i64)
+    local.get $x
+    local.get $x
+    i64.extend_i32_u
+    i64.const 100
+    i64.add)
+
+  ;; catches $e with a reference to it and throws it again
+  (func $rethrow (param $x i32)
+    (local $exn exnref)
+    block $h (result i32 exnref)
+      try_table (catch_ref $e $h)
+        local.get $x
+        call $throw_e
+      end
+      return
+    end
+    local.set $exn
+    drop
+    local.get $exn
+    throw_ref)
+
+  (func $_start (result i32)
+    (local $fail i32) (local $x i32) (local $t i32) (local $i i32) (local $r i64) (local $exn exnref)
+
+    ;; thrown and caught in the same function
+    block $h (result i32)
+      try_table (catch $e $h)
+        i32.const 7
+        throw $e
+      end
+      i32.const -1
+    end
+    i32.const 7
+    i32.ne
+    local.set $fail
+
+    ;; thrown two calls down
+    block $h (result i32)
+      try_table (result i32) (catch $e $h)
+        i32.const 9
+        call $middle
+      end
+    end
+    i32.const 9
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; thrown through call_indirect
+    block $h (result i32)
+      try_table (catch $e $h)
+        i32.const 11
+        i32.const 0
+        call_indirect (type $thrower)
+      end
+      i32.const -1
+    end
+    i32.const 11
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; several values, and a local written inside of the try_table
+    block $h (result i64 f64)
+      try_table (catch $pair $h)
+        i32.const 5
+        local.set $x
+        i32.const 0
+        call $maybe_pair
+        drop
+      end
+      i64.const 0
+      f64.const 0
+    end
+    f64.const 2.5
+    f64.ne
+    local.set $t
+    i64.const 42
+    i64.ne
+    local.get $t
+    i32.or
+    local.get $x
+    i32.const 5
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; calls inside of a try_table that don't throw return as usual
+    block $h
+      try_table (catch_all $h)
+        i32.const 3
+        call $maybe_pair
+        i32.const 3
+        i32.ne
+        local.get $fail
+        i32.or
+        local.set $fail
+        i32.const 4
+        call $two
+        local.set $r
+        i32.const 4
+        i32.ne
+        local.get $r
+        i64.const 104
+        i64.ne
+        i32.or
+        local.get $fail
+        i32.or
+        local.set $fail
+      end
+    end
+
+    ;; caught by reference, thrown again and caught by us
+    block $h (result i32)
+      try_table (catch $e $h)
+        i32.const 13
+        call $rethrow
+      end
+      i32.const -1
+    end
+    i32.const 13
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; the catches are checked in order, catch_all takes the rest
+    block $all
+      block $h (result i32)
+        try_table (catch $e $h) (catch_all $all)
+          throw $empty
+        end
+        i32.const -1
+      end
+      drop
+      i32.const 1
+      local.get $fail
+      i32.or
+      local.set $fail
+    end
+
+    ;; throw_ref to an outer try_table of the same function
+    block $outer (result i32)
+      try_table (catch $e $outer)
+        block $inner (result exnref)
+          try_table (catch_all_ref $inner)
+            i32.const 17
+            throw $e
+          end
+          ref.null exn
+        end
+        throw_ref
+      end
+      i32.const -1
+    end
+    i32.const 17
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; the handler is restored after every throw
+    loop $again
+      block $h (result i32)
+        try_table (catch $e $h)
+          local.get $i
+          call $middle
+          drop
+        end
+        i32.const -1
+      end
+      local.get $i
+      i32.ne
+      local.get $fail
+      i32.or
+      local.set $fail
+      local.get $i
+      i32.const 1
+      i32.add
+      local.tee $i
+      i32.const 1000
+      i32.lt_u
+      br_if $again
+    end
+
+    ;; caught by reference over and over, the exnref is dropped, thrown again
+    ;; and kept in a local while a copy of it is dropped
+    i32.const 0
+    local.set $i
+    loop $again
+      block $h (result i32 exnref)
+        try_table (catch_ref $e $h)
+          local.get $i
+          call $middle
+          drop
+        end
+        i32.const -1
+        ref.null exn
+      end
+      drop
+      local.get $i
+      i32.ne
+      local.get $fail
+      i32.or
+      local.set $fail
+
+      block $outer (result i32)
+        try_table (catch $e $outer)
+          block $inner (result i32 exnref)
+            try_table (catch_ref $e $inner)
+              local.get $i
+              throw $e
+            end
+            unreachable
+          end
+          throw_ref
+        end
+        i32.const -1
+      end
+      local.get $i
+      i32.ne
+      local.get $fail
+      i32.or
+      local.set $fail
+
+      block $outer (result i32)
+        try_table (catch $e $outer)
+          block $inner (result exnref)
+            try_table (catch_all_ref $inner)
+              local.get $i
+              throw $e
+            end
+            unreachable
+          end
+          local.tee $exn
+          drop
+          local.get $exn
+          throw_ref
+        end
+        i32.const -1
+      end
+      local.get $i
+      i32.ne
+      local.get $fail
+      i32.or
+      local.set $fail
+
+      local.get $i
+      i32.const 1
+      i32.add
+      local.tee $i
+      i32.const 100000
+      i32.lt_u
+      br_if $again
+    end
+
+    local.get $fail)
+
+  (export "_start" (func $_start)))
@@ -0,0 +1,190 @@
+;; Exercises exceptions thrown from deep in the call graph, which the jit has to
+;; know may throw to catch them: a throw three calls down, a throw at the end of
+;; a recursive cycle, an indirect call to a function that only throws through
+;; another one, calls that can't throw made inside of a try_table, direct and
+;; indirect, and a call with several results that may throw. Returns 0 on success.
+(module
+  (type $unary (func (param i32) (result i32)))
+  (type $nullary (func (result i32)))
+  (tag $e (param i32))
+  (table 3 funcref)
+  (elem (i32.const 0) $pure $deep $const)
+
+  (func $throw_e (param $x i32) (result i32)
+    local.get $x
+    throw $e)
+
+  (func $level2 (param $x i32) (result i32)
+    local.get $x
+    call $throw_e)
+
+  (func $deep (param $x i32) (result i32)
+    local.get $x
+    call $level2)
+
+  ;; counts down through ping and pong, and throws at the bottom
+  (func $ping (param $x i32) (result i32)
+    block
+      local.get $x
+      br_if 0
+      i32.const 23
+      call $throw_e
+      drop
+    end
+    local.get $x
+    i32.const 1
+    i32.sub
+    call $pong)
+
+  (func $pong (param $x i32) (result i32)
+    local.get $x
+    call $ping)
+
+  (func $pure (param $x i32) (result i32)
+    local.get $x
+    i32.const 1
+    i32.add)
+
+  ;; calls nothing that throws, through a cycle of its own
+  (func $count (param $x i32) (result i32)
+    block
+      local.get $x
+      br_if 0
+      i32.const 0
+      return
+    end
+    local.get $x
+    i32.const 1
+    i32.sub
+    call $count
+    i32.const 1
+    i32.add)
+
+  (func $const (result i32)
+    i32.const 31)
+
+  ;; (a / b, a % b), throws b when it is zero
+  (func $divmod (param $a i32) (param $b i32) (result i32 i32 i64)
+    block
+      local.get $b
+      br_if 0
+      local.get $b
+      call $throw_e
+      drop
+    end
+    local.get $a
+    local.get $b
+    i32.div_u
+    local.get $a
+    local.get $b
+    i32.rem_u
+    i64.const 7)
+
+  (func $_start (result i32)
+    (local $fail i32)
+
+    ;; three calls down
+    block $h (result i32)
+      try_table (result i32) (catch $e $h)
+        i32.const 19
+        call $deep
+      end
+    end
+    i32.const 19
+    i32.ne
+    local.set $fail
+
+    ;; at the bottom of a cycle
+    block $h (result i32)
+      try_table (result i32) (catch $e $h)
+        i32.const 10
+        call $ping
+      end
+    end
+    i32.const 23
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; through the table, to a function that throws two calls down
+    block $h (result i32)
+      try_table (result i32) (catch $e $h)
+        i32.const 29
+        i32.const 1
+        call_indirect (type $unary)
+      end
+    end
+    i32.const 29
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; several results through the invoke helper, (17 / 5, 17 % 5, 7)
+    block $h (result i32)
+      try_table (result i32 i32 i64) (catch $e $h)
+        i32.const 17
+        i32.const 5
+        call $divmod
+      end
+      i32.wrap_i64
+      i32.const 7
+      i32.ne
+      local.get $fail
+      i32.or
+      local.set $fail
+      i32.const 2
+      i32.ne
+      local.get $fail
+      i32.or
+      local.set $fail
+      i32.const 3
+      i32.ne
+      local.get $fail
+      i32.or
+      local.set $fail
+      i32.const 0
+    end
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; and the same call throwing
+    block $h (result i32)
+      try_table (result i32 i32 i64) (catch $e $h)
+        i32.const 17
+        i32.const 0
+        call $divmod
+      end
+      drop
+      drop
+      drop
+      i32.const -1
+    end
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; nothing thrown, direct and through the table
+    block $h
+      try_table (result i32) (catch_all $h)
+        i32.const 5
+        call $count
+        i32.const 41
+        i32.const 0
+        call_indirect (type $unary)
+        i32.add
+        i32.const 2
+        call_indirect (type $nullary)
+        i32.add
+      end
+      i32.const 78
+      i32.ne
+      local.get $fail
+      i32.or
+      return
+    end
+    i32.const 1)
+
+  (export "_start" (func $_start)))
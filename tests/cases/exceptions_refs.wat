@@ -0,0 +1,98 @@
+;; Exercises the refs the jit counts for caught exceptions, every iteration
+;; catches an exception by reference and keeps the exnref around in a local, a
+;; global, a select, a call and a branch that discards it, before throwing it
+;; again and catching it without a reference. Nothing may be freed early or
+;; kept alive, so a run under a leak checker shows both. Returns 0 on success.
+(module
+  (tag $e (param i32))
+  (global $saved (mut exnref) (ref.null exn))
+
+  (func $catch (param $x i32) (result exnref)
+    (local $exn exnref)
+    block $h (result i32 exnref)
+      try_table (catch_ref $e $h)
+        local.get $x
+        throw $e
+      end
+      unreachable
+    end
+    ;; the payload is not needed, the exnref is returned to the caller
+    local.set $exn
+    drop
+    local.get $exn)
+
+  ;; takes an exnref and drops it, the caller passed its ref over
+  (func $consume (param $exn exnref) (param $x i32) (result i32)
+    local.get $x)
+
+  ;; throws the exnref it was given again
+  (func $rethrow (param $exn exnref)
+    local.get $exn
+    throw_ref)
+
+  (func $_start (export "_start") (result i32)
+    (local $i i32) (local $fail i32) (local $exn exnref) (local $other exnref)
+    loop $again
+      ;; a copy in a local and another in the global
+      local.get $i
+      call $catch
+      local.tee $exn
+      global.set $saved
+
+      ;; another exception, one of the two is selected and the other dropped
+      local.get $i
+      i32.const 1
+      i32.add
+      call $catch
+      local.set $other
+      local.get $exn
+      local.get $other
+      local.get $i
+      i32.const 1
+      i32.and
+      select (result exnref)
+      drop
+
+      ;; passed to a call that drops it
+      local.get $other
+      local.get $i
+      call $consume
+      drop
+
+      ;; discarded by a branch out of the block
+      block $out
+        local.get $exn
+        local.get $i
+        br_if $out
+        drop
+      end
+
+      ;; thrown again from the global while the local still holds it, and
+      ;; caught without a reference
+      block $h (result i32)
+        try_table (catch $e $h)
+          global.get $saved
+          call $rethrow
+        end
+        i32.const -1
+      end
+      local.get $i
+      i32.ne
+      local.get $fail
+      i32.or
+      local.set $fail
+
+      ;; the only ref left is in the local, replaced by a null
+      ref.null exn
+      global.set $saved
+
+      local.get $i
+      i32.const 1
+      i32.add
+      local.tee $i
+      i32.const 1000
+      i32.lt_u
+      br_if $again
+    end
+
+    local.get $fail))
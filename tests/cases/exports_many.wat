@@ -0,0 +1,79 @@
+;; A module with many exports of every kind, so _start is looked up through
+;; a hash index that is more than a single probe deep. Names that only differ
+;; in one character or in their length must not be mixed up. Returns 0 on success.
+(module
+  (memory (export "memory") 1)
+  (table (export "table") 1 funcref)
+  (global (export "_start_") i32 (i32.const 1))
+  (global (export "_star") i32 (i32.const 2))
+
+  (func (export "f0") (result i32) i32.const 0)
+  (global (export "g0") i32 (i32.const 0))
+  (func (export "f1") (result i32) i32.const 1)
+  (global (export "g1") i32 (i32.const 1))
+  (func (export "f2") (result i32) i32.const 2)
+  (global (export "g2") i32 (i32.const 2))
+  (func (export "f3") (result i32) i32.const 3)
+  (global (export "g3") i32 (i32.const 3))
+  (func (export "f4") (result i32) i32.const 4)
+  (global (export "g4") i32 (i32.const 4))
+  (func (export "f5") (result i32) i32.const 5)
+  (global (export "g5") i32 (i32.const 5))
+  (func (export "f6") (result i32) i32.const 6)
+  (global (export "g6") i32 (i32.const 6))
+  (func (export "f7") (result i32) i32.const 7)
+  (global (export "g7") i32 (i32.const 7))
+  (func (export "f8") (result i32) i32.const 8)
+  (global (export "g8") i32 (i32.const 8))
+  (func (export "f9") (result i32) i32.const 9)
+  (global (export "g9") i32 (i32.const 9))
+  (func (export "f10") (result i32) i32.const 10)
+  (global (export "g10") i32 (i32.const 10))
+  (func (export "f11") (result i32) i32.const 11)
+  (global (export "g11") i32 (i32.const 11))
+  (func (export "f12") (result i32) i32.const 12)
+  (global (export "g12") i32 (i32.const 12))
+  (func (export "f13") (result i32) i32.const 13)
+  (global (export "g13") i32 (i32.const 13))
+  (func (export "f14") (result i32) i32.const 14)
+  (global (export "g14") i32 (i32.const 14))
+  (func (export "f15") (result i32) i32.const 15)
+  (global (export "g15") i32 (i32.const 15))
+  (func (export "f16") (result i32) i32.const 16)
+  (global (export "g16") i32 (i32.const 16))
+  (func (export "f17") (result i32) i32.const 17)
+  (global (export "g17") i32 (i32.const 17))
+  (func (export "f18") (result i32) i32.const 18)
+  (global (export "g18") i32 (i32.const 18))
+  (func (export "f19") (result i32) i32.const 19)
+  (global (export "g19") i32 (i32.const 19))
+  (func (export "f20") (result i32) i32.const 20)
+  (global (export "g20") i32 (i32.const 20))
+  (func (export "f21") (result i32) i32.const 21)
+  (global (export "g21") i32 (i32.const 21))
+  (func (export "f22") (result i32) i32.const 22)
+  (global (export "g22") i32 (i32.const 22))
+  (func (export "f23") (result i32) i32.const 23)
+  (global (export "g23") i32 (i32.const 23))
+  (func (export "f24") (result i32) i32.const 24)
+  (global (export "g24") i32 (i32.const 24))
+  (func (export "f25") (result i32) i32.const 25)
+  (global (export "g25") i32 (i32.const 25))
+  (func (export "f26") (result i32) i32.const 26)
+  (global (export "g26") i32 (i32.const 26))
+  (func (export "f27") (result i32) i32.const 27)
+  (global (export "g27") i32 (i32.const 27))
+  (func (export "f28") (result i32) i32.const 28)
+  (global (export "g28") i32 (i32.const 28))
+  (func (export "f29") (result i32) i32.const 29)
+  (global (export "g29") i32 (i32.const 29))
+  (func (export "f30") (result i32) i32.const 30)
+  (global (export "g30") i32 (i32.const 30))
+  (func (export "f31") (result i32) i32.const 31)
+  (global (export "g31") i32 (i32.const 31))
+
+  (func $start (export "_start") (result i32)
+    call 0
+    i32.const 0
+    i32.ne)
+)
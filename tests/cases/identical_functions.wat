@@ -0,0 +1,54 @@
+;; Functions with the same type and byte-identical bodies are folded into a
+;; single jitted function. Returns 0 on success.
+;;
+;; What this exercises end-to-end:
+;;   1. Two identical functions called both directly and through the table,
+;;      they share the code and the cfi thunk.
+;;   2. Identical bodies with different types are not folded, the cfi check
+;;      must still tell them apart.
+;;   3. Identical bodies that call the same helper.
+(module
+  (type $v_i (func (result i32)))
+  (type $i_i (func (param i32) (result i32)))
+
+  (func $seven_a (type $v_i) i32.const 7)
+  (func $seven_b (type $v_i) i32.const 7)
+
+  ;; same body bytes as the above, but a different type
+  (func $seven_c (type $i_i) i32.const 7)
+
+  (func $square (param $x i32) (result i32) local.get $x local.get $x i32.mul)
+  (func $square_plus_one_a (type $i_i) local.get 0 call $square i32.const 1 i32.add)
+  (func $square_plus_one_b (type $i_i) local.get 0 call $square i32.const 1 i32.add)
+
+  (table 5 funcref)
+  (elem (i32.const 0) $seven_a $seven_b $seven_c $square_plus_one_a $square_plus_one_b)
+
+  (func $call_v_i (param $idx i32) (result i32)
+    local.get $idx
+    call_indirect (type $v_i))
+
+  (func $call_i_i (param $idx i32) (param $x i32) (result i32)
+    local.get $x
+    local.get $idx
+    call_indirect (type $i_i))
+
+  (func $_start (result i32)
+    block call $seven_a i32.const 7 i32.eq br_if 0 unreachable end
+    block call $seven_b i32.const 7 i32.eq br_if 0 unreachable end
+    block i32.const 0 call $seven_c i32.const 7 i32.eq br_if 0 unreachable end
+
+    block i32.const 0 call $call_v_i i32.const 7 i32.eq br_if 0 unreachable end
+    block i32.const 1 call $call_v_i i32.const 7 i32.eq br_if 0 unreachable end
+    block i32.const 2 i32.const 0 call $call_i_i i32.const 7 i32.eq br_if 0 unreachable end
+
+    block i32.const 5 call $square_plus_one_a i32.const 26 i32.eq br_if 0 unreachable end
+    block i32.const 6 call $square_plus_one_b i32.const 37 i32.eq br_if 0 unreachable end
+    block i32.const 3 i32.const 2 call $call_i_i i32.const 5 i32.eq br_if 0 unreachable end
+    block i32.const 4 i32.const 3 call $call_i_i i32.const 10 i32.eq br_if 0 unreachable end
+
+    i32.const 0)
+
+  (export "seven_a" (func $seven_a))
+  (export "seven_b" (func $seven_b))
+  (export "_start" (func $_start)))
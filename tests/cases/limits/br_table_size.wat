@@ -0,0 +1,13 @@
+;; args: --limit br_table_size=2 --expect-error 5
+;; Two targets and the default one are one over the limit, which must fail
+;; the jit with WASM_ERROR_BR_TABLE_TOO_LARGE.
+(module
+  (func $_start (result i32)
+    block
+      block
+        i32.const 0
+        br_table 0 1 0
+      end
+    end
+    i32.const 0)
+  (export "_start" (func $_start)))
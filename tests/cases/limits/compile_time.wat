@@ -0,0 +1,7 @@
+;; args: --limit compile_time_ns=1 --expect-error 7
+;; The jit can't be done within a nanosecond, so it must fail with
+;; WASM_ERROR_COMPILE_TIMEOUT at the first function it checks the deadline at.
+(module
+  (func $_start (result i32)
+    i32.const 0)
+  (export "_start" (func $_start)))
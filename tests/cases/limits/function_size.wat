@@ -0,0 +1,17 @@
+;; args: --limit function_size=16 --expect-error 2
+;; A body of more than 16 bytes must fail the jit with
+;; WASM_ERROR_FUNCTION_TOO_LARGE.
+(module
+  (func $_start (result i32)
+    i32.const 1
+    i32.const 2
+    i32.add
+    i32.const 3
+    i32.add
+    i32.const 4
+    i32.add
+    i32.const 5
+    i32.add
+    i32.const 15
+    i32.sub)
+  (export "_start" (func $_start)))
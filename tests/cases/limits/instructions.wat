@@ -0,0 +1,16 @@
+;; args: --limit instructions=8 --expect-error 6
+;; The limit is on the module as a whole: each function is within it, but
+;; together they are over it, which must fail the jit with
+;; WASM_ERROR_TOO_MANY_INSTRUCTIONS.
+(module
+  (func $add (param i32 i32) (result i32)
+    local.get 0
+    local.get 1
+    i32.add)
+  (func $_start (result i32)
+    i32.const 1
+    i32.const 1
+    call $add
+    i32.const 2
+    i32.sub)
+  (export "_start" (func $_start)))
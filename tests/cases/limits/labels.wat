@@ -0,0 +1,13 @@
+;; args: --limit labels=3 --expect-error 4
+;; The body of the function is the first label, three blocks nested in it go
+;; one over the limit and must fail the jit with WASM_ERROR_TOO_MANY_LABELS.
+(module
+  (func $_start (result i32)
+    block (result i32)
+      block (result i32)
+        block (result i32)
+          i32.const 0
+        end
+      end
+    end)
+  (export "_start" (func $_start)))
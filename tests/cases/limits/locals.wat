@@ -0,0 +1,11 @@
+;; args: --limit locals=4 --expect-error 3
+;; The params count as locals, so one param and four locals are one more than
+;; the limit and must fail the jit with WASM_ERROR_TOO_MANY_LOCALS.
+(module
+  (func $locals (param i32) (result i32)
+    (local i32 i32 i32 i32)
+    local.get 0)
+  (func $_start (result i32)
+    i32.const 0
+    call $locals)
+  (export "_start" (func $_start)))
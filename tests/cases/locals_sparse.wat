@@ -0,0 +1,79 @@
+;; Sparse local tracking: a label only merges (and a loop only creates header
+;; phis for) the locals written somewhere inside of it. Mixes a local that is
+;; only read in a loop, a local written only by a nested loop (the outer loop
+;; still needs a phi for it), and a dead block ahead of a live one, so the
+;; scopes consumed while skipping dead code must stay in step with the scan.
+;;
+;; Returns 0 on success.
+(module
+  ;; $k is only read in the loops, $acc is only written by the inner loop
+  (func $nested (param $n i32) (result i32)
+    (local $i i32) (local $j i32) (local $acc i32) (local $k i32)
+    i32.const 3
+    local.set $k
+    block $done
+      loop $outer
+        local.get $i
+        local.get $n
+        i32.ge_u
+        br_if $done
+        i32.const 0
+        local.set $j
+        loop $inner
+          local.get $acc
+          local.get $k
+          i32.add
+          local.set $acc
+          local.get $j
+          i32.const 1
+          i32.add
+          local.tee $j
+          i32.const 2
+          i32.lt_u
+          br_if $inner
+        end
+        local.get $i
+        i32.const 1
+        i32.add
+        local.set $i
+        br $outer
+      end
+    end
+    local.get $acc)
+
+  ;; the dead block's scope is skipped, $merge must still see its own
+  ;; written locals ($a) rather than the dead block's ($b)
+  (func $dead_scope (param $x i32) (result i32) (local $a i32) (local $b i32)
+    i32.const 7
+    local.set $b
+    block $out
+      local.get $x
+      br_if $out
+      br $out
+      ;; --- unreachable below ---
+      block
+        i32.const 100
+        local.set $b
+      end
+    end
+    block $merge
+      local.get $x
+      local.set $a
+      local.get $x
+      br_if $merge
+      i32.const 5
+      local.set $a
+    end
+    local.get $a
+    local.get $b
+    i32.add)
+
+  (func $_start (result i32)
+    ;; 4 outer iterations x 2 inner iterations x 3
+    block i32.const 4 call $nested i32.const 24 i32.eq br_if 0 unreachable end
+    ;; fallthrough into $merge: a=5, b=7
+    block i32.const 0 call $dead_scope i32.const 12 i32.eq br_if 0 unreachable end
+    ;; branch into $merge: a=2, b=7
+    block i32.const 2 call $dead_scope i32.const 9 i32.eq br_if 0 unreachable end
+    i32.const 0)
+  (export "_start" (func $_start)))
@@ -0,0 +1,95 @@
+;; Exercises a 64-bit memory: i64 addresses for loads and stores, offsets,
+;; data segments with an i64 offset, memory.size/memory.grow on i64 and the
+;; bulk memory instructions with i64 operands. Returns 0 on success.
+(module
+  (memory i64 1 4)
+  (data (i64.const 16) "\01\02\03\04\05\06\07\08")
+
+  (func $_start (result i32)
+    (local $fail i32)
+
+    ;; the data segment and loads through an i64 address
+    i64.const 16
+    i64.load
+    i64.const 0x0807060504030201
+    i64.ne
+    i64.const 12
+    i32.load8_u offset=8
+    i32.const 5
+    i32.ne
+    i32.or
+    local.set $fail
+
+    ;; store and load back near the end of the page
+    i64.const 65528
+    i64.const 0x1122334455667788
+    i64.store
+    i64.const 65520
+    i64.load offset=8
+    i64.const 0x1122334455667788
+    i64.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; memory.size and memory.grow take and return an i64
+    memory.size
+    i64.const 1
+    i64.ne
+    i64.const 2
+    memory.grow
+    i64.const 1
+    i64.ne
+    i32.or
+    memory.size
+    i64.const 3
+    i64.ne
+    i32.or
+    i64.const 2
+    memory.grow
+    i64.const -1
+    i64.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; the grown pages are zeroed and accessible
+    i64.const 190000
+    i32.load
+    i32.const 0
+    i32.ne
+    i64.const 196604
+    i32.const 0x12345678
+    i32.store
+    i64.const 196604
+    i32.load
+    i32.const 0x12345678
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; fill and copy with i64 operands
+    i64.const 131072
+    i32.const 0xab
+    i64.const 16
+    memory.fill
+    i64.const 131080
+    i64.const 16
+    i64.const 4
+    memory.copy
+    i64.const 131076
+    i64.load
+    i64.const 0x04030201abababab
+    i64.ne
+    i64.const 131084
+    i32.load
+    i32.const 0xabababab
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or)
+
+  (export "_start" (func $_start)))
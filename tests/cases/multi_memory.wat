@@ -0,0 +1,128 @@
+;; Exercises multi-memory: loads and stores through an explicit memory index,
+;; active and passive data segments of other memories, memory.size/grow per
+;; memory, and memory.copy/fill/init on memories past the first. Returns 0 on
+;; success.
+(module
+  (memory $main 1)
+  (memory $scratch 1 2)
+  (memory $wide i64 1 1)
+  (data (memory $scratch) (i32.const 8) "\11\22\33\44")
+  (data $blob "\aa\bb\cc\dd")
+
+  (func $_start (result i32)
+    (local $fail i32)
+
+    ;; the same address in different memories is a different location
+    i32.const 0
+    i32.const 1
+    i32.store $main
+    i32.const 0
+    i32.const 2
+    i32.store $scratch
+    i64.const 0
+    i32.const 3
+    i32.store $wide
+    i32.const 0
+    i32.load $main
+    i32.const 1
+    i32.ne
+    i32.const 0
+    i32.load $scratch
+    i32.const 2
+    i32.ne
+    i32.or
+    i64.const 0
+    i32.load $wide
+    i32.const 3
+    i32.ne
+    i32.or
+    local.set $fail
+
+    ;; the active segment only went to its own memory
+    i32.const 8
+    i32.load $scratch
+    i32.const 0x44332211
+    i32.ne
+    i32.const 8
+    i32.load $main
+    i32.const 0
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; grow one memory and not the others
+    i32.const 1
+    memory.grow $scratch
+    i32.const 1
+    i32.ne
+    memory.size $scratch
+    i32.const 2
+    i32.ne
+    i32.or
+    memory.size $main
+    i32.const 1
+    i32.ne
+    i32.or
+    i32.const 1
+    memory.grow $scratch
+    i32.const -1
+    i32.ne
+    i32.or
+    i32.const 70000
+    i32.const 5
+    i32.store $scratch
+    i32.const 70000
+    i32.load $scratch
+    i32.const 5
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; fill one memory and copy between the others
+    i64.const 16
+    i32.const 0x7f
+    i64.const 4
+    memory.fill $wide
+    i32.const 32
+    i32.const 8
+    i32.const 4
+    memory.copy $main $scratch
+    i32.const 40
+    i32.const 32
+    i32.const 2
+    memory.copy $scratch $main
+    i64.const 16
+    i32.load $wide
+    i32.const 0x7f7f7f7f
+    i32.ne
+    i32.const 32
+    i32.load $main
+    i32.const 0x44332211
+    i32.ne
+    i32.or
+    i32.const 40
+    i32.load $scratch
+    i32.const 0x2211
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; memory.init into a memory past the first
+    i32.const 100
+    i32.const 1
+    i32.const 3
+    memory.init $scratch $blob
+    i32.const 100
+    i32.load $scratch
+    i32.const 0x00ddccbb
+    i32.ne
+    local.get $fail
+    i32.or)
+
+  (export "_start" (func $_start)))
@@ -0,0 +1,206 @@
+;; Exercises multi-value: functions with several results (direct, indirect and
+;; through br/return), blocks with params and several results merged from
+;; several branches, and loops with params that are carried by the back edge.
+;; Returns 0 on success.
+(module
+  (type $pair (func (param i32 i32) (result i32 i32)))
+  (table 1 funcref)
+  (elem (i32.const 0) $swap)
+
+  (func $swap (type $pair)
+    local.get 1
+    local.get 0)
+
+  ;; (q, r) of a / b, returns early through a br to the function body
+  (func $divmod (param $a i32) (param $b i32) (result i32 i64)
+    block
+      local.get $b
+      br_if 0
+      i32.const -1
+      i64.const -1
+      br 1
+    end
+    local.get $a
+    local.get $b
+    i32.div_u
+    local.get $a
+    local.get $b
+    i32.rem_u
+    i64.extend_i32_u)
+
+  ;; the results come from the fallthrough or one of the branches
+  (func $pick (param $x i32) (result i32 f64 i32)
+    block (result i32 f64 i32)
+      i32.const 1
+      f64.const 1.5
+      i32.const 2
+      local.get $x
+      i32.const 1
+      i32.eq
+      br_if 0
+      drop
+      drop
+      drop
+      block (result i32 f64 i32)
+        i32.const 3
+        f64.const 2.5
+        i32.const 4
+        local.get $x
+        br_table 0 1
+      end
+      return
+    end)
+
+  ;; sum of 1..n with the counter and the sum as loop params
+  (func $sum (param $n i32) (result i32)
+    (local $i i32) (local $acc i32)
+    i32.const 0
+    i32.const 0
+    loop (param i32 i32) (result i32)
+      ;; [i, acc] -> [i + 1, acc + i + 1]
+      local.set $acc
+      i32.const 1
+      i32.add
+      local.tee $i
+      local.get $i
+      local.get $acc
+      i32.add
+      local.get $i
+      local.get $n
+      i32.lt_u
+      br_if 0
+      ;; [i, acc] -> [acc]
+      local.set $acc
+      drop
+      local.get $acc
+    end)
+
+  (func $_start (result i32)
+    (local $fail i32) (local $r i64) (local $b f64) (local $c i32)
+
+    ;; swap(1, 2) == (2, 1)
+    i32.const 1
+    i32.const 2
+    call $swap
+    i32.const 1
+    i32.ne
+    local.set $fail
+    i32.const 2
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; the same through call_indirect
+    i32.const 3
+    i32.const 4
+    i32.const 0
+    call_indirect (type $pair)
+    i32.const 3
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+    i32.const 4
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; divmod(17, 5) == (3, 2)
+    i32.const 17
+    i32.const 5
+    call $divmod
+    i64.const 2
+    i64.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+    i32.const 3
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; divmod(1, 0) == (-1, -1)
+    i32.const 1
+    i32.const 0
+    call $divmod
+    local.set $r
+    i32.const -1
+    i32.ne
+    local.get $r
+    i64.const -1
+    i64.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; pick(1) == (1, 1.5, 2)
+    i32.const 1
+    call $pick
+    local.set $c
+    local.set $b
+    i32.const 1
+    i32.ne
+    local.get $b
+    f64.const 1.5
+    f64.ne
+    i32.or
+    local.get $c
+    i32.const 2
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; pick(0) and pick(2) == (3, 2.5, 4), through the br_table
+    i32.const 0
+    call $pick
+    i32.const 2
+    call $pick
+    ;; [3, 2.5, 4, 3, 2.5, 4] -> [3, 2.5, 4, 9]
+    local.set $c
+    i32.trunc_sat_f64_s
+    local.get $c
+    i32.add
+    i32.add
+    i32.const 9
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+    local.set $c
+    i32.trunc_sat_f64_s
+    local.get $c
+    i32.add
+    i32.add
+    i32.const 9
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; a block with params
+    i32.const 20
+    i32.const 22
+    block (param i32 i32) (result i32)
+      i32.add
+    end
+    i32.const 42
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; sum(1..10) == 55
+    i32.const 10
+    call $sum
+    i32.const 55
+    i32.ne
+    local.get $fail
+    i32.or)
+
+  (export "_start" (func $_start)))
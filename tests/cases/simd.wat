@@ -0,0 +1,501 @@
+;; Exercises the fixed-width SIMD instructions: loads and stores, constants,
+;; splats, lane accesses, bitwise ops, integer and float arithmetic, compares,
+;; saturating, widening and narrowing ops, shuffles, and v128 values in locals,
+;; params, results, blocks and select.
+;; Returns 0 on success.
+(module
+  (memory 1)
+  (data (i32.const 16) "\00\01\02\03\04\05\06\07\08\09\0a\0b\0c\0d\0e\0f")
+
+  ;; a v128 param and result
+  (func $add4 (param $a v128) (param $b v128) (result v128)
+    local.get $a
+    local.get $b
+    i32x4.add)
+
+  ;; a v128 next to scalars in the results
+  (func $split (param $v v128) (result i32 v128 i32)
+    local.get $v
+    i32x4.extract_lane 0
+    local.get $v
+    local.get $v
+    i32x4.extract_lane 3)
+
+  ;; returns 1 when all the lanes of the two vectors are equal
+  (func $eq (param $a v128) (param $b v128) (result i32)
+    local.get $a
+    local.get $b
+    i8x16.eq
+    i8x16.all_true)
+
+  (func $_start (result i32)
+    (local $fail i32) (local $v v128) (local $x i32)
+
+    ;; load, store and the lanes of what we loaded
+    i32.const 16
+    v128.load
+    local.tee $v
+    v128.const i8x16 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15
+    call $eq
+    i32.eqz
+    local.set $fail
+
+    i32.const 64
+    local.get $v
+    v128.store offset=8
+    i32.const 72
+    i64.load offset=8
+    i64.const 0x0f0e0d0c0b0a0908
+    i64.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; extract the lanes from both halves
+    local.get $v
+    i8x16.extract_lane_u 13
+    i32.const 13
+    i32.ne
+    local.get $v
+    i16x8.extract_lane_u 2
+    i32.const 0x0504
+    i32.ne
+    i32.or
+    local.get $v
+    i64x2.extract_lane 1
+    i64.const 0x0f0e0d0c0b0a0908
+    i64.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; sign extension of the lanes
+    v128.const i8x16 -1 0 0 0 0 0 0 0 0 0 0 0 0 0 0 -2
+    local.tee $v
+    i8x16.extract_lane_s 15
+    i32.const -2
+    i32.ne
+    local.get $v
+    i8x16.extract_lane_u 0
+    i32.const 255
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; replace a lane and read it back through memory
+    i32.const 128
+    local.get $v
+    i32.const 0x12345678
+    i32x4.replace_lane 2
+    v128.store
+    i32.const 128
+    i32.load offset=8
+    i32.const 0x12345678
+    i32.ne
+    i32.const 128
+    i32.load8_u offset=15
+    i32.const 0xfe
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; splats
+    i32.const 0x1ab
+    i8x16.splat
+    v128.const i8x16 0xab 0xab 0xab 0xab 0xab 0xab 0xab 0xab 0xab 0xab 0xab 0xab 0xab 0xab 0xab 0xab
+    call $eq
+    i32.eqz
+    f32.const 1.5
+    f32x4.splat
+    f32x4.extract_lane 3
+    f32.const 1.5
+    f32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; load splat and load lane
+    i32.const 20
+    v128.load16_splat
+    i16x8.extract_lane_u 7
+    i32.const 0x0504
+    i32.ne
+    i32.const 26
+    v128.const i64x2 0 0
+    v128.load8_lane 9
+    i64x2.extract_lane 1
+    i64.const 0x0a00
+    i64.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; bitwise
+    v128.const i32x4 0xff00ff00 0 -1 0x0f0f0f0f
+    v128.const i32x4 0x0ff00ff0 -1 0 0xffff0000
+    v128.and
+    v128.const i32x4 0x0f000f00 0 0 0x0f0f0000
+    call $eq
+    i32.eqz
+    v128.const i32x4 1 2 3 4
+    v128.not
+    v128.const i32x4 -2 -3 -4 -5
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i64x2 0 0
+    v128.any_true
+    v128.const i64x2 0 0x100
+    v128.any_true
+    i32.eqz
+    i32.or
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; bitselect picks from the first operand where the mask is set
+    v128.const i64x2 -1 -1
+    v128.const i64x2 0 0
+    v128.const i64x2 0xff 0xff00000000000000
+    v128.bitselect
+    v128.const i64x2 0xff 0xff00000000000000
+    call $eq
+    i32.eqz
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; integer arithmetic, through a call
+    v128.const i32x4 1 2 3 0x7fffffff
+    v128.const i32x4 10 20 30 1
+    call $add4
+    v128.const i32x4 11 22 33 0x80000000
+    call $eq
+    i32.eqz
+    v128.const i64x2 3 -4
+    v128.const i64x2 5 6
+    i64x2.mul
+    v128.const i64x2 15 -24
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i8x16 250 100 0 0 0 0 0 0 0 0 0 0 0 0 0 0
+    v128.const i8x16 10 100 0 0 0 0 0 0 0 0 0 0 0 0 0 0
+    i8x16.add_sat_u
+    v128.const i8x16 255 200 0 0 0 0 0 0 0 0 0 0 0 0 0 0
+    call $eq
+    i32.eqz
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; shifts, the count is taken modulo the lane width
+    v128.const i16x8 -16 16 0 0 0 0 0 0
+    i32.const 18
+    i16x8.shr_s
+    v128.const i16x8 -4 4 0 0 0 0 0 0
+    call $eq
+    i32.eqz
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; compares and bitmask
+    v128.const i32x4 1 -1 5 0
+    v128.const i32x4 2 2 2 2
+    i32x4.lt_s
+    i32x4.bitmask
+    i32.const 0xb
+    i32.ne
+    v128.const i32x4 1 -1 5 0
+    v128.const i32x4 2 2 2 2
+    i32x4.lt_u
+    i32x4.bitmask
+    i32.const 0x9
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; shuffle and swizzle
+    v128.const i8x16 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15
+    v128.const i8x16 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31
+    i8x16.shuffle 31 0 30 1 29 2 28 3 27 4 26 5 25 6 24 7
+    v128.const i8x16 31 0 30 1 29 2 28 3 27 4 26 5 25 6 24 7
+    call $eq
+    i32.eqz
+    v128.const i8x16 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25
+    v128.const i8x16 3 2 1 0 16 255 0 0 0 0 0 0 0 0 0 0
+    i8x16.swizzle
+    v128.const i8x16 13 12 11 10 0 0 10 10 10 10 10 10 10 10 10 10
+    call $eq
+    i32.eqz
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; float arithmetic and conversions
+    v128.const f32x4 1.5 -2 4 9
+    f32x4.sqrt
+    f32x4.extract_lane 3
+    f32.const 3
+    f32.ne
+    v128.const f32x4 1.5 -2 4 9
+    v128.const f32x4 0.5 0.5 0.5 0.5
+    f32x4.mul
+    i32x4.trunc_sat_f32x4_s
+    v128.const i32x4 0 -1 2 4
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const f64x2 1.25 -0.5
+    v128.const f64x2 0.75 0.5
+    f64x2.add
+    f64x2.extract_lane 0
+    f64.const 2
+    f64.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; widening
+    v128.const i8x16 -1 2 -3 4 0 0 0 0 0 0 0 0 0 0 0 0
+    i16x8.extend_low_i8x16_s
+    v128.const i16x8 -1 2 -3 4 0 0 0 0
+    call $eq
+    i32.eqz
+    i32.const 16
+    v128.load8x8_u
+    i16x8.extract_lane_u 7
+    i32.const 7
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; i8x16 and i16x8 compares, min and max, with the lanes of both halves
+    v128.const i8x16 -1 5 -128 127 0 0 0 0 0 0 0 0 0 0 0 -3
+    v128.const i8x16 0 5 127 -128 0 0 0 0 0 0 0 0 0 0 0 -4
+    i8x16.lt_s
+    i8x16.bitmask
+    i32.const 0x5
+    i32.ne
+    v128.const i16x8 1 -1 3 0 0 0 0 0
+    v128.const i16x8 2 2 3 0 0 0 0 1
+    i16x8.ge_u
+    i16x8.bitmask
+    i32.const 0x7e
+    i32.ne
+    i32.or
+    v128.const i8x16 -1 5 -128 127 0 0 0 0 0 0 0 0 0 0 0 -3
+    v128.const i8x16 0 5 127 -128 0 0 0 0 0 0 0 0 0 0 0 -4
+    i8x16.min_s
+    v128.const i8x16 -1 5 -128 -128 0 0 0 0 0 0 0 0 0 0 0 -4
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i16x8 1 -1 3 0 0 0 0 0
+    v128.const i16x8 2 2 3 0 0 0 0 1
+    i16x8.max_u
+    v128.const i16x8 2 -1 3 0 0 0 0 1
+    call $eq
+    i32.eqz
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; saturating and rounding arithmetic
+    v128.const i8x16 -128 100 5 0 0 0 0 0 0 0 0 0 0 0 0 127
+    v128.const i8x16 1 -100 5 0 0 0 0 0 0 0 0 0 0 0 0 -1
+    i8x16.sub_sat_s
+    v128.const i8x16 -128 127 0 0 0 0 0 0 0 0 0 0 0 0 0 127
+    call $eq
+    i32.eqz
+    v128.const i16x8 1 65535 0 0 0 0 0 40000
+    v128.const i16x8 2 65535 0 0 0 0 0 30000
+    i16x8.add_sat_u
+    v128.const i16x8 3 65535 0 0 0 0 0 65535
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i16x8 1 65535 0 0 0 0 0 7
+    v128.const i16x8 2 65535 0 0 0 0 0 8
+    i16x8.avgr_u
+    v128.const i16x8 2 65535 0 0 0 0 0 8
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i16x8 -32768 16384 0 0 0 0 0 0
+    v128.const i16x8 -32768 16384 0 0 0 0 0 0
+    i16x8.q15mulr_sat_s
+    v128.const i16x8 32767 8192 0 0 0 0 0 0
+    call $eq
+    i32.eqz
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; abs, popcnt and shr_s of the small lanes
+    v128.const i8x16 -128 -5 5 0 0 0 0 0 0 0 0 0 0 0 0 -1
+    i8x16.abs
+    v128.const i8x16 -128 5 5 0 0 0 0 0 0 0 0 0 0 0 0 1
+    call $eq
+    i32.eqz
+    v128.const i8x16 255 7 0x80 0 0 0 0 0 0 0 0 0 0 0 0 0x55
+    i8x16.popcnt
+    v128.const i8x16 8 3 1 0 0 0 0 0 0 0 0 0 0 0 0 4
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i8x16 -128 64 0 0 0 0 0 0 0 0 0 0 0 0 0 -1
+    i32.const 3
+    i8x16.shr_s
+    v128.const i8x16 -16 8 0 0 0 0 0 0 0 0 0 0 0 0 0 -1
+    call $eq
+    i32.eqz
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; multiplies, narrowing and the widening ops
+    v128.const i16x8 300 -2 0 0 0 0 0 3
+    v128.const i16x8 300 3 0 0 0 0 0 -3
+    i16x8.mul
+    v128.const i16x8 24464 -6 0 0 0 0 0 -9
+    call $eq
+    i32.eqz
+    v128.const i16x8 1 2 -3 4 0 0 0 0
+    v128.const i16x8 5 6 7 8 0 0 0 0
+    i32x4.dot_i16x8_s
+    v128.const i32x4 17 11 0 0
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i32x4 70000 -70000 5 -5
+    v128.const i32x4 0 0 0 32768
+    i16x8.narrow_i32x4_s
+    v128.const i16x8 32767 -32768 5 -5 0 0 0 32767
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i16x8 -1 300 255 7 0 0 0 0
+    v128.const i16x8 0 0 0 0 0 0 0 -5
+    i8x16.narrow_i16x8_u
+    v128.const i8x16 0 255 255 7 0 0 0 0 0 0 0 0 0 0 0 0
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i8x16 0 0 0 0 0 0 0 0 -2 3 0 0 0 0 0 0
+    v128.const i8x16 0 0 0 0 0 0 0 0 100 -100 0 0 0 0 0 0
+    i16x8.extmul_high_i8x16_s
+    v128.const i16x8 -200 -300 0 0 0 0 0 0
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i32x4 -1 2 0 0
+    v128.const i32x4 -1 3 0 0
+    i64x2.extmul_low_i32x4_u
+    v128.const i64x2 0xfffffffe00000001 6
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i16x8 -1 -2 32767 32767 0 0 0 0
+    i32x4.extadd_pairwise_i16x8_s
+    v128.const i32x4 -3 65534 0 0
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i16x8 0 0 0 0 -7 8 0 -1
+    i32x4.extend_high_i16x8_u
+    v128.const i32x4 65529 8 0 65535
+    call $eq
+    i32.eqz
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; float conversions between the shapes
+    v128.const f32x4 1.5 -2 0 0
+    f64x2.promote_low_f32x4
+    f64x2.extract_lane 1
+    f64.const -2
+    f64.ne
+    v128.const f64x2 0.25 3
+    f32x4.demote_f64x2_zero
+    v128.const f32x4 0.25 3 0 0
+    call $eq
+    i32.eqz
+    i32.or
+    v128.const i32x4 -1 1 0 0
+    f32x4.convert_i32x4_u
+    f32x4.extract_lane 0
+    f32.const 4294967296
+    f32.ne
+    i32.or
+    v128.const i32x4 0 -7 0 0
+    f64x2.convert_low_i32x4_s
+    f64x2.extract_lane 1
+    f64.const -7
+    f64.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; v128 results mixed with scalars
+    v128.const i32x4 7 8 9 10
+    call $split
+    i32.const 10
+    i32.ne
+    local.set $x
+    v128.const i32x4 7 8 9 10
+    call $eq
+    i32.eqz
+    local.get $x
+    i32.or
+    local.set $x
+    i32.const 7
+    i32.ne
+    local.get $x
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; blocks, select and drop with v128 values
+    block (result v128)
+      v128.const i32x4 1 1 1 1
+      v128.const i32x4 2 2 2 2
+      i32.const 0
+      select
+      v128.const i32x4 3 3 3 3
+      drop
+      local.get $fail
+      br_if 0
+      v128.const i32x4 1 0 0 0
+      i32x4.add
+    end
+    v128.const i32x4 3 2 2 2
+    call $eq
+    i32.eqz
+    local.get $fail
+    i32.or)
+
+  (export "_start" (func $_start)))
@@ -0,0 +1,169 @@
+;; Exercises reference types and writable tables: table.get/set, ref.func and
+;; ref.null, calling through a slot that was written at runtime, table.size,
+;; table.grow (including past the max), table.fill, table.copy, table.init and
+;; elem.drop of a passive segment and an externref table. Returns 0 on success.
+(module
+  (type $i_i (func (param i32) (result i32)))
+  (table $funcs 2 4 funcref)
+  (table $externs 1 externref)
+  (elem (i32.const 0) $inc)
+  (elem declare func $double)
+  (elem $seg func $inc $double)
+
+  (func $inc (type $i_i)
+    local.get 0
+    i32.const 1
+    i32.add)
+
+  (func $double (type $i_i)
+    local.get 0
+    i32.const 2
+    i32.mul)
+
+  ;; calls the slot of the table with 10
+  (func $call_slot (param $idx i32) (result i32)
+    i32.const 10
+    local.get $idx
+    call_indirect $funcs (type $i_i))
+
+  (func $_start (result i32)
+    (local $fail i32)
+
+    ;; the initial contents, slot 1 starts as null
+    i32.const 0
+    table.get $funcs
+    ref.is_null
+    i32.const 1
+    table.get $funcs
+    ref.is_null
+    i32.eqz
+    i32.or
+    local.set $fail
+
+    ;; write a function in and call it
+    i32.const 1
+    ref.func $double
+    table.set $funcs
+    i32.const 1
+    call $call_slot
+    i32.const 20
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; grow returns the old size, and -1 past the max
+    ref.func $inc
+    i32.const 1
+    table.grow $funcs
+    i32.const 2
+    i32.ne
+    ref.null func
+    i32.const 2
+    table.grow $funcs
+    i32.const -1
+    i32.ne
+    i32.or
+    table.size $funcs
+    i32.const 3
+    i32.ne
+    i32.or
+    i32.const 2
+    call $call_slot
+    i32.const 11
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; grow up to the max, the new slot starts as null
+    ref.null func
+    i32.const 1
+    table.grow $funcs
+    i32.const 3
+    i32.ne
+    i32.const 3
+    table.get $funcs
+    ref.is_null
+    i32.eqz
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; fill [2, 4) with $double, then copy [1, 3) over [0, 2)
+    i32.const 2
+    ref.func $double
+    i32.const 2
+    table.fill $funcs
+    i32.const 0
+    i32.const 1
+    i32.const 2
+    table.copy $funcs $funcs
+    i32.const 0
+    call $call_slot
+    i32.const 1
+    call $call_slot
+    i32.add
+    i32.const 3
+    call $call_slot
+    i32.add
+    i32.const 60
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; init [2, 4) from the passive segment, after it is dropped an
+    ;; empty init still works
+    i32.const 2
+    i32.const 0
+    i32.const 2
+    table.init $funcs $seg
+    elem.drop $seg
+    i32.const 0
+    i32.const 0
+    i32.const 0
+    table.init $funcs $seg
+    i32.const 2
+    call $call_slot
+    i32.const 3
+    call $call_slot
+    i32.add
+    i32.const 31
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; an externref table only holds what it was given
+    i32.const 0
+    table.get $externs
+    ref.is_null
+    i32.eqz
+    table.size $externs
+    i32.const 1
+    i32.ne
+    i32.or
+    ref.null extern
+    i32.const 3
+    table.grow $externs
+    i32.const 1
+    i32.ne
+    i32.or
+    local.get $fail
+    i32.or
+    local.set $fail
+
+    ;; select on references
+    ref.func $inc
+    ref.null func
+    i32.const 0
+    select (result funcref)
+    ref.is_null
+    i32.eqz
+    local.get $fail
+    i32.or)
+
+  (export "_start" (func $_start)))
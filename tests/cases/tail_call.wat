@@ -0,0 +1,76 @@
+;; Exercises return_call to the function itself, which is the only tail call the
+;; jit supports: a deep self tail call that would overflow the stack if it was
+;; not a jump, and one that carries several results. Returns 0 on success.
+(module
+  ;; sum of 1..n, the accumulator is carried by the tail call
+  (func $sum (param $n i32) (param $acc i64) (result i64)
+    (local $unused i32)
+    block
+      local.get $n
+      br_if 0
+      local.get $acc
+      return
+    end
+    ;; the locals start from zero on every iteration
+    local.get $unused
+    i64.extend_i32_u
+    local.get $acc
+    i64.add
+    local.set $acc
+    i32.const 1
+    local.set $unused
+    local.get $n
+    i32.const 1
+    i32.sub
+    local.get $acc
+    local.get $n
+    i64.extend_i32_u
+    i64.add
+    return_call $sum)
+
+  ;; fibonacci, the last two values are carried by the tail call and both
+  ;; are returned
+  (func $fib (param $n i32) (param $a i32) (param $b i32) (result i32 i32)
+    block
+      local.get $n
+      br_if 0
+      local.get $a
+      local.get $b
+      return
+    end
+    local.get $n
+    i32.const 1
+    i32.sub
+    local.get $b
+    local.get $a
+    local.get $b
+    i32.add
+    return_call $fib)
+
+  (func $_start (result i32)
+    (local $fail i32)
+
+    ;; sum(1..1000000)
+    i32.const 1000000
+    i64.const 0
+    call $sum
+    i64.const 500000500000
+    i64.ne
+    local.set $fail
+
+    ;; fib(20), fib(21) == (6765, 10946)
+    i32.const 20
+    i32.const 0
+    i32.const 1
+    call $fib
+    i32.const 10946
+    i32.ne
+    local.get $fail
+    i32.or
+    local.set $fail
+    i32.const 6765
+    i32.ne
+    local.get $fail
+    i32.or)
+
+  (export "_start" (func $_start)))
@@ -0,0 +1,16 @@
+;; A function with many bounds checks that share a single trap block, the
+;; in-bounds accesses in the loop must all pass and only the final store,
+;; one past the end of the page, must TRAP.
+(module
+  (memory 1)
+  (func $_start (result i32)
+    (local $i i32)
+    (local $sum i32)
+    (loop $l
+      (i32.store (local.get $i) (local.get $i))
+      (local.set $sum (i32.add (local.get $sum) (i32.load (local.get $i))))
+      (local.set $i (i32.add (local.get $i) (i32.const 4)))
+      (br_if $l (i32.lt_u (local.get $i) (i32.const 65536))))
+    (i32.store8 (i32.const 65536) (local.get $sum))
+    (local.get $sum))
+  (export "_start" (func $_start)))
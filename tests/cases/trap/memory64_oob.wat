@@ -0,0 +1,11 @@
+;; A 64-bit memory can't rely on the guard region alone, an address past the
+;; declared max must hit the explicit bounds check and TRAP instead of reaching
+;; whatever is mapped past the reservation. Aborts with a non-zero exit.
+(module
+  (memory i64 1 4)
+  (func $_start (result i32)
+    i64.const 0x100000000000
+    i32.load
+    drop
+    i32.const 0)
+  (export "_start" (func $_start)))
@@ -0,0 +1,13 @@
+;; table.fill of a range that runs past the end of the table must TRAP, and
+;; it must do so before writing anything.
+(module
+  (table 4 funcref)
+  (func $f)
+  (elem declare func $f)
+  (func $_start (result i32)
+    i32.const 2
+    ref.func $f
+    i32.const 3
+    table.fill
+    i32.const 0)
+  (export "_start" (func $_start)))
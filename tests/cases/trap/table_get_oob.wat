@@ -0,0 +1,14 @@
+;; table.get past the end of the table must TRAP.
+;; The table starts with 2 slots and grows to 3, so index 3 is still out of
+;; bounds even though it is below the max.
+(module
+  (table 2 8 funcref)
+  (func $_start (result i32)
+    ref.null func
+    i32.const 1
+    table.grow
+    drop
+    i32.const 3
+    table.get
+    ref.is_null)
+  (export "_start" (func $_start)))
@@ -0,0 +1,18 @@
+;; table.init from a dropped elem segment must TRAP, even though the same
+;; init worked before the drop.
+(module
+  (table 4 funcref)
+  (func $f)
+  (elem $seg func $f $f)
+  (func $_start (result i32)
+    i32.const 0
+    i32.const 0
+    i32.const 2
+    table.init $seg
+    elem.drop $seg
+    i32.const 0
+    i32.const 0
+    i32.const 1
+    table.init $seg
+    i32.const 0)
+  (export "_start" (func $_start)))
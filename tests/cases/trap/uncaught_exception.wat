@@ -0,0 +1,18 @@
+;; An exception that nothing catches must TRAP.
+;; The try_table only catches another tag, so the exception passes through it.
+(module
+  (tag $e (param i32))
+  (tag $other)
+
+  (func $throw_e
+    i32.const 1
+    throw $e)
+
+  (func $_start (result i32)
+    block $h
+      try_table (catch $other $h)
+        call $throw_e
+      end
+    end
+    i32.const 0)
+  (export "_start" (func $_start)))
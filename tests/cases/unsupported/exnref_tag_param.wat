@@ -0,0 +1,30 @@
+;; args: --expect-error 9
+;; The jit doesn't count the refs held by the values of an exception, so a tag
+;; with an exnref param must be rejected with WASM_ERROR_UNSUPPORTED. Would
+;; return 0 if it was supported.
+(module
+  (tag $inner (param i32))
+  (tag $outer (param exnref))
+
+  (func $_start (export "_start") (result i32)
+    block $h (result i32)
+      try_table (catch $inner $h)
+        block $o (result exnref)
+          try_table (catch $outer $o)
+            block $i (result i32 exnref)
+              try_table (catch_ref $inner $i)
+                i32.const 7
+                throw $inner
+              end
+              unreachable
+            end
+            throw $outer
+          end
+          unreachable
+        end
+        throw_ref
+      end
+      i32.const -1
+    end
+    i32.const 7
+    i32.ne))
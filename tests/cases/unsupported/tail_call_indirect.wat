@@ -0,0 +1,35 @@
+;; args: --expect-error 9
+;; A return_call_indirect can't be a jump either, even when the table only
+;; holds the function itself, so the module must be rejected with
+;; WASM_ERROR_UNSUPPORTED. Would return 0 if it was supported.
+(module
+  (type $step (func (param i32 i64) (result i64)))
+  (table 1 funcref)
+  (elem (i32.const 0) $sum)
+
+  ;; sum of 1..n, dispatched through the table on every step
+  (func $sum (type $step) (param $n i32) (param $acc i64) (result i64)
+    local.get $n
+    i32.eqz
+    if
+      local.get $acc
+      return
+    end
+    local.get $n
+    i32.const 1
+    i32.sub
+    local.get $acc
+    local.get $n
+    i64.extend_i32_u
+    i64.add
+    i32.const 0
+    return_call_indirect (type $step))
+
+  (func $_start (result i32)
+    i32.const 1000000
+    i64.const 0
+    call $sum
+    i64.const 500000500000
+    i64.ne)
+
+  (export "_start" (func $_start)))
@@ -0,0 +1,35 @@
+;; args: --expect-error 9
+;; A return_call between two functions can't be a jump, spidir has no tail
+;; calls, so the module must be rejected with WASM_ERROR_UNSUPPORTED instead
+;; of growing the stack on every call. Would return 0 if it was supported.
+(module
+  (func $even (param $n i32) (result i32)
+    local.get $n
+    i32.eqz
+    if
+      i32.const 1
+      return
+    end
+    local.get $n
+    i32.const 1
+    i32.sub
+    return_call $odd)
+
+  (func $odd (param $n i32) (result i32)
+    local.get $n
+    i32.eqz
+    if
+      i32.const 0
+      return
+    end
+    local.get $n
+    i32.const 1
+    i32.sub
+    return_call $even)
+
+  (func $_start (result i32)
+    i32.const 1000000
+    call $even
+    i32.eqz)
+
+  (export "_start" (func $_start)))
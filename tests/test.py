@@ -8,6 +8,16 @@
 A test passes iff `build/main -m <wasm>` exits with status 0. Each .wat
 case is responsible for computing its own pass/fail decision and returning
 0 (success) or non-zero (failure) as the wasm `_start`'s i32 return value.
+
+Besides the default run, every case also goes through each of the MODES,
+which load and jit the module through the other paths of the host. Every
+run trims the module before instantiating and running it, and the host is
+built with ASan, so anything still using what the trim freed fails the case.
+
+A .wat case can pass the host extra arguments with `;; args: ...` lines at
+its top, the cases under limits/ use it to set a jit limit and expect the
+exact error going over it fails with. The cases under unsupported/ are valid
+modules the jit rejects, and expect that error the same way.
 """
 
 import subprocess
@@ -31,6 +41,25 @@ from rich.text import Text
 
 WASM_MAGIC = b"\0asm"
 
+# The other ways every case is loaded and jitted, as extra host arguments
+MODES: dict[str, list[str]] = {
+    # jit on a background thread through wasm_module_jit_async, the handle
+    # is destroyed while the thread may still be finishing up
+    "async": ["--async"],
+    # the streaming loader, fed the whole module at once, one byte at a time
+    # so every LEB128 and section header is split across chunks, and in odd
+    # sized chunks that end at every other place in between
+    "stream": ["--stream"],
+    "stream-1": ["--stream=1"],
+    "stream-7": ["--stream=7"],
+    # the module is allocated from an arena, both by the loader and the
+    # streaming loader
+    "arena": ["--arena"],
+    "stream-arena": ["--stream", "--arena"],
+    # the session first jits another case, {other} is the case before this one that jits
+    "session": ["--warmup", "{other}"],
+}
+
 
 def is_wasm(path: Path) -> bool:
     if not path.is_file():
@@ -57,7 +86,28 @@ def is_trap_test(wasm: Path, build_dir: Path) -> bool:
     return "trap" in wasm.relative_to(build_dir).parts
 
 
-def run_test(main_bin: Path, wasm: Path, expect_trap: bool) -> tuple[bool, float, str, str, str | None]:
+def is_unsupported_test(wasm: Path, build_dir: Path) -> bool:
+    """Cases living under an `unsupported/` directory never jit, even without limits."""
+    return "unsupported" in wasm.relative_to(build_dir).parts
+
+
+def case_args(wasm: Path, build_dir: Path, cases_dir: Path) -> list[str]:
+    """The host arguments from the `;; args:` lines at the top of the case's .wat."""
+    source = cases_dir / wasm.relative_to(build_dir).with_suffix(".wat")
+    if not source.is_file():
+        return []
+
+    args: list[str] = []
+    for line in source.read_text().splitlines():
+        if not line.startswith(";;"):
+            break
+        line = line.removeprefix(";;").strip()
+        if line.startswith("args:"):
+            args += line.removeprefix("args:").split()
+    return args
+
+
+def run_test(main_bin: Path, wasm: Path, expect_trap: bool, extra_args: list[str]) -> tuple[bool, float, str, str, str | None]:
     """Run one test and return (ok, elapsed, stdout, stderr, reason_if_failed)."""
     start = time.monotonic()
     proc = subprocess.run(
@@ -66,6 +116,7 @@ def run_test(main_bin: Path, wasm: Path, expect_trap: bool) -> tuple[bool, float
             "-m", str(wasm),
             '--emit-debug-elf', str(wasm) + '.elf',
             f'--spidir-dump={wasm}.spidir',
+            *extra_args,
         ],
         capture_output=True,
         text=True,
@@ -90,6 +141,7 @@ def main() -> int:
     repo_root = Path(__file__).resolve().parent.parent
     main_bin = repo_root / "build" / "main"
     build_dir = repo_root / "tests" / "build"
+    cases_dir = repo_root / "tests" / "cases"
 
     if not main_bin.exists():
         console.print(f"[bold red]error:[/] {main_bin} not found — build it first")
@@ -103,8 +155,18 @@ def main() -> int:
         console.print(f"[bold red]error:[/] no wasm binaries found under {build_dir}")
         return 2
 
-    failures: list[tuple[Path, str, str, str]] = []
-    results: list[tuple[Path, bool, float]] = []
+    args = {wasm: case_args(wasm, build_dir, cases_dir) for wasm in tests}
+    runs: list[tuple[Path, str | None, list[str]]] = [(wasm, None, args[wasm]) for wasm in tests]
+    # the session is warmed up with the closest case before that jits at all
+    warmups = [wasm for wasm in tests if not is_unsupported_test(wasm, build_dir)]
+    others = {wasm: max((w for w in warmups if w < wasm), default=warmups[-1]) for wasm in tests}
+    for mode, extra_args in MODES.items():
+        for wasm in tests:
+            other = str(others[wasm])
+            runs.append((wasm, mode, args[wasm] + [arg.replace("{other}", other) for arg in extra_args]))
+
+    failures: list[tuple[str, str, str, str]] = []
+    results: list[tuple[str, bool, float]] = []
 
     progress = Progress(
         SpinnerColumn(),
@@ -116,14 +178,16 @@ def main() -> int:
         transient=True,
     )
 
-    console.rule(f"[bold]Running {len(tests)} test(s)")
+    console.rule(f"[bold]Running {len(tests)} test(s) in {len(MODES) + 1} mode(s)")
     with progress:
-        task = progress.add_task("running…", total=len(tests))
-        for wasm in tests:
-            name = wasm.relative_to(build_dir)
+        task = progress.add_task("running…", total=len(runs))
+        for wasm, mode, extra_args in runs:
+            name = str(wasm.relative_to(build_dir))
+            if mode is not None:
+                name += f" ({mode})"
             expect_trap = is_trap_test(wasm, build_dir)
             progress.update(task, description=f"[cyan]{name}")
-            ok, elapsed, out, err, reason = run_test(main_bin, wasm, expect_trap)
+            ok, elapsed, out, err, reason = run_test(main_bin, wasm, expect_trap, extra_args)
             results.append((name, ok, elapsed))
             mark = "[green]✓[/]" if ok else "[red]✗[/]"
             tag = " [dim yellow](trap)[/]" if expect_trap else ""
@@ -139,7 +203,7 @@ def main() -> int:
     total_time = sum(t for _, _, t in results)
     table.add_row("[green]passed[/]", str(passed))
     table.add_row("[red]failed[/]" if failures else "[dim]failed[/]", str(len(failures)))
-    table.add_row("total", str(len(tests)))
+    table.add_row("total", str(len(runs)))
     table.add_row("time", f"{total_time:.2f}s")
     console.print(Panel(table, title="Summary", border_style="green" if not failures else "red"))
 